@@ -0,0 +1,220 @@
+# run-bench.py
+# Benchmark runner. Runs the bench scripts and writes the results as JSON.
+#
+# Bench scripts print their results on stdout as lines:
+#   @bench <name> <value> <unit>
+# Each script is run `--warmup` times (results discarded) then `--repeat`
+# times. The process wall time of every run is recorded too and the startup
+# benchmark reads the startup phases from the `--trace` file.
+#
+# The cached benchmark generates a module tree in a temporary directory and
+# runs it from source then built with `--build` (bytecode and preloading).
+#
+# Usage: run-bench.py [options] cepora_exec
+#
+# Copyright (c) 2016 Laurent Zubiaur
+# MIT License (http://opensource.org/licenses/MIT)
+from __future__ import print_function
+
+import sys, argparse, subprocess, json, re, time, platform, tempfile, os, shutil
+from os import path, environ
+
+debug = False
+
+# name, script, cepora options, script arguments
+BENCHMARKS = [
+    ('startup',   'startup.coffee',   [],             []),
+    ('require',   'require.coffee',   [],             []),
+    ('compile',   'compile.coffee',   [],             []),
+    ('bindings',  'bindings.coffee',  [],             []),
+    ('gc',        'gc.coffee',        [],             []),
+    ('particles', 'particles.coffee', [],             []),
+    ('render',    'render.coffee',    ['--headless'], []),
+]
+
+# Startup phases recorded in the trace file (see cpr_cepora.c). Matched by
+# event name or category.
+TRACE_PHASES = {
+    'openCoreModules': 'startup.core',
+    'loadCoffeeScript': 'startup.coffeeScript',
+    'compile': 'startup.compile',
+    'script': 'startup.script',
+}
+
+# Modules generated by the cached benchmark
+CACHED_MODULES = 50
+
+# Units where higher values are better
+HIGHER_IS_BETTER = re.compile(r'(/s|/ms|fps)$')
+
+def trace(*arg):
+    if debug:
+        print(*arg)
+
+def run_once(cmd, trace_file=None):
+    """Run cepora and return the list of (name, value, unit) results"""
+    if trace_file:
+        cmd = cmd[:1] + ['--trace', trace_file] + cmd[1:]
+    trace(' '.join(cmd))
+    start = time.time()
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, env=environ.copy())
+    output = proc.communicate()[0].decode('utf-8', 'replace')
+    elapsed = (time.time() - start) * 1000.0
+    results = []
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[0] == '@bench':
+            results.append((fields[1], float(fields[2]), fields[3]))
+        else:
+            trace(line)
+    if proc.returncode != 0 and not results:
+        print('  failed (exit code {0})'.format(proc.returncode))
+        for line in output.splitlines()[-5:]:
+            print('  ' + line)
+    results.append(('process', elapsed, 'ms'))
+    if trace_file and path.exists(trace_file):
+        with open(trace_file) as f:
+            events = json.load(f)['traceEvents']
+        for e in events:
+            if e.get('ph') == 'X' and e.get('name') in TRACE_PHASES:
+                results.append((TRACE_PHASES[e['name']], e['dur'] / 1000.0, 'ms'))
+            elif e.get('ph') == 'X' and e.get('cat') in TRACE_PHASES:
+                results.append((TRACE_PHASES[e['cat']], e['dur'] / 1000.0, 'ms'))
+        os.remove(trace_file)
+    return results
+
+def summarize(samples):
+    samples = sorted(samples)
+    n = len(samples)
+    mean = sum(samples) / n
+    median = samples[n // 2] if n % 2 else (samples[n // 2 - 1] + samples[n // 2]) / 2.0
+    stddev = (sum((x - mean) ** 2 for x in samples) / (n - 1)) ** 0.5 if n > 1 else 0.0
+    return { 'min': samples[0], 'max': samples[-1], 'mean': mean, 'median': median, 'stddev': stddev }
+
+def run_bench(args, name, script, opts, script_args):
+    cmd = [args.cepora] + opts + [path.join(args.bench_dir, script)] + script_args
+    return run_cmd(args, name, cmd)
+
+def run_cmd(args, name, cmd):
+    trace_file = None
+    if name == 'startup':
+        trace_file = path.join(tempfile.gettempdir(), 'cepora-bench-{0}.json'.format(os.getpid()))
+    for i in range(args.warmup):
+        run_once(cmd, trace_file)
+    samples = {}
+    for i in range(args.repeat):
+        for key, value, unit in run_once(cmd, trace_file):
+            # The process wall time is reported per benchmark
+            if key == 'process':
+                key = name + '.process'
+            samples.setdefault(key, (unit, []))[1].append(value)
+    results = {}
+    for key, (unit, values) in samples.items():
+        results[key] = dict(summarize(values), unit=unit, samples=values)
+    return results
+
+def write_module_tree(dir):
+    """Write a main script requiring CACHED_MODULES modules"""
+    for i in range(CACHED_MODULES):
+        with open(path.join(dir, 'm{0}.coffee'.format(i)), 'w') as f:
+            f.write('class Item{0}\n'.format(i))
+            f.write('  constructor: (@x, @y) ->\n')
+            f.write('  move: (dx, dy) -> new Item{0} @x + dx, @y + dy\n'.format(i))
+            f.write('  length: -> Math.sqrt @x * @x + @y * @y\n')
+            f.write('exports.create = (n) -> (new Item{0} i, i * 2 for i in [0...n])\n'.format(i))
+    with open(path.join(dir, 'main.coffee'), 'w') as f:
+        f.write('start = Date.now()\n')
+        for i in range(CACHED_MODULES):
+            f.write("require 'm{0}.coffee'\n".format(i))
+        f.write('print "@bench #{Duktape.arguments[0]}.require #{Date.now() - start} ms"\n')
+
+def run_cached(args):
+    """Startup of the generated module tree from source then built"""
+    dir = tempfile.mkdtemp(prefix='cepora-bench-')
+    try:
+        write_module_tree(dir)
+        main = path.join(dir, 'main.coffee')
+        results = run_cmd(args, 'cached.source', [args.cepora, '--path', dir, main, 'cached.source'])
+        # Compiling to bytecode also writes the manifest read by the preloader
+        subprocess.check_call([args.cepora, '--build', dir], stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        results.update(run_cmd(args, 'cached.built', [args.cepora, '--path', dir, main, 'cached.built']))
+        return results
+    finally:
+        shutil.rmtree(dir, ignore_errors=True)
+
+def print_results(results):
+    for key in sorted(results):
+        r = results[key]
+        print('  {0:<26} {1:>12.4g} {2:<12} (stddev {3:.3g})'.format(key, r['median'], r['unit'], r['stddev']))
+
+def version(cepora):
+    try:
+        output = subprocess.check_output([cepora, '-v']).decode('utf-8')
+        return output.splitlines()[0].strip()
+    except (OSError, subprocess.CalledProcessError, IndexError):
+        return 'unknown'
+
+def compare(results, baseline):
+    print('\n{0:<28} {1:>12} {2:>12} {3:>8}'.format('benchmark', 'baseline', 'current', 'change'))
+    for key in sorted(results):
+        if key not in baseline:
+            continue
+        old, new = baseline[key]['median'], results[key]['median']
+        change = (new - old) * 100.0 / old if old else 0.0
+        better = change > 0 if HIGHER_IS_BETTER.search(results[key]['unit']) else change < 0
+        flag = '' if abs(change) < 5.0 else (' +' if better else ' -')
+        print('{0:<28} {1:>12.4g} {2:>12.4g} {3:>7.1f}%{4}'.format(key, old, new, change, flag))
+
+def main():
+    global debug
+    parser = argparse.ArgumentParser(description='Run the cepora benchmarks')
+    parser.add_argument('cepora', help='cepora executable')
+    parser.add_argument('-d', '--debug', action='store_true', help='print the commands and outputs')
+    parser.add_argument('-b', '--bench-dir', default='bench', help='bench scripts directory')
+    parser.add_argument('-w', '--warmup', type=int, default=1, help='warmup runs per benchmark (default 1)')
+    parser.add_argument('-r', '--repeat', type=int, default=5, help='measured runs per benchmark (default 5)')
+    parser.add_argument('-f', '--filter', default=None, help='only run the benchmarks matching the regex')
+    parser.add_argument('-o', '--output', default=None, help='write the results to a JSON file')
+    parser.add_argument('-c', '--compare', default=None, help='compare with a previous JSON results file')
+    args = parser.parse_args()
+    debug = args.debug
+    if args.repeat < 1:
+        parser.error('--repeat must be at least 1')
+
+    report = {
+        'version': version(args.cepora),
+        'date': time.strftime('%Y-%m-%dT%H:%M:%S'),
+        'platform': platform.platform(),
+        'warmup': args.warmup,
+        'repeat': args.repeat,
+        'results': {},
+    }
+    failed = False
+    for name, script, opts, script_args in BENCHMARKS:
+        if args.filter and not re.search(args.filter, name):
+            continue
+        print('Run {0}'.format(name))
+        results = run_bench(args, name, script, opts, script_args)
+        if len(results) == 1:
+            # Only the process time: the script didn't report any result
+            failed = True
+        print_results(results)
+        report['results'].update(results)
+
+    if not args.filter or re.search(args.filter, 'cached'):
+        print('Run cached')
+        results = run_cached(args)
+        print_results(results)
+        report['results'].update(results)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+        print('Results written to {0}'.format(args.output))
+    if args.compare:
+        with open(args.compare) as f:
+            compare(report['results'], json.load(f)['results'])
+    sys.exit(1 if failed else 0)
+
+if __name__ == '__main__':
+    main()
@@ -1,6 +1,8 @@
 # User compile-time options
 set(CPR_PROJECT_NAME "cepora")
 set(CPR_BUILD_DEBUG_INTERNAL OFF)
+# Enable the Duktape execution interrupt used by the sampling profiler
+set(CPR_BUILD_SAMPLER ON)
 
 # Run Make in verbose mode
 set(CMAKE_VERBOSE_MAKEFILE OFF)
@@ -0,0 +1,23 @@
+/*
+ * duk_custom.h
+ * Cepora Duktape configuration. Included by duk_config.h when
+ * DUK_OPT_HAVE_CUSTOM_H is defined.
+ */
+
+#if !defined(DUK_CUSTOM_H_INCLUDED)
+#define DUK_CUSTOM_H_INCLUDED
+
+#if defined(CPR_DUK_SAMPLER)
+/* Executor interrupt used by the sampling profiler. The interrupt is triggered
+ * every DUK_HTHREAD_INTCTR_DEFAULT (256k) bytecode instructions and calls the
+ * function stored in the first member of the heap user data (if any) with the
+ * running thread (`thr` in duk__executor_interrupt). The function must not
+ * call the Duktape API and must return 0 (a non zero value raises an
+ * "execution timeout" RangeError). */
+#define DUK_USE_INTERRUPT_COUNTER
+#undef DUK_USE_EXEC_TIMEOUT_CHECK
+#define DUK_USE_EXEC_TIMEOUT_CHECK(udata) \
+  ((udata) != NULL && (*(int (**)(void *, void *))(udata))((udata), (void *) thr))
+#endif
+
+#endif /* DUK_CUSTOM_H_INCLUDED */
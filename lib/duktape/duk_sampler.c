@@ -0,0 +1,50 @@
+/*
+ * duk_sampler.c
+ * Duktape built with the call stack walk of the sampling profiler (see
+ * duk_sampler.h). Compiled instead of duktape.c when CPR_BUILD_SAMPLER is
+ * enabled: the walk reads the activations with the Duktape internals.
+ */
+
+#include "duktape.c"
+#include "duk_sampler.h"
+
+/* Own string property of `obj` or NULL. No getters, no allocation. */
+DUK_LOCAL const char *cpr__duk_own_string(duk_hthread *thr, duk_hobject *obj, duk_hstring *key) {
+  duk_tval *tv = duk_hobject_find_existing_entry_tval_ptr(thr->heap, obj, key);
+  if (tv != NULL && DUK_TVAL_IS_STRING(tv)) {
+    return (const char *) DUK_HSTRING_GET_DATA(DUK_TVAL_GET_STRING(tv));
+  }
+  return NULL;
+}
+
+DUK_EXTERNAL duk_int_t cpr_duk_walk_stack(void *thread, cpr_duk_frame *frames, duk_int_t max) {
+  duk_hthread *thr;
+  duk_activation *act;
+  duk_hobject *func;
+  duk_tval *tv;
+  duk_int_t i, n = 0;
+
+  /* A coroutine stack continues with the stack of its resumer */
+  for (thr = (duk_hthread *) thread; thr != NULL && n < max; thr = thr->resumer) {
+    for (i = (duk_int_t) thr->callstack_top - 1; i >= 0 && n < max; --i) {
+      act = thr->callstack + i;
+      if ((func = DUK_ACT_GET_FUNC(act)) == NULL) {
+        continue;
+      }
+      frames[n].name = cpr__duk_own_string(thr, func, DUK_HTHREAD_STRING_NAME(thr));
+      frames[n].file = NULL;
+      frames[n].line = 0;
+      if (DUK_HOBJECT_IS_COMPILEDFUNCTION(func)) {
+        frames[n].file = cpr__duk_own_string(thr, func, DUK_HTHREAD_STRING_FILE_NAME(thr));
+        /* The executor writes the current pc back before the interrupt */
+        tv = duk_hobject_find_existing_entry_tval_ptr(thr->heap, func, DUK_HTHREAD_STRING_INT_PC2LINE(thr));
+        if (tv != NULL && DUK_TVAL_IS_BUFFER(tv)) {
+          frames[n].line = (duk_int_t) duk__hobject_pc2line_query_raw(thr,
+            (duk_hbuffer_fixed *) DUK_TVAL_GET_BUFFER(tv), duk_hthread_get_act_prev_pc(thr, act));
+        }
+      }
+      ++n;
+    }
+  }
+  return n;
+}
@@ -0,0 +1,24 @@
+/*
+ * duk_sampler.h
+ * Call stack walk of the sampling profiler (see cpr_sampler.h). Part of the
+ * Duktape library when it is built with CPR_BUILD_SAMPLER (see duk_sampler.c).
+ */
+
+#if !defined(DUK_SAMPLER_H_INCLUDED)
+#define DUK_SAMPLER_H_INCLUDED
+
+#include "duktape.h"
+
+typedef struct cpr_duk_frame {
+  const char *name;   /* NULL if the function has no name */
+  const char *file;   /* NULL for native functions */
+  duk_int_t line;
+} cpr_duk_frame;
+
+/* Read the call stack of `thread` (top first) and of the threads that resumed
+ * it. Doesn't call the Duktape API nor allocate so it can be called from the
+ * executor interrupt with the running thread. The strings are valid until
+ * the thread runs again. Return the number of frames (at most `max`). */
+DUK_EXTERNAL_DECL duk_int_t cpr_duk_walk_stack(void *thread, cpr_duk_frame *frames, duk_int_t max);
+
+#endif /* DUK_SAMPLER_H_INCLUDED */
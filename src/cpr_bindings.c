@@ -0,0 +1,229 @@
+/*
+ * cpr_bindings.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <math.h>   /* frexp, ldexp */
+#include <stdlib.h> /* realloc, free */
+#include <string.h> /* memset, memcpy, strcpy, strrchr */
+
+#include "cpr_bindings.h"
+#include "cpr_sys_tools.h" /* cpr_get_time */
+#include "cpr_thread.h"
+#include "cpr_duktape_helpers.h" /* cpr_is_lazy_accessor */
+
+/* Wrapped function stored in the wrapper */
+#define CPR__BINDINGS_TARGET "\xff" "cprTarget"
+/* Lazy accessor and key creating the wrapped function on the first call */
+#define CPR__BINDINGS_GETTER "\xff" "cprGetter"
+#define CPR__BINDINGS_KEY "\xff" "cprKey"
+
+typedef struct cpr__binding {
+  cpr_binding_stats stats;
+  double frame_calls;     /* calls during the current frame */
+  double frame_time;
+} cpr__binding;
+
+static int _enabled = 0;
+static cpr__binding *_bindings = NULL;
+static int _count = 0;
+static int _capacity = 0;
+
+CPR_API_INTERN void cpr__bindings_record(cpr__binding *b, double seconds) {
+  int exp, bucket;
+
+  b->stats.time += seconds;
+  b->frame_time += seconds;
+  /* seconds * 1e9 = m * 2^exp with m in [0.5, 1) so the value is in
+   * [2^(exp - 1), 2^exp) nanoseconds */
+  frexp(seconds * 1e9, &exp);
+  bucket = exp - 1;
+  if (bucket < 0) {
+    bucket = 0;
+  } else if (bucket >= CPR_BINDINGS_BUCKETS) {
+    bucket = CPR_BINDINGS_BUCKETS - 1;
+  }
+  b->stats.histogram[bucket]++;
+}
+
+/* Call the wrapped function with the same `this` and arguments */
+CPR_API_INTERN duk_ret_t cpr__bindings_trampoline(duk_context *ctx) {
+  int id = duk_get_current_magic(ctx);
+  duk_idx_t nargs = duk_get_top(ctx);
+  double start;
+
+  duk_push_current_function(ctx);
+  if (!duk_get_prop_string(ctx, -1, CPR__BINDINGS_TARGET)) {
+    /* Create the function of a lazy module. The accessor defines the
+     * function on its `this`: give it a scratch object. */
+    duk_pop(ctx);
+    duk_get_prop_string(ctx, -1, CPR__BINDINGS_GETTER);
+    duk_push_object(ctx);
+    duk_get_prop_string(ctx, -3, CPR__BINDINGS_KEY);
+    duk_call_method(ctx, 1);
+    duk_dup_top(ctx);
+    duk_put_prop_string(ctx, -3, CPR__BINDINGS_TARGET);
+  }
+  duk_remove(ctx, -2);
+  duk_insert(ctx, 0);
+  duk_push_this(ctx);
+  duk_insert(ctx, 1);
+
+  /* Calls throwing an error are counted but not timed */
+  _bindings[id].stats.calls += 1.0;
+  _bindings[id].frame_calls += 1.0;
+  start = cpr_get_time();
+  duk_call_method(ctx, nargs);
+  /* The call may have wrapped other modules (moving `_bindings`) */
+  cpr__bindings_record(&_bindings[id], cpr_get_time() - start);
+  return 1;
+}
+
+CPR_API_INTERN cpr__binding *cpr__bindings_add(const char *module, const char *key) {
+  cpr__binding *b;
+  const char *dot, *slash;
+  size_t len, mlen;
+  char *name;
+
+  if (_count == _capacity) {
+    int capacity = _capacity ? _capacity * 2 : 256;
+    if (_count == CPR_BINDINGS_MAX || (b = realloc(_bindings, capacity * sizeof(cpr__binding))) == NULL) {
+      return NULL;
+    }
+    _bindings = b;
+    _capacity = capacity;
+  }
+  /* Module id without the file extension ("glfw.so" -> "glfw") */
+  dot = strrchr(module, '.');
+  slash = strrchr(module, '/');
+  mlen = dot && (!slash || dot > slash) ? (size_t)(dot - module) : strlen(module);
+  len = mlen + strlen(key) + 2;
+  if ((name = malloc(len)) == NULL) {
+    return NULL;
+  }
+  memcpy(name, module, mlen);
+  name[mlen] = '.';
+  strcpy(name + mlen + 1, key);
+  b = &_bindings[_count++];
+  memset(b, 0, sizeof(cpr__binding));
+  b->stats.name = name;
+  return b;
+}
+
+CPR_API_EXTERN void cpr_bindings_enable(int enable) {
+  _enabled = enable;
+}
+
+CPR_API_EXTERN int cpr_bindings_is_enabled() {
+  return _enabled;
+}
+
+CPR_API_EXTERN void cpr_bindings_wrap(duk_context *ctx, duk_idx_t obj_idx, const char *module) {
+  duk_idx_t top;
+
+  /* Only the main thread heap is instrumented */
+  if (!_enabled || !cpr_thread_is_main()) {
+    return;
+  }
+  obj_idx = duk_require_normalize_index(ctx, obj_idx);
+  duk_get_global_string(ctx, "Object");
+  duk_get_prop_string(ctx, -1, "getOwnPropertyDescriptor");
+  duk_enum(ctx, obj_idx, DUK_ENUM_OWN_PROPERTIES_ONLY);
+  /* Keys only: reading the values would create the lazy functions */
+  while (duk_next(ctx, -1, 0)) {
+    /* [ ... Object getOwnPropertyDescriptor enum key ] */
+    top = duk_get_top(ctx) - 1;
+    duk_dup(ctx, -3);
+    duk_dup(ctx, obj_idx);
+    duk_dup(ctx, -3);
+    duk_call(ctx, 2);
+    duk_get_prop_string(ctx, -1, "value");
+    duk_get_prop_string(ctx, -2, "get");
+    /* [ ... key desc value get ] */
+    if ((duk_is_c_function(ctx, -2) || duk_is_lightfunc(ctx, -2) || cpr_is_lazy_accessor(ctx, -1)) &&
+        cpr__bindings_add(module, duk_get_string(ctx, -4)) != NULL) {
+      duk_push_c_function(ctx, cpr__bindings_trampoline, DUK_VARARGS);
+      duk_set_magic(ctx, -1, _count - 1);
+      if (duk_is_undefined(ctx, -3)) {
+        duk_dup(ctx, -2);
+        duk_put_prop_string(ctx, -2, CPR__BINDINGS_GETTER);
+        duk_dup(ctx, -5);
+        duk_put_prop_string(ctx, -2, CPR__BINDINGS_KEY);
+      } else {
+        duk_dup(ctx, -3);
+        duk_put_prop_string(ctx, -2, CPR__BINDINGS_TARGET);
+      }
+      /* [ ... key desc value get trampoline ] */
+      duk_dup(ctx, -5);
+      duk_swap_top(ctx, -2);
+      duk_def_prop(ctx, obj_idx, DUK_DEFPROP_HAVE_VALUE |
+          DUK_DEFPROP_HAVE_WRITABLE | DUK_DEFPROP_WRITABLE |
+          DUK_DEFPROP_HAVE_ENUMERABLE | DUK_DEFPROP_ENUMERABLE |
+          DUK_DEFPROP_HAVE_CONFIGURABLE | DUK_DEFPROP_CONFIGURABLE);
+    }
+    duk_set_top(ctx, top);
+  }
+  duk_pop_3(ctx); /* Object getOwnPropertyDescriptor enum */
+}
+
+CPR_API_EXTERN void cpr_bindings_frame() {
+  int i;
+  for (i = 0; i < _count; ++i) {
+    cpr__binding *b = &_bindings[i];
+    b->stats.frames += 1.0;
+    b->stats.last_calls = b->frame_calls;
+    b->stats.last_time = b->frame_time;
+    b->frame_calls = b->frame_time = 0.0;
+  }
+}
+
+CPR_API_EXTERN void cpr_bindings_reset() {
+  int i;
+  for (i = 0; i < _count; ++i) {
+    cpr__binding *b = &_bindings[i];
+    const char *name = b->stats.name;
+    memset(b, 0, sizeof(cpr__binding));
+    b->stats.name = name;
+  }
+}
+
+CPR_API_EXTERN void cpr_bindings_clear() {
+  int i;
+  for (i = 0; i < _count; ++i) {
+    free((char *)_bindings[i].stats.name);
+  }
+  free(_bindings);
+  _bindings = NULL;
+  _count = _capacity = 0;
+}
+
+CPR_API_EXTERN int cpr_bindings_count() {
+  return _count;
+}
+
+CPR_API_EXTERN const cpr_binding_stats *cpr_bindings_get(int id) {
+  return id >= 0 && id < _count ? &_bindings[id].stats : NULL;
+}
+
+CPR_API_EXTERN double cpr_bindings_percentile(const cpr_binding_stats *stats, double percentile) {
+  double total = 0.0, acc = 0.0;
+  int i;
+
+  for (i = 0; i < CPR_BINDINGS_BUCKETS; ++i) {
+    total += stats->histogram[i];
+  }
+  if (total == 0.0) {
+    return 0.0;
+  }
+  for (i = 0; i < CPR_BINDINGS_BUCKETS - 1; ++i) {
+    acc += stats->histogram[i];
+    if (acc * 100.0 >= total * percentile) {
+      break;
+    }
+  }
+  /* Upper bound of the bucket */
+  return ldexp(1.0, i + 1) * 1e-9;
+}
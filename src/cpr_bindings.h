@@ -0,0 +1,66 @@
+/*
+ * cpr_bindings.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_BINDINGS_H
+#define CPR_BINDINGS_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Native binding call counters.
+ * When enabled (`--bindings` command line option) the functions exported by
+ * the C modules are wrapped when the module is loaded. The wrapper counts the
+ * calls of the binding and records their latency in a log2 histogram. The
+ * counters are accumulated per frame (see `cpr_profiler_frame`). Times are
+ * inclusive: script callbacks called by a binding are part of its time.
+ */
+
+/* Bindings are identified by the wrapper magic (16 bits) */
+#define CPR_BINDINGS_MAX        32767
+/* Latency histogram buckets. Bucket `i` counts the calls that took
+ * [2^i, 2^(i+1)) nanoseconds. */
+#define CPR_BINDINGS_BUCKETS    32
+
+typedef struct cpr_binding_stats {
+  const char *name;       /* "module.function" */
+  double calls;           /* total calls */
+  double time;            /* total time in seconds */
+  double frames;          /* frames ended since the binding was loaded */
+  double last_calls;      /* calls during the last frame */
+  double last_time;
+  unsigned int histogram[CPR_BINDINGS_BUCKETS];
+} cpr_binding_stats;
+
+/* Must be called before any module is loaded */
+CPR_API_EXTERN void cpr_bindings_enable(int enable);
+CPR_API_EXTERN int cpr_bindings_is_enabled();
+
+/* Wrap the functions of the object at `obj_idx` (the exports of `module`).
+ * No-op if the bindings counters are not enabled. */
+CPR_API_EXTERN void cpr_bindings_wrap(duk_context *ctx, duk_idx_t obj_idx, const char *module);
+/* End the current frame. Called by `cpr_profiler_frame`. */
+CPR_API_EXTERN void cpr_bindings_frame();
+/* Reset the counters */
+CPR_API_EXTERN void cpr_bindings_reset();
+/* Remove all the bindings. The heaps with wrapped functions must be destroyed
+ * first. */
+CPR_API_EXTERN void cpr_bindings_clear();
+
+CPR_API_EXTERN int cpr_bindings_count();
+/* Return NULL if `id` is not a valid binding id */
+CPR_API_EXTERN const cpr_binding_stats *cpr_bindings_get(int id);
+/* Latency percentile (0-100) estimated from the histogram in seconds */
+CPR_API_EXTERN double cpr_bindings_percentile(const cpr_binding_stats *stats, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_BINDINGS_H */
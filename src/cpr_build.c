@@ -0,0 +1,546 @@
+/*
+ * cpr_build.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdio.h>
+#include <stdlib.h> /* malloc, realloc, free, qsort */
+#include <string.h> /* strlen, strcmp, strrchr, strstr, memcpy */
+#include <ctype.h>  /* isalnum, isspace */
+
+#if defined(_WIN32)
+#include <windows.h> /* FindFirstFile */
+#else
+#include <dirent.h>  /* opendir, readdir */
+#include <sys/stat.h>
+#endif
+
+#include "duktape.h"
+#include "cpr_build.h"
+#include "cpr_cepora.h"
+#include "cpr_debug_internal.h"
+#include "cpr_macros.h"
+#include "cpr_sys_tools.h"
+#include "cpr_thread.h"
+
+#if defined(_WIN32)
+#define CPR__BUILD_SEPARATOR "\\"
+#else
+#define CPR__BUILD_SEPARATOR "/"
+#endif
+
+/* Bytecode file header: "cprbc1 <source hash> <size> <hash>\n" (hex) */
+#define CPR__BUILD_MAGIC        "cprbc1"
+#define CPR__BUILD_HEADER_SIZE  (6 + 3 * 17 + 1)
+
+enum {
+  CPR__BUILD_UP_TO_DATE = 0,
+  CPR__BUILD_COMPILE,
+  CPR__BUILD_DONE,
+  CPR__BUILD_FAILED
+};
+
+typedef struct cpr__build_item {
+  char *path;             /* relative to the build directory ('/' separated) */
+  char *filename;
+  int coffee;
+  int state;
+  char *source;           /* to compile */
+  size_t size;
+  char hash[17];
+  char *deps;             /* required module ids separated by new lines */
+  char *error;
+} cpr__build_item;
+
+typedef struct cpr__build {
+  cpr__build_item *items;
+  int count;
+  int capacity;
+  int coffee;             /* CoffeeScript files to compile */
+  int log_level;
+  volatile long next;     /* next item to compile */
+} cpr__build;
+
+CPR_API_INTERN char *cpr__build_concat(const char *a, const char *b, const char *c) {
+  size_t la = strlen(a), lb = strlen(b), lc = strlen(c);
+  char *str = malloc(la + lb + lc + 1);
+  if (str) {
+    memcpy(str, a, la);
+    memcpy(str + la, b, lb);
+    memcpy(str + la + lb, c, lc + 1);
+  }
+  return str;
+}
+
+CPR_API_INTERN int cpr__build_add(cpr__build *b, const char *dir, const char *rel) {
+  cpr__build_item *items;
+  const char *dot = strrchr(rel, '.');
+
+  if (dot == NULL || (strcmp(dot, ".coffee") != 0 && strcmp(dot, ".js") != 0)) {
+    return 0;
+  }
+  if (b->count == b->capacity) {
+    b->capacity = b->capacity ? b->capacity * 2 : 64;
+    if ((items = realloc(b->items, b->capacity * sizeof(cpr__build_item))) == NULL) {
+      return -1;
+    }
+    b->items = items;
+  }
+  memset(&b->items[b->count], 0, sizeof(cpr__build_item));
+  b->items[b->count].path = cpr_strdup(rel);
+  b->items[b->count].filename = cpr__build_concat(dir, CPR__BUILD_SEPARATOR, rel);
+  b->items[b->count].coffee = strcmp(dot, ".coffee") == 0;
+  return b->items[b->count++].filename ? 0 : -1;
+}
+
+/* Find the scripts in the directory `rel` of the build directory */
+CPR_API_INTERN int cpr__build_walk(cpr__build *b, const char *dir, const char *rel) {
+  char *path, *child;
+  int rc = 0;
+#if defined(_WIN32)
+  WIN32_FIND_DATAA data;
+  HANDLE find;
+
+  path = rel[0] ? cpr__build_concat(dir, "\\", rel) : cpr_strdup(dir);
+  child = path ? cpr__build_concat(path, "\\", "*") : NULL;
+  if (child == NULL || (find = FindFirstFileA(child, &data)) == INVALID_HANDLE_VALUE) {
+    free(child);
+    free(path);
+    return -1;
+  }
+  free(child);
+  do {
+    if (data.cFileName[0] == '.') {
+      continue;
+    }
+    child = rel[0] ? cpr__build_concat(rel, "/", data.cFileName) : cpr_strdup(data.cFileName);
+    if (child == NULL) {
+      rc = -1;
+    } else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      rc = cpr__build_walk(b, dir, child);
+    } else {
+      rc = cpr__build_add(b, dir, child);
+    }
+    free(child);
+  } while (rc == 0 && FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  struct dirent *entry;
+  struct stat st;
+  char *full;
+  DIR *d;
+
+  path = rel[0] ? cpr__build_concat(dir, "/", rel) : cpr_strdup(dir);
+  if (path == NULL || (d = opendir(path)) == NULL) {
+    free(path);
+    return -1;
+  }
+  while (rc == 0 && (entry = readdir(d)) != NULL) {
+    /* Skip hidden files, "." and ".." */
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    child = rel[0] ? cpr__build_concat(rel, "/", entry->d_name) : cpr_strdup(entry->d_name);
+    full = cpr__build_concat(path, "/", entry->d_name);
+    if (child == NULL || full == NULL || stat(full, &st) != 0) {
+      rc = -1;
+    } else if (S_ISDIR(st.st_mode)) {
+      rc = cpr__build_walk(b, dir, child);
+    } else {
+      rc = cpr__build_add(b, dir, child);
+    }
+    free(child);
+    free(full);
+  }
+  closedir(d);
+#endif
+  free(path);
+  return rc;
+}
+
+CPR_API_INTERN int cpr__build_compare(const void *a, const void *b) {
+  return strcmp(((const cpr__build_item *)a)->path, ((const cpr__build_item *)b)->path);
+}
+
+/* Format the 64-bit FNV-1a hash of the data (16 hex digits) */
+CPR_API_INTERN void cpr__build_hash(const char *data, size_t size, char hash[17]) {
+  unsigned long long h = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < size; ++i) {
+    h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+  }
+  sprintf(hash, "%08lx%08lx", (unsigned long)(h >> 32), (unsigned long)(h & 0xffffffffUL));
+}
+
+/* Format the bytecode file header: source hash, bytecode size and hash */
+CPR_API_INTERN void cpr__build_header(const char *source, size_t source_size,
+    const char *bytecode, size_t size, char header[CPR__BUILD_HEADER_SIZE + 1]) {
+  char source_hash[17], hash[17];
+
+  cpr__build_hash(source, source_size, source_hash);
+  cpr__build_hash(bytecode, size, hash);
+  sprintf(header, "%s %s %08lx%08lx %s\n", CPR__BUILD_MAGIC, source_hash,
+      (unsigned long)(((unsigned long long)size) >> 32), (unsigned long)(size & 0xffffffffUL), hash);
+}
+
+CPR_API_EXTERN char *cpr_build_read_file(const char *filename, size_t *size) {
+  FILE *f;
+  long len;
+  char *data = NULL;
+
+  if ((f = fopen(filename, "rb")) == NULL) {
+    return NULL;
+  }
+  if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0 &&
+      (data = malloc((size_t)len + 1)) != NULL) {
+    *size = fread(data, 1, (size_t)len, f);
+    data[*size] = '\0';
+  }
+  fclose(f);
+  return data;
+}
+
+CPR_API_EXTERN const char *cpr_build_check_bytecode(const char *source, size_t source_size,
+    const char *data, size_t size, size_t *bytecode_size) {
+  char header[CPR__BUILD_HEADER_SIZE + 1];
+
+  if (data == NULL || size <= CPR__BUILD_HEADER_SIZE) {
+    return NULL;
+  }
+  cpr__build_header(source, source_size, data + CPR__BUILD_HEADER_SIZE,
+      size - CPR__BUILD_HEADER_SIZE, header);
+  if (memcmp(header, data, CPR__BUILD_HEADER_SIZE) != 0) {
+    return NULL;
+  }
+  *bytecode_size = size - CPR__BUILD_HEADER_SIZE;
+  return data + CPR__BUILD_HEADER_SIZE;
+}
+
+/* Read the file and hash it */
+CPR_API_INTERN int cpr__build_read(cpr__build_item *item) {
+  if ((item->source = cpr_build_read_file(item->filename, &item->size)) == NULL) {
+    return -1;
+  }
+  cpr__build_hash(item->source, item->size, item->hash);
+  return 0;
+}
+
+/* Return 1 if the bytecode file was compiled from the current source */
+CPR_API_INTERN int cpr__build_is_up_to_date(cpr__build_item *item) {
+  char *filename = cpr__build_concat(item->filename, CPR_BYTECODE_EXT, "");
+  char *data = NULL;
+  size_t size = 0, bytecode_size;
+  int rc;
+
+  if (filename) {
+    data = cpr_build_read_file(filename, &size);
+  }
+  rc = cpr_build_check_bytecode(item->source, item->size, data, size, &bytecode_size) != NULL;
+  free(data);
+  free(filename);
+  return rc;
+}
+
+/* Find the static `require('id')` calls of the JavaScript source. Return the
+ * ids separated by new lines (or NULL if none). */
+CPR_API_INTERN char *cpr__build_deps(const char *js, size_t len) {
+  const char *p = js, *end = js + len, *id;
+  char *deps = NULL, *tmp;
+  size_t size = 0, n;
+  char quote;
+
+  while ((p = strstr(p, "require")) != NULL && p < end) {
+    /* Skip identifiers ending with "require" and methods (`a.require`) */
+    if (p > js && (isalnum((unsigned char)p[-1]) || p[-1] == '_' || p[-1] == '$' || p[-1] == '.')) {
+      p += 7;
+      continue;
+    }
+    p += 7;
+    while (isspace((unsigned char)*p)) ++p;
+    if (*p++ != '(') continue;
+    while (isspace((unsigned char)*p)) ++p;
+    if (*p != '\'' && *p != '"') continue;
+    quote = *p++;
+    for (id = p; *p && *p != quote && *p != '\\' && *p != '\n'; ++p);
+    if (*p != quote || p == id) continue;
+    n = (size_t)(p - id);
+    if ((tmp = realloc(deps, size + n + 2)) == NULL) {
+      break;
+    }
+    deps = tmp;
+    memcpy(deps + size, id, n);
+    size += n;
+    deps[size++] = '\n';
+    deps[size] = '\0';
+  }
+  return deps;
+}
+
+/* Compile the module source to a module function and dump its bytecode. The
+ * dependencies are saved in the item.
+ * [ source path coffee item ] -> [ bytecode ] */
+CPR_API_INTERN duk_ret_t cpr__build_compile(duk_context *ctx) {
+  cpr__build_item *item = duk_get_pointer(ctx, -1);
+  const char *js;
+  duk_size_t len;
+
+  duk_pop(ctx);
+  if (duk_get_boolean(ctx, -1)) {
+    duk_get_global_string(ctx, "CoffeeScript");
+    duk_push_string(ctx, "compile");
+    duk_dup(ctx, -5);
+    duk_call_prop(ctx, -3, 1);
+    duk_replace(ctx, -5);
+    duk_pop(ctx);
+  }
+  duk_pop(ctx);
+  js = duk_get_lstring(ctx, -2, &len);
+  item->deps = cpr__build_deps(js, len);
+  /* Same wrapper as the Duktape module loader */
+  duk_push_string(ctx, "function (require, exports, module) {");
+  duk_dup(ctx, -3);
+  duk_push_string(ctx, "\n}");
+  duk_concat(ctx, 3);
+  duk_swap_top(ctx, -2);
+  duk_compile(ctx, DUK_COMPILE_FUNCTION);
+  duk_dump_function(ctx);
+  return 1;
+}
+
+CPR_API_INTERN void cpr__build_write(cpr__build_item *item, const void *data, duk_size_t size) {
+  char *filename = cpr__build_concat(item->filename, CPR_BYTECODE_EXT, "");
+  char header[CPR__BUILD_HEADER_SIZE + 1];
+  FILE *f;
+
+  cpr__build_header(item->source, item->size, data, size, header);
+  if (filename == NULL || (f = fopen(filename, "wb")) == NULL) {
+    item->error = cpr_strdup("can't write the bytecode");
+  } else {
+    if (fwrite(header, 1, CPR__BUILD_HEADER_SIZE, f) != CPR__BUILD_HEADER_SIZE ||
+        fwrite(data, 1, size, f) != size) {
+      item->error = cpr_strdup("can't write the bytecode");
+    }
+    fclose(f);
+  }
+  free(filename);
+}
+
+/* Build thread: compile the items until none is left */
+CPR_API_INTERN void cpr__build_worker(void *arg) {
+  cpr__build *b = arg;
+  cpr__build_item *item;
+  duk_context *ctx;
+  duk_size_t size;
+  void *data;
+  int i;
+
+  if ((ctx = cpr_create_context(NULL, b->log_level)) == NULL ||
+      (b->coffee && cpr_load_coffee_script(ctx) != 0)) {
+    cpr_destroy_context(ctx);
+    return;
+  }
+  while ((i = (int)cpr_atomic_add(&b->next, 1) - 1) < b->count) {
+    item = &b->items[i];
+    if (item->state != CPR__BUILD_COMPILE) {
+      continue;
+    }
+    duk_push_lstring(ctx, item->source, item->size);
+    duk_push_string(ctx, item->path);
+    duk_push_boolean(ctx, item->coffee);
+    duk_push_pointer(ctx, item);
+    if (duk_safe_call(ctx, cpr__build_compile, 4, 1) == DUK_EXEC_SUCCESS) {
+      data = duk_get_buffer(ctx, -1, &size);
+      cpr__build_write(item, data, size);
+    } else {
+      item->error = cpr_strdup(duk_safe_to_string(ctx, -1));
+    }
+    duk_pop(ctx);
+    item->state = item->error ? CPR__BUILD_FAILED : CPR__BUILD_DONE;
+  }
+  cpr_destroy_context(ctx);
+}
+
+/* Push the array of the module dependencies */
+CPR_API_INTERN void cpr__build_push_deps(duk_context *ctx, const char *deps) {
+  const char *end;
+  duk_uarridx_t i = 0;
+
+  duk_push_array(ctx);
+  while (deps && (end = strchr(deps, '\n')) != NULL) {
+    duk_push_lstring(ctx, deps, (duk_size_t)(end - deps));
+    duk_put_prop_index(ctx, -2, i++);
+    deps = end + 1;
+  }
+}
+
+/* Push the module entries of the previous manifest (or an empty object) */
+CPR_API_INTERN duk_ret_t cpr__build_read_manifest(duk_context *ctx) {
+  const char *filename = duk_require_string(ctx, -1);
+
+  if (cpr_file_exists(filename)) {
+    duk_push_string_file(ctx, filename);
+    duk_json_decode(ctx, -1);
+    duk_get_prop_string(ctx, -1, "modules");
+  }
+  if (!duk_is_object(ctx, -1)) {
+    duk_push_object(ctx);
+  }
+  return 1;
+}
+
+CPR_API_EXTERN int cpr_build(const char *dir, int log_level, cpr_build_stats *stats) {
+  cpr__build b;
+  cpr__build_item *item;
+  cpr_thread threads[64];
+  duk_context *ctx;
+  char *manifest;
+  FILE *f;
+  int i, n = 0, compile = 0, failed = 0, thread_count;
+  double start = cpr_get_time();
+
+  memset(&b, 0, sizeof(b));
+  b.log_level = log_level;
+  if (stats) {
+    memset(stats, 0, sizeof(cpr_build_stats));
+  }
+  if ((ctx = cpr_create_context(NULL, log_level)) == NULL) {
+    return -1;
+  }
+  if ((manifest = cpr__build_concat(dir, CPR__BUILD_SEPARATOR, CPR_BUILD_MANIFEST)) == NULL ||
+      cpr__build_walk(&b, dir, "") != 0) {
+    cpr_log_raw("Can't read the directory '%s'\n", dir);
+    failed = 1;
+    goto finished;
+  }
+  qsort(b.items, b.count, sizeof(cpr__build_item), cpr__build_compare);
+
+  /* Skip the sources not changed since the previous build */
+  duk_push_string(ctx, manifest);
+  if (duk_safe_call(ctx, cpr__build_read_manifest, 1, 1) != DUK_EXEC_SUCCESS) {
+    WRN(ctx, "Can't read the manifest '%s' : %s", manifest, duk_safe_to_string(ctx, -1));
+    duk_pop(ctx);
+    duk_push_object(ctx);
+  }
+  for (i = 0; i < b.count; ++i) {
+    item = &b.items[i];
+    if (cpr__build_read(item) != 0) {
+      item->state = CPR__BUILD_FAILED;
+      item->error = cpr_strdup("can't read the file");
+      continue;
+    }
+    duk_get_prop_string(ctx, -1, item->path);
+    if (duk_is_object(ctx, -1)) {
+      duk_get_prop_string(ctx, -1, "hash");
+    } else {
+      duk_push_undefined(ctx);
+    }
+    /* Same check as the module loader. The previous entry has the deps. */
+    if (duk_is_string(ctx, -1) && cpr__build_is_up_to_date(item)) {
+      item->state = CPR__BUILD_UP_TO_DATE;
+    } else {
+      item->state = CPR__BUILD_COMPILE;
+      b.coffee += item->coffee;
+      ++compile;
+    }
+    duk_pop_2(ctx);
+  }
+
+  /* Compile in parallel. The main heap loads the compiler first so the
+   * threads load it from the bytecode cache. */
+  if (compile > 0) {
+    if (b.coffee && cpr_load_coffee_script(ctx) != 0) {
+      failed = 1;
+      goto finished;
+    }
+    thread_count = cpr_thread_cpu_count();
+    thread_count = thread_count < compile ? thread_count : compile;
+    thread_count = thread_count < 64 ? thread_count : 64;
+    for (n = 0; n < thread_count; ++n) {
+      if (cpr_thread_create(&threads[n], cpr__build_worker, &b) != 0) {
+        break;
+      }
+    }
+    if (n == 0) {
+      cpr__build_worker(&b);
+    }
+    for (i = 0; i < n; ++i) {
+      cpr_thread_join(threads[i]);
+    }
+  }
+
+  /* Write the manifest of the built modules */
+  duk_get_global_string(ctx, "JSON");
+  duk_push_string(ctx, "stringify");
+  duk_push_object(ctx);
+  duk_push_int(ctx, 1);
+  duk_put_prop_string(ctx, -2, "version");
+  duk_push_object(ctx);
+  for (i = 0; i < b.count; ++i) {
+    item = &b.items[i];
+    if (item->state == CPR__BUILD_COMPILE) {
+      /* Not compiled (the build thread failed to start) */
+      item->error = cpr_strdup("can't create the compiler heap");
+      item->state = CPR__BUILD_FAILED;
+    }
+    if (item->state == CPR__BUILD_FAILED) {
+      cpr_log_raw("%s: %s\n", item->filename, item->error);
+      ++failed;
+      continue;
+    }
+    duk_push_object(ctx);
+    duk_push_string(ctx, item->hash);
+    duk_put_prop_string(ctx, -2, "hash");
+    duk_push_string(ctx, item->path);
+    duk_push_string(ctx, CPR_BYTECODE_EXT);
+    duk_concat(ctx, 2);
+    duk_put_prop_string(ctx, -2, "bytecode");
+    if (item->state == CPR__BUILD_UP_TO_DATE) {
+      /* Dependencies of the previous build */
+      duk_get_prop_string(ctx, 0, item->path);
+      duk_get_prop_string(ctx, -1, "deps");
+      duk_remove(ctx, -2);
+    } else {
+      cpr__build_push_deps(ctx, item->deps);
+    }
+    duk_put_prop_string(ctx, -2, "deps");
+    duk_put_prop_string(ctx, -2, item->path);
+  }
+  duk_put_prop_string(ctx, -2, "modules");
+  duk_push_null(ctx);
+  duk_push_int(ctx, 2);
+  duk_call_prop(ctx, -5, 3);
+  if ((f = fopen(manifest, "wb")) == NULL || fputs(duk_get_string(ctx, -1), f) < 0) {
+    cpr_log_raw("Can't write the manifest '%s'\n", manifest);
+    ++failed;
+  }
+  if (f) {
+    fclose(f);
+  }
+  duk_pop_3(ctx); /* [ modules JSON result ] */
+
+  if (stats) {
+    stats->count = b.count;
+    stats->compiled = compile - (failed > compile ? compile : failed);
+    stats->up_to_date = b.count - compile;
+    stats->failed = failed;
+    stats->threads = n;
+    stats->time = cpr_get_time() - start;
+  }
+
+finished:
+  for (i = 0; i < b.count; ++i) {
+    free(b.items[i].path);
+    free(b.items[i].filename);
+    free(b.items[i].source);
+    free(b.items[i].deps);
+    free(b.items[i].error);
+  }
+  free(b.items);
+  free(manifest);
+  cpr_destroy_context(ctx);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * cpr_build.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_BUILD_H
+#define CPR_BUILD_H
+
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Ahead-of-time compilation (`cepora --build <dir>`).
+ * Every CoffeeScript and JavaScript file of the directory tree is compiled to
+ * a Duktape bytecode module function written next to the source (".bc"
+ * appended to the file name). The files are compiled in parallel, one heap
+ * with the CoffeeScript compiler per thread. The bytecode file starts with a
+ * header recording the hash of the module source and the size and hash of the
+ * bytecode. The manifest (CPR_BUILD_MANIFEST in the directory) records the
+ * source hash of every module and the modules it requires statically
+ * (`require('id')` calls with a literal id) for preloading (see
+ * cpr_preload.h).
+ *
+ * The build, the module loader and the preloader share the same rule: the
+ * bytecode is used only if its header matches the current module source and
+ * the bytecode itself (see cpr_build_check_bytecode). Otherwise the module is
+ * compiled again (or from source at runtime). The main script is always
+ * compiled from source.
+ */
+
+#define CPR_BYTECODE_EXT    ".bc"
+#define CPR_BUILD_MANIFEST  "manifest.json"
+
+typedef struct cpr_build_stats {
+  int count;              /* modules found */
+  int compiled;
+  int up_to_date;         /* skipped */
+  int failed;
+  int threads;
+  double time;            /* seconds */
+} cpr_build_stats;
+
+/* Build the directory. `stats` (may be NULL) is set to the build result.
+ * Return 0 on success or -1 if a file can't be compiled (the errors are
+ * logged). */
+CPR_API_EXTERN int cpr_build(const char *dir, int log_level, cpr_build_stats *stats);
+
+/* Read a whole file (NUL terminated). Return NULL on error. The caller frees
+ * the data. */
+CPR_API_EXTERN char *cpr_build_read_file(const char *filename, size_t *size);
+
+/* Return the module bytecode of the bytecode file `data` (and its size) if it
+ * was compiled from `source` and isn't corrupted, NULL otherwise. Duktape
+ * doesn't validate the bytecode so it must be checked before loading. */
+CPR_API_EXTERN const char *cpr_build_check_bytecode(const char *source, size_t source_size,
+    const char *data, size_t size, size_t *bytecode_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_BUILD_H */
@@ -0,0 +1,128 @@
+/*
+ * cpr_builtin.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <string.h> /* strncmp */
+
+#include "cpr_builtin.h"
+
+#if defined(CPR_BUILTIN_BROADPHASE)
+#include "modules/cpr_broadphase.h"
+#endif
+#if defined(CPR_BUILTIN_DUMMY)
+#include "modules/cpr_dummy.h"
+#endif
+#if defined(CPR_BUILTIN_ECS)
+#include "modules/cpr_ecs.h"
+#endif
+#if defined(CPR_BUILTIN_FS)
+#include "modules/cpr_fs.h"
+#endif
+#if defined(CPR_BUILTIN_GL3W)
+#include "modules/cpr_gl3w.h"
+#endif
+#if defined(CPR_BUILTIN_GLFW)
+#include "modules/cpr_glfw.h"
+#endif
+#if defined(CPR_BUILTIN_IMGUI)
+#include "modules/cpr_imgui.h"
+#endif
+#if defined(CPR_BUILTIN_JOBS)
+#include "modules/cpr_jobs_module.h"
+#endif
+#if defined(CPR_BUILTIN_MAINLOOP)
+#include "modules/cpr_mainloop.h"
+#endif
+#if defined(CPR_BUILTIN_PARTICLES)
+#include "modules/cpr_particles.h"
+#endif
+#if defined(CPR_BUILTIN_PROFILER)
+#include "modules/cpr_profiler_module.h"
+#endif
+#if defined(CPR_BUILTIN_STREAM)
+#include "modules/cpr_stream.h"
+#endif
+#if defined(CPR_BUILTIN_TILEMAP)
+#include "modules/cpr_tilemap.h"
+#endif
+#if defined(CPR_BUILTIN_WATCH)
+#include "modules/cpr_watch_module.h"
+#endif
+#if defined(CPR_BUILTIN_WORKER)
+#include "modules/cpr_worker.h"
+#endif
+
+/* Sorted by name */
+static const cpr_builtin _builtins[] = {
+#if defined(CPR_BUILTIN_BROADPHASE)
+  { "broadphase", dukopen_broadphase },
+#endif
+#if defined(CPR_BUILTIN_DUMMY)
+  { "dummy", dukopen_dummy },
+#endif
+#if defined(CPR_BUILTIN_ECS)
+  { "ecs", dukopen_ecs },
+#endif
+#if defined(CPR_BUILTIN_FS)
+  { "fs", dukopen_fs },
+#endif
+#if defined(CPR_BUILTIN_GL3W)
+  { "gl3w", dukopen_gl3w },
+#endif
+#if defined(CPR_BUILTIN_GLFW)
+  { "glfw", dukopen_glfw },
+#endif
+#if defined(CPR_BUILTIN_IMGUI)
+  { "imgui", dukopen_imgui },
+#endif
+#if defined(CPR_BUILTIN_JOBS)
+  { "jobs", dukopen_jobs },
+#endif
+#if defined(CPR_BUILTIN_MAINLOOP)
+  { "mainloop", dukopen_mainloop },
+#endif
+#if defined(CPR_BUILTIN_PARTICLES)
+  { "particles", dukopen_particles },
+#endif
+#if defined(CPR_BUILTIN_PROFILER)
+  { "profiler", dukopen_profiler },
+#endif
+#if defined(CPR_BUILTIN_STREAM)
+  { "stream", dukopen_stream },
+#endif
+#if defined(CPR_BUILTIN_TILEMAP)
+  { "tilemap", dukopen_tilemap },
+#endif
+#if defined(CPR_BUILTIN_WATCH)
+  { "watch", dukopen_watch },
+#endif
+#if defined(CPR_BUILTIN_WORKER)
+  { "worker", dukopen_worker },
+#endif
+  { NULL, NULL }
+};
+
+CPR_API_EXTERN duk_c_function cpr_builtin_find(const char *name, size_t len) {
+  const cpr_builtin *builtin;
+
+  for (builtin = _builtins; builtin->name; ++builtin) {
+    if (strncmp(builtin->name, name, len) == 0 && builtin->name[len] == '\0') {
+      return builtin->open;
+    }
+  }
+  return NULL;
+}
+
+CPR_API_EXTERN void cpr_builtin_push_names(duk_context *ctx) {
+  duk_uarridx_t i;
+
+  duk_push_array(ctx);
+  for (i = 0; _builtins[i].name; ++i) {
+    duk_push_string(ctx, _builtins[i].name);
+    duk_put_prop_index(ctx, -2, i);
+  }
+}
@@ -0,0 +1,39 @@
+/*
+ * cpr_builtin.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_BUILTIN_H
+#define CPR_BUILTIN_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Builtin modules.
+ * The C modules listed in the CPR_BUILD_STATIC_MODULES build option are
+ * linked in the runtime (CPR_BUILTIN_<NAME> defined). `require` looks for
+ * the module in the builtin modules table first (e.g. `require 'ecs.so'` or
+ * `require 'ecs'`) so the shared library is never searched nor opened.
+ */
+
+typedef struct cpr_builtin {
+  const char *name;
+  duk_c_function open;
+} cpr_builtin;
+
+/* Return the open function of the builtin module `name` (`len` characters)
+ * or NULL if the module is not builtin */
+CPR_API_EXTERN duk_c_function cpr_builtin_find(const char *name, size_t len);
+/* Push the array of the builtin modules names */
+CPR_API_EXTERN void cpr_builtin_push_names(duk_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_BUILTIN_H */
@@ -10,7 +10,12 @@
 
 #include <stdio.h>
 #include <errno.h>
-#include <string.h> /* strcmp */
+#include <string.h> /* strcmp, strtok, strcspn, memcpy */
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <unistd.h> /* dup, dup2 */
+#include <fcntl.h>  /* open */
+#endif
 
 #include "duktape.h"
 #include "cpr_debug_internal.h"
@@ -19,9 +24,42 @@
 #include "cpr_sys_tools.h"
 #include "cpr_package.h"
 #include "cpr_loadlib.h"
+#include "cpr_trace.h"
+#include "cpr_sampler.h"
+#include "cpr_bindings.h"
+#include "cpr_jobs.h"
+#include "cpr_profiler.h"
+#include "cpr_thread.h"
+#include "cpr_watch.h"
+#include "cpr_build.h"
+#include "cpr_preload.h"
 
 #define CPR_VERSION_STRING "v0.10.99"
 
+/* Headless mode: windows are created invisible and closed after
+ * `_headless_frames` buffer swaps (0 for never). */
+static int _headless = 0;
+static int _headless_frames = 0;
+static int _headless_swaps = 0;
+
+/* The CoffeeScript compiler bytecode is kept to load it in the next heaps
+ * (`--worker` runs and `--build` threads) if `_coffee_cache` is set. Freed
+ * when cepora exits. */
+static int _coffee_cache = 0;
+static char *_coffee_bytecode = NULL;
+static duk_size_t _coffee_bytecode_size = 0;
+
+/* The executor interrupt is only used by the sampler */
+static cpr_heap_udata _heap_udata = { cpr_sampler_interrupt };
+
+CPR_API_EXTERN int cpr_is_headless() {
+  return _headless;
+}
+
+CPR_API_EXTERN int cpr_headless_swap() {
+  return _headless && _headless_frames > 0 && ++_headless_swaps >= _headless_frames;
+}
+
 /* Helper function to set logging level for both C and Javascript API.
  * Note that this only set the *DEFAULT* javascript logging level and will not
  * change Logger objects already created.
@@ -53,9 +91,21 @@ CPR_API_INTERN void cpr__usage() {
   cpr_log_raw("  -h, --help       print this message\n");
   cpr_log_raw("  -o               redirect logging to file\n");
   cpr_log_raw("  -l               set default logging level (0-5)\n");
+  cpr_log_raw("  -p, --path       search the modules and scripts in a directory first\n");
+  cpr_log_raw("  --headless       create invisible windows (offscreen rendering)\n");
+  cpr_log_raw("  --frames         in headless mode close windows after n frames\n");
+  cpr_log_raw("  --trace          record a Chrome trace event file (chrome://tracing)\n");
+  cpr_log_raw("  --sample         sample the scripts and write the collapsed stacks to file\n");
+  cpr_log_raw("  --sample-rate    samples per second (default 1000)\n");
+  cpr_log_raw("  --bindings       count the native bindings calls and print a report on exit\n");
+  cpr_log_raw("  --jobs           number of job system threads (default: cores - 1)\n");
+  cpr_log_raw("  --watch          reload the changed script modules (hot reload)\n");
+  cpr_log_raw("  --build          compile the scripts of a directory to bytecode (incremental)\n");
+  cpr_log_raw("  --worker         run the scripts read from stdin (see tests/run-tests.py)\n");
   cpr_log_raw("\n");
   cpr_log_raw("Environment variables:\n");
-  cpr_log_raw("CPR_PATH           semi-colon separated directories list to seach for module and scripts.");
+  cpr_log_raw("CPR_PATH           semi-colon separated directories list to seach for module and scripts.\n");
+  cpr_log_raw("CPR_HEADLESS       run in headless mode if set to 1.");
   cpr_log_raw("\n");
   exit(EXIT_SUCCESS);
 }
@@ -73,6 +123,97 @@ CPR_API_INTERN void cpr__fatal_handler(duk_context *ctx, duk_errcode_t code, con
   exit(EXIT_FAILURE);
 }
 
+/* Write the collapsed stacks and print the top of the flat profile */
+CPR_API_INTERN void cpr__print_samples(const char *path) {
+  const cpr_sampler_entry *entries;
+  double count = cpr_sampler_sample_count();
+  int i, n;
+
+  if (cpr_sampler_write_collapsed(path) != 0) {
+    cpr_log_raw("Can't write samples file '%s'\n", path);
+  }
+  n = cpr_sampler_flat(&entries);
+  cpr_log_raw("%.0f samples\n%7s %7s  %s\n", count, "self%", "total%", "frame");
+  for (i = 0; i < n && i < 20; ++i) {
+    cpr_log_raw("%7.2f %7.2f  %s\n", entries[i].self * 100.0 / count, entries[i].total * 100.0 / count, entries[i].frame);
+  }
+  cpr_sampler_clear();
+}
+
+/* Sort the bindings ids by total time or by calls */
+static int _bindings_by_time = 0;
+
+CPR_API_INTERN int cpr__compare_bindings(const void *a, const void *b) {
+  const cpr_binding_stats *x = cpr_bindings_get(*(const int *)a);
+  const cpr_binding_stats *y = cpr_bindings_get(*(const int *)b);
+  double u = _bindings_by_time ? x->time : x->calls;
+  double v = _bindings_by_time ? y->time : y->calls;
+  return u < v ? 1 : u > v ? -1 : 0;
+}
+
+/* Print the top bindings by calls and by time */
+CPR_API_INTERN void cpr__print_bindings() {
+  int i, n = cpr_bindings_count(), *ids;
+  const cpr_binding_stats *b;
+  double frames;
+
+  if (n == 0 || (ids = malloc(n * sizeof(int))) == NULL) {
+    return;
+  }
+  for (i = 0; i < n; ++i) {
+    ids[i] = i;
+  }
+  for (_bindings_by_time = 0; _bindings_by_time < 2; ++_bindings_by_time) {
+    qsort(ids, n, sizeof(int), cpr__compare_bindings);
+    if (cpr_bindings_get(ids[0])->calls == 0.0) {
+      break;
+    }
+    cpr_log_raw("Top bindings by %s\n%10s %10s %10s %10s %9s %9s  %s\n", _bindings_by_time ? "time" : "calls",
+        "calls", "calls/fr", "ms", "ms/fr", "p50 us", "p99 us", "binding");
+    for (i = 0; i < n && i < 20; ++i) {
+      b = cpr_bindings_get(ids[i]);
+      if (b->calls == 0.0) {
+        break;
+      }
+      frames = b->frames > 0.0 ? b->frames : 1.0;
+      cpr_log_raw("%10.0f %10.1f %10.3f %10.4f %9.1f %9.1f  %s\n", b->calls, b->calls / frames,
+          b->time * 1e3, b->time * 1e3 / frames, cpr_bindings_percentile(b, 50.0) * 1e6,
+          cpr_bindings_percentile(b, 99.0) * 1e6, b->name);
+    }
+  }
+  free(ids);
+}
+
+/* Compile (or load from the bytecode cache) and run the CoffeeScript
+ * compiler. Called in a safe call with the compiler path on the stack top. */
+CPR_API_INTERN duk_ret_t cpr__load_coffee_script(duk_context *ctx) {
+  void *buf;
+  duk_size_t size;
+
+  if (_coffee_bytecode != NULL) {
+    buf = duk_push_fixed_buffer(ctx, _coffee_bytecode_size);
+    memcpy(buf, _coffee_bytecode, _coffee_bytecode_size);
+    duk_load_function(ctx);
+  } else {
+    duk_push_string_file(ctx, duk_require_string(ctx, -1));
+    duk_dup(ctx, -2);
+    duk_compile(ctx, 0);
+    /* The cache is only written on the main thread */
+    if (_coffee_cache && cpr_thread_is_main()) {
+      duk_dup_top(ctx);
+      duk_dump_function(ctx);
+      buf = duk_get_buffer(ctx, -1, &size);
+      if ((_coffee_bytecode = malloc(size)) != NULL) {
+        memcpy(_coffee_bytecode, buf, size);
+        _coffee_bytecode_size = size;
+      }
+      duk_pop(ctx);
+    }
+  }
+  duk_call(ctx, 0);
+  return 1;
+}
+
 /* Load the core module into the global environment */
 CPR_API_INTERN duk_ret_t cpr__open_core_modules(duk_context *ctx) {
   /* Load the `package` module */
@@ -88,11 +229,138 @@ CPR_API_INTERN duk_ret_t cpr__open_core_modules(duk_context *ctx) {
   return 0;
 }
 
-CPR_API_EXTERN int cpr_start(int argc, char *argv[]) {
+CPR_API_EXTERN void cpr_destroy_context(duk_context *ctx) {
+  void *libs;
+
+  if (ctx) {
+    libs = cpr_loadlib_detach(ctx);
+    duk_destroy_heap(ctx);
+    cpr_loadlib_release(libs);
+  }
+}
+
+CPR_API_EXTERN duk_context *cpr_create_context(void *udata, int log_level) {
+  duk_context *ctx;
+  double start;
+
+  /* TODO investigate memory management implementations like tcmalloc
+   * (https://github.com/gperftools/gperftools) and jmalloc
+   * (https://github.com/jemalloc/jemalloc).
+   */
+  ctx = duk_create_heap(NULL, NULL, NULL, udata, cpr__fatal_handler);
+  if (!ctx) {
+    cpr_log_raw("FATAL: Failed to create a Duktape heap.\n");
+    return NULL;
+  }
+  cpr_set_default_log_level(ctx, log_level);
+
+  start = cpr_get_time();
+  if (duk_safe_call(ctx, cpr__open_core_modules, 0, 1)) {
+    FTL(ctx, "Can't open core modules.");
+    cpr_dump_stack_trace(ctx, -1);
+    cpr_destroy_context(ctx);
+    return NULL;
+  }
+  duk_pop(ctx); /* result */
+  cpr_trace_complete("startup", "openCoreModules", start);
+
+  duk_get_global_string(ctx, "Duktape");
+  duk_push_string(ctx, DUK_USE_OS_STRING);
+  duk_put_prop_string(ctx, -2, "os");
+  duk_push_string(ctx, DUK_USE_ARCH_STRING);
+  duk_put_prop_string(ctx, -2, "arch");
+  duk_push_boolean(ctx, _headless);
+  duk_put_prop_string(ctx, -2, "headless");
+  duk_pop(ctx); /* Duktape */
+  return ctx;
+}
+
+CPR_API_EXTERN int cpr_load_coffee_script(duk_context *ctx) {
+  double start;
+  int rc = -1;
+
+  /* Get CoffeeScript compiler full path */
+  duk_get_global_string(ctx, CPR_PACKAGE_NAME);
+  duk_get_prop_string(ctx, -1, "searchPath");
+  duk_push_string(ctx, CPR__COFFEE_SCRIPT_PATH);
+  duk_pcall(ctx, 1);
+  if (duk_is_null_or_undefined(ctx, -1)) {
+    FTL(ctx, "Can't find CoffeeScript compiler : " CPR__COFFEE_SCRIPT_PATH);
+    duk_pop_2(ctx); /* [package] [result] */
+    return rc;
+  }
+
+  /* Load CoffeeScript compiler into the global environment. The CoffeeScript
+   * compiler will be available in the global variable `CoffeeScript`.
+   */
+  DBG(ctx, "Loading CoffeeScript compiler '%s'", duk_get_string(ctx, -1));
+  start = cpr_get_time();
+  if (duk_safe_call(ctx, cpr__load_coffee_script, 1, 1) != 0) {
+    FTL(ctx, "Error loading CoffeeScript compiler: '%s'", duk_safe_to_string(ctx, -1));
+    cpr_dump_stack_trace(ctx, -1);
+  } else {
+    cpr_trace_complete("startup", "loadCoffeeScript", start);
+    rc = 0;
+  }
+  duk_pop_2(ctx); /* [package] [result] */
+  return rc;
+}
+
+CPR_API_EXTERN int cpr_compile_script(duk_context *ctx, const char *filename) {
+  duk_idx_t top = duk_get_top(ctx);
+  double start;
+
+  duk_get_global_string(ctx, CPR_PACKAGE_NAME);
+  duk_get_prop_string(ctx, -1, "searchPath");
+  duk_push_string(ctx, filename);
+  duk_pcall(ctx, 1);
+  /* If no file is found then `undefined` is pushed */
+  if (duk_is_null_or_undefined(ctx, -1)) {
+    FTL(ctx, "Can't find script : '%s'", filename);
+    duk_set_top(ctx, top);
+    return -1;
+  }
+  CPR__DLOG("script : '%s'", filename);
+
+  /* Get the CoffeeScript global object */
+  duk_get_global_string(ctx, "CoffeeScript");
+  duk_push_string(ctx, "compile");
+  /* Push the content of the file on the top of the stack */
+  duk_push_string_file(ctx, duk_get_string(ctx, -3));
+  /* Compile the coffee script in "safe" mode */
+  start = cpr_get_time();
+  if (duk_pcall_prop(ctx, -3, 1) != DUK_EXEC_SUCCESS) {
+    /* If duk_safe_call fails the error object is at the top of the context.
+     * But we must request at least one return value to actually get the error
+     * object on the stack. */
+    FTL(ctx, "Can't compile script '%s' : %s", filename, duk_safe_to_string(ctx, -1));
+    duk_set_top(ctx, top);
+    return -1;
+  }
+  cpr_trace_complete("compile", filename, start);
+  /* Compile with the script file name for the stack traces and the sampler */
+  duk_push_string(ctx, filename);
+  if (duk_pcompile(ctx, 0) != 0) {
+    cpr_dump_stack_trace(ctx, -1);
+    duk_set_top(ctx, top);
+    return -1;
+  }
+  /* [ ... package path CoffeeScript function ] */
+  duk_replace(ctx, top);
+  duk_set_top(ctx, top + 1);
+  return 0;
+}
+
+/* Run a script in a new heap */
+CPR_API_INTERN int cpr__run(int argc, char *argv[]) {
   duk_context *ctx = NULL;
-  int i = 0, argsConsumed = 0;
+  int i = 0, argsConsumed = 0, status = EXIT_FAILURE;
   int  log_level = 4; /* Default log level to ERROR */
-  const char *filename = NULL, *log_path = NULL;
+  int watch = 0;
+  const char *build_dir = NULL;
+  const char *filename = NULL, *log_path = NULL, *trace_path = NULL, *sample_path = NULL;
+  double start, sample_rate = CPR_SAMPLER_DEFAULT_RATE;
+  cpr_build_stats stats;
 
 #if defined(CPR_DEBUG_INTERNAL)
   CPR__DLOG("Command line arguments:");
@@ -127,11 +395,82 @@ CPR_API_EXTERN int cpr_start(int argc, char *argv[]) {
         cpr_log_raw("%s: %s requires an arguments\n", argv[0], argv[i]);
         exit(EXIT_FAILURE);
       }
+    } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--path") == 0) {
+      if (i + 1 < argc) {
+        cpr_package_set_path(argv[++i]);
+      } else {
+        cpr_log_raw("%s: %s requires an arguments\n", argv[0], argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[i], "--headless") == 0) {
+      _headless = 1;
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      if (i + 1 < argc) {
+        _headless_frames = strtol(argv[++i], NULL, 10);
+      } else {
+        cpr_log_raw("%s: %s requires an arguments\n", argv[0], argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[i], "--trace") == 0) {
+      if (i + 1 < argc) {
+        trace_path = argv[++i];
+      } else {
+        cpr_log_raw("%s: %s requires an arguments\n", argv[0], argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[i], "--sample") == 0) {
+      if (i + 1 < argc) {
+        sample_path = argv[++i];
+      } else {
+        cpr_log_raw("%s: %s requires an arguments\n", argv[0], argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[i], "--bindings") == 0) {
+      cpr_bindings_enable(1);
+    } else if (strcmp(argv[i], "--watch") == 0) {
+      watch = 1;
+    } else if (strcmp(argv[i], "--build") == 0) {
+      if (i + 1 < argc) {
+        build_dir = argv[++i];
+      } else {
+        cpr_log_raw("%s: %s requires an arguments\n", argv[0], argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[i], "--jobs") == 0) {
+      if (i + 1 < argc) {
+        cpr_jobs_set_thread_count(strtol(argv[++i], NULL, 10));
+      } else {
+        cpr_log_raw("%s: %s requires an arguments\n", argv[0], argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[i], "--sample-rate") == 0) {
+      if (i + 1 < argc) {
+        sample_rate = strtod(argv[++i], NULL);
+      } else {
+        cpr_log_raw("%s: %s requires an arguments\n", argv[0], argv[i]);
+        exit(EXIT_FAILURE);
+      }
     }
     ++i;
   }
   argsConsumed = i;
 
+  if (build_dir) {
+    /* The build threads load the compiler from the cache */
+    _coffee_cache = 1;
+    status = cpr_build(build_dir, log_level, &stats) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (status == EXIT_SUCCESS || stats.count > 0) {
+      cpr_log_raw("Built %d modules in %.2fs with %d threads: %d compiled, %d up to date, %d failed\n",
+          stats.count, stats.time, stats.threads, stats.compiled, stats.up_to_date, stats.failed);
+    }
+    cpr_package_set_path(NULL);
+    return status;
+  }
+
+  if (getenv("CPR_HEADLESS") != NULL && strcmp(getenv("CPR_HEADLESS"), "1") == 0) {
+    _headless = 1;
+  }
+
   CPR__DLOG("argc: %d consumed: %d", argc, argsConsumed);
 
   /* Run in CLI mode. First argument is the script file to run. */
@@ -143,20 +482,16 @@ CPR_API_EXTERN int cpr_start(int argc, char *argv[]) {
   }
   CPR__DLOG("main script : '%s'", filename);
 
-  /* Create duktape VM heap */
-  /* TODO investigate memory management implementations like tcmalloc
-   * (https://github.com/gperftools/gperftools) and jmalloc
-   * (https://github.com/jemalloc/jemalloc).
-   */
-  ctx = duk_create_heap(NULL, NULL, NULL, NULL, cpr__fatal_handler);
+  if (trace_path) {
+    cpr_trace_open(trace_path);
+  }
 
+  /* Create duktape VM heap */
+  ctx = cpr_create_context(&_heap_udata, log_level);
   if (!ctx) {
-    cpr_log_raw("FATAL: Failed to create a Duktape heap.\n");
     goto finished;
   }
 
-  cpr_set_default_log_level(ctx, log_level);
-
   /* Redirect the logger ouput to a file stream */
   if (log_path) {
     CPR__DLOG("Redirect log stream to file '%s'", log_path);
@@ -165,19 +500,9 @@ CPR_API_EXTERN int cpr_start(int argc, char *argv[]) {
     }
   }
 
-  if (duk_safe_call(ctx, cpr__open_core_modules, 0, 1)) {
-    FTL(ctx, "Can't open core modules.");
-    cpr_dump_stack_trace(ctx, -1);
-    goto finished;
+  if (trace_path) {
+    cpr_trace_watch_gc(ctx);
   }
-  duk_pop(ctx); /* result */
-
-  duk_get_global_string(ctx, "Duktape");
-  duk_push_string(ctx, DUK_USE_OS_STRING);
-  duk_put_prop_string(ctx, -2, "os");
-  duk_push_string(ctx, DUK_USE_ARCH_STRING);
-  duk_put_prop_string(ctx, -2, "arch");
-  duk_pop(ctx); /* Duktape */
 
   /* Store command line arguments in the `Duktape` global object. */
   duk_push_global_object(ctx);
@@ -193,63 +518,119 @@ CPR_API_EXTERN int cpr_start(int argc, char *argv[]) {
   duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE); /* Non writable property */
   duk_pop_2(ctx);
 
-  /* Get CoffeeScript compiler full path */
-  duk_get_global_string(ctx, CPR_PACKAGE_NAME);
-  duk_get_prop_string(ctx, -1, "searchPath");
-  duk_push_string(ctx, CPR__COFFEE_SCRIPT_PATH);
-  duk_pcall(ctx, 1);
-  if (duk_is_null_or_undefined(ctx, -1)) {
-    FTL(ctx, "Can't find CoffeeScript compiler : " CPR__COFFEE_SCRIPT_PATH);
+  if (cpr_load_coffee_script(ctx) != 0) {
     goto finished;
   }
-
-  /* Load CoffeeScript compiler into the global environment. The CoffeeScript
-   * compiler will be available in the global variable `CoffeeScript`.
-   */
-  DBG(ctx, "Loading CoffeeScript compiler '%s'", duk_get_string(ctx, -1));
-  if (duk_peval_file(ctx, duk_get_string(ctx, -1)) != 0) {
-    FTL(ctx, "Error loading CoffeeScript compiler: '%s'", duk_get_string(ctx, -1));
-    cpr_dump_stack_trace(ctx, -1);
+  /* Read the modules while the main script compiles */
+  cpr_preload_start(ctx, filename, log_level);
+  if (cpr_compile_script(ctx, filename) != 0) {
     goto finished;
   }
-  duk_pop_3(ctx); /* [package] [searchPath] [result] */
-
-  duk_get_global_string(ctx, CPR_PACKAGE_NAME);
-  duk_get_prop_string(ctx, -1, "searchPath");
-  duk_push_string(ctx, filename);
-  duk_pcall(ctx, 1);
-  /* If no file is found then `undefined` is pushed */
-  if (duk_is_null_or_undefined(ctx, -1)) {
-    FTL(ctx, "Can't find script : '%s'", filename);
-    goto finished;
+  CPR__DUMP_CONTEXT(ctx); /* Stack should only contain the compiled script */
+  if (watch && cpr_watch_start(log_level) != 0) {
+    WRN(ctx, "Can't watch the script modules");
   }
-  CPR__DLOG("main script : '%s'", filename);
-
-  /* Get the CoffeeScript global object */
-  duk_get_global_string(ctx, "CoffeeScript");
-  duk_push_string(ctx, "compile");
-  /* Push the content of the file on the top of the stack */
-  duk_push_string_file(ctx, duk_get_string(ctx, -3));
-  /* Compile the coffee script in "safe" mode */
-  if (duk_pcall_prop(ctx, -3, 1) != DUK_EXEC_SUCCESS) {
-    /* If duk_safe_call fails the error object is at the top of the context.
-     * But we must request at least one return value to actually get the error
-     * object on the stack. */
-    FTL(ctx, "Can't compile script '%s' : %s", filename, duk_safe_to_string(ctx, -1));
-    goto finished;
+  if (sample_path && cpr_sampler_start(sample_rate) != 0) {
+    WRN(ctx, "Sampler not available in this build");
   }
-  /* Insert the compiled CoffeeScript script before in the stack so we can
-   * clean up (pop) before evaluating the script */
-  duk_insert(ctx, -4);
-  duk_pop_3(ctx); /* [package] [searchPath] [CoffeeScript] */
-  CPR__DUMP_CONTEXT(ctx); /* Stack should only contain the script source code */
-  if (duk_peval(ctx)) {
+  start = cpr_get_time();
+  if (duk_pcall(ctx, 0)) {
     cpr_dump_stack_trace(ctx, -1);
+  } else {
+    status = EXIT_SUCCESS;
   }
+  cpr_trace_complete("script", filename, start);
+  cpr_sampler_stop();
 
   INF(ctx, "Bye!");
 
 finished:
-  duk_destroy_heap(ctx); /* No-op if ctx is NULL */
+  if (trace_path && cpr_trace_close() != 0) {
+    cpr_log_raw("Can't write trace file '%s'\n", trace_path);
+  }
+  if (sample_path) {
+    cpr__print_samples(sample_path);
+  }
+  if (cpr_bindings_is_enabled()) {
+    cpr__print_bindings();
+  }
+  cpr_watch_stop();
+  cpr_destroy_context(ctx);
+  /* After the heap: destroying it joins the workers using the loader */
+  cpr_preload_stop();
+  cpr_watch_clear();
+  cpr_jobs_shutdown();
+  /* Reset the process state for the next run in worker mode */
+  _headless = _headless_frames = _headless_swaps = 0;
+  cpr_package_set_path(NULL);
+  cpr_bindings_enable(0);
+  cpr_bindings_clear();
+  cpr_profiler_enable(0);
+  cpr_profiler_set_frame_hook(NULL, NULL);
+  cpr_profiler_reset();
+  cpr_jobs_set_thread_count(0);
+  return status;
+}
+
+/* Persistent worker used by the parallel test runner (tests/run-tests.py).
+ * Runs are read from stdin, one per line: the output file followed by the
+ * command line arguments, separated by tabs. Each run uses a new heap and its
+ * output (stdout and stderr) is written to the output file. "@done <code>" is
+ * written to stdout when the run ends. */
+CPR_API_INTERN int cpr__worker(char *argv0) {
+#if defined(__linux__) || defined(__APPLE__)
+  char line[4096], *args[64], *output, *arg;
+  int argc, code, fd, saved_out, saved_err;
+
+  saved_out = dup(1);
+  saved_err = dup(2);
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if ((output = strtok(line, "\t")) == NULL) {
+      continue;
+    }
+    args[0] = argv0;
+    for (argc = 1; argc < 63 && (arg = strtok(NULL, "\t")) != NULL; ++argc) {
+      args[argc] = arg;
+    }
+    args[argc] = NULL;
+    if ((fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+      printf("@done %d\n", EXIT_FAILURE);
+      fflush(stdout);
+      continue;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    dup2(fd, 1);
+    dup2(fd, 2);
+    close(fd);
+    code = cpr__run(argc, args);
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, 1);
+    dup2(saved_err, 2);
+    printf("@done %d\n", code);
+    fflush(stdout);
+  }
   return EXIT_SUCCESS;
+#else
+  cpr_log_raw("%s: --worker is not supported on this platform\n", argv0);
+  return EXIT_FAILURE;
+#endif
+}
+
+CPR_API_EXTERN int cpr_start(int argc, char *argv[]) {
+  int status;
+
+  cpr_thread_set_main();
+  if (argc > 1 && strcmp(argv[1], "--worker") == 0) {
+    /* The runs load the compiler from the cache */
+    _coffee_cache = 1;
+    status = cpr__worker(argv[0]);
+  } else {
+    status = cpr__run(argc, argv);
+  }
+  free(_coffee_bytecode);
+  _coffee_bytecode = NULL;
+  return status;
 }
@@ -12,5 +12,24 @@
 
 CPR_API_EXTERN void cpr_set_default_log_level(duk_context *ctx, unsigned short level);
 CPR_API_EXTERN int cpr_start(int argc, char *argv[]);
+/* Create a heap with the core modules (`module` and `lib`) loaded and the
+ * `Duktape` properties (os, arch, headless) set. `udata` is the heap user data
+ * (see cpr_heap_udata in cpr_sampler.h). Return NULL on failure. */
+CPR_API_EXTERN duk_context *cpr_create_context(void *udata, int log_level);
+/* Destroy a heap created by cpr_create_context. The C module libraries not
+ * used by any heap anymore are closed after the heap (and the finalizers of
+ * their objects). No-op if `ctx` is NULL. */
+CPR_API_EXTERN void cpr_destroy_context(duk_context *ctx);
+/* Load the CoffeeScript compiler in the global `CoffeeScript`. Return 0 on
+ * success or -1 (the error is logged). */
+CPR_API_EXTERN int cpr_load_coffee_script(duk_context *ctx);
+/* Find and compile the CoffeeScript script `filename` and push the compiled
+ * function. Return 0 on success or -1 (the error is logged). */
+CPR_API_EXTERN int cpr_compile_script(duk_context *ctx, const char *filename);
+/* Return true if running in headless mode (--headless or CPR_HEADLESS=1) */
+CPR_API_EXTERN int cpr_is_headless();
+/* Count a buffer swap. Return true if the windows should close because the
+ * headless frames limit (--frames) is reached. */
+CPR_API_EXTERN int cpr_headless_swap();
 
 #endif /* CPR_CEPORA_H */
@@ -0,0 +1,637 @@
+/*
+ * cpr_clone.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdlib.h> /* malloc, calloc, free */
+#include <string.h> /* memcpy, memset, strcmp, strncmp, strlen */
+
+#include "cpr_clone.h"
+
+/* Hidden properties of the transferable ArrayBuffers */
+#define CPR__CLONE_PLAIN "\xff" "cprPlain"  /* external plain buffer */
+#define CPR__CLONE_DATA  "\xff" "cprData"   /* owned memory or NULL once transferred */
+
+#define CPR__CLONE_MAX_DEPTH  256
+#define CPR__CLONE_END_KEYS   0xffffffffU
+
+/* Value tags */
+enum {
+  CPR__TAG_UNDEFINED = 'u',
+  CPR__TAG_NULL = 'n',
+  CPR__TAG_TRUE = 't',
+  CPR__TAG_FALSE = 'f',
+  CPR__TAG_NUMBER = 'd',
+  CPR__TAG_STRING = 's',
+  CPR__TAG_POINTER = 'p',
+  CPR__TAG_ARRAY = 'a',
+  CPR__TAG_OBJECT = 'o',
+  CPR__TAG_DATE = 'D',
+  CPR__TAG_BUFFER = 'b',    /* copied buffer */
+  CPR__TAG_TRANSFER = 'x',  /* transferred buffer */
+  CPR__TAG_REF = 'r'        /* object already cloned */
+};
+
+/* Buffer classes. The class index is stored in the message. */
+typedef struct cpr__clone_class {
+  const char *name;
+  duk_uint_t flags;
+  duk_size_t elem_size;
+} cpr__clone_class;
+
+#define CPR__CLONE_PLAIN_BUFFER 0
+#define CPR__CLONE_ARRAYBUFFER  1
+
+static const cpr__clone_class _classes[] = {
+  { "Buffer", 0, 1 }, /* plain buffer */
+  { "ArrayBuffer", DUK_BUFOBJ_ARRAYBUFFER, 1 },
+  { "DataView", DUK_BUFOBJ_DATAVIEW, 1 },
+  { "Int8Array", DUK_BUFOBJ_INT8ARRAY, 1 },
+  { "Uint8Array", DUK_BUFOBJ_UINT8ARRAY, 1 },
+  { "Uint8ClampedArray", DUK_BUFOBJ_UINT8CLAMPEDARRAY, 1 },
+  { "Int16Array", DUK_BUFOBJ_INT16ARRAY, 2 },
+  { "Uint16Array", DUK_BUFOBJ_UINT16ARRAY, 2 },
+  { "Int32Array", DUK_BUFOBJ_INT32ARRAY, 4 },
+  { "Uint32Array", DUK_BUFOBJ_UINT32ARRAY, 4 },
+  { "Float32Array", DUK_BUFOBJ_FLOAT32ARRAY, 4 },
+  { "Float64Array", DUK_BUFOBJ_FLOAT64ARRAY, 8 },
+};
+
+#define CPR__CLONE_CLASS_COUNT ((int)(sizeof(_classes) / sizeof(_classes[0])))
+
+/* Hash table entry of the objects already cloned */
+typedef struct cpr__clone_ref {
+  void *ptr;
+  duk_uint32_t id;
+} cpr__clone_ref;
+
+typedef struct cpr__clone_writer {
+  duk_context *ctx;
+  duk_idx_t out_idx;          /* output (dynamic buffer) */
+  duk_size_t size;
+  duk_idx_t refs_idx;         /* hash table (fixed buffer) */
+  duk_uint32_t ref_count;
+  duk_uint32_t ref_capacity;  /* power of 2 */
+  duk_idx_t tostring_idx;     /* Object.prototype.toString */
+  duk_idx_t transfer_idx;
+  void **transfers;           /* heap pointers of the transferred ArrayBuffers */
+  duk_uint32_t transfer_count;
+  int depth;
+} cpr__clone_writer;
+
+typedef struct cpr__clone_reader {
+  duk_context *ctx;
+  cpr_clone_data *data;
+  duk_size_t pos;
+  duk_idx_t refs_idx;         /* array of the objects in clone order */
+  duk_uint32_t ref_count;
+  duk_idx_t transfers_idx;    /* adopted ArrayBuffers by transfer index */
+} cpr__clone_reader;
+
+/*
+ * Writer
+ */
+
+CPR_API_INTERN void cpr__clone_write(cpr__clone_writer *w, const void *src, duk_size_t len) {
+  duk_size_t capacity;
+  unsigned char *p = (unsigned char *)duk_get_buffer(w->ctx, w->out_idx, &capacity);
+
+  if (w->size + len > capacity) {
+    capacity = capacity * 2 > w->size + len ? capacity * 2 : w->size + len;
+    p = (unsigned char *)duk_resize_buffer(w->ctx, w->out_idx, capacity);
+  }
+  memcpy(p + w->size, src, len);
+  w->size += len;
+}
+
+CPR_API_INTERN void cpr__clone_write_tag(cpr__clone_writer *w, int tag) {
+  unsigned char c = (unsigned char)tag;
+  cpr__clone_write(w, &c, 1);
+}
+
+CPR_API_INTERN void cpr__clone_write_u32(cpr__clone_writer *w, duk_size_t value) {
+  duk_uint32_t v = (duk_uint32_t)value;
+  if (value >= CPR__CLONE_END_KEYS) {
+    duk_error(w->ctx, DUK_ERR_RANGE_ERROR, "value too large to be cloned");
+  }
+  cpr__clone_write(w, &v, sizeof(v));
+}
+
+CPR_API_INTERN duk_uint32_t cpr__clone_hash(void *ptr, duk_uint32_t capacity) {
+  return (duk_uint32_t)(((duk_size_t)ptr >> 3) * 2654435761U) & (capacity - 1);
+}
+
+/* Return the id of the object or -1 and add it to the table */
+CPR_API_INTERN long cpr__clone_find_ref(cpr__clone_writer *w, void *ptr) {
+  duk_context *ctx = w->ctx;
+  cpr__clone_ref *refs = (cpr__clone_ref *)duk_get_buffer(ctx, w->refs_idx, NULL);
+  duk_uint32_t i;
+
+  for (i = cpr__clone_hash(ptr, w->ref_capacity); refs[i].ptr; i = (i + 1) & (w->ref_capacity - 1)) {
+    if (refs[i].ptr == ptr) {
+      return (long)refs[i].id;
+    }
+  }
+  refs[i].ptr = ptr;
+  refs[i].id = w->ref_count++;
+
+  /* Keep the load factor under 1/2 */
+  if (w->ref_count * 2 > w->ref_capacity) {
+    duk_uint32_t j, capacity = w->ref_capacity * 2;
+    cpr__clone_ref *table = (cpr__clone_ref *)duk_push_fixed_buffer(ctx, capacity * sizeof(cpr__clone_ref));
+    for (j = 0; j < w->ref_capacity; ++j) {
+      if (refs[j].ptr) {
+        for (i = cpr__clone_hash(refs[j].ptr, capacity); table[i].ptr; i = (i + 1) & (capacity - 1));
+        table[i] = refs[j];
+      }
+    }
+    duk_replace(ctx, w->refs_idx);
+    w->ref_capacity = capacity;
+  }
+  return -1;
+}
+
+/* Return the class index of the buffer object at `idx` */
+CPR_API_INTERN int cpr__clone_buffer_class(cpr__clone_writer *w, duk_idx_t idx) {
+  duk_context *ctx = w->ctx;
+  const char *name;
+  int i;
+
+  duk_dup(ctx, w->tostring_idx);
+  duk_dup(ctx, idx);
+  duk_call_method(ctx, 0);
+  /* "[object Name]" */
+  name = duk_get_string(ctx, -1) + 8;
+  for (i = 1; i < CPR__CLONE_CLASS_COUNT; ++i) {
+    if (strncmp(name, _classes[i].name, strlen(_classes[i].name)) == 0 && name[strlen(_classes[i].name)] == ']') {
+      break;
+    }
+  }
+  duk_pop(ctx);
+  /* Other buffer objects (e.g. Duktape.Buffer) are cloned as plain buffers */
+  return i < CPR__CLONE_CLASS_COUNT ? i : CPR__CLONE_PLAIN_BUFFER;
+}
+
+CPR_API_INTERN int cpr__clone_is_date(cpr__clone_writer *w, duk_idx_t idx) {
+  int res;
+  duk_dup(w->ctx, w->tostring_idx);
+  duk_dup(w->ctx, idx);
+  duk_call_method(w->ctx, 0);
+  res = strcmp(duk_get_string(w->ctx, -1), "[object Date]") == 0;
+  duk_pop(w->ctx);
+  return res;
+}
+
+/* Return the index of the ArrayBuffer in the transfer list or -1 */
+CPR_API_INTERN long cpr__clone_find_transfer(cpr__clone_writer *w, void *ptr) {
+  duk_uint32_t i;
+  for (i = 0; i < w->transfer_count; ++i) {
+    if (w->transfers[i] == ptr) {
+      return (long)i;
+    }
+  }
+  return -1;
+}
+
+CPR_API_INTERN void cpr__clone_write_buffer(cpr__clone_writer *w, duk_idx_t idx) {
+  duk_context *ctx = w->ctx;
+  duk_size_t size;
+  void *data = duk_get_buffer_data(ctx, idx, &size);
+  int cls = duk_is_buffer(ctx, idx) ? CPR__CLONE_PLAIN_BUFFER : cpr__clone_buffer_class(w, idx);
+  long transfer = -1;
+
+  if (w->transfer_count && cls != CPR__CLONE_PLAIN_BUFFER) {
+    if (cls == CPR__CLONE_ARRAYBUFFER) {
+      transfer = cpr__clone_find_transfer(w, duk_get_heapptr(ctx, idx));
+    } else {
+      duk_get_prop_string(ctx, idx, "buffer");
+      transfer = cpr__clone_find_transfer(w, duk_get_heapptr(ctx, -1));
+      duk_pop(ctx);
+    }
+  }
+
+  if (transfer >= 0) {
+    unsigned char *base;
+    unsigned char c = (unsigned char)cls;
+    duk_get_prop_index(ctx, w->transfer_idx, (duk_uarridx_t)transfer);
+    duk_get_prop_string(ctx, -1, CPR__CLONE_DATA);
+    base = (unsigned char *)duk_get_pointer(ctx, -1);
+    duk_pop_2(ctx);
+    cpr__clone_write_tag(w, CPR__TAG_TRANSFER);
+    cpr__clone_write(w, &c, 1);
+    cpr__clone_write_u32(w, (duk_size_t)transfer);
+    cpr__clone_write_u32(w, (duk_size_t)((unsigned char *)data - base));
+    cpr__clone_write_u32(w, size);
+  } else {
+    unsigned char c = (unsigned char)cls;
+    cpr__clone_write_tag(w, CPR__TAG_BUFFER);
+    cpr__clone_write(w, &c, 1);
+    cpr__clone_write_u32(w, size);
+    if (size) {
+      cpr__clone_write(w, data, size);
+    }
+  }
+}
+
+CPR_API_INTERN void cpr__clone_write_value(cpr__clone_writer *w, duk_idx_t idx);
+
+CPR_API_INTERN void cpr__clone_write_object(cpr__clone_writer *w, duk_idx_t idx) {
+  duk_context *ctx = w->ctx;
+  duk_size_t i, len;
+  duk_uint32_t end;
+  long id;
+
+  if (duk_is_function(ctx, idx)) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "function can't be cloned");
+  }
+  if ((id = cpr__clone_find_ref(w, duk_get_heapptr(ctx, idx))) >= 0) {
+    cpr__clone_write_tag(w, CPR__TAG_REF);
+    cpr__clone_write_u32(w, (duk_size_t)id);
+    return;
+  }
+  if (++w->depth > CPR__CLONE_MAX_DEPTH) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "object nesting too deep to be cloned");
+  }
+
+  if (duk_is_buffer(ctx, idx) || duk_get_buffer_data(ctx, idx, NULL)) {
+    cpr__clone_write_buffer(w, idx);
+  } else if (duk_is_array(ctx, idx)) {
+    len = duk_get_length(ctx, idx);
+    cpr__clone_write_tag(w, CPR__TAG_ARRAY);
+    cpr__clone_write_u32(w, len);
+    for (i = 0; i < len; ++i) {
+      duk_get_prop_index(ctx, idx, (duk_uarridx_t)i);
+      cpr__clone_write_value(w, -1);
+      duk_pop(ctx);
+    }
+  } else if (cpr__clone_is_date(w, idx)) {
+    double time;
+    duk_get_prop_string(ctx, idx, "getTime");
+    duk_dup(ctx, idx);
+    duk_call_method(ctx, 0);
+    time = duk_get_number(ctx, -1);
+    duk_pop(ctx);
+    cpr__clone_write_tag(w, CPR__TAG_DATE);
+    cpr__clone_write(w, &time, sizeof(time));
+  } else {
+    /* Own enumerable properties */
+    cpr__clone_write_tag(w, CPR__TAG_OBJECT);
+    duk_enum(ctx, idx, DUK_ENUM_OWN_PROPERTIES_ONLY);
+    while (duk_next(ctx, -1, 1)) {
+      const char *key = duk_get_lstring(ctx, -2, &len);
+      cpr__clone_write_u32(w, len);
+      cpr__clone_write(w, key, len);
+      cpr__clone_write_value(w, -1);
+      duk_pop_2(ctx);
+    }
+    duk_pop(ctx);
+    /* The end marker is not a valid key length */
+    end = CPR__CLONE_END_KEYS;
+    cpr__clone_write(w, &end, sizeof(end));
+  }
+  --w->depth;
+}
+
+CPR_API_INTERN void cpr__clone_write_value(cpr__clone_writer *w, duk_idx_t idx) {
+  duk_context *ctx = w->ctx;
+  idx = duk_normalize_index(ctx, idx);
+
+  switch (duk_get_type(ctx, idx)) {
+    case DUK_TYPE_UNDEFINED:
+      cpr__clone_write_tag(w, CPR__TAG_UNDEFINED);
+      break;
+    case DUK_TYPE_NULL:
+      cpr__clone_write_tag(w, CPR__TAG_NULL);
+      break;
+    case DUK_TYPE_BOOLEAN:
+      cpr__clone_write_tag(w, duk_get_boolean(ctx, idx) ? CPR__TAG_TRUE : CPR__TAG_FALSE);
+      break;
+    case DUK_TYPE_NUMBER: {
+      double d = duk_get_number(ctx, idx);
+      cpr__clone_write_tag(w, CPR__TAG_NUMBER);
+      cpr__clone_write(w, &d, sizeof(d));
+      break;
+    }
+    case DUK_TYPE_STRING: {
+      duk_size_t len;
+      const char *str = duk_get_lstring(ctx, idx, &len);
+      cpr__clone_write_tag(w, CPR__TAG_STRING);
+      cpr__clone_write_u32(w, len);
+      cpr__clone_write(w, str, len);
+      break;
+    }
+    case DUK_TYPE_POINTER: {
+      void *ptr = duk_get_pointer(ctx, idx);
+      cpr__clone_write_tag(w, CPR__TAG_POINTER);
+      cpr__clone_write(w, &ptr, sizeof(ptr));
+      break;
+    }
+    case DUK_TYPE_OBJECT:
+    case DUK_TYPE_BUFFER:
+      cpr__clone_write_object(w, idx);
+      break;
+    default:
+      duk_error(ctx, DUK_ERR_TYPE_ERROR, "value can't be cloned");
+  }
+}
+
+CPR_API_EXTERN void cpr_clone_serialize(duk_context *ctx, duk_idx_t idx, duk_idx_t transfer_idx, cpr_clone_data *data) {
+  cpr__clone_writer w;
+  duk_uint32_t i;
+  duk_size_t capacity;
+
+  memset(data, 0, sizeof(cpr_clone_data));
+  memset(&w, 0, sizeof(w));
+  w.ctx = ctx;
+  idx = duk_require_normalize_index(ctx, idx);
+
+  /* Transferred ArrayBuffers */
+  if (transfer_idx != DUK_INVALID_INDEX && !duk_is_undefined(ctx, transfer_idx)) {
+    w.transfer_idx = duk_require_normalize_index(ctx, transfer_idx);
+    if (!duk_is_array(ctx, w.transfer_idx)) {
+      duk_error(ctx, DUK_ERR_TYPE_ERROR, "transfer list must be an array");
+    }
+    w.transfer_count = (duk_uint32_t)duk_get_length(ctx, w.transfer_idx);
+    w.transfers = (void **)duk_push_fixed_buffer(ctx, (w.transfer_count + 1) * sizeof(void *));
+    for (i = 0; i < w.transfer_count; ++i) {
+      duk_get_prop_index(ctx, w.transfer_idx, i);
+      duk_get_prop_string(ctx, -1, CPR__CLONE_DATA);
+      if (!duk_is_pointer(ctx, -1)) {
+        duk_error(ctx, DUK_ERR_TYPE_ERROR, "only transferable ArrayBuffers can be transferred");
+      }
+      if (duk_get_pointer(ctx, -1) == NULL) {
+        duk_error(ctx, DUK_ERR_TYPE_ERROR, "ArrayBuffer already transferred");
+      }
+      w.transfers[i] = duk_get_heapptr(ctx, -2);
+      if (cpr__clone_find_transfer(&w, w.transfers[i]) != (long)i) {
+        duk_error(ctx, DUK_ERR_TYPE_ERROR, "ArrayBuffer transferred twice");
+      }
+      duk_pop_2(ctx);
+    }
+  }
+
+  duk_push_dynamic_buffer(ctx, 256);
+  w.out_idx = duk_get_top_index(ctx);
+  w.ref_capacity = 64;
+  duk_push_fixed_buffer(ctx, w.ref_capacity * sizeof(cpr__clone_ref));
+  w.refs_idx = duk_get_top_index(ctx);
+  duk_get_global_string(ctx, "Object");
+  duk_get_prop_string(ctx, -1, "prototype");
+  duk_get_prop_string(ctx, -1, "toString");
+  duk_remove(ctx, -2);
+  duk_remove(ctx, -2);
+  w.tostring_idx = duk_get_top_index(ctx);
+
+  cpr__clone_write_value(&w, idx);
+
+  /* Serialization succeeded: detach the transferred buffers */
+  if (w.transfer_count) {
+    data->transfers = (void **)malloc(w.transfer_count * sizeof(void *));
+    data->transfer_sizes = (duk_size_t *)malloc(w.transfer_count * sizeof(duk_size_t));
+    if (data->transfers == NULL || data->transfer_sizes == NULL) {
+      free(data->transfers);
+      free(data->transfer_sizes);
+      memset(data, 0, sizeof(cpr_clone_data));
+      duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the transfer list");
+    }
+    for (i = 0; i < w.transfer_count; ++i) {
+      duk_get_prop_index(ctx, w.transfer_idx, i);
+      duk_get_prop_string(ctx, -1, CPR__CLONE_DATA);
+      data->transfers[i] = duk_get_pointer(ctx, -1);
+      duk_pop(ctx);
+      duk_get_prop_string(ctx, -1, CPR__CLONE_PLAIN);
+      duk_get_buffer(ctx, -1, &data->transfer_sizes[i]);
+      duk_config_buffer(ctx, -1, NULL, 0);
+      duk_pop(ctx);
+      duk_push_pointer(ctx, NULL);
+      duk_put_prop_string(ctx, -2, CPR__CLONE_DATA);
+      duk_pop(ctx);
+    }
+    data->transfer_count = (int)w.transfer_count;
+  }
+
+  data->data = (unsigned char *)duk_steal_buffer(ctx, w.out_idx, &capacity);
+  data->size = w.size;
+  duk_pop_n(ctx, w.transfer_count ? 4 : 3);
+}
+
+/*
+ * Reader
+ */
+
+CPR_API_INTERN const unsigned char *cpr__clone_read(cpr__clone_reader *r, duk_size_t len) {
+  const unsigned char *p = r->data->data + r->pos;
+  if (len > r->data->size - r->pos) {
+    duk_error(r->ctx, DUK_ERR_ERROR, "corrupted clone data");
+  }
+  r->pos += len;
+  return p;
+}
+
+CPR_API_INTERN duk_uint32_t cpr__clone_read_u32(cpr__clone_reader *r) {
+  duk_uint32_t v;
+  memcpy(&v, cpr__clone_read(r, sizeof(v)), sizeof(v));
+  return v;
+}
+
+CPR_API_INTERN void cpr__clone_add_ref(cpr__clone_reader *r) {
+  duk_dup_top(r->ctx);
+  duk_put_prop_index(r->ctx, r->refs_idx, r->ref_count++);
+}
+
+CPR_API_INTERN void cpr__clone_push_transfer(cpr__clone_reader *r, int cls) {
+  duk_context *ctx = r->ctx;
+  duk_uint32_t t = cpr__clone_read_u32(r);
+  duk_uint32_t offset = cpr__clone_read_u32(r);
+  duk_uint32_t len = cpr__clone_read_u32(r);
+
+  if ((int)t >= r->data->transfer_count || cls == CPR__CLONE_PLAIN_BUFFER) {
+    duk_error(ctx, DUK_ERR_ERROR, "corrupted clone data");
+  }
+  duk_get_prop_index(ctx, r->transfers_idx, t);
+  if (duk_is_undefined(ctx, -1)) {
+    duk_pop(ctx);
+    if (r->data->transfers[t] == NULL) {
+      duk_error(ctx, DUK_ERR_ERROR, "corrupted clone data");
+    }
+    cpr_clone_push_buffer(ctx, r->data->transfers[t], r->data->transfer_sizes[t]);
+    /* Owned by the heap */
+    r->data->transfers[t] = NULL;
+    duk_dup_top(ctx);
+    duk_put_prop_index(ctx, r->transfers_idx, t);
+  }
+  if ((duk_size_t)offset + len > r->data->transfer_sizes[t]) {
+    duk_error(ctx, DUK_ERR_ERROR, "corrupted clone data");
+  }
+  if (cls != CPR__CLONE_ARRAYBUFFER) {
+    /* View of the ArrayBuffer */
+    duk_get_global_string(ctx, _classes[cls].name);
+    duk_dup(ctx, -2);
+    duk_push_uint(ctx, offset);
+    duk_push_uint(ctx, (duk_uint_t)(len / _classes[cls].elem_size));
+    duk_new(ctx, 3);
+    duk_remove(ctx, -2);
+  }
+}
+
+CPR_API_INTERN void cpr__clone_read_value(cpr__clone_reader *r) {
+  duk_context *ctx = r->ctx;
+  int tag = *cpr__clone_read(r, 1);
+  duk_uint32_t i, len;
+
+  switch (tag) {
+    case CPR__TAG_UNDEFINED:
+      duk_push_undefined(ctx);
+      break;
+    case CPR__TAG_NULL:
+      duk_push_null(ctx);
+      break;
+    case CPR__TAG_TRUE:
+    case CPR__TAG_FALSE:
+      duk_push_boolean(ctx, tag == CPR__TAG_TRUE);
+      break;
+    case CPR__TAG_NUMBER: {
+      double d;
+      memcpy(&d, cpr__clone_read(r, sizeof(d)), sizeof(d));
+      duk_push_number(ctx, d);
+      break;
+    }
+    case CPR__TAG_STRING:
+      len = cpr__clone_read_u32(r);
+      duk_push_lstring(ctx, (const char *)cpr__clone_read(r, len), len);
+      break;
+    case CPR__TAG_POINTER: {
+      void *ptr;
+      memcpy(&ptr, cpr__clone_read(r, sizeof(ptr)), sizeof(ptr));
+      duk_push_pointer(ctx, ptr);
+      break;
+    }
+    case CPR__TAG_ARRAY:
+      len = cpr__clone_read_u32(r);
+      duk_push_array(ctx);
+      cpr__clone_add_ref(r);
+      for (i = 0; i < len; ++i) {
+        cpr__clone_read_value(r);
+        duk_put_prop_index(ctx, -2, i);
+      }
+      break;
+    case CPR__TAG_OBJECT:
+      duk_push_object(ctx);
+      cpr__clone_add_ref(r);
+      while ((len = cpr__clone_read_u32(r)) != CPR__CLONE_END_KEYS) {
+        duk_push_lstring(ctx, (const char *)cpr__clone_read(r, len), len);
+        cpr__clone_read_value(r);
+        duk_put_prop(ctx, -3);
+      }
+      break;
+    case CPR__TAG_DATE: {
+      double time;
+      memcpy(&time, cpr__clone_read(r, sizeof(time)), sizeof(time));
+      duk_get_global_string(ctx, "Date");
+      duk_push_number(ctx, time);
+      duk_new(ctx, 1);
+      cpr__clone_add_ref(r);
+      break;
+    }
+    case CPR__TAG_BUFFER: {
+      int cls = *cpr__clone_read(r, 1);
+      void *p;
+      if (cls >= CPR__CLONE_CLASS_COUNT) {
+        duk_error(ctx, DUK_ERR_ERROR, "corrupted clone data");
+      }
+      len = cpr__clone_read_u32(r);
+      p = duk_push_fixed_buffer(ctx, len);
+      if (len) {
+        memcpy(p, cpr__clone_read(r, len), len);
+      }
+      if (cls != CPR__CLONE_PLAIN_BUFFER) {
+        duk_push_buffer_object(ctx, -1, 0, len, _classes[cls].flags);
+        duk_remove(ctx, -2);
+      }
+      cpr__clone_add_ref(r);
+      break;
+    }
+    case CPR__TAG_TRANSFER: {
+      int cls = *cpr__clone_read(r, 1);
+      if (cls >= CPR__CLONE_CLASS_COUNT) {
+        duk_error(ctx, DUK_ERR_ERROR, "corrupted clone data");
+      }
+      cpr__clone_push_transfer(r, cls);
+      cpr__clone_add_ref(r);
+      break;
+    }
+    case CPR__TAG_REF:
+      i = cpr__clone_read_u32(r);
+      if (i >= r->ref_count) {
+        duk_error(ctx, DUK_ERR_ERROR, "corrupted clone data");
+      }
+      duk_get_prop_index(ctx, r->refs_idx, i);
+      break;
+    default:
+      duk_error(ctx, DUK_ERR_ERROR, "corrupted clone data");
+  }
+}
+
+CPR_API_EXTERN void cpr_clone_deserialize(duk_context *ctx, cpr_clone_data *data) {
+  cpr__clone_reader r;
+
+  memset(&r, 0, sizeof(r));
+  r.ctx = ctx;
+  r.data = data;
+  duk_push_array(ctx);
+  r.refs_idx = duk_get_top_index(ctx);
+  duk_push_array(ctx);
+  r.transfers_idx = duk_get_top_index(ctx);
+
+  cpr__clone_read_value(&r);
+  duk_insert(ctx, r.refs_idx);
+  duk_pop_2(ctx);
+}
+
+CPR_API_EXTERN void cpr_clone_free(cpr_clone_data *data) {
+  int i;
+  for (i = 0; i < data->transfer_count; ++i) {
+    free(data->transfers[i]);
+  }
+  free(data->transfers);
+  free(data->transfer_sizes);
+  free(data->data);
+  memset(data, 0, sizeof(cpr_clone_data));
+}
+
+/*
+ * Transferable ArrayBuffer
+ */
+
+CPR_API_INTERN duk_ret_t cpr__clone_finalizer(duk_context *ctx) {
+  void *ptr;
+
+  duk_get_prop_string(ctx, 0, CPR__CLONE_DATA);
+  ptr = duk_get_pointer(ctx, -1);
+  if (ptr) {
+    duk_get_prop_string(ctx, 0, CPR__CLONE_PLAIN);
+    if (duk_is_buffer(ctx, -1)) {
+      duk_config_buffer(ctx, -1, NULL, 0);
+    }
+    free(ptr);
+  }
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_clone_push_buffer(duk_context *ctx, void *ptr, duk_size_t size) {
+  if (ptr == NULL && (ptr = calloc(1, size ? size : 1)) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate %lu bytes", (unsigned long)size);
+  }
+  duk_push_external_buffer(ctx);
+  duk_config_buffer(ctx, -1, ptr, size);
+  duk_push_buffer_object(ctx, -1, 0, size, DUK_BUFOBJ_ARRAYBUFFER);
+  duk_swap_top(ctx, -2);
+  duk_put_prop_string(ctx, -2, CPR__CLONE_PLAIN);
+  duk_push_pointer(ctx, ptr);
+  duk_put_prop_string(ctx, -2, CPR__CLONE_DATA);
+  duk_push_c_function(ctx, cpr__clone_finalizer, 1);
+  duk_set_finalizer(ctx, -2);
+}
@@ -0,0 +1,61 @@
+/*
+ * cpr_clone.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_CLONE_H
+#define CPR_CLONE_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Structured clone.
+ * Serialize script values to pass them to another heap (e.g. a worker thread).
+ * Supported values are undefined, null, booleans, numbers, strings, pointers,
+ * arrays, plain objects (own enumerable properties), dates and buffers (plain
+ * buffers, ArrayBuffer, DataView and typed arrays). Cycles and shared
+ * references are preserved. Functions and other objects can't be cloned.
+ *
+ * Buffers are copied unless they are transferred. Only transferable
+ * ArrayBuffers (see `cpr_clone_push_buffer`) can be transferred: the ownership
+ * of their memory is moved to the message without copy and the buffer (and its
+ * views) is detached (zero length) in the sending heap.
+ *
+ * The heaps must use the default allocator (malloc/free).
+ */
+
+typedef struct cpr_clone_data {
+  unsigned char *data;
+  duk_size_t size;
+  /* Memory of the transferred buffers */
+  void **transfers;
+  duk_size_t *transfer_sizes;
+  int transfer_count;
+} cpr_clone_data;
+
+/* Serialize the value at `idx`. `transfer_idx` is an array of transferable
+ * ArrayBuffers or DUK_INVALID_INDEX. Throws a TypeError if a value can't be
+ * cloned. `cpr_clone_free` must be called to release `data`. */
+CPR_API_EXTERN void cpr_clone_serialize(duk_context *ctx, duk_idx_t idx, duk_idx_t transfer_idx, cpr_clone_data *data);
+/* Push the deserialized value. The transferred buffers are owned by the heap
+ * afterwards. `data` must still be released with `cpr_clone_free`. */
+CPR_API_EXTERN void cpr_clone_deserialize(duk_context *ctx, cpr_clone_data *data);
+/* Release the serialized data and the transferred buffers that were not
+ * deserialized */
+CPR_API_EXTERN void cpr_clone_free(cpr_clone_data *data);
+
+/* Push a transferable ArrayBuffer that owns `ptr` (allocated with malloc).
+ * The memory is freed when the ArrayBuffer is garbage collected. If `ptr` is
+ * NULL a zero filled buffer of `size` bytes is allocated. */
+CPR_API_EXTERN void cpr_clone_push_buffer(duk_context *ctx, void *ptr, duk_size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_CLONE_H */
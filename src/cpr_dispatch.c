@@ -0,0 +1,83 @@
+/*
+ * cpr_dispatch.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include "cpr_dispatch.h"
+#include "cpr_thread.h"
+
+typedef struct cpr__dispatcher {
+  cpr_dispatch_func func; /* NULL if removed while dispatching */
+  void *udata;
+} cpr__dispatcher;
+
+static cpr__dispatcher _dispatchers[CPR_DISPATCH_MAX];
+static int _count = 0;
+static int _depth = 0; /* nested cpr_dispatch calls */
+
+/* Drop the dispatchers removed while dispatching */
+CPR_API_INTERN void cpr__dispatch_compact() {
+  int i, n = 0;
+  for (i = 0; i < _count; ++i) {
+    if (_dispatchers[i].func) {
+      _dispatchers[n++] = _dispatchers[i];
+    }
+  }
+  _count = n;
+}
+
+CPR_API_EXTERN int cpr_dispatch_add(cpr_dispatch_func func, void *udata) {
+  if (_count == CPR_DISPATCH_MAX || !cpr_thread_is_main()) {
+    return -1;
+  }
+  _dispatchers[_count].func = func;
+  _dispatchers[_count].udata = udata;
+  ++_count;
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_dispatch_remove(cpr_dispatch_func func, void *udata) {
+  int i;
+  for (i = 0; i < _count; ++i) {
+    if (_dispatchers[i].func == func && _dispatchers[i].udata == udata) {
+      if (_depth > 0) {
+        _dispatchers[i].func = NULL;
+      } else {
+        _dispatchers[i] = _dispatchers[--_count];
+      }
+      return;
+    }
+  }
+}
+
+/* The dispatchers added while dispatching are called the next time */
+CPR_API_INTERN duk_ret_t cpr__dispatch_run(duk_context *ctx) {
+  int i;
+  for (i = _count - 1; i >= 0; --i) {
+    if (_dispatchers[i].func) {
+      _dispatchers[i].func(ctx, _dispatchers[i].udata);
+    }
+  }
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_dispatch(duk_context *ctx) {
+  int rc;
+  if (!cpr_thread_is_main()) {
+    return;
+  }
+  /* A dispatcher may remove itself or others: the removals are deferred
+   * until the outer call returns (or throws) */
+  ++_depth;
+  rc = duk_safe_call(ctx, cpr__dispatch_run, 0, 1);
+  if (--_depth == 0) {
+    cpr__dispatch_compact();
+  }
+  if (rc != DUK_EXEC_SUCCESS) {
+    duk_throw(ctx);
+  }
+  duk_pop(ctx);
+}
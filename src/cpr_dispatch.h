@@ -0,0 +1,41 @@
+/*
+ * cpr_dispatch.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_DISPATCH_H
+#define CPR_DISPATCH_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Deferred callbacks.
+ * Modules that complete work on other threads (e.g. the `fs` module) register
+ * a dispatcher that calls the script callbacks of the completed work.
+ * `cpr_dispatch` runs the dispatchers after the window events are polled
+ * (`glfw.pollEvents` and every `mainloop` iteration) so the callbacks are
+ * called at a well-defined point of the frame. Main thread only.
+ */
+
+#define CPR_DISPATCH_MAX 16
+
+/* Dispatchers may throw (the error is propagated to the caller of
+ * `cpr_dispatch`). `ctx` is the heap of the frame loop. */
+typedef void (*cpr_dispatch_func)(duk_context *ctx, void *udata);
+
+/* Return 0 on success or -1 if CPR_DISPATCH_MAX dispatchers are registered or
+ * if not called on the main thread */
+CPR_API_EXTERN int cpr_dispatch_add(cpr_dispatch_func func, void *udata);
+CPR_API_EXTERN void cpr_dispatch_remove(cpr_dispatch_func func, void *udata);
+CPR_API_EXTERN void cpr_dispatch(duk_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_DISPATCH_H */
@@ -6,6 +6,25 @@
 
 #include "cpr_duktape_helpers.h"
 
+#include <stdlib.h> /* qsort, bsearch */
+#include <string.h> /* strcmp, memset */
+
+/* Function list entries of the lazy functions accessor sorted by key (fixed
+ * buffer of entry pointers) */
+#define CPR__LAZY_FUNCS "\xff" "lazyFuncs"
+
+CPR_API_EXTERN void cpr_push_c_function_light(duk_context *ctx, duk_c_function func, duk_idx_t nargs, duk_int_t magic) {
+  if ((nargs == DUK_VARARGS || (nargs >= 0 && nargs <= CPR_LIGHTFUNC_MAX_NARGS)) &&
+      magic >= CPR_LIGHTFUNC_MIN_MAGIC && magic <= CPR_LIGHTFUNC_MAX_MAGIC) {
+    duk_push_c_lightfunc(ctx, func, nargs, nargs == DUK_VARARGS ? 0 : nargs, magic);
+  } else {
+    duk_push_c_function(ctx, func, nargs);
+    if (magic != 0) {
+      duk_set_magic(ctx, -1, magic);
+    }
+  }
+}
+
 CPR_API_EXTERN void cpr_put_function_list_magic(duk_context *ctx, duk_idx_t obj_index, const cpr_function_list_magic_entry *funcs) {
   const cpr_function_list_magic_entry *ent = funcs;
 
@@ -13,12 +32,133 @@ CPR_API_EXTERN void cpr_put_function_list_magic(duk_context *ctx, duk_idx_t obj_
 
   if (ent != NULL) {
     while (ent->key != NULL) {
-      duk_push_c_function(ctx, ent->value, ent->nargs);
-      if (ent->magic != 0) {
-        duk_set_magic(ctx, -1, ent->magic);
-      }
+      cpr_push_c_function_light(ctx, ent->value, ent->nargs, ent->magic);
       duk_put_prop_string(ctx, obj_index, ent->key);
       ent++;
     }
   }
 }
+
+CPR_API_EXTERN void cpr_put_function_list_light(duk_context *ctx, duk_idx_t obj_index, const duk_function_list_entry *funcs) {
+  const duk_function_list_entry *ent = funcs;
+
+  obj_index = duk_require_normalize_index(ctx, obj_index);
+
+  if (ent != NULL) {
+    while (ent->key != NULL) {
+      cpr_push_c_function_light(ctx, ent->value, ent->nargs, 0);
+      duk_put_prop_string(ctx, obj_index, ent->key);
+      ent++;
+    }
+  }
+}
+
+CPR_API_INTERN int cpr__lazy_compare(const void *a, const void *b) {
+  return strcmp((*(const duk_function_list_entry * const *)a)->key,
+                (*(const duk_function_list_entry * const *)b)->key);
+}
+
+CPR_API_INTERN int cpr__lazy_compare_key(const void *key, const void *ent) {
+  return strcmp(key, (*(const duk_function_list_entry * const *)ent)->key);
+}
+
+/* Accessor of the lazy functions: getter (key) and setter (value, key).
+ * Replace the accessor property with the function (or the value set). */
+CPR_API_INTERN duk_ret_t cpr__lazy_accessor(duk_context *ctx) {
+  const duk_function_list_entry **ent = NULL, **sorted;
+  duk_idx_t key_idx = duk_get_top(ctx) > 1 ? 1 : 0;
+  duk_size_t size;
+
+  duk_require_string(ctx, key_idx);
+  if (key_idx == 1) {
+    duk_dup(ctx, 0);
+  } else {
+    duk_push_current_function(ctx);
+    duk_get_prop_string(ctx, -1, CPR__LAZY_FUNCS);
+    /* Once for every function used */
+    if ((sorted = duk_get_buffer(ctx, -1, &size)) != NULL) {
+      ent = bsearch(duk_get_string(ctx, key_idx), sorted, size / sizeof(*sorted), sizeof(*sorted), cpr__lazy_compare_key);
+    }
+    if (ent == NULL) {
+      return 0;
+    }
+    cpr_push_c_function_light(ctx, (*ent)->value, (*ent)->nargs, 0);
+  }
+  duk_push_this(ctx);
+  duk_dup(ctx, key_idx);
+  duk_dup(ctx, -3);
+  duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE |
+      DUK_DEFPROP_HAVE_WRITABLE | DUK_DEFPROP_WRITABLE |
+      DUK_DEFPROP_HAVE_ENUMERABLE | DUK_DEFPROP_ENUMERABLE |
+      DUK_DEFPROP_HAVE_CONFIGURABLE | DUK_DEFPROP_CONFIGURABLE);
+  duk_pop(ctx); /* this */
+  return 1;
+}
+
+CPR_API_EXTERN void cpr_put_function_list_lazy(duk_context *ctx, duk_idx_t obj_index, const duk_function_list_entry *funcs) {
+  const duk_function_list_entry *ent = funcs, **sorted;
+  duk_size_t count = 0, i;
+
+  obj_index = duk_require_normalize_index(ctx, obj_index);
+
+  if (ent != NULL) {
+    /* A single accessor function for all the functions. The entries are
+     * sorted for the lookups (the modules list them by topic). */
+    duk_push_c_function(ctx, cpr__lazy_accessor, DUK_VARARGS);
+    while (funcs[count].key != NULL) {
+      ++count;
+    }
+    sorted = duk_push_fixed_buffer(ctx, count * sizeof(*sorted));
+    for (i = 0; i < count; ++i) {
+      sorted[i] = &funcs[i];
+    }
+    if (count > 1) {
+      qsort(sorted, count, sizeof(*sorted), cpr__lazy_compare);
+    }
+    duk_put_prop_string(ctx, -2, CPR__LAZY_FUNCS);
+    while (ent->key != NULL) {
+      duk_push_string(ctx, ent->key);
+      duk_dup(ctx, -2); /* getter */
+      duk_dup(ctx, -3); /* setter */
+      duk_def_prop(ctx, obj_index, DUK_DEFPROP_HAVE_GETTER | DUK_DEFPROP_HAVE_SETTER |
+          DUK_DEFPROP_HAVE_ENUMERABLE | DUK_DEFPROP_ENUMERABLE |
+          DUK_DEFPROP_HAVE_CONFIGURABLE | DUK_DEFPROP_CONFIGURABLE);
+      ent++;
+    }
+    duk_pop(ctx); /* accessor */
+  }
+}
+
+CPR_API_EXTERN int cpr_is_lazy_accessor(duk_context *ctx, duk_idx_t idx) {
+  int lazy = 0;
+  if (duk_is_c_function(ctx, idx)) {
+    lazy = duk_get_prop_string(ctx, idx, CPR__LAZY_FUNCS);
+    duk_pop(ctx);
+  }
+  return lazy;
+}
+
+CPR_API_EXTERN void cpr_push_module_exports(duk_context *ctx) {
+  if (duk_get_top(ctx) > 0 && duk_is_object(ctx, 0)) {
+    duk_dup(ctx, 0);
+  } else {
+    duk_push_object(ctx);
+  }
+}
+
+CPR_API_EXTERN void *cpr_get_heap_state(duk_context *ctx, const char *key, duk_size_t size) {
+  void *state;
+
+  duk_push_global_stash(ctx);
+  if (duk_get_prop_string(ctx, -1, key)) {
+    state = duk_require_buffer(ctx, -1, NULL);
+  } else {
+    duk_pop(ctx);
+    state = duk_push_fixed_buffer(ctx, size);
+    memset(state, 0, size);
+    duk_dup_top(ctx);
+    duk_put_prop_string(ctx, -3, key);
+  }
+  duk_pop_2(ctx);
+  return state;
+}
@@ -25,7 +25,44 @@ struct cpr_function_list_magic_entry {
 };
 
 typedef struct cpr_function_list_magic_entry cpr_function_list_magic_entry;
+
+/* Lightweight functions (lightfuncs) limits */
+#define CPR_LIGHTFUNC_MAX_NARGS 14
+#define CPR_LIGHTFUNC_MIN_MAGIC (-128)
+#define CPR_LIGHTFUNC_MAX_MAGIC 127
+
+/* Push a C function as a lightfunc (no heap object) if `nargs` and `magic`
+ * fit the lightfunc limits or as a regular function otherwise. Lightfuncs
+ * can't have properties: don't use them for functions that need any (e.g.
+ * constructors with a prototype). */
+CPR_API_EXTERN void cpr_push_c_function_light(duk_context *ctx, duk_c_function func, duk_idx_t nargs, duk_int_t magic);
+/* The functions are registered as lightfuncs where possible */
 CPR_API_EXTERN void cpr_put_function_list_magic(duk_context *ctx, duk_idx_t obj_index, const cpr_function_list_magic_entry *funcs);
+/* `duk_put_function_list` registering lightfuncs where possible */
+CPR_API_EXTERN void cpr_put_function_list_light(duk_context *ctx, duk_idx_t obj_index, const duk_function_list_entry *funcs);
+
+/* Lazy registration of a module functions. Every function of the list is
+ * defined as an accessor property and the function (a lightfunc if possible)
+ * is only created (and the accessor replaced with it) on the first property
+ * access (binary search of the key). `funcs` must outlive the object (static
+ * table). */
+CPR_API_EXTERN void cpr_put_function_list_lazy(duk_context *ctx, duk_idx_t obj_index, const duk_function_list_entry *funcs);
+/* Return true if the value at `idx` is the accessor of a lazy function. It
+ * creates the function when called with the property key (`this` receives
+ * the function property). */
+CPR_API_EXTERN int cpr_is_lazy_accessor(duk_context *ctx, duk_idx_t idx);
+
+/* Push the object a module init function (`dukopen_*`) must populate: the
+ * `exports` object passed by the module loader (first argument) or a new
+ * object if none is passed. Returning the loader's object avoids copying the
+ * module properties to `exports`. */
+CPR_API_EXTERN void cpr_push_module_exports(duk_context *ctx);
+
+/* Return the module state `key` of the heap: `size` bytes zeroed when first
+ * used and freed with the heap (fixed buffer in the global stash). The
+ * module libraries outlive the heaps (worker heaps, `--worker` runs) so
+ * their statics must not hold per-heap state. */
+CPR_API_EXTERN void *cpr_get_heap_state(duk_context *ctx, const char *key, duk_size_t size);
 
 #ifdef __cplusplus
 }
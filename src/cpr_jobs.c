@@ -0,0 +1,487 @@
+/*
+ * cpr_jobs.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdlib.h> /* malloc, calloc, realloc, free */
+
+#include "cpr_jobs.h"
+#include "cpr_thread.h"
+
+#define CPR__JOBS_MAX_THREADS   64
+#define CPR__JOBS_DEQUE_SIZE    64    /* initial capacity (power of 2) */
+#define CPR__JOBS_RANGES        4     /* parallel-for ranges per thread */
+
+/* Job pointer of the script handles */
+#define CPR__JOBS_HANDLE        "\xff" "cprJob"
+
+#if defined(_MSC_VER)
+#define CPR__THREAD_LOCAL __declspec(thread)
+#else
+#define CPR__THREAD_LOCAL __thread
+#endif
+
+typedef struct cpr__job_link {
+  cpr_job *job;
+  struct cpr__job_link *next;
+} cpr__job_link;
+
+struct cpr_job {
+  cpr_job_func func;
+  cpr_job_range_func range_func;
+  void *data;
+  int begin;                  /* range (parallel-for) */
+  int end;
+  int grain;
+  cpr_job *parent;            /* parallel-for job of a range */
+  volatile long unfinished;   /* the job or its unfinished ranges */
+  volatile long pending;      /* unfinished dependencies + 1 until submitted */
+  volatile long refs;
+  volatile long done;
+  int submitted;
+  cpr__job_link *dependents;  /* protected by `_mutex` */
+};
+
+/* Ready jobs. The owner pushes and pops at the bottom and the other threads
+ * steal at the top. */
+typedef struct cpr__deque {
+  cpr_mutex mutex;
+  cpr_job **jobs;             /* ring buffer */
+  long capacity;              /* power of 2 */
+  long top;
+  long bottom;
+} cpr__deque;
+
+/* 0 stopped, 1 starting, 2 started */
+static volatile long _state = 0;
+static int _requested = 0;
+static int _count = 0;
+static cpr_thread _threads[CPR__JOBS_MAX_THREADS];
+/* One deque per worker and one for the other threads */
+static cpr__deque _deques[CPR__JOBS_MAX_THREADS + 1];
+static volatile long _queued = 0;
+static volatile long _sleeping = 0;
+static int _quit = 0;
+static cpr_mutex _mutex;
+static cpr_cond _work_cond;   /* jobs queued or quit */
+static cpr_cond _done_cond;   /* a job is done */
+static CPR__THREAD_LOCAL int _worker = -1;
+
+CPR_API_INTERN void cpr__jobs_start();
+CPR_API_INTERN void cpr__job_execute(cpr_job *job);
+CPR_API_INTERN void cpr__job_finish(cpr_job *job);
+
+/*
+ * Deques
+ */
+
+CPR_API_INTERN void cpr__deque_push(cpr__deque *d, cpr_job *job) {
+  cpr_mutex_lock(&d->mutex);
+  if (d->bottom - d->top == d->capacity) {
+    /* Grow and unwrap the ring buffer */
+    long i, capacity = d->capacity * 2;
+    cpr_job **jobs = malloc(capacity * sizeof(cpr_job *));
+    if (jobs == NULL) {
+      cpr_mutex_unlock(&d->mutex);
+      /* Out of memory: run the job now */
+      cpr__job_execute(job);
+      return;
+    }
+    for (i = d->top; i < d->bottom; ++i) {
+      jobs[i - d->top] = d->jobs[i & (d->capacity - 1)];
+    }
+    free(d->jobs);
+    d->jobs = jobs;
+    d->bottom -= d->top;
+    d->top = 0;
+    d->capacity = capacity;
+  }
+  d->jobs[d->bottom & (d->capacity - 1)] = job;
+  d->bottom++;
+  cpr_mutex_unlock(&d->mutex);
+  cpr_atomic_add(&_queued, 1);
+}
+
+CPR_API_INTERN cpr_job *cpr__deque_pop(cpr__deque *d) {
+  cpr_job *job = NULL;
+  cpr_mutex_lock(&d->mutex);
+  if (d->bottom > d->top) {
+    job = d->jobs[--d->bottom & (d->capacity - 1)];
+  }
+  cpr_mutex_unlock(&d->mutex);
+  return job;
+}
+
+CPR_API_INTERN cpr_job *cpr__deque_steal(cpr__deque *d) {
+  cpr_job *job = NULL;
+  cpr_mutex_lock(&d->mutex);
+  if (d->bottom > d->top) {
+    job = d->jobs[d->top++ & (d->capacity - 1)];
+  }
+  cpr_mutex_unlock(&d->mutex);
+  return job;
+}
+
+/* Deque of the calling thread */
+CPR_API_INTERN int cpr__jobs_deque() {
+  return _worker >= 0 ? _worker : _count;
+}
+
+/* Pop a job from the own deque or steal one */
+CPR_API_INTERN cpr_job *cpr__jobs_find(int self) {
+  cpr_job *job;
+  int i;
+
+  if (cpr_atomic_get(&_queued) == 0) {
+    return NULL;
+  }
+  job = cpr__deque_pop(&_deques[self]);
+  for (i = 1; job == NULL && i <= _count; ++i) {
+    job = cpr__deque_steal(&_deques[(self + i) % (_count + 1)]);
+  }
+  if (job) {
+    cpr_atomic_add(&_queued, -1);
+  }
+  return job;
+}
+
+CPR_API_INTERN void cpr__jobs_wake() {
+  if (cpr_atomic_get(&_sleeping) > 0) {
+    cpr_mutex_lock(&_mutex);
+    cpr_cond_broadcast(&_work_cond);
+    cpr_mutex_unlock(&_mutex);
+  }
+}
+
+/*
+ * Jobs
+ */
+
+CPR_API_INTERN void cpr__job_execute(cpr_job *job) {
+  if (job->range_func) {
+    job->range_func(job->data, job->begin, job->end);
+  } else if (job->func) {
+    job->func(job->data);
+  }
+  cpr__job_finish(job);
+}
+
+/* Queue a job whose dependencies are done */
+CPR_API_INTERN void cpr__job_schedule(cpr_job *job) {
+  cpr__deque *d = &_deques[cpr__jobs_deque()];
+  int i, n, grain, threads;
+
+  if (job->range_func == NULL || job->parent) {
+    cpr__deque_push(d, job);
+    cpr__jobs_wake();
+    return;
+  }
+
+  /* Split the parallel-for in ranges */
+  if (job->end <= 0) {
+    cpr__job_finish(job);
+    return;
+  }
+  threads = _count + 1;
+  grain = job->grain > 0 ? job->grain : (job->end + threads * CPR__JOBS_RANGES - 1) / (threads * CPR__JOBS_RANGES);
+  grain = grain > 0 ? grain : 1;
+  n = (job->end + grain - 1) / grain;
+  job->unfinished = n;
+  for (i = 0; i < n; ++i) {
+    cpr_job *range = calloc(1, sizeof(cpr_job));
+    int begin = i * grain, end = begin + grain < job->end ? begin + grain : job->end;
+    if (range == NULL) {
+      /* Out of memory: run the range now */
+      job->range_func(job->data, begin, end);
+      cpr__job_finish(job);
+      continue;
+    }
+    range->range_func = job->range_func;
+    range->data = job->data;
+    range->begin = begin;
+    range->end = end;
+    range->parent = job;
+    range->unfinished = 1;
+    range->refs = 1;
+    cpr__deque_push(d, range);
+  }
+  cpr__jobs_wake();
+}
+
+CPR_API_INTERN void cpr__job_finish(cpr_job *job) {
+  cpr__job_link *link, *next;
+  cpr_job *parent = job->parent;
+
+  if (cpr_atomic_add(&job->unfinished, -1) != 0) {
+    return;
+  }
+  if (parent) {
+    /* Range of a parallel-for */
+    free(job);
+    cpr__job_finish(parent);
+    return;
+  }
+
+  cpr_mutex_lock(&_mutex);
+  cpr_atomic_add(&job->done, 1);
+  link = job->dependents;
+  job->dependents = NULL;
+  cpr_cond_broadcast(&_done_cond);
+  cpr_mutex_unlock(&_mutex);
+
+  for (; link; link = next) {
+    next = link->next;
+    if (cpr_atomic_add(&link->job->pending, -1) == 0) {
+      cpr__job_schedule(link->job);
+    }
+    cpr_job_release(link->job);
+    free(link);
+  }
+  /* Reference taken by `cpr_job_submit` */
+  cpr_job_release(job);
+}
+
+CPR_API_EXTERN cpr_job *cpr_job_create(cpr_job_func func, void *data) {
+  cpr_job *job = calloc(1, sizeof(cpr_job));
+  if (job) {
+    job->func = func;
+    job->data = data;
+    job->unfinished = 1;
+    job->pending = 1;
+    job->refs = 1;
+  }
+  return job;
+}
+
+CPR_API_EXTERN cpr_job *cpr_job_create_for(int count, int grain, cpr_job_range_func func, void *data) {
+  cpr_job *job = cpr_job_create(NULL, data);
+  if (job) {
+    job->range_func = func;
+    job->end = count;
+    job->grain = grain;
+  }
+  return job;
+}
+
+CPR_API_EXTERN int cpr_job_depends(cpr_job *job, cpr_job *dependency) {
+  cpr__job_link *link;
+
+  cpr__jobs_start();
+  cpr_mutex_lock(&_mutex);
+  if (!dependency->done) {
+    if ((link = malloc(sizeof(cpr__job_link))) == NULL) {
+      cpr_mutex_unlock(&_mutex);
+      return -1;
+    }
+    cpr_job_retain(job);
+    cpr_atomic_add(&job->pending, 1);
+    link->job = job;
+    link->next = dependency->dependents;
+    dependency->dependents = link;
+  }
+  cpr_mutex_unlock(&_mutex);
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_job_submit(cpr_job *job) {
+  cpr__jobs_start();
+  job->submitted = 1;
+  cpr_job_retain(job);
+  if (cpr_atomic_add(&job->pending, -1) == 0) {
+    cpr__job_schedule(job);
+  }
+}
+
+CPR_API_EXTERN int cpr_job_is_done(cpr_job *job) {
+  return cpr_atomic_get(&job->done) != 0;
+}
+
+CPR_API_EXTERN void cpr_job_wait(cpr_job *job) {
+  int self = cpr__jobs_deque();
+  cpr_job *other;
+
+  while (!cpr_job_is_done(job)) {
+    if ((other = cpr__jobs_find(self)) != NULL) {
+      cpr__job_execute(other);
+      continue;
+    }
+    /* The remaining jobs are running on other threads. Time out to help
+     * with the jobs they queue. */
+    cpr_mutex_lock(&_mutex);
+    if (!job->done) {
+      cpr_cond_timedwait(&_done_cond, &_mutex, 0.001);
+    }
+    cpr_mutex_unlock(&_mutex);
+  }
+}
+
+CPR_API_EXTERN void cpr_job_retain(cpr_job *job) {
+  cpr_atomic_add(&job->refs, 1);
+}
+
+CPR_API_EXTERN void cpr_job_release(cpr_job *job) {
+  if (job && cpr_atomic_add(&job->refs, -1) == 0) {
+    free(job);
+  }
+}
+
+CPR_API_EXTERN void cpr_jobs_parallel_for(int count, int grain, cpr_job_range_func func, void *data) {
+  cpr_job *job = cpr_job_create_for(count, grain, func, data);
+  if (job == NULL) {
+    func(data, 0, count);
+    return;
+  }
+  cpr_job_submit(job);
+  cpr_job_wait(job);
+  cpr_job_release(job);
+}
+
+/*
+ * Workers
+ */
+
+CPR_API_INTERN void cpr__jobs_worker(void *arg) {
+  cpr_job *job;
+  int quit = 0;
+
+  _worker = (int)(size_t)arg;
+  while (!quit) {
+    if ((job = cpr__jobs_find(_worker)) != NULL) {
+      cpr__job_execute(job);
+      continue;
+    }
+    cpr_mutex_lock(&_mutex);
+    cpr_atomic_add(&_sleeping, 1);
+    while (cpr_atomic_get(&_queued) == 0 && !_quit) {
+      cpr_cond_wait(&_work_cond, &_mutex);
+    }
+    cpr_atomic_add(&_sleeping, -1);
+    /* Run the queued jobs before quitting */
+    quit = _quit && cpr_atomic_get(&_queued) == 0;
+    cpr_mutex_unlock(&_mutex);
+  }
+}
+
+CPR_API_INTERN void cpr__jobs_start() {
+  int i;
+
+  if (cpr_atomic_get(&_state) == 2) {
+    return;
+  }
+  if (!cpr_atomic_cas(&_state, 0, 1)) {
+    /* Started by another thread */
+    while (cpr_atomic_get(&_state) != 2);
+    return;
+  }
+
+  cpr_mutex_init(&_mutex);
+  cpr_cond_init(&_work_cond);
+  cpr_cond_init(&_done_cond);
+  _quit = 0;
+  _count = cpr_jobs_thread_count();
+  for (i = 0; i <= _count; ++i) {
+    cpr_mutex_init(&_deques[i].mutex);
+    _deques[i].capacity = CPR__JOBS_DEQUE_SIZE;
+    _deques[i].jobs = malloc(CPR__JOBS_DEQUE_SIZE * sizeof(cpr_job *));
+    _deques[i].top = _deques[i].bottom = 0;
+  }
+  for (i = 0; i < _count; ++i) {
+    if (cpr_thread_create(&_threads[i], cpr__jobs_worker, (void *)(size_t)i) != 0) {
+      break;
+    }
+  }
+  /* Threads that failed to start leave their deque to the others */
+  _count = i;
+  cpr_atomic_add(&_state, 1);
+}
+
+CPR_API_EXTERN void cpr_jobs_shutdown() {
+  int i;
+
+  if (!cpr_atomic_cas(&_state, 2, 1)) {
+    return;
+  }
+  cpr_mutex_lock(&_mutex);
+  _quit = 1;
+  cpr_cond_broadcast(&_work_cond);
+  cpr_mutex_unlock(&_mutex);
+  for (i = 0; i < _count; ++i) {
+    cpr_thread_join(_threads[i]);
+  }
+  /* No worker started: run the remaining jobs */
+  if (_count == 0) {
+    cpr_job *job;
+    while ((job = cpr__jobs_find(0)) != NULL) {
+      cpr__job_execute(job);
+    }
+  }
+  for (i = 0; i <= _count; ++i) {
+    cpr_mutex_destroy(&_deques[i].mutex);
+    free(_deques[i].jobs);
+    _deques[i].jobs = NULL;
+  }
+  cpr_cond_destroy(&_work_cond);
+  cpr_cond_destroy(&_done_cond);
+  cpr_mutex_destroy(&_mutex);
+  _count = 0;
+  cpr_atomic_add(&_state, -1);
+}
+
+CPR_API_EXTERN void cpr_jobs_set_thread_count(int count) {
+  cpr_jobs_shutdown();
+  _requested = count < 0 ? 0 : count;
+}
+
+CPR_API_EXTERN int cpr_jobs_thread_count() {
+  int count;
+
+  if (cpr_atomic_get(&_state) == 2) {
+    return _count;
+  }
+  count = _requested > 0 ? _requested : cpr_thread_cpu_count() - 1;
+  count = count > 0 ? count : 1;
+  return count < CPR__JOBS_MAX_THREADS ? count : CPR__JOBS_MAX_THREADS;
+}
+
+/*
+ * Script handles
+ */
+
+CPR_API_INTERN duk_ret_t cpr__jobs_handle_finalizer(duk_context *ctx) {
+  cpr_job *job;
+
+  duk_get_prop_string(ctx, 0, CPR__JOBS_HANDLE);
+  if ((job = duk_get_pointer(ctx, -1)) != NULL) {
+    if (job->submitted) {
+      cpr_job_wait(job);
+    }
+    cpr_job_release(job);
+  }
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_jobs_push_handle(duk_context *ctx, cpr_job *job) {
+  duk_push_object(ctx);
+  cpr_job_retain(job);
+  duk_push_pointer(ctx, job);
+  duk_put_prop_string(ctx, -2, CPR__JOBS_HANDLE);
+  duk_push_c_function(ctx, cpr__jobs_handle_finalizer, 1);
+  duk_set_finalizer(ctx, -2);
+}
+
+CPR_API_EXTERN cpr_job *cpr_jobs_require_handle(duk_context *ctx, duk_idx_t idx) {
+  cpr_job *job = NULL;
+
+  if (duk_is_object(ctx, idx)) {
+    duk_get_prop_string(ctx, idx, CPR__JOBS_HANDLE);
+    job = duk_get_pointer(ctx, -1);
+    duk_pop(ctx);
+  }
+  if (job == NULL) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "job handle expected");
+  }
+  return job;
+}
@@ -0,0 +1,81 @@
+/*
+ * cpr_jobs.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_JOBS_H
+#define CPR_JOBS_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Job system.
+ * A pool of worker threads shared by the native modules. Every worker owns a
+ * deque of ready jobs: it pushes and pops its own jobs at the bottom and
+ * steals from the top of the other deques when its deque is empty. Jobs
+ * submitted from other threads go to the deque of the submitting thread
+ * (one shared deque for all the non worker threads).
+ *
+ * Jobs can depend on other jobs (graphs) and parallel-for jobs are split in
+ * ranges run in parallel. A thread waiting for a job runs other jobs until it
+ * is done. Job functions must not call Duktape.
+ *
+ * The scheduler starts on the first submitted job with the number of worker
+ * threads set by `cpr_jobs_set_thread_count` (`--jobs` command line option)
+ * or the number of cores minus one.
+ */
+
+typedef struct cpr_job cpr_job;
+
+typedef void (*cpr_job_func)(void *data);
+/* Process the items [begin, end) */
+typedef void (*cpr_job_range_func)(void *data, int begin, int end);
+
+/* 0 (default) uses the number of cores minus one. Restarts the workers if the
+ * scheduler is running. */
+CPR_API_EXTERN void cpr_jobs_set_thread_count(int count);
+/* Number of worker threads (started or not) */
+CPR_API_EXTERN int cpr_jobs_thread_count();
+/* Wait for the workers to finish their jobs and stop them */
+CPR_API_EXTERN void cpr_jobs_shutdown();
+
+/* Create a job. The job is not scheduled until it's submitted and all its
+ * dependencies are done. The returned reference must be released with
+ * `cpr_job_release`. Return NULL if out of memory. */
+CPR_API_EXTERN cpr_job *cpr_job_create(cpr_job_func func, void *data);
+/* Create a parallel-for job that calls `func` for ranges of at most `grain`
+ * items of [0, count). If `grain` is 0 the ranges are sized so every thread
+ * gets a few of them. */
+CPR_API_EXTERN cpr_job *cpr_job_create_for(int count, int grain, cpr_job_range_func func, void *data);
+/* `job` is run after `dependency` is done. Must be called before `job` is
+ * submitted. Return -1 if out of memory. */
+CPR_API_EXTERN int cpr_job_depends(cpr_job *job, cpr_job *dependency);
+CPR_API_EXTERN void cpr_job_submit(cpr_job *job);
+CPR_API_EXTERN int cpr_job_is_done(cpr_job *job);
+/* Run other jobs until `job` is done */
+CPR_API_EXTERN void cpr_job_wait(cpr_job *job);
+CPR_API_EXTERN void cpr_job_retain(cpr_job *job);
+CPR_API_EXTERN void cpr_job_release(cpr_job *job);
+
+/* Create, submit and wait for a parallel-for job. Runs `func` on the calling
+ * thread if the job can't be created. */
+CPR_API_EXTERN void cpr_jobs_parallel_for(int count, int grain, cpr_job_range_func func, void *data);
+
+/* Push a script handle of `job` (see the `jobs` module). The handle keeps a
+ * reference to the job and waits for the job when it's garbage collected so
+ * the values referenced by the handle (e.g. buffers stored in its properties)
+ * outlive the job. */
+CPR_API_EXTERN void cpr_jobs_push_handle(duk_context *ctx, cpr_job *job);
+/* Return the job of the handle at `idx` or throw a TypeError */
+CPR_API_EXTERN cpr_job *cpr_jobs_require_handle(duk_context *ctx, duk_idx_t idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_JOBS_H */
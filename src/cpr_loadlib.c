@@ -12,16 +12,56 @@
 
 #include "cpr_config.h"
 
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* strlen, strcmp, strrchr, strncpy, memcpy */
+
 #include "duktape.h"
 #include "cpr_loadlib.h"
 #include "cpr_macros.h"
+#include "cpr_sys_tools.h"
+#include "cpr_thread.h"
 
 #define CPR_OPEN_PREFIX "dukopen_"
-#define CPR_OPEN_PREFIX_LEN (sizeof(INIT_PREFIX)-1)
-
+#define CPR_OPEN_PREFIX_LEN (sizeof(CPR_OPEN_PREFIX)-1)
+/* Libraries loaded by the heap in the global stash (filename -> { id, exports }) */
+#define CPR__LOADLIB_CACHE "cprLibs"
+/* References held by the heap in the global stash (filename -> count). Unloaded
+ * libraries are still referenced until the heap is destroyed. */
+#define CPR__LOADLIB_HELD "cprLibsHeld"
+#define CPR__LOADLIB_ERROR_SIZE 256
+
+/* Loaded library. The libraries are shared by the heaps of the process. */
+typedef struct cpr__lib {
+  char *filename;
+  void *handle;
+  char *sym;              /* init function name */
+  duk_c_function init;
+  int refcount;           /* heaps using the library */
+  struct cpr__lib *next;
+} cpr__lib;
+
+/* References of a heap returned by cpr_loadlib_detach (NULL terminated) */
+typedef struct cpr__lib_ref {
+  cpr__lib *lib;
+  int count;
+} cpr__lib_ref;
+
+static cpr__lib *_libs = NULL;
+static cpr_mutex _mutex;
+static volatile long _mutex_state = 0; /* 0: none, 1: initializing, 2: ready */
+
+/* The platform functions don't call Duktape: they run under the registry
+ * lock. The system error (if any) is copied to `error`. */
 CPR_API_INTERN void cpr_close_lib(void *handle);
-CPR_API_INTERN void *cpr_open_lib(duk_context *ctx, const char *filename);
-CPR_API_INTERN duk_c_function cpr_load_sym(duk_context *ctx, void *handle, const char *sym);
+CPR_API_INTERN void *cpr_open_lib(const char *filename, char *error, size_t size);
+CPR_API_INTERN duk_c_function cpr_load_sym(void *handle, const char *sym, char *error, size_t size);
+
+CPR_API_INTERN void cpr__lib_error(char *error, size_t size, const char *msg) {
+  if (msg) {
+    strncpy(error, msg, size - 1);
+    error[size - 1] = '\0';
+  }
+}
 
 #if defined(CPR_USE_DLOPEN)
 
@@ -33,7 +73,7 @@ CPR_API_INTERN void cpr_close_lib(void *handle) {
   }
 }
 
-CPR_API_INTERN void *cpr_open_lib(duk_context *ctx, const char *filename) {
+CPR_API_INTERN void *cpr_open_lib(const char *filename, char *error, size_t size) {
   void *handle = NULL;
   /*
    * RTLD_NOW: all undefined symbols in the library are resolved before dlopen returns
@@ -53,24 +93,16 @@ CPR_API_INTERN void *cpr_open_lib(duk_context *ctx, const char *filename) {
 
   handle = dlopen(filename, RTLD_NOW | RTLD_GLOBAL);
   if (!handle) {
-    /* Low level error is logged and a custom error message is returned so we
-     * can look for the same message on every platform (mainly for testing purpose). */
-    ERR(ctx, "%s", dlerror());
-    duk_push_sprintf(ctx, "Cannot open shared library '%s'", filename);
+    cpr__lib_error(error, size, dlerror());
   }
 
   return handle;
 }
 
-CPR_API_INTERN duk_c_function cpr_load_sym(duk_context *ctx, void *handle, const char *sym) {
+CPR_API_INTERN duk_c_function cpr_load_sym(void *handle, const char *sym, char *error, size_t size) {
   duk_c_function func = NULL;
   char *errmsg = NULL;
 
-  if (handle == NULL) {
-    duk_push_string(ctx, "Invalid library handle (NULL)");
-    return NULL;
-  }
-
   /* Clear any existing previous error */
   dlerror();
 #if defined(__GNUC__)
@@ -82,8 +114,7 @@ CPR_API_INTERN duk_c_function cpr_load_sym(duk_context *ctx, void *handle, const
   func = (duk_c_function) dlsym(handle, sym);
 #endif
   if ((errmsg = dlerror()) != NULL)  {
-    ERR(ctx, "%s", errmsg);
-    duk_push_sprintf(ctx, "Cannot find symbol '%s'", sym);
+    cpr__lib_error(error, size, errmsg);
     return NULL;
   }
   return func;
@@ -101,112 +132,304 @@ CPR_API_INTERN void cpr_close_lib(void *handle) {
   }
 }
 
-CPR_API_INTERN void *cpr_open_lib(duk_context *ctx, const char *filename) {
-  HMODULE handle = NULL;
+CPR_API_INTERN void *cpr_open_lib(const char *filename, char *error, size_t size) {
+  /* TODO copy the system error */
+  (void)error;
+  (void)size;
+  return LoadLibraryA(filename);
+}
 
-  if ((handle = LoadLibraryA(filename)) == NULL) {
-    /* TODO log system error */
-    duk_push_sprintf(ctx, "Cannot open shared library '%s'", filename);
+CPR_API_INTERN duk_c_function cpr_load_sym(void *handle, const char *sym, char *error, size_t size) {
+  /* TODO copy the system error */
+  (void)error;
+  (void)size;
+  return (duk_c_function)GetProcAddress((HMODULE)handle, sym);
+}
+
+#else
+#error Dynamic library loading not supported on this platform
+#endif
+
+/* The mutex is initialized by the first caller (the heaps of the worker
+ * threads may load libraries concurrently) */
+CPR_API_INTERN void cpr__lib_lock() {
+  if (cpr_atomic_get(&_mutex_state) != 2) {
+    if (cpr_atomic_cas(&_mutex_state, 0, 1)) {
+      cpr_mutex_init(&_mutex);
+      cpr_atomic_cas(&_mutex_state, 1, 2);
+    } else {
+      while (cpr_atomic_get(&_mutex_state) != 2);
+    }
   }
-  return handle;
+  cpr_mutex_lock(&_mutex);
 }
 
-CPR_API_INTERN duk_c_function cpr_load_sym(duk_context *ctx, void *handle, const char *sym) {
-  duk_c_function func = NULL;
+CPR_API_INTERN void cpr__lib_unlock() {
+  cpr_mutex_unlock(&_mutex);
+}
 
-  if (handle == NULL) {
-    duk_push_string(ctx, "Invalid library handle (NULL)");
-    return NULL;
+CPR_API_INTERN cpr__lib **cpr__lib_find(const char *filename) {
+  cpr__lib **lib = &_libs;
+  while (*lib && strcmp((*lib)->filename, filename) != 0) {
+    lib = &(*lib)->next;
   }
+  return lib;
+}
 
-  if ((func = (duk_c_function)GetProcAddress((HMODULE)handle, sym)) == NULL)  {
-    /* TODO log system error */
-    duk_push_sprintf(ctx, "Cannot find symbol '%s'", sym);
-    return NULL;
+CPR_API_INTERN void cpr__lib_free(cpr__lib **plib) {
+  cpr__lib *lib = *plib;
+  *plib = lib->next;
+  cpr_close_lib(lib->handle);
+  free(lib->filename);
+  free(lib->sym);
+  free(lib);
+}
+
+/* Get the init function of the library. The library is opened and the
+ * symbol resolved only if not already done by a heap. On error the error
+ * message is pushed and NULL is returned. */
+CPR_API_INTERN duk_c_function cpr__lib_acquire(duk_context *ctx, const char *filename, const char *sym) {
+  cpr__lib **plib, *lib;
+  duk_c_function init = NULL;
+  void *handle = NULL;
+  char error[CPR__LOADLIB_ERROR_SIZE];
+
+  error[0] = '\0';
+  cpr__lib_lock();
+  plib = cpr__lib_find(filename);
+  if (*plib == NULL) {
+    if ((handle = cpr_open_lib(filename, error, sizeof(error))) == NULL) {
+      goto finished;
+    }
+    if ((lib = calloc(1, sizeof(cpr__lib))) == NULL ||
+        (lib->filename = cpr_strdup(filename)) == NULL) {
+      free(lib);
+      cpr_close_lib(handle);
+      handle = NULL;
+      goto finished;
+    }
+    lib->handle = handle;
+    *plib = lib;
   }
-  return func;
+  lib = *plib;
+  handle = lib->handle;
+  if (lib->sym && strcmp(lib->sym, sym) == 0) {
+    init = lib->init;
+  } else if ((init = cpr_load_sym(lib->handle, sym, error, sizeof(error))) != NULL) {
+    free(lib->sym);
+    lib->sym = cpr_strdup(sym);
+    lib->init = lib->sym ? init : NULL;
+  }
+  if (init) {
+    ++lib->refcount;
+  } else if (lib->refcount == 0) {
+    cpr__lib_free(plib);
+  }
+
+finished:
+  cpr__lib_unlock();
+  if (init == NULL) {
+    /* Low level error is logged and a custom error message is returned so we
+     * can look for the same message on every platform (mainly for testing purpose). */
+    if (error[0]) {
+      ERR(ctx, "%s", error);
+    }
+    if (handle == NULL) {
+      duk_push_sprintf(ctx, "Cannot open shared library '%s'", filename);
+    } else {
+      duk_push_sprintf(ctx, "Cannot find symbol '%s'", sym);
+    }
+  }
+  return init;
 }
 
-#else
-#error Dynamic library loading not supported on this platform
-#endif
+/* Push a stash object of the heap (created on first use) */
+CPR_API_INTERN void cpr__lib_push_stash(duk_context *ctx, const char *key) {
+  duk_push_global_stash(ctx);
+  if (!duk_get_prop_string(ctx, -1, key)) {
+    duk_pop(ctx);
+    duk_push_object(ctx);
+    duk_dup_top(ctx);
+    duk_put_prop_string(ctx, -3, key);
+  }
+  duk_remove(ctx, -2);
+}
 
-/* Check if the module `mod_id` is already loaded. */
-CPR_API_INTERN duk_ret_t cpr_is_mod_loaded(duk_context *ctx, const char *mod_id) {
-  duk_ret_t rc = 0;
-  duk_get_global_string(ctx, "Duktape");
-  duk_get_prop_string(ctx, -1, "modLoaded");
-  duk_push_string(ctx, mod_id);
-  rc = duk_has_prop(ctx, -2);
-  duk_pop_2(ctx);
+/* Push the libraries loaded by the heap */
+CPR_API_INTERN void cpr__lib_push_cache(duk_context *ctx) {
+  cpr__lib_push_stash(ctx, CPR__LOADLIB_CACHE);
+}
 
-  return rc;
+/* Count a reference of the heap to the acquired library */
+CPR_API_INTERN void cpr__lib_hold(duk_context *ctx, const char *filename) {
+  cpr__lib_push_stash(ctx, CPR__LOADLIB_HELD);
+  duk_get_prop_string(ctx, -1, filename);
+  duk_push_int(ctx, duk_get_int(ctx, -1) + 1);
+  duk_put_prop_string(ctx, -3, filename);
+  duk_pop_2(ctx);
 }
 
-/* Low level library loading */
+/* Low level library loading. A library already loaded by the heap returns
+ * the same exports. Libraries loaded by another heap are not opened again.
+ * @params filename, id, [exports] (object passed to the init function) */
 /* TODO don't prefix the open lib function name */
 CPR_API_EXTERN duk_ret_t cpr_loadlib(duk_context *ctx) {
-  void *lib = NULL;
   const char *dot = NULL;
   const char *filename = NULL;
   const char *id = NULL;
-  // const char *modid = NULL;
-  duk_size_t len = 0;
+  size_t len = 0;
   duk_c_function init_func = NULL;
+  int has_exports = duk_get_top(ctx) > 2;
+  char *sym;
 
   filename = duk_require_string(ctx, 0);
   id = duk_require_string(ctx, 1);
 
   DBG(ctx, "cpr_loadlib: id: '%s' filename '%s'", id, filename);
 
-  if (cpr_is_mod_loaded(ctx, id) == 1) {
-    WRN(ctx, "FIXME - Module already loaded: '%s'", id);
-    /* FIXME Checking it modLoaded has the property `filename` is not
-     * enough because:
-     * 1: the module id must be extract from the path
-     * 2: the property already exists when the require handler is called
-     */
-  }
-
-  if ((lib = cpr_open_lib(ctx, filename)) == NULL) {
-    goto error;
+  cpr__lib_push_cache(ctx);
+  duk_get_prop_string(ctx, -1, filename);
+  if (duk_is_object(ctx, -1)) {
+    DBG(ctx, "Library already loaded '%s'", filename);
+    duk_get_prop_string(ctx, -1, "exports");
+    return 1;
   }
+  duk_pop(ctx);
 
   if ((dot = strrchr(id, '.')) == NULL) {
     len = strlen(id);
   } else {
     len = dot - id;
   }
-  duk_push_string(ctx, CPR_OPEN_PREFIX);
-  duk_push_lstring(ctx, id, len);
-  duk_concat(ctx, 2);
-  if ((init_func = cpr_load_sym(ctx, lib, duk_get_string(ctx, -1))) == NULL) {
+  if ((sym = malloc(CPR_OPEN_PREFIX_LEN + len + 1)) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "Cannot load library '%s'", filename);
+  }
+  memcpy(sym, CPR_OPEN_PREFIX, CPR_OPEN_PREFIX_LEN);
+  memcpy(sym + CPR_OPEN_PREFIX_LEN, id, len);
+  sym[CPR_OPEN_PREFIX_LEN + len] = '\0';
+  init_func = cpr__lib_acquire(ctx, filename, sym);
+  free(sym);
+  if (init_func == NULL) {
     /* TODO test error */
-    goto error;
+    duk_error(ctx, 1, "%s", duk_get_string(ctx, -1));
   }
-  duk_pop(ctx);
-  /* Call the module's init function */
-  duk_push_c_function(ctx, init_func, 0);
-  if (duk_pcall(ctx, 0) != DUK_EXEC_SUCCESS ) {
+  /* Held even if the init function fails: it may have created objects */
+  cpr__lib_hold(ctx, filename);
+  /* Call the module's init function with the `exports` object to populate
+   * (undefined if not passed) */
+  duk_push_c_function(ctx, init_func, 1);
+  if (has_exports) {
+    duk_dup(ctx, 2);
+  } else {
+    duk_push_undefined(ctx);
+  }
+  if (duk_pcall(ctx, 1) != DUK_EXEC_SUCCESS ) {
     /* TODO test error */
-    goto err_rethrow;
+    duk_throw(ctx);
   }
+  duk_push_object(ctx);
+  duk_dup(ctx, 1);
+  duk_put_prop_string(ctx, -2, "id");
+  duk_dup(ctx, -2);
+  duk_put_prop_string(ctx, -2, "exports");
+  duk_put_prop_string(ctx, -3, filename);
   return 1; /* Return the module init function result */
+}
 
-error:
-  cpr_close_lib(lib);
-  duk_error(ctx, 1, duk_get_string(ctx, -1));
-  return 0; /* Not reachable */
+/* Unload a library loaded by the heap. The module is removed from
+ * `Duktape.modLoaded` so the next require calls the init function again. The
+ * objects created by the library (functions, accessors, finalizers) may still
+ * be referenced by the heap so the library is only released when the heap is
+ * destroyed.
+ * @params filename
+ * @return true if the library was loaded by the heap */
+CPR_API_EXTERN duk_ret_t cpr_unloadlib(duk_context *ctx) {
+  const char *filename = duk_require_string(ctx, 0);
+
+  cpr__lib_push_cache(ctx);
+  duk_get_prop_string(ctx, -1, filename);
+  if (!duk_is_object(ctx, -1)) {
+    duk_push_false(ctx);
+    return 1;
+  }
+  duk_get_global_string(ctx, "Duktape");
+  duk_get_prop_string(ctx, -1, "modLoaded");
+  duk_get_prop_string(ctx, -3, "id");
+  duk_del_prop(ctx, -2);
+  duk_pop_3(ctx);
+  duk_del_prop_string(ctx, -1, filename);
+  duk_push_true(ctx);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr__lib_detach(duk_context *ctx) {
+  cpr__lib_ref *refs;
+  cpr__lib **plib;
+  duk_size_t count = 0;
+
+  cpr__lib_push_stash(ctx, CPR__LOADLIB_HELD);
+  duk_enum(ctx, -1, DUK_ENUM_OWN_PROPERTIES_ONLY);
+  while (duk_next(ctx, -1, 0)) {
+    ++count;
+    duk_pop(ctx);
+  }
+  duk_pop(ctx);
+  refs = duk_push_fixed_buffer(ctx, (count + 1) * sizeof(cpr__lib_ref));
+  count = 0;
+  duk_enum(ctx, -2, DUK_ENUM_OWN_PROPERTIES_ONLY);
+  while (duk_next(ctx, -1, 1)) {
+    cpr__lib_lock();
+    plib = cpr__lib_find(duk_get_string(ctx, -2));
+    if (*plib) {
+      refs[count].lib = *plib;
+      refs[count++].count = duk_get_int(ctx, -1);
+    }
+    cpr__lib_unlock();
+    duk_pop_2(ctx);
+  }
+  refs[count].lib = NULL;
+  duk_pop(ctx);
+  return 1;
+}
 
-err_rethrow:
-  cpr_close_lib(lib);
-  duk_throw(ctx);
-  return 0; /* Not reachable */
+CPR_API_EXTERN void *cpr_loadlib_detach(duk_context *ctx) {
+  cpr__lib_ref *refs = NULL;
+  duk_size_t size;
+  void *buf;
+
+  if (duk_safe_call(ctx, cpr__lib_detach, 0, 1) == DUK_EXEC_SUCCESS) {
+    buf = duk_get_buffer(ctx, -1, &size);
+    if ((refs = malloc(size)) != NULL) {
+      memcpy(refs, buf, size);
+    }
+  }
+  duk_pop(ctx);
+  return refs;
+}
+
+CPR_API_EXTERN void cpr_loadlib_release(void *libs) {
+  cpr__lib_ref *ref;
+  cpr__lib **plib;
+
+  if (libs == NULL) {
+    return;
+  }
+  cpr__lib_lock();
+  for (ref = libs; ref->lib; ++ref) {
+    ref->lib->refcount -= ref->count;
+    if (ref->lib->refcount <= 0) {
+      for (plib = &_libs; *plib != ref->lib; plib = &(*plib)->next);
+      cpr__lib_free(plib);
+    }
+  }
+  cpr__lib_unlock();
+  free(libs);
 }
 
 CPR_API_EXTERN duk_ret_t dukopen_loadlib(duk_context *ctx) {
   const duk_function_list_entry module_funcs[] = {
-    { "loadlib", cpr_loadlib, 2 },
+    { "loadlib", cpr_loadlib, DUK_VARARGS },
+    { "unloadlib", cpr_unloadlib, 1 },
     { NULL, NULL, 0 }
   };
   duk_push_object(ctx);  /* module result */
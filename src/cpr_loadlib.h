@@ -15,7 +15,21 @@ extern "C" {
 #endif
 
 CPR_API_EXTERN duk_ret_t dukopen_loadlib(duk_context *ctx);
+/* Load a C module library: [ filename id (exports) ] -> [ exports ]. The
+ * libraries are opened once per process and the exports created once per
+ * heap. The optional `exports` object is passed to the init function (see
+ * cpr_push_module_exports). */
 CPR_API_EXTERN duk_ret_t cpr_loadlib(duk_context *ctx);
+/* Unload a library loaded by the heap: [ filename ] -> [ unloaded ]. The
+ * library stays open until the heap is destroyed: a rebuilt library is only
+ * loaded once no heap uses the previous one. */
+CPR_API_EXTERN duk_ret_t cpr_unloadlib(duk_context *ctx);
+/* Return the library references of the heap to pass to cpr_loadlib_release
+ * once the heap is destroyed (see cpr_destroy_context). */
+CPR_API_EXTERN void *cpr_loadlib_detach(duk_context *ctx);
+/* Release the references returned by cpr_loadlib_detach. The libraries not
+ * used by any heap are closed. */
+CPR_API_EXTERN void cpr_loadlib_release(void *libs);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,117 @@
+/*
+ * cpr_native.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* strcmp */
+
+#include "cpr_native.h"
+#include "cpr_macros.h"
+#include "cpr_duktape_helpers.h"
+
+/* Internal slot of the handles (native record pointer) */
+#define CPR__NATIVE_PTR "\xff" "native"
+/* Shared handles in the global stash ("<type>:<pointer>" -> handle) */
+#define CPR__NATIVE_SHARED "cprNativeShared"
+
+CPR_API_INTERN duk_ret_t cpr__native_finalizer(duk_context *ctx) {
+  cpr_native *n;
+
+  duk_get_prop_string(ctx, 0, CPR__NATIVE_PTR);
+  if ((n = duk_get_pointer(ctx, -1)) != NULL) {
+    cpr_native_destroy(n);
+    free(n);
+    duk_push_pointer(ctx, NULL);
+    duk_put_prop_string(ctx, 0, CPR__NATIVE_PTR);
+  }
+  return 0;
+}
+
+CPR_API_EXTERN cpr_native *cpr_native_push(duk_context *ctx, const cpr_native_type *type, void *ptr, void *state) {
+  cpr_native *n;
+
+  duk_push_object(ctx);
+  if ((n = malloc(sizeof(cpr_native))) == NULL) {
+    if (type->finalize) {
+      type->finalize(ptr, state);
+    }
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate %s handle", type->name);
+  }
+  n->type = type;
+  n->ptr = ptr;
+  n->state = state;
+  n->handle = duk_get_heapptr(ctx, -1);
+  duk_push_pointer(ctx, n);
+  duk_put_prop_string(ctx, -2, CPR__NATIVE_PTR);
+  cpr_push_c_function_light(ctx, cpr__native_finalizer, 1, 0);
+  duk_set_finalizer(ctx, -2);
+  return n;
+}
+
+CPR_API_EXTERN void cpr_native_push_handle(duk_context *ctx, cpr_native *n) {
+  duk_push_heapptr(ctx, n->handle);
+}
+
+CPR_API_EXTERN void cpr_native_push_shared(duk_context *ctx, const cpr_native_type *type, void *ptr) {
+  if (ptr == NULL) {
+    duk_push_null(ctx);
+    return;
+  }
+  duk_push_global_stash(ctx);
+  if (!duk_get_prop_string(ctx, -1, CPR__NATIVE_SHARED)) {
+    duk_pop(ctx);
+    duk_push_object(ctx);
+    duk_dup_top(ctx);
+    duk_put_prop_string(ctx, -3, CPR__NATIVE_SHARED);
+  }
+  duk_push_sprintf(ctx, "%s:%p", type->name, ptr);
+  if (!duk_get_prop(ctx, -2)) {
+    duk_pop(ctx);
+    cpr_native_push(ctx, type, ptr, NULL);
+    duk_push_sprintf(ctx, "%s:%p", type->name, ptr);
+    duk_dup(ctx, -2);
+    duk_put_prop(ctx, -4);
+  }
+  duk_replace(ctx, -3);
+  duk_pop(ctx);
+}
+
+CPR_API_EXTERN cpr_native *cpr_native_require(duk_context *ctx, duk_idx_t idx, const char *name) {
+  cpr_native *n = NULL;
+
+  if (duk_is_object(ctx, idx)) {
+    duk_get_prop_string(ctx, idx, CPR__NATIVE_PTR);
+    n = duk_get_pointer(ctx, -1);
+    duk_pop(ctx);
+  }
+  if (n == NULL || (n->type->name != name && strcmp(n->type->name, name) != 0)) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s handle expected", name);
+  }
+  if (n->ptr == NULL) {
+    duk_error(ctx, DUK_ERR_ERROR, "%s was destroyed", name);
+  }
+  return n;
+}
+
+CPR_API_EXTERN cpr_native *cpr_native_get(duk_context *ctx, duk_idx_t idx, const char *name) {
+  return duk_is_null_or_undefined(ctx, idx) ? NULL : cpr_native_require(ctx, idx, name);
+}
+
+CPR_API_EXTERN void cpr_native_destroy(cpr_native *n) {
+  void *ptr = n->ptr;
+  void *state = cpr_native_invalidate(n);
+  if (ptr && n->type->finalize) {
+    n->type->finalize(ptr, state);
+  }
+}
+
+CPR_API_EXTERN void *cpr_native_invalidate(cpr_native *n) {
+  void *state = n->state;
+  n->ptr = NULL;
+  n->state = NULL;
+  return state;
+}
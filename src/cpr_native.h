@@ -0,0 +1,67 @@
+/*
+ * cpr_native.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_NATIVE_H
+#define CPR_NATIVE_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Typed handles to native objects.
+ * A handle is a script object wrapping a native pointer, the type of the
+ * pointer and optional per-object native state (e.g. the callbacks of a
+ * window) in an internal slot. The bindings get the pointer and its state in
+ * a single property lookup and a handle of another type or of a destroyed
+ * object raises an error instead of passing a dangling pointer to the native
+ * library. When the handle is garbage collected the type finalizer releases
+ * the object and its state unless it was destroyed explicitly before.
+ *
+ * Types are compared by name so a module can check the handles created by
+ * another module (e.g. GLFW windows in mainloop.run). */
+
+typedef struct cpr_native_type {
+  const char *name;
+  /* Release the native object and its state (may be NULL) */
+  void (*finalize)(void *ptr, void *state);
+} cpr_native_type;
+
+typedef struct cpr_native {
+  const cpr_native_type *type;
+  void *ptr;    /* NULL once destroyed */
+  void *state;
+  void *handle; /* Handle heap pointer (borrowed) */
+} cpr_native;
+
+/* Push a new handle for `ptr`. Return its native record. */
+CPR_API_EXTERN cpr_native *cpr_native_push(duk_context *ctx, const cpr_native_type *type, void *ptr, void *state);
+/* Push the handle of a live native record (e.g. in a native callback) */
+CPR_API_EXTERN void cpr_native_push_handle(duk_context *ctx, cpr_native *n);
+/* Push the unique handle of an object owned by the native library (e.g. a
+ * monitor), creating it on first use. Shared handles live as long as the heap
+ * (their type usually has no finalizer). Push null if `ptr` is NULL. */
+CPR_API_EXTERN void cpr_native_push_shared(duk_context *ctx, const cpr_native_type *type, void *ptr);
+/* Return the native record of the handle at `idx`. Throw a TypeError if the
+ * value isn't a handle of type `name` or an Error if the object was
+ * destroyed. */
+CPR_API_EXTERN cpr_native *cpr_native_require(duk_context *ctx, duk_idx_t idx, const char *name);
+/* Same as cpr_native_require but return NULL if the value is null or
+ * undefined */
+CPR_API_EXTERN cpr_native *cpr_native_get(duk_context *ctx, duk_idx_t idx, const char *name);
+/* Finalize the object now: its handle becomes stale */
+CPR_API_EXTERN void cpr_native_destroy(cpr_native *n);
+/* Mark the object destroyed without finalizing it (e.g. freed by the native
+ * library). The state is returned to the caller. */
+CPR_API_EXTERN void *cpr_native_invalidate(cpr_native *n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_NATIVE_H */
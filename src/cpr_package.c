@@ -11,7 +11,14 @@
 #include "cpr_error.h"
 #include "cpr_macros.h"
 #include "cpr_loadlib.h"
+#include "cpr_trace.h"
+#include "cpr_bindings.h"
+#include "cpr_watch.h"
+#include "cpr_build.h"
+#include "cpr_preload.h"
+#include "cpr_builtin.h"
 
+#include <stdio.h>  /* fopen */
 #include <stdlib.h> /* getenv */
 
 #define CPR__PATH_SEPARATOR ';' /* Path separator used in the CPR_PATH environment variable */
@@ -29,26 +36,19 @@
 #define CPR__MODULE_EXT ".so"
 #endif
 
-/* Look up for a file using the search paths (package.paths). Return `undefined`
- * if the file is not found.
- */
-CPR_API_INTERN duk_ret_t cpr__search_path(duk_context *ctx) {
-  const char *filename = NULL;
-  if (duk_is_null_or_undefined(ctx, -1)) {
-    duk_push_undefined(ctx);
-    return 1;
-  }
+/* Search path set on the command line (--path), tried first */
+static const char *_path = NULL;
 
-  filename = duk_require_string(ctx, -1);
+CPR_API_EXTERN int cpr_package_search(duk_context *ctx, const char *filename) {
   /* return filename if absolute path */
   if (cpr_file_is_absolute(filename)) {
     CPR__DLOG("path is absolute '%s'", filename);
     if (cpr_file_exists(filename)) {
       duk_push_string(ctx, filename);
-    } else {
-      duk_push_undefined(ctx);
+      return 1;
     }
-    return 1;
+    duk_push_undefined(ctx);
+    return 0;
   }
 
   duk_get_global_string(ctx, CPR_PACKAGE_NAME);
@@ -56,27 +56,127 @@ CPR_API_INTERN duk_ret_t cpr__search_path(duk_context *ctx) {
   duk_enum(ctx, -1, DUK_ENUM_ARRAY_INDICES_ONLY);
   while (duk_next(ctx, -1, 1)) {
     duk_push_string(ctx, CPR__FILE_SYSTEM_SEPARATOR);
-    duk_dup(ctx, 0);
+    duk_push_string(ctx, filename);
     duk_concat(ctx, 3);
     if (cpr_file_exists(duk_get_string(ctx, -1))) {
       DBG(ctx, "Found file '%s'", duk_get_string(ctx, -1));
+      duk_replace(ctx, -5); /* package */
+      duk_pop_3(ctx); /* key, paths enum */
       return 1;
     }
     DBG(ctx, "No file '%s'", duk_get_string(ctx, -1));
     duk_pop_2(ctx); /* pop key and value */
   }
   duk_pop_3(ctx); /* package paths enum */
-  ERR(ctx, "Module '%s' not found", filename);
   duk_push_undefined(ctx);
+  return 0;
+}
+
+/* Look up for a file using the search paths (package.paths). Return `undefined`
+ * if the file is not found.
+ */
+CPR_API_INTERN duk_ret_t cpr__search_path(duk_context *ctx) {
+  const char *filename = NULL;
+  if (duk_is_null_or_undefined(ctx, -1)) {
+    duk_push_undefined(ctx);
+    return 1;
+  }
+
+  filename = duk_require_string(ctx, -1);
+  if (!cpr_package_search(ctx, filename) && !cpr_file_is_absolute(filename)) {
+    ERR(ctx, "Module '%s' not found", filename);
+  }
   return 1;
 }
 
+/* Push the module bytecode compiled ahead of time (see cpr_build.h) if it
+ * matches the module source. Return 1 if the bytecode was pushed. The source
+ * is only read (and hashed) if the module has a bytecode file. */
+CPR_API_INTERN int cpr__push_bytecode(duk_context *ctx, const char *filename) {
+  char *source = NULL, *data = NULL;
+  const char *bytecode = NULL;
+  size_t source_size = 0, size = 0, bytecode_size = 0;
+
+  duk_push_string(ctx, filename);
+  duk_push_string(ctx, CPR_BYTECODE_EXT);
+  duk_concat(ctx, 2);
+  if ((data = cpr_build_read_file(duk_get_string(ctx, -1), &size)) != NULL &&
+      (source = cpr_build_read_file(filename, &source_size)) != NULL) {
+    bytecode = cpr_build_check_bytecode(source, source_size, data, size, &bytecode_size);
+  }
+  duk_pop(ctx);
+  if (bytecode) {
+    memcpy(duk_push_fixed_buffer(ctx, (duk_size_t)bytecode_size), bytecode, bytecode_size);
+  }
+  free(data);
+  free(source);
+  return bytecode != NULL;
+}
+
+/* Run the module bytecode at the stack top and replace it with undefined
+ * (the module is already evaluated). */
+CPR_API_INTERN void cpr__run_bytecode(duk_context *ctx) {
+  duk_load_function(ctx);
+  /* Same call as the Duktape module loader: this = exports */
+  duk_dup(ctx, 2);
+  duk_dup(ctx, 1);
+  duk_dup(ctx, 2);
+  duk_dup(ctx, 3);
+  duk_call_method(ctx, 3);
+  duk_pop(ctx);
+  duk_push_undefined(ctx);
+}
+
+/* Export the C module init function result at the stack top and replace it
+ * with undefined (no source code) */
+CPR_API_INTERN void cpr__export_module(duk_context *ctx) {
+  cpr_bindings_wrap(ctx, -1, duk_get_string(ctx, 0));
+  /* The init function populated the `exports` table passed as argument
+   * (see cpr_push_module_exports) */
+  if (!duk_strict_equals(ctx, -1, 2)) {
+    /* Otherwise the init function returned (pushed) a new object with the
+    * exported functions/properties. Those exported functions are then copied
+    * to the `exports` table so they are available outside the C module.
+    */
+    duk_enum(ctx, -1, DUK_ENUM_INCLUDE_NONENUMERABLE | DUK_ENUM_OWN_PROPERTIES_ONLY | DUK_ENUM_INCLUDE_INTERNAL);
+    while (duk_next(ctx, -1 /*enum_index*/, 1 /*get_value*/)) {
+      duk_put_prop(ctx, 2); /* `exports` table is the third parameters (at idx 2 on the stack) */
+    }
+    duk_pop(ctx); /* pop enum object */
+  }
+  duk_pop(ctx); /* pop module result */
+  duk_push_undefined(ctx); /* Return undefined because no source code. */
+}
+
+/* Return the open function if the module `id` is linked in the runtime. The
+ * module file extension is optional. */
+CPR_API_INTERN duk_c_function cpr__find_builtin(const char *id) {
+  size_t len = strlen(id), ext = strlen(CPR__MODULE_EXT);
+  if (len > ext && strcmp(id + len - ext, CPR__MODULE_EXT) == 0) {
+    len -= ext;
+  }
+  return cpr_builtin_find(id, len);
+}
+
 /* Custom package loader
  * @params id, require, exports, module
  */
 CPR_API_INTERN duk_ret_t cpr__require_handler(duk_context *ctx) {
   const char *filename = NULL;
+  double start = cpr_get_time(), compile_start;
+  int preload;
+  duk_c_function open;
   CPR__DLOG("require '%s'", duk_get_string(ctx, 0));
+  /* Modules linked in the runtime (see cpr_builtin.h) */
+  if ((open = cpr__find_builtin(duk_get_string(ctx, 0))) != NULL) {
+    INF(ctx, "Load builtin module '%s'", duk_get_string(ctx, 0));
+    duk_push_c_function(ctx, open, 1);
+    duk_dup(ctx, 2);
+    duk_call(ctx, 1);
+    cpr__export_module(ctx);
+    cpr_trace_complete("module", duk_get_string(ctx, 0), start);
+    return 1;
+  }
   /* Search for the file in the search paths */
   duk_get_global_string(ctx, CPR_PACKAGE_NAME);
   duk_get_prop_string(ctx, -1, "searchPath");
@@ -89,45 +189,58 @@ CPR_API_INTERN duk_ret_t cpr__require_handler(duk_context *ctx) {
   /* TODO Lazy file extension check  */
   char *dot = strrchr(duk_get_string(ctx, -1), '.');
   if (dot && strcmp(dot, ".coffee") == 0) {
-    INF(ctx, "Load CoffeeScript module '%s'", filename);
-    /* Get the CoffeeScript global object */
-    duk_get_global_string(ctx, "CoffeeScript");
-    duk_push_string(ctx, "compile");
-    /* Push the content of the file on the top of the stack */
-    duk_push_string_file(ctx, filename);
-    /* Compile the coffee script in "safe" mode */
-    if (duk_pcall_prop(ctx, -3, 1) != DUK_EXEC_SUCCESS) {
-      duk_error(ctx, DUK_ERR_SYNTAX_ERROR, "Can't compile CoffeeScript '%s' : %s", filename, duk_safe_to_string(ctx, -1));
+    cpr_watch_add(duk_get_string(ctx, 0), filename);
+    if (cpr_watch_push_source(ctx, filename)) {
+      /* Recompiled in background by the watcher (see cpr_watch.h) */
+      INF(ctx, "Reload CoffeeScript module '%s'", filename);
+    } else if ((preload = cpr_preload_push(ctx, filename)) == CPR_PRELOAD_SOURCE) {
+      /* Compiled in background at startup (see cpr_preload.h) */
+      INF(ctx, "Load preloaded CoffeeScript module '%s'", filename);
+    } else if (preload == CPR_PRELOAD_BYTECODE || cpr__push_bytecode(ctx, filename)) {
+      INF(ctx, "Load CoffeeScript module bytecode '%s'", filename);
+      cpr__run_bytecode(ctx);
+    } else {
+      INF(ctx, "Load CoffeeScript module '%s'", filename);
+      /* Get the CoffeeScript global object */
+      duk_get_global_string(ctx, "CoffeeScript");
+      duk_push_string(ctx, "compile");
+      /* Push the content of the file on the top of the stack */
+      duk_push_string_file(ctx, filename);
+      /* Compile the coffee script in "safe" mode */
+      compile_start = cpr_get_time();
+      if (duk_pcall_prop(ctx, -3, 1) != DUK_EXEC_SUCCESS) {
+        duk_error(ctx, DUK_ERR_SYNTAX_ERROR, "Can't compile CoffeeScript '%s' : %s", filename, duk_safe_to_string(ctx, -1));
+      }
+      cpr_trace_complete("compile", filename, compile_start);
     }
   } else if (dot && strcmp(dot, CPR__MODULE_EXT) == 0) {
     INF(ctx, "Load C module id: '%s' filename:'%s'", duk_get_string(ctx, 0), filename);
-    duk_push_c_function(ctx, cpr_loadlib, 2);
+    duk_push_c_function(ctx, cpr_loadlib, 3);
     duk_push_string(ctx, filename);
     duk_dup(ctx, 0);
-    duk_call(ctx, 2);
-    /* duk_replace(ctx, 2);*/  /* Replacing the "exports" table doesnt work */
-    /* The init function should return (push) an object with the exported
-    * functions/properties. Those exported functions are then copied to the
-    * `exports` table so they are available outside the C module.
-    */
-    duk_enum(ctx, -1, DUK_ENUM_INCLUDE_NONENUMERABLE | DUK_ENUM_OWN_PROPERTIES_ONLY | DUK_ENUM_INCLUDE_INTERNAL);
-    while (duk_next(ctx, -1 /*enum_index*/, 1 /*get_value*/)) {
-      duk_put_prop(ctx, 2); /* `exports` table is the third parameters (at idx 2 on the stack) */
-    }
-    duk_pop(ctx); /* pop enum object */
-    duk_pop(ctx); /* pop module result */
-    duk_push_undefined(ctx); /* Return undefined because no source code. */
+    duk_dup(ctx, 2);
+    duk_call(ctx, 3);
+    cpr__export_module(ctx);
   } else {
     INF(ctx, "Load Javascript module '%s'", filename);
-    duk_push_string_file(ctx, filename);
+    cpr_watch_add(duk_get_string(ctx, 0), filename);
+    if ((preload = cpr_preload_push(ctx, filename)) == CPR_PRELOAD_BYTECODE ||
+        (preload == CPR_PRELOAD_NONE && cpr__push_bytecode(ctx, filename))) {
+      cpr__run_bytecode(ctx);
+    } else if (preload == CPR_PRELOAD_NONE) {
+      duk_push_string_file(ctx, filename);
+    }
   }
+  /* The bytecode modules are already evaluated above. The module source (if
+   * any) is evaluated by Duktape after this handler returns. */
+  cpr_trace_complete("module", duk_get_string(ctx, 0), start);
 
   return 1;
 }
 
 /* Look for CPR_PATH environment variable to set the search paths. If CPR_PATH
  * is not defined, try to figure out the search paths from the process
- * executable path.
+ * executable path. The command line path (if any) comes first.
  */
 CPR_API_INTERN duk_ret_t cpr__init_search_path(duk_context *ctx) {
   const char *ptr = NULL, *ptr2 = NULL, *path = NULL;
@@ -136,10 +249,14 @@ CPR_API_INTERN duk_ret_t cpr__init_search_path(duk_context *ctx) {
 
   obj_idx = duk_normalize_index(ctx, -1);
 
+  duk_push_array(ctx);
+  if (_path) {
+    duk_push_string(ctx, _path);
+    duk_put_prop_index(ctx, -2, i++);
+  }
   if ((path = getenv("CPR_PATH")) != NULL) {
     INF(ctx, "Found CPR_PATH : '%s'\n", path);
     ptr = path;
-    duk_push_array(ctx);
     while((ptr2 = strchr(ptr, CPR__PATH_SEPARATOR)) != NULL) {
       if ((ptr2 - ptr) > 0 ) {
         duk_push_lstring(ctx, ptr, (duk_size_t)(ptr2 - ptr));
@@ -154,14 +271,13 @@ CPR_API_INTERN duk_ret_t cpr__init_search_path(duk_context *ctx) {
     duk_put_prop_string(ctx, obj_idx, "paths");
   } else if ((path = cpr_get_exec_dir()) != NULL) {
     CPR__DLOG("executable dir: '%s'", path);
-    duk_push_array(ctx);
     duk_push_string(ctx, path);
-    duk_put_prop_index(ctx, -2, 0);
+    duk_put_prop_index(ctx, -2, i++);
     /* TODO Add Resources folder for MacOS platform */
     duk_push_string(ctx, path);
     duk_push_string(ctx, CPR__RESOURCES_PATH);
     duk_concat(ctx, 2);
-    duk_put_prop_index(ctx, -2, 1);
+    duk_put_prop_index(ctx, -2, i++);
     duk_put_prop_string(ctx, obj_idx, "paths");
   } else {
     duk_error(ctx, DUK_ERR_ERROR, "Can't retreive executable path. Please try setting CPR_PATH.");
@@ -169,9 +285,43 @@ CPR_API_INTERN duk_ret_t cpr__init_search_path(duk_context *ctx) {
   return 0;
 }
 
+/* Compile the scripts of a directory to bytecode like `--build` (see
+ * cpr_build.h). The compiler heaps log with the heap level.
+ * @params dir
+ * @return { count, compiled, upToDate, failed } */
+CPR_API_INTERN duk_ret_t cpr__build_dir(duk_context *ctx) {
+  const char *dir = duk_require_string(ctx, 0);
+  cpr_build_stats stats;
+  int log_level;
+
+  duk_get_global_string(ctx, "Duktape");
+  duk_get_prop_string(ctx, -1, "Logger");
+  duk_get_prop_string(ctx, -1, "clog");
+  duk_get_prop_string(ctx, -1, "l");
+  log_level = duk_get_int(ctx, -1);
+  duk_pop_n(ctx, 4);
+
+  cpr_build(dir, log_level, &stats);
+  duk_push_object(ctx);
+  duk_push_int(ctx, stats.count);
+  duk_put_prop_string(ctx, -2, "count");
+  duk_push_int(ctx, stats.compiled);
+  duk_put_prop_string(ctx, -2, "compiled");
+  duk_push_int(ctx, stats.up_to_date);
+  duk_put_prop_string(ctx, -2, "upToDate");
+  duk_push_int(ctx, stats.failed);
+  duk_put_prop_string(ctx, -2, "failed");
+  return 1;
+}
+
+CPR_API_EXTERN void cpr_package_set_path(const char *path) {
+  _path = path;
+}
+
 CPR_API_EXTERN duk_ret_t dukopen_package(duk_context *ctx) {
   const duk_function_list_entry module_funcs[] = {
     { "searchPath", cpr__search_path, 1 },
+    { "build", cpr__build_dir, 1 },
     { NULL, NULL, 0 }
   };
   CPR__DLOG("Opening module");
@@ -184,6 +334,8 @@ CPR_API_EXTERN duk_ret_t dukopen_package(duk_context *ctx) {
   duk_pop(ctx); /* pop Duktape */
 
   duk_put_function_list(ctx, -1, module_funcs);
+  cpr_builtin_push_names(ctx);
+  duk_put_prop_string(ctx, -2, "builtins");
 
   return 1;  /* return module value */
 }
@@ -17,6 +17,13 @@ extern "C" {
 #endif
 
 CPR_API_EXTERN duk_ret_t dukopen_package(duk_context *ctx);
+/* Look up `filename` in the search paths (`module.paths`) like
+ * `module.searchPath` but without logging an error if it's not found. Push the
+ * path found or undefined. Return 1 if the file is found. */
+CPR_API_EXTERN int cpr_package_search(duk_context *ctx, const char *filename);
+/* Set the search path tried before the CPR_PATH directories by the heaps
+ * created afterwards (NULL to unset). The string is not copied. */
+CPR_API_EXTERN void cpr_package_set_path(const char *path);
 
 #ifdef __cplusplus
 }
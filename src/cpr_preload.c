@@ -0,0 +1,454 @@
+/*
+ * cpr_preload.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdio.h> /* sprintf */
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* strlen, strcmp, strncmp, strcspn, strrchr, memcpy */
+
+#include "cpr_preload.h"
+#include "cpr_build.h"
+#include "cpr_cepora.h"
+#include "cpr_macros.h"
+#include "cpr_package.h"
+#include "cpr_sys_tools.h"
+#include "cpr_thread.h"
+
+#if defined(_WIN32)
+#define CPR__PRELOAD_SEPARATOR "\\"
+#else
+#define CPR__PRELOAD_SEPARATOR "/"
+#endif
+/* Reading threads */
+#define CPR__PRELOAD_THREADS 2
+
+enum {
+  CPR__PRELOAD_PENDING = 0,
+  CPR__PRELOAD_READY,
+  CPR__PRELOAD_FAILED,
+  CPR__PRELOAD_USED
+};
+
+typedef struct cpr__preload_item {
+  char *filename;         /* module file (as resolved by the module loader) */
+  int coffee;
+  int state;
+  int type;               /* CPR_PRELOAD_SOURCE or CPR_PRELOAD_BYTECODE */
+  char *data;
+  size_t size;
+} cpr__preload_item;
+
+/* The mutex protects the items state */
+static cpr_mutex _mutex;
+static cpr_cond _cond;
+static cpr__preload_item *_items = NULL;
+static int _count = 0;
+static int _capacity = 0;
+static volatile long _next = 0;
+static cpr_thread _threads[CPR__PRELOAD_THREADS];
+static int _thread_count = 0;
+static int _log_level = 4;
+
+/* Compile the CoffeeScript source at the stack top. Called in a safe call. */
+CPR_API_INTERN duk_ret_t cpr__preload_compile(duk_context *ctx) {
+  duk_get_global_string(ctx, "CoffeeScript");
+  duk_push_string(ctx, "compile");
+  duk_dup(ctx, -3);
+  duk_call_prop(ctx, -3, 1);
+  return 1;
+}
+
+/* Preloading thread: read the modules in the order they are required and
+ * compile the CoffeeScript modules without bytecode. */
+CPR_API_INTERN void cpr__preload_thread(void *arg) {
+  duk_context *ctx = NULL;
+  cpr__preload_item *item;
+  char *bytecode, *data, *file;
+  const char *source, *code;
+  size_t size = 0, file_size = 0, code_size = 0;
+  int i, type, coffee_failed = 0;
+
+  (void)arg;
+  while ((i = (int)cpr_atomic_add(&_next, 1) - 1) < _count) {
+    item = &_items[i];
+    type = CPR_PRELOAD_NONE;
+    data = NULL;
+    /* Same check as the module loader (see cpr_build_check_bytecode) */
+    if ((data = cpr_build_read_file(item->filename, &size)) != NULL &&
+        (bytecode = malloc(strlen(item->filename) + sizeof(CPR_BYTECODE_EXT))) != NULL) {
+      strcpy(bytecode, item->filename);
+      strcat(bytecode, CPR_BYTECODE_EXT);
+      if ((file = cpr_build_read_file(bytecode, &file_size)) != NULL &&
+          (code = cpr_build_check_bytecode(data, size, file, file_size, &code_size)) != NULL) {
+        memmove(file, code, code_size);
+        free(data);
+        data = file;
+        size = code_size;
+        file = NULL;
+        type = CPR_PRELOAD_BYTECODE;
+      }
+      free(file);
+      free(bytecode);
+    }
+    if (data != NULL && type == CPR_PRELOAD_NONE) {
+      type = CPR_PRELOAD_SOURCE;
+      if (item->coffee) {
+        /* The compiler heap is created on demand */
+        if (ctx == NULL && !coffee_failed) {
+          ctx = cpr_create_context(NULL, _log_level);
+          if (ctx == NULL || cpr_load_coffee_script(ctx) != 0) {
+            coffee_failed = 1;
+          }
+        }
+        if (!coffee_failed) {
+          duk_push_lstring(ctx, data, size);
+          if (duk_safe_call(ctx, cpr__preload_compile, 1, 1) == DUK_EXEC_SUCCESS) {
+            free(data);
+            source = duk_get_lstring(ctx, -1, &size);
+            if ((data = malloc(size + 1)) != NULL) {
+              memcpy(data, source, size + 1);
+            }
+          } else {
+            /* The module loader reports the error */
+            free(data);
+            data = NULL;
+          }
+          duk_pop(ctx);
+        } else {
+          free(data);
+          data = NULL;
+        }
+      }
+    }
+    cpr_mutex_lock(&_mutex);
+    item->data = data;
+    item->size = size;
+    item->type = type;
+    item->state = data ? CPR__PRELOAD_READY : CPR__PRELOAD_FAILED;
+    cpr_cond_broadcast(&_cond);
+    cpr_mutex_unlock(&_mutex);
+  }
+  cpr_destroy_context(ctx);
+}
+
+CPR_API_INTERN void cpr__preload_add(const char *dir, const char *id) {
+  cpr__preload_item *items;
+  const char *dot = strrchr(id, '.');
+  char *filename;
+
+  if (cpr_file_is_absolute(id) || dot == NULL ||
+      (strcmp(dot, ".coffee") != 0 && strcmp(dot, ".js") != 0)) {
+    return;
+  }
+  if (_count == _capacity) {
+    _capacity = _capacity ? _capacity * 2 : 32;
+    if ((items = realloc(_items, _capacity * sizeof(cpr__preload_item))) == NULL) {
+      return;
+    }
+    _items = items;
+  }
+  /* Same file name as module.searchPath */
+  if ((filename = malloc(strlen(dir) + strlen(id) + 2)) == NULL) {
+    return;
+  }
+  strcpy(filename, dir);
+  strcat(filename, CPR__PRELOAD_SEPARATOR);
+  strcat(filename, id);
+  memset(&_items[_count], 0, sizeof(cpr__preload_item));
+  _items[_count].filename = filename;
+  _items[_count].coffee = strcmp(dot, ".coffee") == 0;
+  ++_count;
+}
+
+/* Resolve the module id at the stack top as required by the module `base`
+ * (NULL for the main script) like the Duktape module loader: relative ids
+ * are resolved against the directory of `base` and the "." and ".." terms
+ * are removed. Return 0 if the id is invalid.
+ * [ ... id ] -> [ ... resolved|undefined ] */
+CPR_API_INTERN int cpr__preload_resolve(duk_context *ctx, const char *base) {
+  const char *id = duk_get_string(ctx, -1);
+  char *in, *out, *p, *q;
+  size_t n, len = strlen(id) + (base ? strlen(base) + 4 : 0) + 1;
+
+  in = duk_push_fixed_buffer(ctx, len * 2);
+  out = in + len;
+  if (base && id[0] == '.') {
+    sprintf(in, "%s/../%s", base, id);
+  } else {
+    strcpy(in, id);
+  }
+  for (p = in, q = out; ; ) {
+    n = strcspn(p, "/");
+    if (n == 1 && p[0] == '.') {
+      /* Skipped */
+    } else if (n == 2 && p[0] == '.' && p[1] == '.') {
+      if (q == out) {
+        break;
+      }
+      while (q > out && q[-1] != '/') --q;
+      if (q > out) {
+        --q;
+      }
+    } else if (n == 0 || p[0] == '.') {
+      break;
+    } else {
+      if (q > out) {
+        *q++ = '/';
+      }
+      memcpy(q, p, n);
+      q += n;
+    }
+    p += n;
+    while (*p == '/') ++p;
+    if (*p == '\0') {
+      /* The id must end with a name */
+      if (p[-1] != '/' && n > 0 && p[-n] != '.') {
+        duk_push_lstring(ctx, out, (duk_size_t)(q - out));
+        duk_replace(ctx, -3);
+        duk_pop(ctx);
+        return 1;
+      }
+      break;
+    }
+  }
+  duk_pop(ctx);
+  duk_push_undefined(ctx);
+  duk_replace(ctx, -2);
+  return 0;
+}
+
+/* Push the path of the file relative to the search path `dir`. Return 0 if
+ * the file isn't in the directory. */
+CPR_API_INTERN int cpr__preload_push_relative(duk_context *ctx, const char *dir, const char *filename) {
+  char *full_dir = cpr_get_full_path(dir), *full = cpr_get_full_path(filename);
+  size_t len = full_dir ? strlen(full_dir) : 0;
+  int rc = full_dir && full && strncmp(full_dir, full, len) == 0 &&
+      full[len] == CPR__PRELOAD_SEPARATOR[0];
+
+  if (rc) {
+    duk_push_string(ctx, full + len + 1);
+  }
+  free(full_dir);
+  free(full);
+  return rc;
+}
+
+/* Find the manifest entry of the module id at the stack top. The entry "dir"
+ * property is set to the search path of the manifest.
+ * [ ... id ] -> [ ... id entry|undefined ] */
+CPR_API_INTERN int cpr__preload_lookup(duk_context *ctx, duk_idx_t manifests) {
+  duk_idx_t id = duk_get_top_index(ctx);
+  duk_size_t i, n = duk_get_length(ctx, manifests);
+
+  for (i = 0; i < n; ++i) {
+    duk_get_prop_index(ctx, manifests, i);
+    duk_get_prop_string(ctx, -1, "modules");
+    duk_dup(ctx, id);
+    duk_get_prop(ctx, -2);
+    if (duk_is_object(ctx, -1)) {
+      duk_get_prop_string(ctx, -3, "dir");
+      duk_put_prop_string(ctx, -2, "dir");
+      duk_replace(ctx, id + 1);
+      duk_set_top(ctx, id + 2);
+      return 1;
+    }
+    duk_set_top(ctx, id + 1);
+  }
+  duk_push_undefined(ctx);
+  return 0;
+}
+
+/* Add the dependencies of the manifest entry at the stack top, depth first
+ * (the order the modules are evaluated). `base` is the module id of the entry
+ * (NULL for the main script). */
+CPR_API_INTERN void cpr__preload_visit(duk_context *ctx, duk_idx_t manifests, duk_idx_t seen, const char *base) {
+  duk_idx_t entry = duk_get_top_index(ctx);
+  duk_size_t i, n;
+
+  duk_require_stack(ctx, 8);
+  duk_get_prop_string(ctx, entry, "deps");
+  n = duk_is_array(ctx, -1) ? duk_get_length(ctx, -1) : 0;
+  for (i = 0; i < n; ++i) {
+    duk_get_prop_index(ctx, entry + 1, i);
+    if (duk_is_string(ctx, -1) && cpr__preload_resolve(ctx, base)) {
+      duk_dup(ctx, -1);
+      if (!duk_has_prop(ctx, seen)) {
+        duk_dup(ctx, -1);
+        duk_push_true(ctx);
+        duk_put_prop(ctx, seen);
+        if (cpr__preload_lookup(ctx, manifests)) {
+          duk_get_prop_string(ctx, -1, "dir");
+          cpr__preload_add(duk_get_string(ctx, -1), duk_get_string(ctx, -3));
+          duk_pop(ctx);
+          cpr__preload_visit(ctx, manifests, seen, duk_get_string(ctx, -2));
+        }
+      }
+    }
+    duk_set_top(ctx, entry + 2);
+  }
+  duk_pop(ctx);
+}
+
+/* Collect the modules to preload. Nothing is preloaded if the main script
+ * isn't in a built directory.
+ * [ id ] -> [ ] */
+CPR_API_INTERN duk_ret_t cpr__preload_graph(duk_context *ctx) {
+  duk_size_t i, n;
+
+  /* [ id manifests ] */
+  duk_push_array(ctx);
+  duk_get_global_string(ctx, CPR_PACKAGE_NAME);
+  duk_get_prop_string(ctx, -1, "paths");
+  n = duk_get_length(ctx, -1);
+  for (i = 0; i < n; ++i) {
+    duk_get_prop_index(ctx, 3, i);
+    duk_push_string(ctx, CPR__PRELOAD_SEPARATOR CPR_BUILD_MANIFEST);
+    duk_concat(ctx, 2);
+    if (cpr_file_exists(duk_get_string(ctx, -1))) {
+      duk_push_object(ctx);
+      duk_push_string_file(ctx, duk_get_string(ctx, -2));
+      duk_json_decode(ctx, -1);
+      duk_get_prop_string(ctx, -1, "modules");
+      if (duk_is_object(ctx, -1)) {
+        duk_put_prop_string(ctx, -3, "modules");
+        duk_get_prop_index(ctx, 3, i);
+        duk_put_prop_string(ctx, -3, "dir");
+        duk_pop(ctx);
+        duk_put_prop_index(ctx, 1, duk_get_length(ctx, 1));
+      }
+    }
+    duk_set_top(ctx, 4);
+  }
+  /* [ id manifests filename ] */
+  duk_get_prop_string(ctx, 2, "searchPath");
+  duk_dup(ctx, 0);
+  duk_call(ctx, 1);
+  duk_replace(ctx, 2);
+  duk_set_top(ctx, 3);
+  if (!duk_is_string(ctx, 2)) {
+    return 0;
+  }
+
+  /* The main script entry is keyed on its path in the built directory.
+   * [ id manifests filename seen manifest dir key modules entry ] */
+  duk_push_object(ctx);
+  n = duk_get_length(ctx, 1);
+  for (i = 0; i < n; ++i) {
+    duk_get_prop_index(ctx, 1, i);
+    duk_get_prop_string(ctx, -1, "dir");
+    if (cpr__preload_push_relative(ctx, duk_get_string(ctx, -1), duk_get_string(ctx, 2))) {
+      duk_get_prop_string(ctx, -3, "modules");
+      duk_dup(ctx, -2);
+      duk_get_prop(ctx, -2);
+      if (duk_is_object(ctx, -1)) {
+        duk_dup(ctx, -3);
+        duk_push_true(ctx);
+        duk_put_prop(ctx, 3);
+        cpr__preload_visit(ctx, 1, 3, NULL);
+        return 0;
+      }
+    }
+    duk_set_top(ctx, 4);
+  }
+  return 0;
+}
+
+CPR_API_EXTERN int cpr_preload_start(duk_context *ctx, const char *id, int log_level) {
+  int i;
+
+  if (_thread_count > 0 || _count > 0) {
+    return 0;
+  }
+  _log_level = log_level;
+  duk_push_string(ctx, id);
+  if (duk_safe_call(ctx, cpr__preload_graph, 1, 1) != DUK_EXEC_SUCCESS) {
+    WRN(ctx, "Can't read the module manifests : %s", duk_safe_to_string(ctx, -1));
+  }
+  duk_pop(ctx);
+  if (_count == 0) {
+    return 0;
+  }
+  cpr_mutex_init(&_mutex);
+  cpr_cond_init(&_cond);
+  _next = 0;
+  for (i = 0; i < CPR__PRELOAD_THREADS && i < _count; ++i) {
+    if (cpr_thread_create(&_threads[_thread_count], cpr__preload_thread, NULL) == 0) {
+      ++_thread_count;
+    }
+  }
+  if (_thread_count == 0) {
+    cpr_preload_stop();
+    return 0;
+  }
+  INF(ctx, "Preloading %d modules", _count);
+  return _count;
+}
+
+CPR_API_EXTERN void cpr_preload_stop() {
+  int i;
+
+  if (_count == 0) {
+    return;
+  }
+  for (i = 0; i < _thread_count; ++i) {
+    cpr_thread_join(_threads[i]);
+  }
+  if (_thread_count > 0) {
+    cpr_cond_destroy(&_cond);
+    cpr_mutex_destroy(&_mutex);
+  }
+  for (i = 0; i < _count; ++i) {
+    free(_items[i].filename);
+    free(_items[i].data);
+  }
+  free(_items);
+  _items = NULL;
+  _count = _capacity = _thread_count = 0;
+}
+
+CPR_API_EXTERN int cpr_preload_push(duk_context *ctx, const char *filename) {
+  cpr__preload_item *item = NULL;
+  int i, type = CPR_PRELOAD_NONE;
+  void *buf, *data = NULL;
+  size_t size = 0;
+
+  /* The worker heaps share the module loader: preloading is for the main
+   * heap only */
+  if (_thread_count == 0 || !cpr_thread_is_main()) {
+    return type;
+  }
+  for (i = 0; i < _count; ++i) {
+    if (strcmp(_items[i].filename, filename) == 0) {
+      item = &_items[i];
+      break;
+    }
+  }
+  if (item == NULL) {
+    return type;
+  }
+  /* Claim the module: it's loaded once (a reloaded module is read again) */
+  cpr_mutex_lock(&_mutex);
+  while (item->state == CPR__PRELOAD_PENDING) {
+    cpr_cond_wait(&_cond, &_mutex);
+  }
+  if (item->state == CPR__PRELOAD_READY) {
+    type = item->type;
+    data = item->data;
+    size = item->size;
+    item->data = NULL;
+    item->state = CPR__PRELOAD_USED;
+  }
+  cpr_mutex_unlock(&_mutex);
+  if (type == CPR_PRELOAD_BYTECODE) {
+    buf = duk_push_fixed_buffer(ctx, size);
+    memcpy(buf, data, size);
+  } else if (type == CPR_PRELOAD_SOURCE) {
+    duk_push_lstring(ctx, data, size);
+  }
+  free(data);
+  return type;
+}
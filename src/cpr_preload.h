@@ -0,0 +1,51 @@
+/*
+ * cpr_preload.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_PRELOAD_H
+#define CPR_PRELOAD_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Module preloading.
+ * The build manifests (see cpr_build.h) found in the package search paths
+ * record the static dependencies of the modules (ids resolved like the
+ * module loader). At startup the modules reachable from the main script are
+ * read by background threads (the
+ * bytecode if it's up to date, the source otherwise) and the CoffeeScript
+ * modules without bytecode are compiled. The module loader then takes the
+ * preloaded module instead of reading the file. Modules are still evaluated
+ * when required, in the same order. Nothing is preloaded if the main script
+ * isn't in a built search path.
+ *
+ * Main thread only: cpr_preload_push returns CPR_PRELOAD_NONE in the worker
+ * heaps.
+ */
+
+enum {
+  CPR_PRELOAD_NONE = 0,
+  CPR_PRELOAD_SOURCE,   /* JavaScript source (compiled CoffeeScript) */
+  CPR_PRELOAD_BYTECODE  /* Module function bytecode (buffer) */
+};
+
+/* Start preloading the dependencies of the main script `id`. Return the
+ * number of modules preloaded. */
+CPR_API_EXTERN int cpr_preload_start(duk_context *ctx, const char *id, int log_level);
+/* Wait for the threads and free the modules not used */
+CPR_API_EXTERN void cpr_preload_stop();
+/* If the module `filename` was preloaded push it (waiting for it if needed)
+ * and return its type. Return CPR_PRELOAD_NONE otherwise. */
+CPR_API_EXTERN int cpr_preload_push(duk_context *ctx, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_PRELOAD_H */
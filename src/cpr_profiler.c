@@ -0,0 +1,307 @@
+/*
+ * cpr_profiler.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_profiler.h"
+#include "cpr_sys_tools.h" /* cpr_get_time */
+#include "cpr_trace.h"
+#include "cpr_bindings.h"
+#include "cpr_thread.h"
+
+#include <stdlib.h> /* qsort */
+#include <string.h> /* strncmp, strncpy, strrchr, strlen, memset */
+
+typedef struct cpr__profiler_zone {
+  char name[CPR_PROFILER_NAME_SIZE];
+  int parent;       /* zone of the enclosing scope or -1 */
+  int depth;
+  double acc;       /* time accumulated during the current frame */
+  double calls;     /* calls during the current frame */
+  double last_calls;
+  double history[CPR_PROFILER_HISTORY]; /* ring buffer */
+  int head;         /* next history slot */
+  int count;        /* history values */
+} cpr__profiler_zone;
+
+typedef struct cpr__profiler_scope {
+  int zone;
+  double start;
+} cpr__profiler_scope;
+
+static int _enabled = 0;
+static cpr__profiler_zone _zones[CPR_PROFILER_MAX_ZONES];
+static int _zone_count = 0;
+static cpr__profiler_scope _stack[CPR_PROFILER_MAX_DEPTH];
+static int _depth = 0;
+/* Zones deeper than CPR_PROFILER_MAX_DEPTH are counted but not recorded */
+static int _overflow = 0;
+/* Zones entered (traced) and not yet left */
+static int _open = 0;
+/* Zones closed by cpr__profiler_close_all. Their ends are ignored. */
+static int _orphans = 0;
+static double _frame_start = -1.0;
+static cpr_profiler_frame_hook _frame_hook = NULL;
+static void *_frame_hook_udata = NULL;
+
+/* Zones are keyed on their name and their parent: the same name entered from
+ * two different scopes is two zones. */
+CPR_API_INTERN int cpr__profiler_intern(const char *name, int parent, int depth) {
+  int i;
+  for (i = 0; i < _zone_count; ++i) {
+    if (_zones[i].parent == parent && _zones[i].depth == depth &&
+        strncmp(_zones[i].name, name, CPR_PROFILER_NAME_SIZE - 1) == 0) {
+      return i;
+    }
+  }
+  if (_zone_count == CPR_PROFILER_MAX_ZONES) {
+    return -1;
+  }
+  memset(&_zones[i], 0, sizeof(cpr__profiler_zone));
+  strncpy(_zones[i].name, name, CPR_PROFILER_NAME_SIZE - 1);
+  _zones[i].parent = parent;
+  _zones[i].depth = depth;
+  return _zone_count++;
+}
+
+/* Forget the open zones and close their trace events. The zones are nested
+ * so their ends come after the ends of the zones entered later. */
+CPR_API_INTERN void cpr__profiler_close_all() {
+  int n = _open;
+  while (n-- > 0) {
+    cpr_trace_end();
+  }
+  _orphans += _open;
+  _open = 0;
+  _depth = 0;
+  _overflow = 0;
+}
+
+/* Compare a zone name and a path segment of `len` characters */
+CPR_API_INTERN int cpr__profiler_name_equals(const char *name, const char *segment, size_t len) {
+  if (len > CPR_PROFILER_NAME_SIZE - 1) {
+    len = CPR_PROFILER_NAME_SIZE - 1;
+  }
+  return strncmp(name, segment, len) == 0 && name[len] == '\0';
+}
+
+/* Return 1 if the enclosing zones of `zone` match the path `path` of `len`
+ * characters ("grandparent/parent", innermost last) */
+CPR_API_INTERN int cpr__profiler_match_parents(int zone, const char *path, size_t len) {
+  const char *segment;
+  while (len > 0) {
+    segment = path + len;
+    while (segment > path && segment[-1] != '/') {
+      --segment;
+    }
+    zone = _zones[zone].parent;
+    if (zone < 0 || !cpr__profiler_name_equals(_zones[zone].name, segment, path + len - segment)) {
+      return 0;
+    }
+    len = segment > path ? (size_t)(segment - path) - 1 : 0;
+  }
+  return 1;
+}
+
+CPR_API_INTERN void cpr__profiler_push(cpr__profiler_zone *z, double value) {
+  z->history[z->head] = value;
+  z->head = (z->head + 1) % CPR_PROFILER_HISTORY;
+  if (z->count < CPR_PROFILER_HISTORY) {
+    ++z->count;
+  }
+}
+
+CPR_API_INTERN int cpr__profiler_compare(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+CPR_API_EXTERN void cpr_profiler_enable(int enable) {
+  if (!enable == !_enabled) {
+    return;
+  }
+  _enabled = enable != 0;
+  /* Zones opened before the profiler was disabled are never recorded */
+  cpr__profiler_close_all();
+  _frame_start = -1.0;
+}
+
+CPR_API_EXTERN int cpr_profiler_is_enabled() {
+  return _enabled;
+}
+
+CPR_API_EXTERN void cpr_profiler_begin(const char *name) {
+  int zone;
+  cpr_trace_begin("zone", name);
+  if (!cpr_thread_is_main()) {
+    return;
+  }
+  ++_open;
+  if (!_enabled) {
+    return;
+  }
+  if (_depth == CPR_PROFILER_MAX_DEPTH || _overflow) {
+    ++_overflow;
+    return;
+  }
+  zone = cpr__profiler_intern(name, _depth > 0 ? _stack[_depth - 1].zone : -1, _depth);
+  _stack[_depth].zone = zone;
+  _stack[_depth].start = cpr_get_time();
+  ++_depth;
+}
+
+CPR_API_EXTERN int cpr_profiler_end(const char *name) {
+  cpr__profiler_scope *scope;
+  cpr__profiler_zone *z;
+  if (!cpr_thread_is_main()) {
+    cpr_trace_end();
+    return 0;
+  }
+  if (_open == 0 && _orphans > 0) {
+    /* Zone closed when the profiler was disabled or reset */
+    --_orphans;
+    return 0;
+  }
+  if (_open == 0) {
+    return -1;
+  }
+  if (_enabled && _overflow) {
+    --_overflow;
+  } else if (_enabled && (scope = &_stack[_depth - 1])->zone >= 0) {
+    z = &_zones[scope->zone];
+    if (name != NULL && strncmp(z->name, name, CPR_PROFILER_NAME_SIZE - 1) != 0) {
+      /* The zone and its trace event stay open */
+      return -1;
+    }
+    z->acc += cpr_get_time() - scope->start;
+    z->calls += 1.0;
+    --_depth;
+  } else if (_enabled) {
+    /* Too many zones. Nothing to record. */
+    --_depth;
+  }
+  --_open;
+  cpr_trace_end();
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_profiler_add(const char *name, double seconds) {
+  int zone;
+  if (!_enabled || !cpr_thread_is_main() || (zone = cpr__profiler_intern(name, -1, 0)) < 0) {
+    return;
+  }
+  _zones[zone].acc += seconds;
+  _zones[zone].calls += 1.0;
+}
+
+CPR_API_EXTERN void cpr_profiler_frame() {
+  double now;
+  int i, frame;
+  if (!cpr_thread_is_main()) {
+    return;
+  }
+  cpr_trace_frame();
+  cpr_bindings_frame();
+  if (!_enabled) {
+    return;
+  }
+  if (_frame_hook != NULL) {
+    _frame_hook(_frame_hook_udata);
+  }
+  now = cpr_get_time();
+  if (_frame_start >= 0.0 && (frame = cpr__profiler_intern("frame", -1, 0)) >= 0) {
+    _zones[frame].acc = now - _frame_start;
+    _zones[frame].calls = 1.0;
+  }
+  _frame_start = now;
+  /* Only the frames where a zone was entered are part of its history */
+  for (i = 0; i < _zone_count; ++i) {
+    cpr__profiler_zone *z = &_zones[i];
+    z->last_calls = z->calls;
+    if (z->calls > 0.0) {
+      cpr__profiler_push(z, z->acc);
+    }
+    z->acc = 0.0;
+    z->calls = 0.0;
+  }
+}
+
+CPR_API_EXTERN void cpr_profiler_reset() {
+  cpr__profiler_close_all();
+  _zone_count = 0;
+  _frame_start = -1.0;
+}
+
+CPR_API_EXTERN void cpr_profiler_set_frame_hook(cpr_profiler_frame_hook hook, void *udata) {
+  _frame_hook = hook;
+  _frame_hook_udata = udata;
+}
+
+CPR_API_EXTERN int cpr_profiler_zone_count() {
+  return _zone_count;
+}
+
+CPR_API_EXTERN int cpr_profiler_find_zone(const char *path) {
+  const char *name = strrchr(path, '/');
+  size_t len = name ? (size_t)(name - path) : 0;
+  int i;
+
+  name = name ? name + 1 : path;
+  for (i = 0; i < _zone_count; ++i) {
+    if (cpr__profiler_name_equals(_zones[i].name, name, strlen(name)) &&
+        cpr__profiler_match_parents(i, path, len)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+CPR_API_EXTERN int cpr_profiler_get_stats(int zone, cpr_profiler_stats *stats) {
+  double sorted[CPR_PROFILER_HISTORY], sum = 0.0;
+  cpr__profiler_zone *z;
+  int i, n;
+
+  if (zone < 0 || zone >= _zone_count) {
+    return -1;
+  }
+  z = &_zones[zone];
+  memset(stats, 0, sizeof(cpr_profiler_stats));
+  stats->name = z->name;
+  stats->depth = z->depth;
+  stats->frames = n = cpr_profiler_get_history(zone, sorted, CPR_PROFILER_HISTORY);
+  stats->calls = z->last_calls;
+  if (n == 0) {
+    return 0;
+  }
+  stats->last = sorted[n - 1];
+  for (i = 0; i < n; ++i) {
+    sum += sorted[i];
+  }
+  qsort(sorted, n, sizeof(double), cpr__profiler_compare);
+  stats->min = sorted[0];
+  stats->max = sorted[n - 1];
+  stats->avg = sum / n;
+  /* Nearest rank percentiles */
+  stats->p50 = sorted[(n * 50 + 99) / 100 - 1];
+  stats->p95 = sorted[(n * 95 + 99) / 100 - 1];
+  stats->p99 = sorted[(n * 99 + 99) / 100 - 1];
+  return 0;
+}
+
+CPR_API_EXTERN int cpr_profiler_get_history(int zone, double *out, int size) {
+  cpr__profiler_zone *z;
+  int i, n, first;
+
+  if (zone < 0 || zone >= _zone_count) {
+    return 0;
+  }
+  z = &_zones[zone];
+  n = z->count < size ? z->count : size;
+  /* Copy the most recent `n` values */
+  first = (z->head - n + CPR_PROFILER_HISTORY) % CPR_PROFILER_HISTORY;
+  for (i = 0; i < n; ++i) {
+    out[i] = z->history[(first + i) % CPR_PROFILER_HISTORY];
+  }
+  return n;
+}
@@ -0,0 +1,82 @@
+/*
+ * cpr_profiler.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_PROFILER_H
+#define CPR_PROFILER_H
+
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Frame profiler.
+ * Zones are named and nested scopes timed on the CPU. The time spent in every
+ * zone is accumulated until the end of the frame (`cpr_profiler_frame`) and
+ * then pushed into a rolling history used to compute the zone statistics.
+ * Zones are only recorded when the profiler is enabled but they are always
+ * traced (see cpr_trace.h). The profiler is not thread safe: calls from
+ * other threads than the main thread are ignored.
+ */
+
+#define CPR_PROFILER_MAX_ZONES  64
+#define CPR_PROFILER_MAX_DEPTH  32
+#define CPR_PROFILER_HISTORY    256
+#define CPR_PROFILER_NAME_SIZE  48
+
+/* Zone statistics over the history. Times are in seconds. */
+typedef struct cpr_profiler_stats {
+  const char *name;
+  int depth;        /* nesting depth */
+  int frames;       /* number of frames in the history */
+  double calls;     /* calls during the last frame */
+  double last;
+  double min, max, avg;
+  double p50, p95, p99;
+} cpr_profiler_stats;
+
+/* Called at the start of `cpr_profiler_frame` (e.g. to collect GPU timings) */
+typedef void (*cpr_profiler_frame_hook)(void *udata);
+
+CPR_API_EXTERN void cpr_profiler_enable(int enable);
+CPR_API_EXTERN int cpr_profiler_is_enabled();
+
+/* Enter the zone `name`. The name is copied (and truncated to
+ * CPR_PROFILER_NAME_SIZE - 1 characters). */
+CPR_API_EXTERN void cpr_profiler_begin(const char *name);
+/* Leave the innermost zone. If `name` is not NULL it must match the name of
+ * the innermost zone. Return 0 on success or -1 if no zone is open or the
+ * name doesn't match (the zone stays open). The zones open when the profiler
+ * is enabled, disabled or reset are closed: their ends are ignored. */
+CPR_API_EXTERN int cpr_profiler_end(const char *name);
+/* Add `seconds` to the zone `name` in the current frame (e.g. GPU timings) */
+CPR_API_EXTERN void cpr_profiler_add(const char *name, double seconds);
+/* End the current frame. The time since the previous call is recorded in the
+ * "frame" zone. */
+CPR_API_EXTERN void cpr_profiler_frame();
+/* Remove all the zones and their history */
+CPR_API_EXTERN void cpr_profiler_reset();
+
+CPR_API_EXTERN void cpr_profiler_set_frame_hook(cpr_profiler_frame_hook hook, void *udata);
+
+/* Number of zones. Zone ids are in [0, count) in the order they were first
+ * entered. */
+CPR_API_EXTERN int cpr_profiler_zone_count();
+/* Return the id of the first zone matching `path` or -1. The zones are keyed
+ * on their name and parent zone: the path is the zone name optionally
+ * preceded by the names of its enclosing zones ("parent/name"). */
+CPR_API_EXTERN int cpr_profiler_find_zone(const char *path);
+/* Return 0 on success or -1 if `zone` is not a valid id */
+CPR_API_EXTERN int cpr_profiler_get_stats(int zone, cpr_profiler_stats *stats);
+/* Copy at most `size` history values (oldest first) of `zone` into `out`.
+ * Return the number of values copied. */
+CPR_API_EXTERN int cpr_profiler_get_history(int zone, double *out, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_PROFILER_H */
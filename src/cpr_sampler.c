@@ -0,0 +1,254 @@
+/*
+ * cpr_sampler.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdio.h>
+#include <stdlib.h> /* malloc, realloc, free, qsort */
+#include <string.h> /* strcmp, strlen, memcpy */
+
+#include "cpr_sampler.h"
+#include "cpr_sys_tools.h" /* cpr_get_time */
+#include "duk_sampler.h" /* cpr_duk_walk_stack */
+
+#define CPR__SAMPLER_FRAME_SIZE 256
+
+/* String keyed table of sampler entries. `slots` is an open addressing hash
+ * table of indices into `entries` (-1 for empty slots). */
+typedef struct cpr__sampler_table {
+  cpr_sampler_entry *entries;
+  int count;
+  int *slots;
+  int slot_count;
+} cpr__sampler_table;
+
+static int _running = 0;
+static double _interval = 0.0;
+static double _next = 0.0;
+static double _samples = 0.0;
+static cpr__sampler_table _frames = { NULL, 0, NULL, 0 };
+static cpr__sampler_table _stacks = { NULL, 0, NULL, 0 };
+
+/* Frames of the current sample (top first) */
+static cpr_duk_frame _raw[CPR_SAMPLER_MAX_DEPTH];
+static char _sample[CPR_SAMPLER_MAX_DEPTH][CPR__SAMPLER_FRAME_SIZE];
+static char _stack_key[CPR_SAMPLER_MAX_DEPTH * CPR__SAMPLER_FRAME_SIZE];
+
+CPR_API_INTERN unsigned int cpr__sampler_hash(const char *s) {
+  unsigned int h = 2166136261u; /* FNV-1a */
+  while (*s) {
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  }
+  return h;
+}
+
+CPR_API_INTERN int cpr__sampler_rehash(cpr__sampler_table *t, int slot_count) {
+  unsigned int i;
+  int j, *slots;
+
+  if ((slots = malloc(slot_count * sizeof(int))) == NULL) {
+    return -1;
+  }
+  for (j = 0; j < slot_count; ++j) {
+    slots[j] = -1;
+  }
+  for (j = 0; j < t->count; ++j) {
+    i = cpr__sampler_hash(t->entries[j].frame) & (slot_count - 1);
+    while (slots[i] >= 0) {
+      i = (i + 1) & (slot_count - 1);
+    }
+    slots[i] = j;
+  }
+  free(t->slots);
+  t->slots = slots;
+  t->slot_count = slot_count;
+  return 0;
+}
+
+/* Return the entry `key` (created if it doesn't exist) or NULL */
+CPR_API_INTERN cpr_sampler_entry *cpr__sampler_get(cpr__sampler_table *t, const char *key) {
+  cpr_sampler_entry *entries, *e;
+  unsigned int i;
+  size_t len;
+  char *frame;
+
+  /* Keep the table at most half full. The entries array has the capacity of
+   * half the slots. */
+  if (t->count * 2 >= t->slot_count) {
+    int slot_count = t->slot_count ? t->slot_count * 2 : 256;
+    if ((entries = realloc(t->entries, (slot_count / 2) * sizeof(cpr_sampler_entry))) == NULL) {
+      return NULL;
+    }
+    t->entries = entries;
+    if (cpr__sampler_rehash(t, slot_count) != 0) {
+      return NULL;
+    }
+  }
+  i = cpr__sampler_hash(key) & (t->slot_count - 1);
+  while (t->slots[i] >= 0) {
+    e = &t->entries[t->slots[i]];
+    if (strcmp(e->frame, key) == 0) {
+      return e;
+    }
+    i = (i + 1) & (t->slot_count - 1);
+  }
+  len = strlen(key) + 1;
+  if ((frame = malloc(len)) == NULL) {
+    return NULL;
+  }
+  memcpy(frame, key, len);
+  t->slots[i] = t->count;
+  e = &t->entries[t->count++];
+  e->frame = frame;
+  e->self = e->total = 0.0;
+  return e;
+}
+
+CPR_API_INTERN void cpr__sampler_free(cpr__sampler_table *t) {
+  int i;
+  for (i = 0; i < t->count; ++i) {
+    free((char *)t->entries[i].frame);
+  }
+  free(t->entries);
+  free(t->slots);
+  t->entries = NULL;
+  t->slots = NULL;
+  t->count = t->slot_count = 0;
+}
+
+CPR_API_INTERN int cpr__sampler_compare(const void *a, const void *b) {
+  const cpr_sampler_entry *x = a, *y = b;
+  if (x->self != y->self) {
+    return x->self < y->self ? 1 : -1;
+  }
+  return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+/* Record the call stack of the running thread. Called from the interrupt. */
+CPR_API_INTERN void cpr__sampler_sample(void *thread) {
+  cpr_sampler_entry *e;
+  const char *name;
+  int depth, i, j;
+  size_t len = 0;
+
+#if defined(CPR_BUILD_SAMPLER)
+  depth = cpr_duk_walk_stack(thread, _raw, CPR_SAMPLER_MAX_DEPTH);
+#else
+  /* Not started (the walk is not in the Duktape library) */
+  depth = 0;
+  (void)thread;
+#endif
+  if (depth == 0) {
+    return;
+  }
+  for (i = 0; i < depth; ++i) {
+    name = _raw[i].name && *_raw[i].name ? _raw[i].name : "anon";
+    if (_raw[i].file != NULL) {
+      snprintf(_sample[i], CPR__SAMPLER_FRAME_SIZE, "%s %s:%d", name, _raw[i].file, (int)_raw[i].line);
+    } else {
+      snprintf(_sample[i], CPR__SAMPLER_FRAME_SIZE, "%s [native]", name);
+    }
+    /* `;` separates the frames in the collapsed stacks */
+    for (j = 0; _sample[i][j]; ++j) {
+      if (_sample[i][j] == ';') {
+        _sample[i][j] = ':';
+      }
+    }
+  }
+
+  _samples += 1.0;
+  for (i = 0; i < depth; ++i) {
+    /* Count recursive frames once */
+    for (j = 0; j < i; ++j) {
+      if (strcmp(_sample[i], _sample[j]) == 0) {
+        break;
+      }
+    }
+    if (j == i && (e = cpr__sampler_get(&_frames, _sample[i])) != NULL) {
+      e->total += 1.0;
+      e->self += i == 0 ? 1.0 : 0.0;
+    }
+  }
+  /* Collapsed stack: root first */
+  for (i = depth - 1; i >= 0; --i) {
+    size_t n = strlen(_sample[i]);
+    memcpy(_stack_key + len, _sample[i], n);
+    len += n;
+    _stack_key[len++] = i ? ';' : '\0';
+  }
+  if ((e = cpr__sampler_get(&_stacks, _stack_key)) != NULL) {
+    e->self += 1.0;
+  }
+}
+
+/* Must not call the Duktape API (see duk_custom.h) */
+CPR_API_EXTERN int cpr_sampler_interrupt(void *udata, void *thread) {
+  double now;
+
+  (void)udata;
+  if (!_running) {
+    return 0;
+  }
+  now = cpr_get_time();
+  if (now < _next) {
+    return 0;
+  }
+  _next = now + _interval;
+  cpr__sampler_sample(thread);
+  return 0;
+}
+
+CPR_API_EXTERN int cpr_sampler_start(double rate) {
+#if defined(CPR_BUILD_SAMPLER)
+  _interval = rate > 0.0 ? 1.0 / rate : 1.0 / CPR_SAMPLER_DEFAULT_RATE;
+  _next = 0.0;
+  _running = 1;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+CPR_API_EXTERN void cpr_sampler_stop() {
+  _running = 0;
+}
+
+CPR_API_EXTERN int cpr_sampler_is_running() {
+  return _running;
+}
+
+CPR_API_EXTERN void cpr_sampler_clear() {
+  cpr__sampler_free(&_frames);
+  cpr__sampler_free(&_stacks);
+  _samples = 0.0;
+}
+
+CPR_API_EXTERN double cpr_sampler_sample_count() {
+  return _samples;
+}
+
+CPR_API_EXTERN int cpr_sampler_flat(const cpr_sampler_entry **entries) {
+  if (_frames.count > 0) {
+    qsort(_frames.entries, _frames.count, sizeof(cpr_sampler_entry), cpr__sampler_compare);
+    cpr__sampler_rehash(&_frames, _frames.slot_count);
+  }
+  *entries = _frames.entries;
+  return _frames.count;
+}
+
+CPR_API_EXTERN int cpr_sampler_write_collapsed(const char *filename) {
+  FILE *f;
+  int i, err;
+
+  if ((f = fopen(filename, "w")) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < _stacks.count; ++i) {
+    fprintf(f, "%s %.0f\n", _stacks.entries[i].frame, _stacks.entries[i].self);
+  }
+  err = ferror(f);
+  return fclose(f) != 0 || err ? -1 : 0;
+}
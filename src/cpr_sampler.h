@@ -0,0 +1,68 @@
+/*
+ * cpr_sampler.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_SAMPLER_H
+#define CPR_SAMPLER_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sampling script profiler.
+ * Samples are taken from the Duktape executor interrupt (see
+ * lib/duktape/duk_custom.h) so the effective rate is bounded by the interrupt
+ * rate (every 256k bytecode instructions) and time spent in native code is
+ * not sampled. Each sample records the call stack of the running thread
+ * (function name, file and line of every frame), a coroutine stack followed
+ * by the stack of its resumer. Lines are the lines of the compiled
+ * JavaScript. The stack is read without the Duktape API (see
+ * lib/duktape/duk_sampler.h).
+ */
+
+#define CPR_SAMPLER_DEFAULT_RATE 1000.0
+#define CPR_SAMPLER_MAX_DEPTH    64
+
+/* Heap user data passed to `duk_create_heap`. `interrupt` must be the first
+ * member (see duk_custom.h). It is called with the running thread. */
+typedef struct cpr_heap_udata {
+  int (*interrupt)(void *udata, void *thread);
+} cpr_heap_udata;
+
+/* Flat profile entry. `self` counts the samples where the frame is the top of
+ * the stack and `total` the samples where the frame is on the stack. */
+typedef struct cpr_sampler_entry {
+  const char *frame;  /* "name file:line" */
+  double self;
+  double total;
+} cpr_sampler_entry;
+
+/* Executor interrupt. Set as the `interrupt` member of the heap user data. */
+CPR_API_EXTERN int cpr_sampler_interrupt(void *udata, void *thread);
+
+/* Return 0 on success or -1 if the sampler is not compiled in */
+CPR_API_EXTERN int cpr_sampler_start(double rate);
+CPR_API_EXTERN void cpr_sampler_stop();
+CPR_API_EXTERN int cpr_sampler_is_running();
+/* Remove all the samples */
+CPR_API_EXTERN void cpr_sampler_clear();
+CPR_API_EXTERN double cpr_sampler_sample_count();
+
+/* Number of flat profile entries. Entries are sorted by self samples. The
+ * entries are valid until the next sample or `cpr_sampler_clear`. */
+CPR_API_EXTERN int cpr_sampler_flat(const cpr_sampler_entry **entries);
+/* Write the samples in the collapsed stack format used by flamegraph.pl and
+ * speedscope (one "root;...;leaf count" line per stack). Return 0 on success
+ * or -1 if the file can't be written. */
+CPR_API_EXTERN int cpr_sampler_write_collapsed(const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_SAMPLER_H */
@@ -8,11 +8,12 @@
 #include "cpr_sys_tools.h"
 
 #include <stdio.h>
-#include <string.h>     /* strdup, _strdup */
+#include <string.h>     /* strdup, _strdup, strlen, memcpy */
 #include <stdlib.h>     /* malloc, free, realpath, _splitpath_s */
 
 #if defined(__APPLE__)
 #include <mach-o/dyld.h> /* For _NSGetExecutablePath */
+#include <mach/mach_time.h> /* mach_absolute_time */
 #include <sys/stat.h>
 #endif
 
@@ -23,6 +24,11 @@
 #include <limits.h> /* realpath */
 #endif
 
+#if defined(__linux__) || defined(__APPLE__)
+#include <time.h> /* clock_gettime, nanosleep */
+#include <errno.h>
+#endif
+
 /* GetModuleFileName will link the executable against KERNEL32.DLL */
 #if defined(_WIN32)
 #include <windows.h>
@@ -52,6 +58,21 @@ CPR_API_EXTERN int cpr_file_exists(const char *path) {
 #endif
 }
 
+CPR_API_EXTERN double cpr_file_mtime(const char *path) {
+#if defined(__linux__) || defined(__APPLE__)
+  struct stat st;
+  return stat(path, &st) == 0 ? (double)st.st_mtime : 0.0;
+#elif defined(_WIN32)
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) {
+    return 0.0;
+  }
+  /* 100 ns intervals since 1601 */
+  return ((double)data.ftLastWriteTime.dwHighDateTime * 4294967296.0 +
+          (double)data.ftLastWriteTime.dwLowDateTime) * 1e-7;
+#endif
+}
+
 CPR_API_EXTERN char *cpr_get_exec_dir() {
     char *path = NULL, *dir = NULL;
 #if defined(_WIN32)
@@ -157,3 +178,59 @@ end:
     free(buf);
     return full_path;
 }
+
+CPR_API_EXTERN char *cpr_strdup(const char *str) {
+    size_t len = strlen(str) + 1;
+    char *dup = malloc(len);
+    if (dup) {
+        memcpy(dup, str, len);
+    }
+    return dup;
+}
+
+CPR_API_EXTERN char *cpr_get_full_path(const char *path) {
+#if defined(_WIN32)
+    return _fullpath(NULL, path, 0);
+#else
+    return realpath(path, NULL);
+#endif
+}
+
+CPR_API_EXTERN double cpr_get_time() {
+#if defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return (double)mach_absolute_time() * timebase.numer / timebase.denom * 1e-9;
+#elif defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#elif defined(_WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#endif
+}
+
+CPR_API_EXTERN void cpr_sleep(double seconds) {
+    if (seconds <= 0.0) {
+        return;
+    }
+#if defined(_WIN32)
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    {
+        struct timespec ts;
+        ts.tv_sec = (time_t)seconds;
+        ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+        /* Resume after signal interruptions */
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+    }
+#endif
+}
@@ -14,6 +14,9 @@ extern "C" {
 #endif
 
 CPR_API_EXTERN int cpr_file_is_absolute(const char *path);
+/* Portable strdup (NULL if out of memory). The string must be freed by the
+ * caller. */
+CPR_API_EXTERN char *cpr_strdup(const char *str);
 
 /* TODO check GLFW cmake options (GLFW_USE_CHDIR) or directive (_GLFW_USE_CHDIR)
  * when building OSX release because glfwInit will change current directory
@@ -21,6 +24,8 @@ CPR_API_EXTERN int cpr_file_is_absolute(const char *path);
  */
 
 CPR_API_EXTERN int cpr_file_exists(const char *path);
+/* Last modification time of the file in seconds or 0 if the file doesn't exist */
+CPR_API_EXTERN double cpr_file_mtime(const char *path);
 
 /* Get the directory absolute path of the executable.
  * The path string must be freed by the caller.
@@ -30,6 +35,18 @@ CPR_API_EXTERN char *cpr_get_exec_dir();
  * The string is dynamically allocated and must be freed by the caller.
  */
 CPR_API_EXTERN char *cpr_get_exec_path();
+/* Get the absolute path of an existing file (symbolic links, /./ and /../
+ * components resolved). Return NULL on error. The string must be freed by the
+ * caller.
+ */
+CPR_API_EXTERN char *cpr_get_full_path(const char *path);
+
+/* Monotonic high resolution time in seconds. The origin is unspecified so
+ * only time differences are meaningful.
+ */
+CPR_API_EXTERN double cpr_get_time();
+/* Suspend the calling thread for at least `seconds` */
+CPR_API_EXTERN void cpr_sleep(double seconds);
 
 #ifdef __cplusplus
 }
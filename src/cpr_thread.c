@@ -0,0 +1,192 @@
+/*
+ * cpr_thread.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdlib.h> /* malloc, free */
+
+#include "cpr_thread.h"
+
+#if defined(_WIN32)
+#include <process.h> /* _beginthreadex */
+#else
+#include <errno.h>  /* ETIMEDOUT */
+#include <time.h>   /* clock_gettime */
+#include <unistd.h> /* sysconf */
+#endif
+
+typedef struct cpr__thread_start {
+  cpr_thread_func func;
+  void *arg;
+} cpr__thread_start;
+
+#if defined(_WIN32)
+#define CPR__THREAD_RETURN unsigned __stdcall
+static DWORD _main_thread = 0;
+#else
+#define CPR__THREAD_RETURN void *
+static pthread_t _main_thread;
+#endif
+static int _main_thread_set = 0;
+
+CPR_API_INTERN CPR__THREAD_RETURN cpr__thread_main(void *arg) {
+  cpr__thread_start start = *(cpr__thread_start *)arg;
+  free(arg);
+  start.func(start.arg);
+  return 0;
+}
+
+CPR_API_EXTERN int cpr_thread_create(cpr_thread *thread, cpr_thread_func func, void *arg) {
+  cpr__thread_start *start;
+
+  if ((start = malloc(sizeof(cpr__thread_start))) == NULL) {
+    return -1;
+  }
+  start->func = func;
+  start->arg = arg;
+#if defined(_WIN32)
+  *thread = (HANDLE)_beginthreadex(NULL, 0, cpr__thread_main, start, 0, NULL);
+  if (*thread == 0) {
+#else
+  if (pthread_create(thread, NULL, cpr__thread_main, start) != 0) {
+#endif
+    free(start);
+    return -1;
+  }
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_thread_join(cpr_thread thread) {
+#if defined(_WIN32)
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+CPR_API_EXTERN void cpr_thread_set_main() {
+#if defined(_WIN32)
+  _main_thread = GetCurrentThreadId();
+#else
+  _main_thread = pthread_self();
+#endif
+  _main_thread_set = 1;
+}
+
+CPR_API_EXTERN int cpr_thread_is_main() {
+#if defined(_WIN32)
+  return !_main_thread_set || _main_thread == GetCurrentThreadId();
+#else
+  return !_main_thread_set || pthread_equal(_main_thread, pthread_self());
+#endif
+}
+
+CPR_API_EXTERN int cpr_thread_cpu_count() {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#endif
+}
+
+#if defined(_WIN32)
+
+CPR_API_EXTERN void cpr_mutex_init(cpr_mutex *mutex) {
+  InitializeCriticalSection(mutex);
+}
+
+CPR_API_EXTERN void cpr_mutex_destroy(cpr_mutex *mutex) {
+  DeleteCriticalSection(mutex);
+}
+
+CPR_API_EXTERN void cpr_mutex_lock(cpr_mutex *mutex) {
+  EnterCriticalSection(mutex);
+}
+
+CPR_API_EXTERN void cpr_mutex_unlock(cpr_mutex *mutex) {
+  LeaveCriticalSection(mutex);
+}
+
+CPR_API_EXTERN void cpr_cond_init(cpr_cond *cond) {
+  InitializeConditionVariable(cond);
+}
+
+CPR_API_EXTERN void cpr_cond_destroy(cpr_cond *cond) {
+  /* Nothing to release */
+}
+
+CPR_API_EXTERN void cpr_cond_wait(cpr_cond *cond, cpr_mutex *mutex) {
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+CPR_API_EXTERN int cpr_cond_timedwait(cpr_cond *cond, cpr_mutex *mutex, double seconds) {
+  return SleepConditionVariableCS(cond, mutex, (DWORD)(seconds * 1000.0)) ? 0 : -1;
+}
+
+CPR_API_EXTERN void cpr_cond_signal(cpr_cond *cond) {
+  WakeConditionVariable(cond);
+}
+
+CPR_API_EXTERN void cpr_cond_broadcast(cpr_cond *cond) {
+  WakeAllConditionVariable(cond);
+}
+
+#else
+
+CPR_API_EXTERN void cpr_mutex_init(cpr_mutex *mutex) {
+  pthread_mutex_init(mutex, NULL);
+}
+
+CPR_API_EXTERN void cpr_mutex_destroy(cpr_mutex *mutex) {
+  pthread_mutex_destroy(mutex);
+}
+
+CPR_API_EXTERN void cpr_mutex_lock(cpr_mutex *mutex) {
+  pthread_mutex_lock(mutex);
+}
+
+CPR_API_EXTERN void cpr_mutex_unlock(cpr_mutex *mutex) {
+  pthread_mutex_unlock(mutex);
+}
+
+CPR_API_EXTERN void cpr_cond_init(cpr_cond *cond) {
+  pthread_cond_init(cond, NULL);
+}
+
+CPR_API_EXTERN void cpr_cond_destroy(cpr_cond *cond) {
+  pthread_cond_destroy(cond);
+}
+
+CPR_API_EXTERN void cpr_cond_wait(cpr_cond *cond, cpr_mutex *mutex) {
+  pthread_cond_wait(cond, mutex);
+}
+
+CPR_API_EXTERN int cpr_cond_timedwait(cpr_cond *cond, cpr_mutex *mutex, double seconds) {
+  struct timespec ts;
+  long nsec;
+
+  /* pthread_cond_timedwait takes an absolute CLOCK_REALTIME time */
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += (time_t)seconds;
+  nsec = ts.tv_nsec + (long)((seconds - (double)(time_t)seconds) * 1e9);
+  ts.tv_sec += nsec / 1000000000L;
+  ts.tv_nsec = nsec % 1000000000L;
+  return pthread_cond_timedwait(cond, mutex, &ts) == ETIMEDOUT ? -1 : 0;
+}
+
+CPR_API_EXTERN void cpr_cond_signal(cpr_cond *cond) {
+  pthread_cond_signal(cond);
+}
+
+CPR_API_EXTERN void cpr_cond_broadcast(cpr_cond *cond) {
+  pthread_cond_broadcast(cond);
+}
+
+#endif
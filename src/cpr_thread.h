@@ -0,0 +1,76 @@
+/*
+ * cpr_thread.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_THREAD_H
+#define CPR_THREAD_H
+
+#include "cpr_config.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Minimal threads, mutexes and condition variables (POSIX threads or Win32) */
+
+#if defined(_WIN32)
+typedef HANDLE cpr_thread;
+typedef CRITICAL_SECTION cpr_mutex;
+typedef CONDITION_VARIABLE cpr_cond;
+#else
+typedef pthread_t cpr_thread;
+typedef pthread_mutex_t cpr_mutex;
+typedef pthread_cond_t cpr_cond;
+#endif
+
+typedef void (*cpr_thread_func)(void *arg);
+
+/* Return 0 on success or -1 if the thread can't be created */
+CPR_API_EXTERN int cpr_thread_create(cpr_thread *thread, cpr_thread_func func, void *arg);
+CPR_API_EXTERN void cpr_thread_join(cpr_thread thread);
+/* The main thread is the thread that called `cpr_thread_set_main` (the
+ * runtime calls it in `cpr_start`). The profiler, the trace and the bindings
+ * counters only record the main thread. */
+CPR_API_EXTERN void cpr_thread_set_main();
+CPR_API_EXTERN int cpr_thread_is_main();
+/* Number of logical processors */
+CPR_API_EXTERN int cpr_thread_cpu_count();
+
+CPR_API_EXTERN void cpr_mutex_init(cpr_mutex *mutex);
+CPR_API_EXTERN void cpr_mutex_destroy(cpr_mutex *mutex);
+CPR_API_EXTERN void cpr_mutex_lock(cpr_mutex *mutex);
+CPR_API_EXTERN void cpr_mutex_unlock(cpr_mutex *mutex);
+
+CPR_API_EXTERN void cpr_cond_init(cpr_cond *cond);
+CPR_API_EXTERN void cpr_cond_destroy(cpr_cond *cond);
+CPR_API_EXTERN void cpr_cond_wait(cpr_cond *cond, cpr_mutex *mutex);
+/* Wait at most `seconds`. Return 0 if signaled or -1 on timeout. */
+CPR_API_EXTERN int cpr_cond_timedwait(cpr_cond *cond, cpr_mutex *mutex, double seconds);
+CPR_API_EXTERN void cpr_cond_signal(cpr_cond *cond);
+CPR_API_EXTERN void cpr_cond_broadcast(cpr_cond *cond);
+
+/* Atomic operations on `volatile long` (full memory barrier). `cpr_atomic_add`
+ * returns the new value and `cpr_atomic_cas` returns true if `*ptr` was equal
+ * to `old` and has been set to `value`. */
+#if defined(_WIN32)
+#define cpr_atomic_add(ptr, delta)      (InterlockedExchangeAdd((ptr), (delta)) + (delta))
+#define cpr_atomic_cas(ptr, old, value) (InterlockedCompareExchange((ptr), (value), (old)) == (old))
+#else
+#define cpr_atomic_add(ptr, delta)      __sync_add_and_fetch((ptr), (delta))
+#define cpr_atomic_cas(ptr, old, value) __sync_bool_compare_and_swap((ptr), (old), (value))
+#endif
+#define cpr_atomic_get(ptr)             cpr_atomic_add((ptr), 0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_THREAD_H */
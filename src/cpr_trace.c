@@ -0,0 +1,263 @@
+/*
+ * cpr_trace.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdio.h>
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* strcmp, strlen, memcpy */
+
+#include "cpr_trace.h"
+#include "cpr_sys_tools.h" /* cpr_get_time */
+#include "cpr_thread.h"
+
+typedef struct cpr__trace_event {
+  double ts;          /* seconds since the trace was opened */
+  double dur;         /* complete events duration */
+  const char *cat;
+  int name;           /* interned name or -1 */
+  char ph;            /* event type: 'B', 'E', 'X' or 'i' */
+} cpr__trace_event;
+
+static char *_filename = NULL;
+static double _origin = 0.0;
+static double _frame_start = -1.0;
+static cpr__trace_event *_events = NULL;
+static int _event_count = 0;
+static int _event_capacity = 0;
+static int _dropped = 0;
+static int _depth = 0;  /* open duration events */
+
+/* Interned event names. `_slots` is an open addressing hash table of indices
+ * into `_names` (-1 for empty slots). */
+static char **_names = NULL;
+static int _name_count = 0;
+static int *_slots = NULL;
+static int _slot_count = 0;
+
+CPR_API_INTERN unsigned int cpr__trace_hash(const char *s) {
+  unsigned int h = 2166136261u; /* FNV-1a */
+  while (*s) {
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  }
+  return h;
+}
+
+CPR_API_INTERN int cpr__trace_intern(const char *name) {
+  unsigned int i;
+  int j, *slots;
+  char **names;
+  size_t len;
+
+  if (name == NULL) {
+    return -1;
+  }
+  /* Keep the table at most half full */
+  if (_name_count * 2 >= _slot_count) {
+    int count = _slot_count ? _slot_count * 2 : 256;
+    /* Grow the names first: the tables are unchanged on failure */
+    if ((names = realloc(_names, (count / 2) * sizeof(char *))) == NULL) {
+      return -1;
+    }
+    _names = names;
+    if ((slots = malloc(count * sizeof(int))) == NULL) {
+      return -1;
+    }
+    for (j = 0; j < count; ++j) {
+      slots[j] = -1;
+    }
+    for (j = 0; j < _name_count; ++j) {
+      i = cpr__trace_hash(_names[j]) & (count - 1);
+      while (slots[i] >= 0) {
+        i = (i + 1) & (count - 1);
+      }
+      slots[i] = j;
+    }
+    free(_slots);
+    _slots = slots;
+    _slot_count = count;
+  }
+  i = cpr__trace_hash(name) & (_slot_count - 1);
+  while (_slots[i] >= 0) {
+    if (strcmp(_names[_slots[i]], name) == 0) {
+      return _slots[i];
+    }
+    i = (i + 1) & (_slot_count - 1);
+  }
+  len = strlen(name) + 1;
+  if ((_names[_name_count] = malloc(len)) == NULL) {
+    return -1;
+  }
+  memcpy(_names[_name_count], name, len);
+  _slots[i] = _name_count;
+  return _name_count++;
+}
+
+CPR_API_INTERN cpr__trace_event *cpr__trace_push(char ph, const char *cat, const char *name, double ts) {
+  cpr__trace_event *e;
+  /* Events are only recorded on the main thread */
+  if (!cpr_thread_is_main()) {
+    return NULL;
+  }
+  if (_event_count == _event_capacity) {
+    int capacity = _event_capacity ? _event_capacity * 2 : 4096;
+    if (_event_count == CPR_TRACE_MAX_EVENTS ||
+        (e = realloc(_events, capacity * sizeof(cpr__trace_event))) == NULL) {
+      ++_dropped;
+      return NULL;
+    }
+    _events = e;
+    _event_capacity = capacity;
+  }
+  e = &_events[_event_count++];
+  e->ph = ph;
+  e->cat = cat;
+  e->name = cpr__trace_intern(name);
+  e->ts = ts - _origin;
+  e->dur = 0.0;
+  return e;
+}
+
+CPR_API_INTERN void cpr__trace_write_string(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', f);
+      fputc(*s, f);
+    } else if ((unsigned char)*s < 0x20) {
+      fprintf(f, "\\u%04x", (unsigned char)*s);
+    } else {
+      fputc(*s, f);
+    }
+  }
+  fputc('"', f);
+}
+
+CPR_API_INTERN void cpr__trace_free() {
+  int i;
+  for (i = 0; i < _name_count; ++i) {
+    free(_names[i]);
+  }
+  free(_names);
+  free(_slots);
+  free(_events);
+  free(_filename);
+  _names = NULL;
+  _slots = NULL;
+  _events = NULL;
+  _filename = NULL;
+  _name_count = _slot_count = 0;
+  _event_count = _event_capacity = 0;
+  _dropped = _depth = 0;
+  _frame_start = -1.0;
+}
+
+CPR_API_EXTERN int cpr_trace_open(const char *filename) {
+  size_t len = strlen(filename) + 1;
+  if (_filename != NULL || (_filename = malloc(len)) == NULL) {
+    return -1;
+  }
+  memcpy(_filename, filename, len);
+  _origin = cpr_get_time();
+  return 0;
+}
+
+CPR_API_EXTERN int cpr_trace_close() {
+  FILE *f;
+  int i;
+
+  if (_filename == NULL) {
+    return -1;
+  }
+  if ((f = fopen(_filename, "w")) == NULL) {
+    cpr__trace_free();
+    return -1;
+  }
+  fprintf(f, "{\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"cepora\"}}");
+  for (i = 0; i < _event_count; ++i) {
+    cpr__trace_event *e = &_events[i];
+    fprintf(f, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":1,\"ts\":%.3f", e->ph, e->ts * 1e6);
+    if (e->cat != NULL) {
+      fprintf(f, ",\"cat\":\"%s\"", e->cat);
+    }
+    if (e->name >= 0) {
+      fprintf(f, ",\"name\":");
+      cpr__trace_write_string(f, _names[e->name]);
+    }
+    if (e->ph == 'X') {
+      fprintf(f, ",\"dur\":%.3f", e->dur * 1e6);
+    } else if (e->ph == 'i') {
+      fprintf(f, ",\"s\":\"t\"");
+    }
+    fputc('}', f);
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%d}}\n", _dropped);
+  i = ferror(f);
+  i = fclose(f) != 0 || i;
+  cpr__trace_free();
+  return i ? -1 : 0;
+}
+
+CPR_API_EXTERN int cpr_trace_is_enabled() {
+  return _filename != NULL;
+}
+
+CPR_API_EXTERN void cpr_trace_begin(const char *cat, const char *name) {
+  if (_filename != NULL && cpr__trace_push('B', cat, name, cpr_get_time()) != NULL) {
+    ++_depth;
+  }
+}
+
+CPR_API_EXTERN void cpr_trace_end() {
+  if (_filename != NULL && _depth > 0 && cpr__trace_push('E', NULL, NULL, cpr_get_time()) != NULL) {
+    --_depth;
+  }
+}
+
+CPR_API_EXTERN void cpr_trace_complete(const char *cat, const char *name, double start) {
+  double now = cpr_get_time();
+  cpr__trace_event *e;
+  if (_filename != NULL && (e = cpr__trace_push('X', cat, name, start)) != NULL) {
+    e->dur = now - start;
+  }
+}
+
+CPR_API_EXTERN void cpr_trace_instant(const char *cat, const char *name) {
+  if (_filename != NULL) {
+    cpr__trace_push('i', cat, name, cpr_get_time());
+  }
+}
+
+CPR_API_EXTERN void cpr_trace_frame() {
+  double now;
+  if (_filename == NULL) {
+    return;
+  }
+  now = cpr_get_time();
+  if (_frame_start >= 0.0) {
+    cpr_trace_complete("frame", "frame", _frame_start);
+  }
+  _frame_start = now;
+}
+
+CPR_API_INTERN duk_ret_t cpr__trace_gc_finalizer(duk_context *ctx) {
+  if (_filename != NULL) {
+    cpr_trace_instant("gc", "gc");
+    /* Watch the next cycle */
+    cpr_trace_watch_gc(ctx);
+  }
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_trace_watch_gc(duk_context *ctx) {
+  duk_push_object(ctx);
+  duk_dup(ctx, -1);
+  duk_put_prop_string(ctx, -2, "self");
+  duk_push_c_function(ctx, cpr__trace_gc_finalizer, 1);
+  duk_set_finalizer(ctx, -2);
+  duk_pop(ctx);
+}
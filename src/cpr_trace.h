@@ -0,0 +1,56 @@
+/*
+ * cpr_trace.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_TRACE_H
+#define CPR_TRACE_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Runtime activity tracing.
+ * Events are recorded in memory while the trace is open and written to the
+ * trace file in the Chrome trace event JSON format when it is closed (view it
+ * in chrome://tracing or https://ui.perfetto.dev). Tracing is enabled with the
+ * `--trace filename` command line option.
+ *
+ * Event categories must be string literals. Names are copied. Like the
+ * profiler the trace must only be used from the main thread.
+ */
+
+/* Events recorded after this limit are dropped */
+#define CPR_TRACE_MAX_EVENTS (1 << 21)
+
+/* Start recording. Return 0 on success or -1 if the trace is already open. */
+CPR_API_EXTERN int cpr_trace_open(const char *filename);
+/* Write the trace file and stop recording. Return 0 on success or -1 if the
+ * file can't be written. */
+CPR_API_EXTERN int cpr_trace_close();
+CPR_API_EXTERN int cpr_trace_is_enabled();
+
+/* Begin and end a duration event. Ends without a matching begin are ignored. */
+CPR_API_EXTERN void cpr_trace_begin(const char *cat, const char *name);
+CPR_API_EXTERN void cpr_trace_end();
+/* Record a complete event from `start` (see cpr_get_time) to now */
+CPR_API_EXTERN void cpr_trace_complete(const char *cat, const char *name, double start);
+CPR_API_EXTERN void cpr_trace_instant(const char *cat, const char *name);
+/* Record the frame that ends now. Called by `cpr_profiler_frame`. */
+CPR_API_EXTERN void cpr_trace_frame();
+
+/* Record an instant "gc" event at the end of every mark-and-sweep cycle of
+ * the heap of `ctx`. Duktape has no GC callback so the cycles are detected
+ * with a finalizer on a self referencing object, which only mark-and-sweep
+ * can collect. */
+CPR_API_EXTERN void cpr_trace_watch_gc(duk_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_TRACE_H */
@@ -0,0 +1,448 @@
+/*
+ * cpr_watch.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#include "cpr_config.h"
+
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* strcmp, strrchr */
+
+#if defined(CPR_BUILD_LINUX)
+#include <poll.h>
+#include <unistd.h> /* read, close */
+#include <sys/inotify.h>
+#endif
+
+#include "cpr_watch.h"
+#include "cpr_cepora.h"
+#include "cpr_dispatch.h"
+#include "cpr_error.h"
+#include "cpr_macros.h"
+#include "cpr_sys_tools.h"
+#include "cpr_thread.h"
+
+/* Reload listeners in the global stash */
+#define CPR__WATCH_LISTENERS "cprWatchListeners"
+/* Seconds between two checks of the modification times (no inotify) */
+#define CPR__WATCH_POLL_INTERVAL 0.5
+
+typedef struct cpr__watch_file {
+  char *id;
+  char *filename;
+  int wd;                 /* inotify watch of the directory */
+  double mtime;
+  int changed;            /* to recompile */
+  int ready;              /* recompiled, to reload */
+  char *source;           /* compiled JavaScript (CoffeeScript modules) */
+  char *error;            /* compilation error */
+  struct cpr__watch_file *next;
+} cpr__watch_file;
+
+/* The mutex protects the files list and the files state */
+static cpr_mutex _mutex;
+static int _init = 0;
+static int _enabled = 0;  /* record the required modules */
+static cpr__watch_file *_files = NULL;
+static cpr_thread _thread;
+static int _started = 0;
+static volatile int _stop = 0;
+static int _log_level = 4;
+#if defined(CPR_BUILD_LINUX)
+static int _fd = -1;
+#endif
+
+CPR_API_INTERN const char *cpr__watch_basename(const char *filename) {
+  const char *sep = strrchr(filename, '/');
+#if defined(_WIN32)
+  const char *sep2 = strrchr(filename, '\\');
+  sep = sep2 > sep ? sep2 : sep;
+#endif
+  return sep ? sep + 1 : filename;
+}
+
+/* Watch the directory of the file */
+CPR_API_INTERN void cpr__watch_file_dir(cpr__watch_file *file) {
+#if defined(CPR_BUILD_LINUX)
+  const char *base = cpr__watch_basename(file->filename);
+  char *dir;
+
+  if (_fd < 0 || file->wd >= 0) {
+    return;
+  }
+  if (base == file->filename) {
+    file->wd = inotify_add_watch(_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO);
+  } else if ((dir = cpr_strdup(file->filename)) != NULL) {
+    dir[base - file->filename - 1] = '\0';
+    file->wd = inotify_add_watch(_fd, dir[0] ? dir : "/", IN_CLOSE_WRITE | IN_MOVED_TO);
+    free(dir);
+  }
+#else
+  (void)file;
+#endif
+}
+
+/* Wait for changes and flag the changed files */
+CPR_API_INTERN void cpr__watch_wait() {
+  cpr__watch_file *file;
+#if defined(CPR_BUILD_LINUX)
+  char buf[4096];
+  const struct inotify_event *event;
+  struct pollfd pfd;
+  ssize_t len, i;
+
+  pfd.fd = _fd;
+  pfd.events = POLLIN;
+  /* Wake up regularly to check the stop flag */
+  if (poll(&pfd, 1, 100) <= 0 || (len = read(_fd, buf, sizeof(buf))) <= 0) {
+    return;
+  }
+  cpr_mutex_lock(&_mutex);
+  for (i = 0; i < len; i += sizeof(struct inotify_event) + event->len) {
+    event = (const struct inotify_event *)&buf[i];
+    for (file = _files; event->len && file; file = file->next) {
+      if (file->wd == event->wd && strcmp(cpr__watch_basename(file->filename), event->name) == 0) {
+        file->changed = 1;
+      }
+    }
+  }
+  cpr_mutex_unlock(&_mutex);
+#else
+  double mtime;
+
+  cpr_sleep(CPR__WATCH_POLL_INTERVAL);
+  cpr_mutex_lock(&_mutex);
+  for (file = _files; file; file = file->next) {
+    if ((mtime = cpr_file_mtime(file->filename)) != file->mtime) {
+      file->mtime = mtime;
+      file->changed = 1;
+    }
+  }
+  cpr_mutex_unlock(&_mutex);
+#endif
+}
+
+/* Compile the CoffeeScript file at the stack top. Called in a safe call. */
+CPR_API_INTERN duk_ret_t cpr__watch_compile(duk_context *ctx) {
+  duk_get_global_string(ctx, "CoffeeScript");
+  duk_push_string(ctx, "compile");
+  duk_push_string_file(ctx, duk_require_string(ctx, -3));
+  duk_call_prop(ctx, -3, 1);
+  return 1;
+}
+
+/* Background compiler */
+CPR_API_INTERN void cpr__watch_main(void *arg) {
+  duk_context *ctx = NULL;
+  cpr__watch_file *file;
+  const char *filename, *dot;
+  char *source, *error;
+  (void)arg;
+
+  while (!_stop) {
+    cpr__watch_wait();
+
+    for (;;) {
+      cpr_mutex_lock(&_mutex);
+      for (file = _files; file && !file->changed; file = file->next);
+      if (file) {
+        file->changed = 0;
+      }
+      cpr_mutex_unlock(&_mutex);
+      if (file == NULL || _stop) {
+        break;
+      }
+
+      /* The list only grows while the watcher runs */
+      filename = file->filename;
+      source = error = NULL;
+      dot = strrchr(filename, '.');
+      if (dot && strcmp(dot, ".coffee") == 0) {
+        if (ctx == NULL && (ctx = cpr_create_context(NULL, _log_level)) != NULL &&
+            cpr_load_coffee_script(ctx) != 0) {
+          cpr_destroy_context(ctx);
+          ctx = NULL;
+        }
+        if (ctx == NULL) {
+          error = cpr_strdup("can't load the CoffeeScript compiler");
+        } else {
+          duk_push_string(ctx, filename);
+          if (duk_safe_call(ctx, cpr__watch_compile, 1, 1) == DUK_EXEC_SUCCESS) {
+            source = cpr_strdup(duk_get_string(ctx, -1));
+          } else {
+            error = cpr_strdup(duk_safe_to_string(ctx, -1));
+          }
+          duk_pop(ctx);
+        }
+      }
+
+      cpr_mutex_lock(&_mutex);
+      free(file->source);
+      free(file->error);
+      file->source = source;
+      file->error = error;
+      file->ready = 1;
+      cpr_mutex_unlock(&_mutex);
+    }
+  }
+  cpr_destroy_context(ctx);
+}
+
+CPR_API_INTERN void cpr__watch_dispatch(duk_context *ctx, void *udata) {
+  (void)udata;
+  cpr_watch_reload(ctx);
+}
+
+CPR_API_INTERN void cpr__watch_init() {
+  if (!_init) {
+    cpr_mutex_init(&_mutex);
+    _init = 1;
+  }
+}
+
+CPR_API_EXTERN int cpr_watch_start(int log_level) {
+  cpr__watch_file *file;
+
+  if (_started || !cpr_thread_is_main()) {
+    return _started ? 0 : -1;
+  }
+  cpr__watch_init();
+  _enabled = 1;
+  _log_level = log_level;
+  _stop = 0;
+#if defined(CPR_BUILD_LINUX)
+  if ((_fd = inotify_init()) < 0) {
+    return -1;
+  }
+#endif
+  cpr_mutex_lock(&_mutex);
+  for (file = _files; file; file = file->next) {
+    file->mtime = cpr_file_mtime(file->filename);
+    cpr__watch_file_dir(file);
+  }
+  cpr_mutex_unlock(&_mutex);
+  if (cpr_thread_create(&_thread, cpr__watch_main, NULL) != 0) {
+#if defined(CPR_BUILD_LINUX)
+    close(_fd);
+    _fd = -1;
+#endif
+    return -1;
+  }
+  cpr_dispatch_add(cpr__watch_dispatch, NULL);
+  _started = 1;
+  return 0;
+}
+
+CPR_API_EXTERN void cpr_watch_stop() {
+  cpr__watch_file *file;
+
+  if (!_started) {
+    return;
+  }
+  _stop = 1;
+  cpr_thread_join(_thread);
+  cpr_dispatch_remove(cpr__watch_dispatch, NULL);
+#if defined(CPR_BUILD_LINUX)
+  close(_fd);
+  _fd = -1;
+#endif
+  for (file = _files; file; file = file->next) {
+    file->wd = -1;
+  }
+  _started = 0;
+}
+
+CPR_API_EXTERN int cpr_watch_is_started() {
+  return _started;
+}
+
+CPR_API_EXTERN void cpr_watch_enable() {
+  if (cpr_thread_is_main()) {
+    _enabled = 1;
+  }
+}
+
+CPR_API_EXTERN void cpr_watch_clear() {
+  cpr__watch_file *file;
+
+  if (_started) {
+    return;
+  }
+  _enabled = 0;
+  if (!_init) {
+    return;
+  }
+  while ((file = _files) != NULL) {
+    _files = file->next;
+    free(file->id);
+    free(file->filename);
+    free(file->source);
+    free(file->error);
+    free(file);
+  }
+}
+
+CPR_API_EXTERN void cpr_watch_add(const char *id, const char *filename) {
+  cpr__watch_file *file;
+
+  /* Only the main heap modules are reloaded and only when watching (or
+   * about to) */
+  if (!cpr_thread_is_main() || !_enabled) {
+    return;
+  }
+  cpr__watch_init();
+  for (file = _files; file; file = file->next) {
+    if (strcmp(file->filename, filename) == 0) {
+      return;
+    }
+  }
+  if ((file = calloc(1, sizeof(cpr__watch_file))) == NULL) {
+    return;
+  }
+  file->id = cpr_strdup(id);
+  file->filename = cpr_strdup(filename);
+  if (file->id == NULL || file->filename == NULL) {
+    free(file->id);
+    free(file->filename);
+    free(file);
+    return;
+  }
+  file->wd = -1;
+  file->mtime = cpr_file_mtime(filename);
+  cpr__watch_file_dir(file);
+
+  cpr_mutex_lock(&_mutex);
+  file->next = _files;
+  _files = file;
+  cpr_mutex_unlock(&_mutex);
+}
+
+CPR_API_EXTERN int cpr_watch_push_source(duk_context *ctx, const char *filename) {
+  cpr__watch_file *file;
+  char *source = NULL;
+
+  if (!_init || !cpr_thread_is_main()) {
+    return 0;
+  }
+  cpr_mutex_lock(&_mutex);
+  for (file = _files; file; file = file->next) {
+    if (strcmp(file->filename, filename) == 0) {
+      source = file->source;
+      file->source = NULL;
+      break;
+    }
+  }
+  cpr_mutex_unlock(&_mutex);
+  if (source == NULL) {
+    return 0;
+  }
+  duk_push_string(ctx, source);
+  free(source);
+  return 1;
+}
+
+/* Call the listeners with the `nargs` arguments on the stack top (popped) */
+CPR_API_INTERN void cpr__watch_notify(duk_context *ctx, int nargs) {
+  duk_idx_t args = duk_get_top(ctx) - nargs;
+  duk_size_t i, n;
+  int j;
+
+  cpr_watch_push_listeners(ctx);
+  n = duk_get_length(ctx, -1);
+  for (i = 0; i < n; ++i) {
+    duk_get_prop_index(ctx, -1, (duk_uarridx_t)i);
+    for (j = 0; j < nargs; ++j) {
+      duk_dup(ctx, args + j);
+    }
+    if (duk_pcall(ctx, nargs) != DUK_EXEC_SUCCESS) {
+      ERR(ctx, "Reload listener failed : %s", duk_safe_to_string(ctx, -1));
+      cpr_dump_stack_trace(ctx, -1);
+    }
+    duk_pop(ctx);
+  }
+  duk_set_top(ctx, args);
+}
+
+CPR_API_EXTERN int cpr_watch_reload(duk_context *ctx) {
+  cpr__watch_file *file;
+  char *error;
+  int count = 0;
+
+  if (!_init || !cpr_thread_is_main()) {
+    return 0;
+  }
+  for (;;) {
+    cpr_mutex_lock(&_mutex);
+    for (file = _files; file && !file->ready; file = file->next);
+    error = NULL;
+    if (file) {
+      file->ready = 0;
+      error = file->error;
+      file->error = NULL;
+    }
+    cpr_mutex_unlock(&_mutex);
+    if (file == NULL) {
+      break;
+    }
+    ++count;
+
+    if (error) {
+      ERR(ctx, "Can't recompile module '%s' : %s", file->id, error);
+      duk_push_error_object(ctx, DUK_ERR_SYNTAX_ERROR, "%s", error);
+      duk_push_string(ctx, file->id);
+      free(error);
+      cpr__watch_notify(ctx, 2);
+      continue;
+    }
+
+    INF(ctx, "Reload module '%s'", file->id);
+    duk_get_global_string(ctx, "Duktape");
+    duk_get_prop_string(ctx, -1, "modLoaded");
+    duk_del_prop_string(ctx, -1, file->id);
+    duk_pop_2(ctx);
+
+    duk_get_global_string(ctx, "require");
+    duk_push_string(ctx, file->id);
+    if (duk_pcall(ctx, 1) != DUK_EXEC_SUCCESS) {
+      ERR(ctx, "Can't reload module '%s' : %s", file->id, duk_safe_to_string(ctx, -1));
+      duk_push_string(ctx, file->id);
+      cpr__watch_notify(ctx, 2);
+    } else {
+      /* [ ... exports ] -> [ ... null id exports ] */
+      duk_push_null(ctx);
+      duk_push_string(ctx, file->id);
+      duk_dup(ctx, -3);
+      duk_remove(ctx, -4);
+      cpr__watch_notify(ctx, 3);
+    }
+  }
+  return count;
+}
+
+CPR_API_EXTERN void cpr_watch_push_ids(duk_context *ctx) {
+  cpr__watch_file *file;
+  duk_uarridx_t i = 0;
+
+  duk_push_array(ctx);
+  if (!_init) {
+    return;
+  }
+  cpr_mutex_lock(&_mutex);
+  for (file = _files; file; file = file->next) {
+    duk_push_string(ctx, file->id);
+    duk_put_prop_index(ctx, -2, i++);
+  }
+  cpr_mutex_unlock(&_mutex);
+}
+
+CPR_API_EXTERN void cpr_watch_push_listeners(duk_context *ctx) {
+  duk_push_global_stash(ctx);
+  if (!duk_get_prop_string(ctx, -1, CPR__WATCH_LISTENERS)) {
+    duk_pop(ctx);
+    duk_push_array(ctx);
+    duk_dup_top(ctx);
+    duk_put_prop_string(ctx, -3, CPR__WATCH_LISTENERS);
+  }
+  duk_remove(ctx, -2);
+}
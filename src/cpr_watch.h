@@ -0,0 +1,60 @@
+/*
+ * cpr_watch.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_WATCH_H
+#define CPR_WATCH_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Hot reload of the script modules (watch mode).
+ * The module loader records the CoffeeScript and JavaScript modules required
+ * by the main heap once the watch mode is started or the `watch` module is
+ * loaded. In watch mode (`--watch` or the `watch` module) a thread
+ * watches their directories (inotify on Linux, modification times elsewhere)
+ * and recompiles a changed module in its own heap. The recompiled modules are
+ * reloaded in the main heap at a safe point (see cpr_dispatch.h): their
+ * `Duktape.modLoaded` entry is removed, the module is required again (using
+ * the compiled source) and the reload listeners are called with
+ * `(error, id, exports)`. Only the changed modules are recompiled.
+ *
+ * Main thread only.
+ */
+
+/* Start watching the modules. The background compiler logs with `log_level`.
+ * Return 0 on success or -1 if the watcher can't be started. */
+CPR_API_EXTERN int cpr_watch_start(int log_level);
+CPR_API_EXTERN void cpr_watch_stop();
+CPR_API_EXTERN int cpr_watch_is_started();
+/* Record the modules required from now on (the `watch` module is loaded).
+ * cpr_watch_start enables it too. */
+CPR_API_EXTERN void cpr_watch_enable();
+/* Forget the recorded modules and stop recording (the watcher must be
+ * stopped) */
+CPR_API_EXTERN void cpr_watch_clear();
+
+/* Record the module `id` loaded from `filename` (module loader) if enabled */
+CPR_API_EXTERN void cpr_watch_add(const char *id, const char *filename);
+/* If `filename` was recompiled push its compiled source and return 1. Return
+ * 0 otherwise. */
+CPR_API_EXTERN int cpr_watch_push_source(duk_context *ctx, const char *filename);
+/* Reload the recompiled modules and call the listeners. Return the number of
+ * modules reloaded (or failed). */
+CPR_API_EXTERN int cpr_watch_reload(duk_context *ctx);
+/* Push the array of the recorded module ids */
+CPR_API_EXTERN void cpr_watch_push_ids(duk_context *ctx);
+/* Push the array of the reload listeners (global stash) */
+CPR_API_EXTERN void cpr_watch_push_listeners(duk_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_WATCH_H */
@@ -0,0 +1,1046 @@
+/*
+ * cpr_broadphase.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Broadphase collision detection.
+ * A broadphase stores axis aligned boxes (x, y, width, height) addressed by
+ * integer handles and finds the overlapping pairs, the boxes inside a
+ * rectangle or the boxes hit by a ray. Two structures are available:
+ *   - HASH: uniform spatial hash. Boxes are binned in square cells of
+ *     `cellSize` and the hash is rebuilt (counting sort) on the first query
+ *     after a change. Best for many moving boxes of similar sizes.
+ *   - TREE: dynamic AABB tree balanced with rotations. Leaves are enlarged by
+ *     `margin` so small moves don't change the tree. Best for boxes of very
+ *     different sizes or mostly static worlds.
+ *
+ * Results are written into script owned Int32Arrays so scripts can reuse the
+ * same output buffers every frame. Functions writing results return the total
+ * count even if the output is too small to hold all of them.
+ */
+
+#include "cpr_broadphase.h"
+#include "cpr_macros.h"
+#include "cpr_duktape_helpers.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h> /* realloc, free, qsort */
+#include <string.h> /* memset */
+
+#define CPR__BROADPHASE_HASH            1
+#define CPR__BROADPHASE_TREE            2
+#define CPR__BROADPHASE_DEFAULT_CELL    64.0
+#define CPR__BROADPHASE_DEFAULT_MARGIN  4.0
+#define CPR__BROADPHASE_MIN_BUCKETS     64
+#define CPR__BROADPHASE_NULL            -1
+/* Cell coordinates are clamped to +/- CPR__BROADPHASE_MAX_CELL */
+#define CPR__BROADPHASE_MAX_CELL        (1 << 24)
+/* Maximum number of (body, cell) entries of the spatial hash */
+#define CPR__BROADPHASE_MAX_ENTRIES     (1 << 24)
+
+typedef struct cpr__broadphase_box {
+  float minx, miny, maxx, maxy;
+} cpr__broadphase_box;
+
+typedef struct cpr__broadphase_body {
+  cpr__broadphase_box box;
+  int alive;
+  int next;           /* next free body if not alive */
+  int leaf;           /* tree leaf */
+  uint32_t stamp;     /* last query visiting the body */
+} cpr__broadphase_body;
+
+/* Spatial hash entry: a body in a cell */
+typedef struct cpr__broadphase_entry {
+  int cx, cy;
+  int body;
+  unsigned bucket;
+} cpr__broadphase_entry;
+
+typedef struct cpr__broadphase_node {
+  cpr__broadphase_box box;  /* fat box */
+  int parent;               /* next free node if not used */
+  int child1, child2;       /* CPR__BROADPHASE_NULL for leaves */
+  int height;               /* 0 for leaves, -1 if free */
+  int body;
+} cpr__broadphase_node;
+
+typedef struct cpr__broadphase_hit {
+  int body;
+  float t;
+} cpr__broadphase_hit;
+
+typedef struct cpr__broadphase {
+  int type;
+  float cell_size;
+  float margin;
+  cpr__broadphase_body *bodies;
+  int body_count;     /* alive bodies */
+  int body_capacity;  /* bodies array length */
+  int body_used;      /* high water mark */
+  int free_body;
+  uint32_t stamp;
+  /* Spatial hash */
+  int dirty;
+  cpr__broadphase_entry *entries;
+  cpr__broadphase_entry *scratch;
+  int entry_count, entry_capacity, scratch_capacity;
+  int *buckets;       /* bucket_count + 1 start offsets in `entries` */
+  unsigned bucket_count;
+  /* AABB tree */
+  cpr__broadphase_node *nodes;
+  int node_capacity;
+  int free_node;
+  int root;
+  int *stack;
+  int stack_capacity;
+  /* Raycast hits scratch buffer */
+  cpr__broadphase_hit *hits;
+  int hit_count, hit_capacity;
+} cpr__broadphase;
+
+/* Output buffer of a query */
+typedef struct cpr__broadphase_output {
+  int32_t *data;
+  int size;
+  int count;
+} cpr__broadphase_output;
+
+/* Grow `*ptr` to hold at least `need` elements of `size` bytes */
+CPR_API_INTERN void cpr__broadphase_reserve(duk_context *ctx, void **ptr, int *capacity, int need, size_t size) {
+  int cap = *capacity > 0 ? *capacity : 16;
+  void *p;
+
+  if (need <= *capacity) {
+    return;
+  }
+  while (cap < need) {
+    cap *= 2;
+  }
+  if ((p = realloc(*ptr, (size_t)cap * size)) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "broadphase: out of memory");
+  }
+  *ptr = p;
+  *capacity = cap;
+}
+
+CPR_API_INTERN int cpr__broadphase_overlap(const cpr__broadphase_box *a, const cpr__broadphase_box *b) {
+  return a->minx <= b->maxx && b->minx <= a->maxx && a->miny <= b->maxy && b->miny <= a->maxy;
+}
+
+CPR_API_INTERN int cpr__broadphase_contains(const cpr__broadphase_box *a, const cpr__broadphase_box *b) {
+  return a->minx <= b->minx && a->miny <= b->miny && b->maxx <= a->maxx && b->maxy <= a->maxy;
+}
+
+CPR_API_INTERN cpr__broadphase_box cpr__broadphase_union(const cpr__broadphase_box *a, const cpr__broadphase_box *b) {
+  cpr__broadphase_box r;
+  r.minx = a->minx < b->minx ? a->minx : b->minx;
+  r.miny = a->miny < b->miny ? a->miny : b->miny;
+  r.maxx = a->maxx > b->maxx ? a->maxx : b->maxx;
+  r.maxy = a->maxy > b->maxy ? a->maxy : b->maxy;
+  return r;
+}
+
+CPR_API_INTERN float cpr__broadphase_perimeter(const cpr__broadphase_box *b) {
+  return 2.0f * ((b->maxx - b->minx) + (b->maxy - b->miny));
+}
+
+/* Slab test of the segment p + t * d, t in [0, 1]. Return the entry t or -1 */
+CPR_API_INTERN float cpr__broadphase_ray_box(const cpr__broadphase_box *b, float px, float py, float dx, float dy) {
+  float t0 = 0.0f, t1 = 1.0f, inv, ta, tb, tmp;
+  int axis;
+  float p[2], d[2], lo[2], hi[2];
+
+  p[0] = px; p[1] = py;
+  d[0] = dx; d[1] = dy;
+  lo[0] = b->minx; lo[1] = b->miny;
+  hi[0] = b->maxx; hi[1] = b->maxy;
+  for (axis = 0; axis < 2; ++axis) {
+    if (d[axis] == 0.0f) {
+      if (p[axis] < lo[axis] || p[axis] > hi[axis]) {
+        return -1.0f;
+      }
+      continue;
+    }
+    inv = 1.0f / d[axis];
+    ta = (lo[axis] - p[axis]) * inv;
+    tb = (hi[axis] - p[axis]) * inv;
+    if (ta > tb) {
+      tmp = ta; ta = tb; tb = tmp;
+    }
+    t0 = ta > t0 ? ta : t0;
+    t1 = tb < t1 ? tb : t1;
+    if (t0 > t1) {
+      return -1.0f;
+    }
+  }
+  return t0;
+}
+
+CPR_API_INTERN void cpr__broadphase_emit(cpr__broadphase_output *out, int value) {
+  if (out->count < out->size) {
+    out->data[out->count] = value;
+  }
+  ++out->count;
+}
+
+CPR_API_INTERN void cpr__broadphase_emit_pair(cpr__broadphase_output *out, int a, int b) {
+  if ((out->count + 1) * 2 <= out->size) {
+    out->data[out->count * 2] = a < b ? a : b;
+    out->data[out->count * 2 + 1] = a < b ? b : a;
+  }
+  ++out->count;
+}
+
+CPR_API_INTERN void cpr__broadphase_add_hit(duk_context *ctx, cpr__broadphase *bp, int body, float t) {
+  cpr__broadphase_reserve(ctx, (void **)&bp->hits, &bp->hit_capacity, bp->hit_count + 1, sizeof(cpr__broadphase_hit));
+  bp->hits[bp->hit_count].body = body;
+  bp->hits[bp->hit_count].t = t;
+  ++bp->hit_count;
+}
+
+CPR_API_INTERN int cpr__broadphase_compare_hits(const void *a, const void *b) {
+  const cpr__broadphase_hit *ha = (const cpr__broadphase_hit *)a;
+  const cpr__broadphase_hit *hb = (const cpr__broadphase_hit *)b;
+  if (ha->t != hb->t) {
+    return ha->t < hb->t ? -1 : 1;
+  }
+  return ha->body - hb->body;
+}
+
+/* Start a new query: bodies are visited at most once per stamp */
+CPR_API_INTERN uint32_t cpr__broadphase_next_stamp(cpr__broadphase *bp) {
+  int i;
+  if (++bp->stamp == 0) {
+    for (i = 0; i < bp->body_used; ++i) {
+      bp->bodies[i].stamp = 0;
+    }
+    bp->stamp = 1;
+  }
+  return bp->stamp;
+}
+
+/* Spatial hash ***************************************************************/
+
+CPR_API_INTERN int cpr__broadphase_cell(cpr__broadphase *bp, float v) {
+  float c = floorf(v / bp->cell_size);
+  /* Out of range or NaN */
+  if (!(c > (float)-CPR__BROADPHASE_MAX_CELL)) {
+    return -CPR__BROADPHASE_MAX_CELL;
+  }
+  return c < (float)CPR__BROADPHASE_MAX_CELL ? (int)c : CPR__BROADPHASE_MAX_CELL;
+}
+
+CPR_API_INTERN unsigned cpr__broadphase_hash(cpr__broadphase *bp, int cx, int cy) {
+  return (((unsigned)cx * 73856093u) ^ ((unsigned)cy * 19349663u)) & (bp->bucket_count - 1);
+}
+
+/* Number of cells overlapped by the box. Cells are clamped: the spans can't
+ * overflow. */
+CPR_API_INTERN void cpr__broadphase_span(cpr__broadphase *bp, const cpr__broadphase_box *box, size_t *w, size_t *h) {
+  *w = (size_t)(cpr__broadphase_cell(bp, box->maxx) - cpr__broadphase_cell(bp, box->minx) + 1);
+  *h = (size_t)(cpr__broadphase_cell(bp, box->maxy) - cpr__broadphase_cell(bp, box->miny) + 1);
+}
+
+/* Reject a box spanning more cells than the hash can hold before it's added
+ * (the rebuild also checks the total of all the boxes) */
+CPR_API_INTERN void cpr__broadphase_check_span(duk_context *ctx, cpr__broadphase *bp, const cpr__broadphase_box *box) {
+  size_t w, h;
+  if (bp->type != CPR__BROADPHASE_HASH) {
+    return;
+  }
+  cpr__broadphase_span(bp, box, &w, &h);
+  if (h > CPR__BROADPHASE_MAX_ENTRIES / w) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "broadphase: too many cells (box too large for the cell size %f)", bp->cell_size);
+  }
+}
+
+/* Bin every body in the cells it overlaps. Entries are sorted by bucket with a
+ * counting sort so each bucket is a contiguous range of `entries`. */
+CPR_API_INTERN void cpr__broadphase_hash_rebuild(duk_context *ctx, cpr__broadphase *bp) {
+  int i, n = 0, cx, cy, cx0, cy0, cx1, cy1;
+  size_t w, h, total = 0;
+  unsigned b, buckets;
+  cpr__broadphase_body *body;
+  cpr__broadphase_entry *e;
+
+  if (!bp->dirty) {
+    return;
+  }
+  for (i = 0; i < bp->body_used; ++i) {
+    body = &bp->bodies[i];
+    if (body->alive) {
+      cpr__broadphase_span(bp, &body->box, &w, &h);
+      if (h > CPR__BROADPHASE_MAX_ENTRIES / w || w * h > CPR__BROADPHASE_MAX_ENTRIES - total) {
+        duk_error(ctx, DUK_ERR_RANGE_ERROR, "broadphase: too many cells (box %d too large for the cell size %f)", i, bp->cell_size);
+      }
+      total += w * h;
+    }
+  }
+  n = (int)total;
+  cpr__broadphase_reserve(ctx, (void **)&bp->entries, &bp->entry_capacity, n, sizeof(cpr__broadphase_entry));
+  cpr__broadphase_reserve(ctx, (void **)&bp->scratch, &bp->scratch_capacity, n, sizeof(cpr__broadphase_entry));
+
+  /* Power of two buckets count, about 2 buckets per entry */
+  for (buckets = CPR__BROADPHASE_MIN_BUCKETS; buckets < (unsigned)n * 2; buckets *= 2);
+  if (buckets != bp->bucket_count) {
+    free(bp->buckets);
+    if ((bp->buckets = (int *)malloc((buckets + 1) * sizeof(int))) == NULL) {
+      bp->bucket_count = 0;
+      duk_error(ctx, DUK_ERR_ALLOC_ERROR, "broadphase: out of memory");
+    }
+    bp->bucket_count = buckets;
+  }
+  memset(bp->buckets, 0, (bp->bucket_count + 1) * sizeof(int));
+
+  e = bp->scratch;
+  for (i = 0; i < bp->body_used; ++i) {
+    body = &bp->bodies[i];
+    if (!body->alive) {
+      continue;
+    }
+    cx0 = cpr__broadphase_cell(bp, body->box.minx);
+    cy0 = cpr__broadphase_cell(bp, body->box.miny);
+    cx1 = cpr__broadphase_cell(bp, body->box.maxx);
+    cy1 = cpr__broadphase_cell(bp, body->box.maxy);
+    for (cy = cy0; cy <= cy1; ++cy) {
+      for (cx = cx0; cx <= cx1; ++cx, ++e) {
+        e->cx = cx;
+        e->cy = cy;
+        e->body = i;
+        e->bucket = cpr__broadphase_hash(bp, cx, cy);
+        ++bp->buckets[e->bucket + 1];
+      }
+    }
+  }
+  for (b = 0; b < bp->bucket_count; ++b) {
+    bp->buckets[b + 1] += bp->buckets[b];
+  }
+  /* Scatter (bucket starts are restored afterward) */
+  for (i = 0; i < n; ++i) {
+    bp->entries[bp->buckets[bp->scratch[i].bucket]++] = bp->scratch[i];
+  }
+  for (b = bp->bucket_count; b > 0; --b) {
+    bp->buckets[b] = bp->buckets[b - 1];
+  }
+  bp->buckets[0] = 0;
+  bp->entry_count = n;
+  bp->dirty = 0;
+}
+
+CPR_API_INTERN void cpr__broadphase_hash_pairs(duk_context *ctx, cpr__broadphase *bp, cpr__broadphase_output *out) {
+  unsigned b;
+  int i, j;
+  cpr__broadphase_entry *ei, *ej;
+  const cpr__broadphase_box *ba, *bb;
+
+  cpr__broadphase_hash_rebuild(ctx, bp);
+  for (b = 0; b < bp->bucket_count; ++b) {
+    for (i = bp->buckets[b]; i < bp->buckets[b + 1]; ++i) {
+      ei = &bp->entries[i];
+      for (j = i + 1; j < bp->buckets[b + 1]; ++j) {
+        ej = &bp->entries[j];
+        if (ei->cx != ej->cx || ei->cy != ej->cy) {
+          continue;
+        }
+        ba = &bp->bodies[ei->body].box;
+        bb = &bp->bodies[ej->body].box;
+        if (!cpr__broadphase_overlap(ba, bb)) {
+          continue;
+        }
+        /* Boxes sharing several cells: only report the pair in the cell
+         * holding the top-left corner of their intersection */
+        if (cpr__broadphase_cell(bp, ba->minx > bb->minx ? ba->minx : bb->minx) == ei->cx &&
+            cpr__broadphase_cell(bp, ba->miny > bb->miny ? ba->miny : bb->miny) == ei->cy) {
+          cpr__broadphase_emit_pair(out, ei->body, ej->body);
+        }
+      }
+    }
+  }
+}
+
+CPR_API_INTERN void cpr__broadphase_hash_query(duk_context *ctx, cpr__broadphase *bp, const cpr__broadphase_box *box, cpr__broadphase_output *out) {
+  int i, cx, cy, cx0, cy0, cx1, cy1;
+  unsigned b;
+  uint32_t stamp;
+  cpr__broadphase_entry *e;
+  cpr__broadphase_body *body;
+
+  cpr__broadphase_hash_rebuild(ctx, bp);
+  stamp = cpr__broadphase_next_stamp(bp);
+  cx0 = cpr__broadphase_cell(bp, box->minx);
+  cy0 = cpr__broadphase_cell(bp, box->miny);
+  cx1 = cpr__broadphase_cell(bp, box->maxx);
+  cy1 = cpr__broadphase_cell(bp, box->maxy);
+  /* Rectangle larger than the hash content: test the bodies directly */
+  if ((double)(cx1 - cx0 + 1) * (double)(cy1 - cy0 + 1) > (double)bp->entry_count) {
+    for (i = 0; i < bp->body_used; ++i) {
+      if (bp->bodies[i].alive && cpr__broadphase_overlap(&bp->bodies[i].box, box)) {
+        cpr__broadphase_emit(out, i);
+      }
+    }
+    return;
+  }
+  for (cy = cy0; cy <= cy1; ++cy) {
+    for (cx = cx0; cx <= cx1; ++cx) {
+      b = cpr__broadphase_hash(bp, cx, cy);
+      for (i = bp->buckets[b]; i < bp->buckets[b + 1]; ++i) {
+        e = &bp->entries[i];
+        body = &bp->bodies[e->body];
+        if (e->cx != cx || e->cy != cy || body->stamp == stamp) {
+          continue;
+        }
+        body->stamp = stamp;
+        if (cpr__broadphase_overlap(&body->box, box)) {
+          cpr__broadphase_emit(out, e->body);
+        }
+      }
+    }
+  }
+}
+
+/* Walk the cells crossed by the segment in order (DDA). If `nearest` is set
+ * the walk stops as soon as no later cell can hold a closer hit. Hits are
+ * collected in `bp->hits`. */
+CPR_API_INTERN void cpr__broadphase_hash_raycast(duk_context *ctx, cpr__broadphase *bp, float x0, float y0, float x1, float y1, int nearest) {
+  int i, cx, cy, cx_end, cy_end, step_x, step_y;
+  unsigned b;
+  uint32_t stamp;
+  float dx = x1 - x0, dy = y1 - y0, t, best = 2.0f;
+  float t_max_x, t_max_y, t_delta_x, t_delta_y;
+  cpr__broadphase_entry *e;
+  cpr__broadphase_body *body;
+
+  cpr__broadphase_hash_rebuild(ctx, bp);
+  stamp = cpr__broadphase_next_stamp(bp);
+  cx = cpr__broadphase_cell(bp, x0);
+  cy = cpr__broadphase_cell(bp, y0);
+  cx_end = cpr__broadphase_cell(bp, x1);
+  cy_end = cpr__broadphase_cell(bp, y1);
+  step_x = dx > 0.0f ? 1 : (dx < 0.0f ? -1 : 0);
+  step_y = dy > 0.0f ? 1 : (dy < 0.0f ? -1 : 0);
+  t_delta_x = step_x ? bp->cell_size / fabsf(dx) : HUGE_VALF;
+  t_delta_y = step_y ? bp->cell_size / fabsf(dy) : HUGE_VALF;
+  t_max_x = step_x ? ((float)(cx + (step_x > 0)) * bp->cell_size - x0) / dx : HUGE_VALF;
+  t_max_y = step_y ? ((float)(cy + (step_y > 0)) * bp->cell_size - y0) / dy : HUGE_VALF;
+
+  for (;;) {
+    b = cpr__broadphase_hash(bp, cx, cy);
+    for (i = bp->buckets[b]; i < bp->buckets[b + 1]; ++i) {
+      e = &bp->entries[i];
+      body = &bp->bodies[e->body];
+      if (e->cx != cx || e->cy != cy || body->stamp == stamp) {
+        continue;
+      }
+      body->stamp = stamp;
+      if ((t = cpr__broadphase_ray_box(&body->box, x0, y0, dx, dy)) >= 0.0f) {
+        if (!nearest) {
+          cpr__broadphase_add_hit(ctx, bp, e->body, t);
+        } else if (t < best || (t == best && e->body < bp->hits[0].body)) {
+          best = t;
+          bp->hit_count = 0;
+          cpr__broadphase_add_hit(ctx, bp, e->body, t);
+        }
+      }
+    }
+    /* A hit before the cell exit can't be beaten by the next cells */
+    if ((cx == cx_end && cy == cy_end) || (nearest && best <= (t_max_x < t_max_y ? t_max_x : t_max_y))) {
+      break;
+    }
+    if (t_max_x < t_max_y) {
+      if (t_max_x > 1.0f) break;
+      cx += step_x;
+      t_max_x += t_delta_x;
+    } else {
+      if (t_max_y > 1.0f) break;
+      cy += step_y;
+      t_max_y += t_delta_y;
+    }
+  }
+}
+
+/* AABB tree ******************************************************************/
+
+CPR_API_INTERN int cpr__broadphase_alloc_node(duk_context *ctx, cpr__broadphase *bp) {
+  int i, n, capacity = bp->node_capacity;
+  cpr__broadphase_node *node;
+
+  if (bp->free_node == CPR__BROADPHASE_NULL) {
+    cpr__broadphase_reserve(ctx, (void **)&bp->nodes, &bp->node_capacity, capacity + 1, sizeof(cpr__broadphase_node));
+    /* Thread the new nodes in the free list */
+    for (i = capacity; i < bp->node_capacity; ++i) {
+      bp->nodes[i].parent = i + 1 < bp->node_capacity ? i + 1 : CPR__BROADPHASE_NULL;
+      bp->nodes[i].height = -1;
+    }
+    bp->free_node = capacity;
+  }
+  n = bp->free_node;
+  node = &bp->nodes[n];
+  bp->free_node = node->parent;
+  node->parent = CPR__BROADPHASE_NULL;
+  node->child1 = CPR__BROADPHASE_NULL;
+  node->child2 = CPR__BROADPHASE_NULL;
+  node->height = 0;
+  node->body = CPR__BROADPHASE_NULL;
+  return n;
+}
+
+CPR_API_INTERN void cpr__broadphase_free_node(cpr__broadphase *bp, int n) {
+  bp->nodes[n].parent = bp->free_node;
+  bp->nodes[n].height = -1;
+  bp->free_node = n;
+}
+
+CPR_API_INTERN void cpr__broadphase_fix_node(cpr__broadphase *bp, int n) {
+  cpr__broadphase_node *node = &bp->nodes[n];
+  cpr__broadphase_node *c1 = &bp->nodes[node->child1];
+  cpr__broadphase_node *c2 = &bp->nodes[node->child2];
+  node->height = 1 + (c1->height > c2->height ? c1->height : c2->height);
+  node->box = cpr__broadphase_union(&c1->box, &c2->box);
+}
+
+/* Rotate the node `ia` with its taller child if its sub trees heights differ
+ * by more than one. Return the new root of the sub tree. */
+CPR_API_INTERN int cpr__broadphase_balance(cpr__broadphase *bp, int ia) {
+  cpr__broadphase_node *a = &bp->nodes[ia], *up, *parent;
+  int iup, keep, move, balance;
+
+  if (a->child1 == CPR__BROADPHASE_NULL || a->height < 2) {
+    return ia;
+  }
+  balance = bp->nodes[a->child2].height - bp->nodes[a->child1].height;
+  if (balance > -2 && balance < 2) {
+    return ia;
+  }
+  iup = balance > 0 ? a->child2 : a->child1;
+  up = &bp->nodes[iup];
+
+  /* `up` replaces `a` in its parent */
+  up->parent = a->parent;
+  a->parent = iup;
+  if (up->parent == CPR__BROADPHASE_NULL) {
+    bp->root = iup;
+  } else {
+    parent = &bp->nodes[up->parent];
+    if (parent->child1 == ia) {
+      parent->child1 = iup;
+    } else {
+      parent->child2 = iup;
+    }
+  }
+
+  /* `up` keeps its taller child and adopts `a`, `a` adopts the other child */
+  if (bp->nodes[up->child1].height > bp->nodes[up->child2].height) {
+    keep = up->child1;
+    move = up->child2;
+  } else {
+    keep = up->child2;
+    move = up->child1;
+  }
+  up->child1 = keep;
+  up->child2 = ia;
+  if (a->child1 == iup) {
+    a->child1 = move;
+  } else {
+    a->child2 = move;
+  }
+  bp->nodes[move].parent = ia;
+
+  cpr__broadphase_fix_node(bp, ia);
+  cpr__broadphase_fix_node(bp, iup);
+  return iup;
+}
+
+CPR_API_INTERN void cpr__broadphase_insert_leaf(duk_context *ctx, cpr__broadphase *bp, int leaf) {
+  int index, sibling, old_parent, new_parent;
+  float area, combined, cost, inheritance, cost1, cost2;
+  cpr__broadphase_box box, u;
+  cpr__broadphase_node *node, *c1, *c2;
+
+  if (bp->root == CPR__BROADPHASE_NULL) {
+    bp->root = leaf;
+    bp->nodes[leaf].parent = CPR__BROADPHASE_NULL;
+    return;
+  }
+
+  /* Find the best sibling with the perimeter cost heuristic */
+  box = bp->nodes[leaf].box;
+  index = bp->root;
+  while (bp->nodes[index].child1 != CPR__BROADPHASE_NULL) {
+    node = &bp->nodes[index];
+    c1 = &bp->nodes[node->child1];
+    c2 = &bp->nodes[node->child2];
+    area = cpr__broadphase_perimeter(&node->box);
+    u = cpr__broadphase_union(&node->box, &box);
+    combined = cpr__broadphase_perimeter(&u);
+    cost = 2.0f * combined;
+    inheritance = 2.0f * (combined - area);
+    u = cpr__broadphase_union(&c1->box, &box);
+    cost1 = cpr__broadphase_perimeter(&u) + inheritance;
+    if (c1->child1 != CPR__BROADPHASE_NULL) {
+      cost1 -= cpr__broadphase_perimeter(&c1->box);
+    }
+    u = cpr__broadphase_union(&c2->box, &box);
+    cost2 = cpr__broadphase_perimeter(&u) + inheritance;
+    if (c2->child1 != CPR__BROADPHASE_NULL) {
+      cost2 -= cpr__broadphase_perimeter(&c2->box);
+    }
+    if (cost < cost1 && cost < cost2) {
+      break;
+    }
+    index = cost1 < cost2 ? node->child1 : node->child2;
+  }
+  sibling = index;
+
+  /* New parent of the leaf and its sibling. Nodes may be reallocated. */
+  new_parent = cpr__broadphase_alloc_node(ctx, bp);
+  old_parent = bp->nodes[sibling].parent;
+  node = &bp->nodes[new_parent];
+  node->parent = old_parent;
+  node->box = cpr__broadphase_union(&box, &bp->nodes[sibling].box);
+  node->height = bp->nodes[sibling].height + 1;
+  node->child1 = sibling;
+  node->child2 = leaf;
+  bp->nodes[sibling].parent = new_parent;
+  bp->nodes[leaf].parent = new_parent;
+  if (old_parent == CPR__BROADPHASE_NULL) {
+    bp->root = new_parent;
+  } else if (bp->nodes[old_parent].child1 == sibling) {
+    bp->nodes[old_parent].child1 = new_parent;
+  } else {
+    bp->nodes[old_parent].child2 = new_parent;
+  }
+
+  /* Refit and balance the ancestors */
+  for (index = bp->nodes[leaf].parent; index != CPR__BROADPHASE_NULL; index = bp->nodes[index].parent) {
+    index = cpr__broadphase_balance(bp, index);
+    cpr__broadphase_fix_node(bp, index);
+  }
+}
+
+CPR_API_INTERN void cpr__broadphase_remove_leaf(cpr__broadphase *bp, int leaf) {
+  int parent, grand_parent, sibling, index;
+
+  if (leaf == bp->root) {
+    bp->root = CPR__BROADPHASE_NULL;
+    return;
+  }
+  parent = bp->nodes[leaf].parent;
+  grand_parent = bp->nodes[parent].parent;
+  sibling = bp->nodes[parent].child1 == leaf ? bp->nodes[parent].child2 : bp->nodes[parent].child1;
+
+  cpr__broadphase_free_node(bp, parent);
+  if (grand_parent == CPR__BROADPHASE_NULL) {
+    bp->root = sibling;
+    bp->nodes[sibling].parent = CPR__BROADPHASE_NULL;
+    return;
+  }
+  if (bp->nodes[grand_parent].child1 == parent) {
+    bp->nodes[grand_parent].child1 = sibling;
+  } else {
+    bp->nodes[grand_parent].child2 = sibling;
+  }
+  bp->nodes[sibling].parent = grand_parent;
+  for (index = grand_parent; index != CPR__BROADPHASE_NULL; index = bp->nodes[index].parent) {
+    index = cpr__broadphase_balance(bp, index);
+    cpr__broadphase_fix_node(bp, index);
+  }
+}
+
+/* Insert or move the leaf of a body. The leaf is only moved when the body box
+ * leaves its fat box. */
+CPR_API_INTERN void cpr__broadphase_tree_update(duk_context *ctx, cpr__broadphase *bp, int id) {
+  cpr__broadphase_body *body = &bp->bodies[id];
+  cpr__broadphase_box fat;
+
+  if (body->leaf != CPR__BROADPHASE_NULL) {
+    if (cpr__broadphase_contains(&bp->nodes[body->leaf].box, &body->box)) {
+      return;
+    }
+    cpr__broadphase_remove_leaf(bp, body->leaf);
+  } else {
+    body->leaf = cpr__broadphase_alloc_node(ctx, bp);
+    /* `body` is still valid: only the nodes have been reallocated */
+    bp->nodes[body->leaf].body = id;
+  }
+  fat.minx = body->box.minx - bp->margin;
+  fat.miny = body->box.miny - bp->margin;
+  fat.maxx = body->box.maxx + bp->margin;
+  fat.maxy = body->box.maxy + bp->margin;
+  bp->nodes[body->leaf].box = fat;
+  cpr__broadphase_insert_leaf(ctx, bp, body->leaf);
+}
+
+CPR_API_INTERN void cpr__broadphase_push(duk_context *ctx, cpr__broadphase *bp, int *top, int n) {
+  cpr__broadphase_reserve(ctx, (void **)&bp->stack, &bp->stack_capacity, *top + 1, sizeof(int));
+  bp->stack[(*top)++] = n;
+}
+
+/* Report the bodies overlapping `box`. If `pair_with` is a body only the
+ * bodies with a greater handle are reported as pairs. */
+CPR_API_INTERN void cpr__broadphase_tree_query(duk_context *ctx, cpr__broadphase *bp, const cpr__broadphase_box *box, int pair_with, cpr__broadphase_output *out) {
+  int top = 0;
+  cpr__broadphase_node *node;
+
+  if (bp->root == CPR__BROADPHASE_NULL) {
+    return;
+  }
+  cpr__broadphase_push(ctx, bp, &top, bp->root);
+  while (top > 0) {
+    node = &bp->nodes[bp->stack[--top]];
+    if (!cpr__broadphase_overlap(&node->box, box)) {
+      continue;
+    }
+    if (node->child1 != CPR__BROADPHASE_NULL) {
+      cpr__broadphase_push(ctx, bp, &top, node->child1);
+      cpr__broadphase_push(ctx, bp, &top, node->child2);
+    } else if (pair_with == CPR__BROADPHASE_NULL) {
+      if (cpr__broadphase_overlap(&bp->bodies[node->body].box, box)) {
+        cpr__broadphase_emit(out, node->body);
+      }
+    } else if (node->body > pair_with && cpr__broadphase_overlap(&bp->bodies[node->body].box, box)) {
+      cpr__broadphase_emit_pair(out, pair_with, node->body);
+    }
+  }
+}
+
+CPR_API_INTERN void cpr__broadphase_tree_raycast(duk_context *ctx, cpr__broadphase *bp, float x0, float y0, float x1, float y1, int nearest) {
+  int top = 0;
+  float dx = x1 - x0, dy = y1 - y0, t, best = 2.0f;
+  cpr__broadphase_node *node;
+
+  if (bp->root == CPR__BROADPHASE_NULL) {
+    return;
+  }
+  cpr__broadphase_push(ctx, bp, &top, bp->root);
+  while (top > 0) {
+    node = &bp->nodes[bp->stack[--top]];
+    t = cpr__broadphase_ray_box(&node->box, x0, y0, dx, dy);
+    if (t < 0.0f || (nearest && t > best)) {
+      continue;
+    }
+    if (node->child1 != CPR__BROADPHASE_NULL) {
+      cpr__broadphase_push(ctx, bp, &top, node->child1);
+      cpr__broadphase_push(ctx, bp, &top, node->child2);
+      continue;
+    }
+    if ((t = cpr__broadphase_ray_box(&bp->bodies[node->body].box, x0, y0, dx, dy)) < 0.0f) {
+      continue;
+    }
+    if (!nearest) {
+      cpr__broadphase_add_hit(ctx, bp, node->body, t);
+    } else if (t < best || (t == best && node->body < bp->hits[0].body)) {
+      best = t;
+      bp->hit_count = 0;
+      cpr__broadphase_add_hit(ctx, bp, node->body, t);
+    }
+  }
+}
+
+/* Bodies *********************************************************************/
+
+CPR_API_INTERN cpr__broadphase *cpr__broadphase_require(duk_context *ctx, duk_idx_t idx) {
+  cpr__broadphase *bp = duk_require_pointer(ctx, idx);
+  if (bp == NULL) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "invalid broadphase (NULL)");
+  }
+  return bp;
+}
+
+CPR_API_INTERN int cpr__broadphase_require_body(duk_context *ctx, cpr__broadphase *bp, duk_idx_t idx) {
+  int id = duk_require_int(ctx, idx);
+  if (id < 0 || id >= bp->body_used || !bp->bodies[id].alive) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid broadphase handle %d", id);
+  }
+  return id;
+}
+
+CPR_API_INTERN cpr__broadphase_box cpr__broadphase_make_box(duk_context *ctx, float x, float y, float w, float h) {
+  cpr__broadphase_box box;
+  /* Comparisons are false for NaN */
+  if (!(w >= 0.0f && h >= 0.0f && fabsf(x) < HUGE_VALF && fabsf(y) < HUGE_VALF && x + w < HUGE_VALF && y + h < HUGE_VALF)) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid box (%f,%f,%f,%f)", x, y, w, h);
+  }
+  box.minx = x;
+  box.miny = y;
+  box.maxx = x + w;
+  box.maxy = y + h;
+  return box;
+}
+
+CPR_API_INTERN cpr__broadphase_box cpr__broadphase_require_box(duk_context *ctx, duk_idx_t idx) {
+  return cpr__broadphase_make_box(ctx,
+    (float)duk_require_number(ctx, idx), (float)duk_require_number(ctx, idx + 1),
+    (float)duk_require_number(ctx, idx + 2), (float)duk_require_number(ctx, idx + 3));
+}
+
+CPR_API_INTERN void cpr__broadphase_set_box(duk_context *ctx, cpr__broadphase *bp, int id, const cpr__broadphase_box *box) {
+  bp->bodies[id].box = *box;
+  if (bp->type == CPR__BROADPHASE_TREE) {
+    cpr__broadphase_tree_update(ctx, bp, id);
+  } else {
+    bp->dirty = 1;
+  }
+}
+
+CPR_API_INTERN void cpr__broadphase_require_output(duk_context *ctx, duk_idx_t idx, cpr__broadphase_output *out) {
+  duk_size_t size;
+  out->data = (int32_t *)duk_require_buffer_data(ctx, idx, &size);
+  out->size = (int)(size / sizeof(int32_t));
+  out->count = 0;
+}
+
+/* Binding API */
+
+/* broadphase.create(type [, param])
+ * `param` is the cell size of a HASH (default 64) or the leaves margin of a
+ * TREE (default 4). */
+CPR_API_INTERN duk_ret_t cpr_broadphase_create(duk_context *ctx) {
+  cpr__broadphase *bp;
+  int type = duk_require_int(ctx, 0);
+  double param;
+
+  if (type != CPR__BROADPHASE_HASH && type != CPR__BROADPHASE_TREE) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid broadphase type %d", type);
+  }
+  if (duk_is_null_or_undefined(ctx, 1)) {
+    param = type == CPR__BROADPHASE_HASH ? CPR__BROADPHASE_DEFAULT_CELL : CPR__BROADPHASE_DEFAULT_MARGIN;
+  } else {
+    param = duk_require_number(ctx, 1);
+  }
+  if (type == CPR__BROADPHASE_HASH ? !(param > 0.0) : !(param >= 0.0)) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid broadphase parameter %f", param);
+  }
+  if ((bp = (cpr__broadphase *)calloc(1, sizeof(cpr__broadphase))) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "broadphase: out of memory");
+  }
+  bp->type = type;
+  bp->cell_size = (float)param;
+  bp->margin = (float)param;
+  bp->free_body = CPR__BROADPHASE_NULL;
+  bp->free_node = CPR__BROADPHASE_NULL;
+  bp->root = CPR__BROADPHASE_NULL;
+  duk_push_pointer(ctx, bp);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr_broadphase_destroy(duk_context *ctx) {
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+  free(bp->bodies);
+  free(bp->entries);
+  free(bp->scratch);
+  free(bp->buckets);
+  free(bp->nodes);
+  free(bp->stack);
+  free(bp->hits);
+  free(bp);
+  return 0;
+}
+
+/* broadphase.add(bp, x, y, width, height) -> handle */
+CPR_API_INTERN duk_ret_t cpr_broadphase_add(duk_context *ctx) {
+  int id;
+  cpr__broadphase_body *body;
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+  cpr__broadphase_box box = cpr__broadphase_require_box(ctx, 1);
+
+  cpr__broadphase_check_span(ctx, bp, &box);
+  if (bp->free_body != CPR__BROADPHASE_NULL) {
+    id = bp->free_body;
+    bp->free_body = bp->bodies[id].next;
+  } else {
+    cpr__broadphase_reserve(ctx, (void **)&bp->bodies, &bp->body_capacity, bp->body_used + 1, sizeof(cpr__broadphase_body));
+    id = bp->body_used++;
+  }
+  body = &bp->bodies[id];
+  body->alive = 1;
+  body->leaf = CPR__BROADPHASE_NULL;
+  body->stamp = 0;
+  ++bp->body_count;
+  cpr__broadphase_set_box(ctx, bp, id, &box);
+  duk_push_int(ctx, id);
+  return 1;
+}
+
+/* broadphase.remove(bp, handle)
+ * The handle may be returned again by a later `add`. */
+CPR_API_INTERN duk_ret_t cpr_broadphase_remove(duk_context *ctx) {
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+  int id = cpr__broadphase_require_body(ctx, bp, 1);
+  cpr__broadphase_body *body = &bp->bodies[id];
+
+  if (body->leaf != CPR__BROADPHASE_NULL) {
+    cpr__broadphase_remove_leaf(bp, body->leaf);
+    cpr__broadphase_free_node(bp, body->leaf);
+  }
+  body->alive = 0;
+  body->next = bp->free_body;
+  bp->free_body = id;
+  --bp->body_count;
+  bp->dirty = 1;
+  return 0;
+}
+
+/* broadphase.move(bp, handle, x, y, width, height) */
+CPR_API_INTERN duk_ret_t cpr_broadphase_move(duk_context *ctx) {
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+  int id = cpr__broadphase_require_body(ctx, bp, 1);
+  cpr__broadphase_box box = cpr__broadphase_require_box(ctx, 2);
+  cpr__broadphase_check_span(ctx, bp, &box);
+  cpr__broadphase_set_box(ctx, bp, id, &box);
+  return 0;
+}
+
+/* broadphase.update(bp, boxes [, handles])
+ * Bulk move from a Float32Array of (x, y, width, height) boxes. Box i belongs
+ * to handles[i] or, without handles, to the handle i (removed handles are
+ * skipped). */
+CPR_API_INTERN duk_ret_t cpr_broadphase_update(duk_context *ctx) {
+  duk_size_t size, handles_size = 0;
+  const float *boxes;
+  const int32_t *handles = NULL;
+  int i, n, id;
+  cpr__broadphase_box box;
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+
+  boxes = (const float *)duk_require_buffer_data(ctx, 1, &size);
+  n = (int)(size / (4 * sizeof(float)));
+  if (!duk_is_null_or_undefined(ctx, 2)) {
+    handles = (const int32_t *)duk_require_buffer_data(ctx, 2, &handles_size);
+    if ((duk_size_t)n > handles_size / sizeof(int32_t)) {
+      n = (int)(handles_size / sizeof(int32_t));
+    }
+  } else if (n > bp->body_used) {
+    n = bp->body_used;
+  }
+
+  for (i = 0; i < n; ++i, boxes += 4) {
+    id = handles ? handles[i] : i;
+    if (id < 0 || id >= bp->body_used || !bp->bodies[id].alive) {
+      if (handles) {
+        duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid broadphase handle %d", id);
+      }
+      continue;
+    }
+    box = cpr__broadphase_make_box(ctx, boxes[0], boxes[1], boxes[2], boxes[3]);
+    cpr__broadphase_check_span(ctx, bp, &box);
+    cpr__broadphase_set_box(ctx, bp, id, &box);
+  }
+  return 0;
+}
+
+/* broadphase.pairs(bp, out) -> number of overlapping pairs
+ * Write the pairs of handles (a, b) with a < b into the Int32Array `out`. */
+CPR_API_INTERN duk_ret_t cpr_broadphase_pairs(duk_context *ctx) {
+  int i;
+  cpr__broadphase_output out;
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+
+  cpr__broadphase_require_output(ctx, 1, &out);
+  if (bp->type == CPR__BROADPHASE_HASH) {
+    cpr__broadphase_hash_pairs(ctx, bp, &out);
+  } else {
+    for (i = 0; i < bp->body_used; ++i) {
+      if (bp->bodies[i].alive) {
+        cpr__broadphase_tree_query(ctx, bp, &bp->bodies[i].box, i, &out);
+      }
+    }
+  }
+  duk_push_int(ctx, out.count);
+  return 1;
+}
+
+/* broadphase.queryRect(bp, x, y, width, height, out) -> number of handles */
+CPR_API_INTERN duk_ret_t cpr_broadphase_query_rect(duk_context *ctx) {
+  cpr__broadphase_output out;
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+  cpr__broadphase_box box = cpr__broadphase_require_box(ctx, 1);
+
+  cpr__broadphase_require_output(ctx, 5, &out);
+  if (bp->type == CPR__BROADPHASE_HASH) {
+    cpr__broadphase_hash_query(ctx, bp, &box, &out);
+  } else {
+    cpr__broadphase_tree_query(ctx, bp, &box, CPR__BROADPHASE_NULL, &out);
+  }
+  duk_push_int(ctx, out.count);
+  return 1;
+}
+
+CPR_API_INTERN void cpr__broadphase_raycast(duk_context *ctx, cpr__broadphase *bp, int nearest) {
+  float x0, y0, x1, y1;
+
+  x0 = (float)duk_require_number(ctx, 1);
+  y0 = (float)duk_require_number(ctx, 2);
+  x1 = (float)duk_require_number(ctx, 3);
+  y1 = (float)duk_require_number(ctx, 4);
+  cpr__broadphase_make_box(ctx, x0, y0, 0.0f, 0.0f);
+  cpr__broadphase_make_box(ctx, x1, y1, 0.0f, 0.0f);
+  bp->hit_count = 0;
+  if (bp->type == CPR__BROADPHASE_HASH) {
+    cpr__broadphase_hash_raycast(ctx, bp, x0, y0, x1, y1, nearest);
+  } else {
+    cpr__broadphase_tree_raycast(ctx, bp, x0, y0, x1, y1, nearest);
+  }
+}
+
+/* broadphase.raycast(bp, x0, y0, x1, y1) -> nearest handle hit or -1 */
+CPR_API_INTERN duk_ret_t cpr_broadphase_raycast(duk_context *ctx) {
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+  cpr__broadphase_raycast(ctx, bp, 1);
+  duk_push_int(ctx, bp->hit_count > 0 ? bp->hits[0].body : -1);
+  return 1;
+}
+
+/* broadphase.raycastAll(bp, x0, y0, x1, y1, out) -> number of handles
+ * Write the handles hit by the segment sorted by distance into `out`. */
+CPR_API_INTERN duk_ret_t cpr_broadphase_raycast_all(duk_context *ctx) {
+  int i;
+  cpr__broadphase_output out;
+  cpr__broadphase *bp = cpr__broadphase_require(ctx, 0);
+
+  cpr__broadphase_require_output(ctx, 5, &out);
+  cpr__broadphase_raycast(ctx, bp, 0);
+  qsort(bp->hits, bp->hit_count, sizeof(cpr__broadphase_hit), cpr__broadphase_compare_hits);
+  for (i = 0; i < bp->hit_count; ++i) {
+    cpr__broadphase_emit(&out, bp->hits[i].body);
+  }
+  duk_push_int(ctx, out.count);
+  return 1;
+}
+
+/* broadphase.count(bp) -> number of bodies */
+CPR_API_INTERN duk_ret_t cpr_broadphase_count(duk_context *ctx) {
+  duk_push_int(ctx, cpr__broadphase_require(ctx, 0)->body_count);
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_broadphase(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "create",       cpr_broadphase_create,      2 },
+    { "destroy",      cpr_broadphase_destroy,     1 },
+    { "add",          cpr_broadphase_add,         5 },
+    { "remove",       cpr_broadphase_remove,      2 },
+    { "move",         cpr_broadphase_move,        6 },
+    { "update",       cpr_broadphase_update,      3 },
+    { "pairs",        cpr_broadphase_pairs,       2 },
+    { "queryRect",    cpr_broadphase_query_rect,  6 },
+    { "raycast",      cpr_broadphase_raycast,     5 },
+    { "raycastAll",   cpr_broadphase_raycast_all, 6 },
+    { "count",        cpr_broadphase_count,       1 },
+    { NULL, NULL, 0 }
+  };
+
+  const duk_number_list_entry module_consts[] = {
+    { "HASH", (double)CPR__BROADPHASE_HASH },
+    { "TREE", (double)CPR__BROADPHASE_TREE },
+    { NULL, 0.0 }
+  };
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+  duk_put_number_list(ctx, -1, module_consts);
+
+  return 1;  /* return module value */
+}
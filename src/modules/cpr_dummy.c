@@ -1,5 +1,10 @@
 #include "cpr_dummy.h"
 #include "cpr_macros.h"
+#include "cpr_jobs.h"
+#include "cpr_duktape_helpers.h"
+#include "cpr_native.h"
+
+#include <stdlib.h> /* malloc, free */
 
 CPR_API_INTERN duk_ret_t foo(duk_context *ctx)
 {
@@ -7,8 +12,99 @@ CPR_API_INTERN duk_ret_t foo(duk_context *ctx)
   return 0;
 }
 
+/* Used to measure the binding call overhead (bench/bindings.coffee) */
+CPR_API_INTERN duk_ret_t noop(duk_context *ctx)
+{
+  return 0;
+}
+
+CPR_API_INTERN void square_range(void *data, int begin, int end)
+{
+  double *values = data;
+  int i;
+  for (i = begin; i < end; ++i) {
+    values[i] *= values[i];
+  }
+}
+
+/* Square the values of a Float64Array in a parallel-for job (tests/jobs.coffee) */
+CPR_API_INTERN duk_ret_t squares(duk_context *ctx)
+{
+  duk_size_t size;
+  double *values = duk_require_buffer_data(ctx, 0, &size);
+  cpr_job *job = cpr_job_create_for((int)(size / sizeof(double)), duk_get_int(ctx, 1), square_range, values);
+
+  if (job == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the job");
+  }
+  cpr_jobs_push_handle(ctx, job);
+  duk_dup(ctx, 0);
+  duk_put_prop_string(ctx, -2, "values");
+  cpr_job_submit(job);
+  cpr_job_release(job);
+  return 1;
+}
+
+/* Native handles (tests/native.coffee). The freed counters are counted per
+ * heap: the state of a counter is the heap count (see cpr_get_heap_state). */
+#define COUNTERS_FREED "cprDummyCountersFreed"
+
+CPR_API_INTERN void finalize_counter(void *ptr, void *state)
+{
+  free(ptr);
+  ++*(int *)state;
+}
+
+static const cpr_native_type counter_type = { "DummyCounter", finalize_counter };
+
+CPR_API_INTERN duk_ret_t counter(duk_context *ctx)
+{
+  int *value = malloc(sizeof(int));
+  if (value == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the counter");
+  }
+  *value = duk_get_int(ctx, 0);
+  cpr_native_push(ctx, &counter_type, value, cpr_get_heap_state(ctx, COUNTERS_FREED, sizeof(int)));
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t increment(duk_context *ctx)
+{
+  int *value = cpr_native_require(ctx, 0, counter_type.name)->ptr;
+  duk_push_int(ctx, ++*value);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t destroy_counter(duk_context *ctx)
+{
+  cpr_native_destroy(cpr_native_require(ctx, 0, counter_type.name));
+  return 0;
+}
+
+CPR_API_INTERN duk_ret_t counters_freed(duk_context *ctx)
+{
+  duk_push_int(ctx, *(int *)cpr_get_heap_state(ctx, COUNTERS_FREED, sizeof(int)));
+  return 1;
+}
+
+/* Times the library was initialized since it was opened (tests/unload.coffee) */
+static int _opened = 0;
+
+CPR_API_INTERN duk_ret_t opened(duk_context *ctx)
+{
+  duk_push_int(ctx, _opened);
+  return 1;
+}
+
 CPR_API_INTERN const duk_function_list_entry module_funcs[] = {
   { "foo", foo, 1 },
+  { "noop", noop, 0 },
+  { "squares", squares, 2 },
+  { "counter", counter, 1 },
+  { "increment", increment, 1 },
+  { "destroyCounter", destroy_counter, 1 },
+  { "countersFreed", counters_freed, 0 },
+  { "opened", opened, 0 },
   { NULL, NULL, 0 }
 };
 
@@ -21,8 +117,9 @@ CPR_API_INTERN const duk_number_list_entry module_consts[] = {
 
 CPR_API_EXTERN duk_ret_t dukopen_dummy(duk_context *ctx) {
   DBG(ctx, "dukopen_dummy");
-  duk_push_object(ctx);  /* module result */
-  duk_put_function_list(ctx, -1, module_funcs);
+  ++_opened;
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_lazy(ctx, -1, module_funcs);
   duk_put_number_list(ctx, -1, module_consts);
 
   return 1;  /* return module value */
@@ -0,0 +1,662 @@
+/*
+ * cpr_ecs.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Entity-component storage.
+ * Entities are grouped by archetype (the set of components they own). Each
+ * archetype stores its components structure-of-arrays: one column per
+ * component field. Columns are allocated in C and exposed to scripts as
+ * Float32Array/Int32Array views on external buffers, so systems can run tight
+ * typed array loops over the `count` first rows of each archetype returned by
+ * a query.
+ *
+ * Views must not be kept across structural changes (create, destroy, add or
+ * remove): when an archetype grows its columns are reallocated and its views
+ * are replaced. Old views are redirected to the new memory but keep their
+ * previous length. After `destroyWorld` all views are empty.
+ */
+
+#include "cpr_ecs.h"
+#include "cpr_macros.h"
+#include "cpr_duktape_helpers.h"
+
+#include <stdint.h>
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* memcpy, memset */
+
+#define CPR__ECS_FLOAT32            1
+#define CPR__ECS_INT32              2
+#define CPR__ECS_MAX_COMPONENTS     32
+#define CPR__ECS_MAX_FIELDS         16
+#define CPR__ECS_INITIAL_CAPACITY   64
+/* Entity id: generation (11 bits) and record index (20 bits) */
+#define CPR__ECS_INDEX_BITS         20
+#define CPR__ECS_INDEX_MASK         ((1 << CPR__ECS_INDEX_BITS) - 1)
+#define CPR__ECS_MAX_ENTITIES       (1 << CPR__ECS_INDEX_BITS)
+#define CPR__ECS_GENERATION_MASK    ((1 << (31 - CPR__ECS_INDEX_BITS)) - 1)
+#define CPR__ECS_ENTITY_ID(__gen__, __idx__) (((__gen__) << CPR__ECS_INDEX_BITS) | (__idx__))
+/* Global stash object holding the scripting side of every world */
+#define CPR__ECS_STASH_KEY          "cpr_ecs"
+
+typedef struct cpr__ecs_component {
+  int type;
+  int fields;
+} cpr__ecs_component;
+
+typedef struct cpr__ecs_column {
+  void *data;     /* capacity * 4 bytes */
+  void *buffer;   /* heap pointer of the external buffer wrapping `data` */
+} cpr__ecs_column;
+
+typedef struct cpr__ecs_archetype {
+  uint32_t mask;
+  int count;
+  int capacity;
+  int32_t *entities;
+  void *entities_buffer;
+  /* Field columns of each component (NULL if not part of the archetype) */
+  cpr__ecs_column *columns[CPR__ECS_MAX_COMPONENTS];
+  void *object;   /* heap pointer of the archetype script object */
+} cpr__ecs_archetype;
+
+typedef struct cpr__ecs_record {
+  int archetype;  /* -1 if the record is free */
+  int row;        /* next free record if the record is free */
+  int generation;
+} cpr__ecs_record;
+
+typedef struct cpr__ecs_world {
+  cpr__ecs_component components[CPR__ECS_MAX_COMPONENTS];
+  int component_count;
+  cpr__ecs_archetype *archetypes;
+  int archetype_count;
+  int archetype_capacity;
+  cpr__ecs_record *records;
+  int record_count;
+  int record_capacity;
+  int free_head;  /* first free record or -1 */
+  /* Heap pointer of the world script object, kept reachable in the stash */
+  void *holder;
+} cpr__ecs_world;
+
+CPR_API_INTERN void *cpr__ecs_alloc(duk_context *ctx, void *ptr, size_t size) {
+  void *res = realloc(ptr, size);
+  if (res == NULL && size > 0) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "ecs: out of memory");
+  }
+  return res;
+}
+
+/* Push the external buffer wrapping `data` and return its heap pointer. The
+ * buffer is appended to the holder `buffers` array so it stays reachable. */
+CPR_API_INTERN void *cpr__ecs_push_buffer(duk_context *ctx, cpr__ecs_world *w, void *data, duk_size_t size) {
+  void *ptr;
+  duk_push_external_buffer(ctx);
+  duk_config_buffer(ctx, -1, data, size);
+  ptr = duk_get_heapptr(ctx, -1);
+  duk_push_heapptr(ctx, w->holder);
+  duk_get_prop_string(ctx, -1, "buffers");
+  duk_dup(ctx, -3);
+  duk_put_prop_index(ctx, -2, (duk_uarridx_t)duk_get_length(ctx, -2));
+  duk_pop_3(ctx);
+  return ptr;
+}
+
+CPR_API_INTERN void cpr__ecs_push_view(duk_context *ctx, void *buffer, int type, int capacity) {
+  duk_push_heapptr(ctx, buffer);
+  duk_push_buffer_object(ctx, -1, 0, (duk_size_t)capacity * 4,
+    type == CPR__ECS_INT32 ? DUK_BUFOBJ_INT32ARRAY : DUK_BUFOBJ_FLOAT32ARRAY);
+  duk_remove(ctx, -2); /* plain buffer */
+}
+
+CPR_API_INTERN void cpr__ecs_update_count(duk_context *ctx, cpr__ecs_archetype *a) {
+  duk_push_heapptr(ctx, a->object);
+  duk_push_int(ctx, a->count);
+  duk_put_prop_string(ctx, -2, "count");
+  duk_pop(ctx);
+}
+
+/* (Re)create the typed array views of the archetype object */
+CPR_API_INTERN void cpr__ecs_update_views(duk_context *ctx, cpr__ecs_world *w, cpr__ecs_archetype *a) {
+  int c, f;
+
+  duk_push_heapptr(ctx, a->object);
+  cpr__ecs_push_view(ctx, a->entities_buffer, CPR__ECS_INT32, a->capacity);
+  duk_put_prop_string(ctx, -2, "entities");
+  duk_push_array(ctx);
+  for (c = 0; c < w->component_count; ++c) {
+    if (a->columns[c] == NULL) {
+      continue;
+    }
+    duk_push_array(ctx);
+    for (f = 0; f < w->components[c].fields; ++f) {
+      cpr__ecs_push_view(ctx, a->columns[c][f].buffer, w->components[c].type, a->capacity);
+      duk_put_prop_index(ctx, -2, f);
+    }
+    duk_put_prop_index(ctx, -2, c);
+  }
+  duk_put_prop_string(ctx, -2, "columns");
+  duk_push_int(ctx, a->count);
+  duk_put_prop_string(ctx, -2, "count");
+  duk_pop(ctx);
+}
+
+CPR_API_INTERN void cpr__ecs_grow(duk_context *ctx, cpr__ecs_world *w, cpr__ecs_archetype *a) {
+  int c, f, capacity = a->capacity * 2;
+
+  a->entities = cpr__ecs_alloc(ctx, a->entities, (size_t)capacity * 4);
+  duk_push_heapptr(ctx, a->entities_buffer);
+  duk_config_buffer(ctx, -1, a->entities, (duk_size_t)capacity * 4);
+  duk_pop(ctx);
+  for (c = 0; c < w->component_count; ++c) {
+    if (a->columns[c] == NULL) {
+      continue;
+    }
+    for (f = 0; f < w->components[c].fields; ++f) {
+      a->columns[c][f].data = cpr__ecs_alloc(ctx, a->columns[c][f].data, (size_t)capacity * 4);
+      duk_push_heapptr(ctx, a->columns[c][f].buffer);
+      duk_config_buffer(ctx, -1, a->columns[c][f].data, (duk_size_t)capacity * 4);
+      duk_pop(ctx);
+    }
+  }
+  a->capacity = capacity;
+  cpr__ecs_update_views(ctx, w, a);
+}
+
+/* Find or create the archetype with the component set `mask` */
+CPR_API_INTERN int cpr__ecs_get_archetype(duk_context *ctx, cpr__ecs_world *w, uint32_t mask) {
+  int i, c, f;
+  cpr__ecs_archetype *a;
+
+  for (i = 0; i < w->archetype_count; ++i) {
+    if (w->archetypes[i].mask == mask) {
+      return i;
+    }
+  }
+
+  if (w->archetype_count == w->archetype_capacity) {
+    w->archetype_capacity = w->archetype_capacity ? w->archetype_capacity * 2 : 8;
+    w->archetypes = cpr__ecs_alloc(ctx, w->archetypes, w->archetype_capacity * sizeof(cpr__ecs_archetype));
+  }
+  a = &w->archetypes[w->archetype_count];
+  memset(a, 0, sizeof(cpr__ecs_archetype));
+  a->mask = mask;
+  a->capacity = CPR__ECS_INITIAL_CAPACITY;
+  /* Count the archetype right away so a failed allocation is released with the world */
+  w->archetype_count++;
+
+  a->entities = cpr__ecs_alloc(ctx, NULL, (size_t)a->capacity * 4);
+  a->entities_buffer = cpr__ecs_push_buffer(ctx, w, a->entities, (duk_size_t)a->capacity * 4);
+  for (c = 0; c < w->component_count; ++c) {
+    if ((mask & (1u << c)) == 0) {
+      continue;
+    }
+    a->columns[c] = cpr__ecs_alloc(ctx, NULL, w->components[c].fields * sizeof(cpr__ecs_column));
+    memset(a->columns[c], 0, w->components[c].fields * sizeof(cpr__ecs_column));
+    for (f = 0; f < w->components[c].fields; ++f) {
+      a->columns[c][f].data = cpr__ecs_alloc(ctx, NULL, (size_t)a->capacity * 4);
+      a->columns[c][f].buffer = cpr__ecs_push_buffer(ctx, w, a->columns[c][f].data, (duk_size_t)a->capacity * 4);
+    }
+  }
+
+  /* Script object: { mask, count, entities, columns } */
+  duk_push_heapptr(ctx, w->holder);
+  duk_get_prop_string(ctx, -1, "archetypes");
+  duk_push_object(ctx);
+  a->object = duk_get_heapptr(ctx, -1);
+  duk_push_uint(ctx, mask);
+  duk_put_prop_string(ctx, -2, "mask");
+  duk_put_prop_index(ctx, -2, (duk_uarridx_t)(w->archetype_count - 1));
+  duk_pop(ctx); /* archetypes */
+  /* A new archetype invalidates the cached queries */
+  duk_push_object(ctx);
+  duk_put_prop_string(ctx, -2, "queries");
+  duk_pop(ctx); /* holder */
+
+  cpr__ecs_update_views(ctx, w, a);
+  return w->archetype_count - 1;
+}
+
+/* Append a zeroed row for `entity` and return its index */
+CPR_API_INTERN int cpr__ecs_push_row(duk_context *ctx, cpr__ecs_world *w, cpr__ecs_archetype *a, int32_t entity) {
+  int c, f, row;
+
+  if (a->count == a->capacity) {
+    cpr__ecs_grow(ctx, w, a);
+  }
+  row = a->count++;
+  a->entities[row] = entity;
+  for (c = 0; c < w->component_count; ++c) {
+    if (a->columns[c] == NULL) {
+      continue;
+    }
+    for (f = 0; f < w->components[c].fields; ++f) {
+      ((uint32_t *)a->columns[c][f].data)[row] = 0;
+    }
+  }
+  return row;
+}
+
+/* Remove a row by moving the last row in its place */
+CPR_API_INTERN void cpr__ecs_remove_row(cpr__ecs_world *w, cpr__ecs_archetype *a, int row) {
+  int c, f, last = a->count - 1;
+  uint32_t *data;
+
+  if (row != last) {
+    for (c = 0; c < w->component_count; ++c) {
+      if (a->columns[c] == NULL) {
+        continue;
+      }
+      for (f = 0; f < w->components[c].fields; ++f) {
+        data = (uint32_t *)a->columns[c][f].data;
+        data[row] = data[last];
+      }
+    }
+    a->entities[row] = a->entities[last];
+    w->records[a->entities[row] & CPR__ECS_INDEX_MASK].row = row;
+  }
+  a->count--;
+}
+
+/* Move an entity to another archetype, keeping the components shared by both */
+CPR_API_INTERN void cpr__ecs_move(duk_context *ctx, cpr__ecs_world *w, int index, int dst_index) {
+  cpr__ecs_record *r = &w->records[index];
+  cpr__ecs_archetype *src, *dst;
+  int c, f, row;
+
+  if (r->archetype == dst_index) {
+    return;
+  }
+  dst = &w->archetypes[dst_index];
+  row = cpr__ecs_push_row(ctx, w, dst, CPR__ECS_ENTITY_ID(r->generation, index));
+  src = &w->archetypes[r->archetype];
+  for (c = 0; c < w->component_count; ++c) {
+    if (src->columns[c] == NULL || dst->columns[c] == NULL) {
+      continue;
+    }
+    for (f = 0; f < w->components[c].fields; ++f) {
+      ((uint32_t *)dst->columns[c][f].data)[row] = ((uint32_t *)src->columns[c][f].data)[r->row];
+    }
+  }
+  cpr__ecs_remove_row(w, src, r->row);
+  cpr__ecs_update_count(ctx, src);
+  cpr__ecs_update_count(ctx, dst);
+  r->archetype = dst_index;
+  r->row = row;
+}
+
+CPR_API_INTERN cpr__ecs_world *cpr__ecs_require_world(duk_context *ctx, duk_idx_t idx) {
+  cpr__ecs_world *w = duk_require_pointer(ctx, idx);
+  if (w == NULL) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "invalid ecs world (NULL)");
+  }
+  return w;
+}
+
+CPR_API_INTERN int cpr__ecs_require_component(duk_context *ctx, cpr__ecs_world *w, duk_idx_t idx) {
+  int c = duk_require_int(ctx, idx);
+  if (c < 0 || c >= w->component_count) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid component %d", c);
+  }
+  return c;
+}
+
+/* Return the record index of a live entity */
+CPR_API_INTERN int cpr__ecs_require_entity(duk_context *ctx, cpr__ecs_world *w, duk_idx_t idx) {
+  int e = duk_require_int(ctx, idx);
+  int index = e & CPR__ECS_INDEX_MASK;
+  if (e < 0 || index >= w->record_count ||
+      w->records[index].archetype < 0 ||
+      w->records[index].generation != (e >> CPR__ECS_INDEX_BITS)) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid or destroyed entity %d", e);
+  }
+  return index;
+}
+
+/* Build a component mask from an array of component ids */
+CPR_API_INTERN uint32_t cpr__ecs_get_mask(duk_context *ctx, cpr__ecs_world *w, duk_idx_t idx) {
+  uint32_t mask = 0;
+  duk_size_t i, len;
+
+  if (duk_is_null_or_undefined(ctx, idx)) {
+    return 0;
+  }
+  if (!duk_is_array(ctx, idx)) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "components must be an array");
+  }
+  len = duk_get_length(ctx, idx);
+  for (i = 0; i < len; ++i) {
+    duk_get_prop_index(ctx, idx, (duk_uarridx_t)i);
+    mask |= 1u << cpr__ecs_require_component(ctx, w, -1);
+    duk_pop(ctx);
+  }
+  return mask;
+}
+
+CPR_API_INTERN uint32_t *cpr__ecs_field_ptr(duk_context *ctx, cpr__ecs_world *w, int index, int c, int f) {
+  cpr__ecs_record *r = &w->records[index];
+  cpr__ecs_archetype *a = &w->archetypes[r->archetype];
+  if (a->columns[c] == NULL) {
+    duk_error(ctx, DUK_ERR_ERROR, "entity has no component %d", c);
+  }
+  if (f < 0 || f >= w->components[c].fields) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid field %d", f);
+  }
+  return &((uint32_t *)a->columns[c][f].data)[r->row];
+}
+
+/* Binding API */
+
+/* ecs.createWorld() */
+CPR_API_INTERN duk_ret_t cpr_ecs_create_world(duk_context *ctx) {
+  cpr__ecs_world *w;
+
+  if ((w = (cpr__ecs_world *)calloc(1, sizeof(cpr__ecs_world))) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "ecs: out of memory");
+  }
+  w->free_head = -1;
+  /* The world script object keeps the column buffers and archetype objects
+   * reachable. It's stored in the global stash until the world is destroyed. */
+  duk_push_global_stash(ctx);
+  if (!duk_get_prop_string(ctx, -1, CPR__ECS_STASH_KEY)) {
+    duk_pop(ctx);
+    duk_push_object(ctx);
+    duk_dup(ctx, -1);
+    duk_put_prop_string(ctx, -3, CPR__ECS_STASH_KEY);
+  }
+  duk_push_sprintf(ctx, "%p", (void *)w);
+  duk_push_object(ctx);
+  w->holder = duk_get_heapptr(ctx, -1);
+  duk_push_array(ctx);
+  duk_put_prop_string(ctx, -2, "buffers");
+  duk_push_array(ctx);
+  duk_put_prop_string(ctx, -2, "archetypes");
+  duk_push_object(ctx);
+  duk_put_prop_string(ctx, -2, "queries");
+  duk_put_prop(ctx, -3);
+  duk_pop_2(ctx);
+
+  /* Archetype 0 holds the entities without component */
+  cpr__ecs_get_archetype(ctx, w, 0);
+
+  duk_push_pointer(ctx, w);
+  return 1;
+}
+
+/* ecs.destroyWorld(world) */
+CPR_API_INTERN duk_ret_t cpr_ecs_destroy_world(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  cpr__ecs_archetype *a;
+  int i, c, f;
+
+  for (i = 0; i < w->archetype_count; ++i) {
+    a = &w->archetypes[i];
+    free(a->entities);
+    for (c = 0; c < w->component_count; ++c) {
+      if (a->columns[c] == NULL) {
+        continue;
+      }
+      for (f = 0; f < w->components[c].fields; ++f) {
+        free(a->columns[c][f].data);
+      }
+      free(a->columns[c]);
+    }
+  }
+  /* Detach the buffers so views still held by scripts are empty */
+  duk_push_heapptr(ctx, w->holder);
+  duk_get_prop_string(ctx, -1, "buffers");
+  for (i = 0; i < (int)duk_get_length(ctx, -1); ++i) {
+    duk_get_prop_index(ctx, -1, i);
+    duk_config_buffer(ctx, -1, NULL, 0);
+    duk_pop(ctx);
+  }
+  duk_pop_2(ctx);
+  duk_push_global_stash(ctx);
+  duk_get_prop_string(ctx, -1, CPR__ECS_STASH_KEY);
+  duk_push_sprintf(ctx, "%p", (void *)w);
+  duk_del_prop(ctx, -2);
+  duk_pop_2(ctx);
+
+  free(w->archetypes);
+  free(w->records);
+  free(w);
+  return 0;
+}
+
+/* ecs.component(world, type, fields)
+ * Register a component made of `fields` FLOAT32 or INT32 values. Returns the
+ * component id. Components must be registered before creating entities. */
+CPR_API_INTERN duk_ret_t cpr_ecs_component(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int type = duk_require_int(ctx, 1);
+  int fields = duk_require_int(ctx, 2);
+
+  if (type != CPR__ECS_FLOAT32 && type != CPR__ECS_INT32) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "invalid component type %d", type);
+  }
+  if (fields <= 0 || fields > CPR__ECS_MAX_FIELDS) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid component fields count %d", fields);
+  }
+  if (w->component_count == CPR__ECS_MAX_COMPONENTS) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "too many components (max %d)", CPR__ECS_MAX_COMPONENTS);
+  }
+  if (w->record_count > 0) {
+    duk_error(ctx, DUK_ERR_ERROR, "components must be registered before creating entities");
+  }
+  w->components[w->component_count].type = type;
+  w->components[w->component_count].fields = fields;
+  duk_push_int(ctx, w->component_count++);
+  return 1;
+}
+
+/* ecs.create(world [, components]) */
+CPR_API_INTERN duk_ret_t cpr_ecs_create(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  cpr__ecs_record *r;
+  int index, archetype;
+
+  archetype = cpr__ecs_get_archetype(ctx, w, cpr__ecs_get_mask(ctx, w, 1));
+  if (w->free_head >= 0) {
+    index = w->free_head;
+    w->free_head = w->records[index].row;
+  } else {
+    if (w->record_count == CPR__ECS_MAX_ENTITIES) {
+      duk_error(ctx, DUK_ERR_RANGE_ERROR, "too many entities");
+    }
+    if (w->record_count == w->record_capacity) {
+      w->record_capacity = w->record_capacity ? w->record_capacity * 2 : CPR__ECS_INITIAL_CAPACITY;
+      w->records = cpr__ecs_alloc(ctx, w->records, w->record_capacity * sizeof(cpr__ecs_record));
+    }
+    index = w->record_count++;
+    w->records[index].generation = 0;
+    w->records[index].archetype = -1;
+  }
+  r = &w->records[index];
+  r->row = cpr__ecs_push_row(ctx, w, &w->archetypes[archetype], CPR__ECS_ENTITY_ID(r->generation, index));
+  r->archetype = archetype;
+  cpr__ecs_update_count(ctx, &w->archetypes[archetype]);
+  duk_push_int(ctx, CPR__ECS_ENTITY_ID(r->generation, index));
+  return 1;
+}
+
+/* ecs.destroy(world, entity) */
+CPR_API_INTERN duk_ret_t cpr_ecs_destroy(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int index = cpr__ecs_require_entity(ctx, w, 1);
+  cpr__ecs_record *r = &w->records[index];
+  cpr__ecs_archetype *a = &w->archetypes[r->archetype];
+
+  cpr__ecs_remove_row(w, a, r->row);
+  cpr__ecs_update_count(ctx, a);
+  r->archetype = -1;
+  r->generation = (r->generation + 1) & CPR__ECS_GENERATION_MASK;
+  r->row = w->free_head;
+  w->free_head = index;
+  return 0;
+}
+
+/* ecs.alive(world, entity) */
+CPR_API_INTERN duk_ret_t cpr_ecs_alive(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int e = duk_require_int(ctx, 1);
+  int index = e & CPR__ECS_INDEX_MASK;
+  duk_push_boolean(ctx, e >= 0 && index < w->record_count &&
+                        w->records[index].archetype >= 0 &&
+                        w->records[index].generation == (e >> CPR__ECS_INDEX_BITS));
+  return 1;
+}
+
+/* ecs.add(world, entity, component) */
+CPR_API_INTERN duk_ret_t cpr_ecs_add(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int index = cpr__ecs_require_entity(ctx, w, 1);
+  int c = cpr__ecs_require_component(ctx, w, 2);
+  uint32_t mask = w->archetypes[w->records[index].archetype].mask | (1u << c);
+  cpr__ecs_move(ctx, w, index, cpr__ecs_get_archetype(ctx, w, mask));
+  return 0;
+}
+
+/* ecs.remove(world, entity, component) */
+CPR_API_INTERN duk_ret_t cpr_ecs_remove(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int index = cpr__ecs_require_entity(ctx, w, 1);
+  int c = cpr__ecs_require_component(ctx, w, 2);
+  uint32_t mask = w->archetypes[w->records[index].archetype].mask & ~(1u << c);
+  cpr__ecs_move(ctx, w, index, cpr__ecs_get_archetype(ctx, w, mask));
+  return 0;
+}
+
+/* ecs.has(world, entity, component) */
+CPR_API_INTERN duk_ret_t cpr_ecs_has(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int index = cpr__ecs_require_entity(ctx, w, 1);
+  int c = cpr__ecs_require_component(ctx, w, 2);
+  duk_push_boolean(ctx, (w->archetypes[w->records[index].archetype].mask & (1u << c)) != 0);
+  return 1;
+}
+
+/* ecs.get(world, entity, component, field) */
+CPR_API_INTERN duk_ret_t cpr_ecs_get(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int index = cpr__ecs_require_entity(ctx, w, 1);
+  int c = cpr__ecs_require_component(ctx, w, 2);
+  uint32_t *ptr = cpr__ecs_field_ptr(ctx, w, index, c, duk_require_int(ctx, 3));
+  if (w->components[c].type == CPR__ECS_INT32) {
+    duk_push_int(ctx, *(int32_t *)ptr);
+  } else {
+    duk_push_number(ctx, *(float *)ptr);
+  }
+  return 1;
+}
+
+/* ecs.set(world, entity, component, field, value) */
+CPR_API_INTERN duk_ret_t cpr_ecs_set(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int index = cpr__ecs_require_entity(ctx, w, 1);
+  int c = cpr__ecs_require_component(ctx, w, 2);
+  uint32_t *ptr = cpr__ecs_field_ptr(ctx, w, index, c, duk_require_int(ctx, 3));
+  if (w->components[c].type == CPR__ECS_INT32) {
+    *(int32_t *)ptr = duk_require_int(ctx, 4);
+  } else {
+    *(float *)ptr = (float)duk_require_number(ctx, 4);
+  }
+  return 0;
+}
+
+/* ecs.query(world, components)
+ * Return the array of archetypes owning all the components. Each archetype is
+ * an object { mask, count, entities, columns } where `columns[component][field]`
+ * is a typed array view and only the `count` first elements are valid.
+ * The result is cached until a new archetype is created. */
+CPR_API_INTERN duk_ret_t cpr_ecs_query(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  uint32_t mask = cpr__ecs_get_mask(ctx, w, 1);
+  int i, n = 0;
+
+  duk_push_heapptr(ctx, w->holder);
+  duk_get_prop_string(ctx, -1, "queries");
+  duk_push_uint(ctx, mask);
+  if (duk_get_prop(ctx, -2)) {
+    return 1;
+  }
+  duk_pop(ctx);
+  duk_push_array(ctx);
+  for (i = 0; i < w->archetype_count; ++i) {
+    if ((w->archetypes[i].mask & mask) == mask) {
+      duk_push_heapptr(ctx, w->archetypes[i].object);
+      duk_put_prop_index(ctx, -2, n++);
+    }
+  }
+  duk_push_uint(ctx, mask);
+  duk_dup(ctx, -2);
+  duk_put_prop(ctx, -4);
+  return 1;
+}
+
+/* ecs.integrate(world, target, source, dt)
+ * Native kernel: target[f] += source[f] * dt for every entity owning both
+ * FLOAT32 components (e.g. position and velocity). */
+CPR_API_INTERN duk_ret_t cpr_ecs_integrate(duk_context *ctx) {
+  cpr__ecs_world *w = cpr__ecs_require_world(ctx, 0);
+  int target = cpr__ecs_require_component(ctx, w, 1);
+  int source = cpr__ecs_require_component(ctx, w, 2);
+  float dt = (float)duk_require_number(ctx, 3);
+  uint32_t mask = (1u << target) | (1u << source);
+  cpr__ecs_archetype *a;
+  float *dst, *src;
+  int i, f, n, fields;
+
+  if (w->components[target].type != CPR__ECS_FLOAT32 || w->components[source].type != CPR__ECS_FLOAT32) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "integrate requires FLOAT32 components");
+  }
+  fields = w->components[target].fields < w->components[source].fields ?
+           w->components[target].fields : w->components[source].fields;
+  for (i = 0; i < w->archetype_count; ++i) {
+    a = &w->archetypes[i];
+    if ((a->mask & mask) != mask) {
+      continue;
+    }
+    for (f = 0; f < fields; ++f) {
+      dst = (float *)a->columns[target][f].data;
+      src = (float *)a->columns[source][f].data;
+      for (n = 0; n < a->count; ++n) {
+        dst[n] += src[n] * dt;
+      }
+    }
+  }
+  return 0;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_ecs(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "createWorld",  cpr_ecs_create_world,   0 },
+    { "destroyWorld", cpr_ecs_destroy_world,  1 },
+    { "component",    cpr_ecs_component,      3 },
+    { "create",       cpr_ecs_create,         2 },
+    { "destroy",      cpr_ecs_destroy,        2 },
+    { "alive",        cpr_ecs_alive,          2 },
+    { "add",          cpr_ecs_add,            3 },
+    { "remove",       cpr_ecs_remove,         3 },
+    { "has",          cpr_ecs_has,            3 },
+    { "get",          cpr_ecs_get,            4 },
+    { "set",          cpr_ecs_set,            5 },
+    { "query",        cpr_ecs_query,          2 },
+    { "integrate",    cpr_ecs_integrate,      4 },
+    { NULL, NULL, 0 }
+  };
+
+  const duk_number_list_entry module_consts[] = {
+    { "FLOAT32",        (double)CPR__ECS_FLOAT32 },
+    { "INT32",          (double)CPR__ECS_INT32 },
+    { "MAX_COMPONENTS", (double)CPR__ECS_MAX_COMPONENTS },
+    { NULL, 0.0 }
+  };
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+  duk_put_number_list(ctx, -1, module_consts);
+
+  return 1;  /* return module value */
+}
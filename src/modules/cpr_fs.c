@@ -0,0 +1,550 @@
+/*
+ * cpr_fs.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Asynchronous file I/O.
+ * Files are read and written by a small pool of I/O threads so loading or
+ * saving never stalls the frame. The completion callbacks are called on the
+ * heap thread by the frame loop (see cpr_dispatch.h) or by `fs.dispatch`
+ * (e.g. in worker threads that have no frame loop).
+ *
+ *   fs.read 'level1.bin', (err, buffer, bytes) -> ...
+ *   fs.read 'level1.bin', {offset: 1024, length: 256, buffer: chunk}, (err, buffer, bytes) -> ...
+ *   fs.write 'save.json', JSON.stringify(state), (err, bytes) -> ...
+ *   fs.write 'save.bin', data, {offset: 64}, (err, bytes) -> ...
+ *   fs.remove 'save.tmp', (err) -> ...
+ *
+ * `read` without a target buffer returns a new ArrayBuffer (transferable, see
+ * `worker.post`) of the whole file or of `length` bytes from `offset`. With a
+ * target buffer at most `length` bytes (default the buffer size) are read into
+ * it. `write` truncates the file unless an offset is given. The buffers and
+ * strings passed to the requests are referenced until the callback is called
+ * and must not be resized meanwhile.
+ */
+
+#include "cpr_fs.h"
+#include "cpr_clone.h"
+#include "cpr_dispatch.h"
+#include "cpr_thread.h"
+#include "cpr_duktape_helpers.h"
+
+#include <stdio.h>  /* fopen, fread, fwrite, fseek, remove */
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* strlen, memcpy */
+
+#define CPR__FS_THREADS 2
+#define CPR__FS_READ    0
+#define CPR__FS_WRITE   1
+#define CPR__FS_REMOVE  2
+
+/* State of the heap in its global stash */
+#define CPR__FS_STASH     "cprFs"
+#define CPR__FS_PTR       "\xff" "cprFsPtr"
+#define CPR__FS_CALLBACKS "callbacks"
+
+struct cpr__fs_state;
+
+typedef struct cpr__fs_request {
+  int type;
+  int id;
+  char *path;
+  long offset;            /* -1 truncates the file (write) */
+  duk_size_t length;      /* 0 reads to the end of the file or buffer */
+  unsigned char *data;    /* target (read) or source (write) */
+  duk_size_t size;
+  int own;                /* `data` allocated by the request */
+  duk_size_t result;      /* bytes read or written */
+  char error[256];
+  struct cpr__fs_state *state;
+  struct cpr__fs_request *next;
+} cpr__fs_request;
+
+typedef struct cpr__fs_state {
+  duk_context *ctx;
+  cpr_mutex mutex;        /* protects the done list and `running` */
+  cpr_cond cond;          /* signaled when a request is done */
+  cpr__fs_request *done_head;
+  cpr__fs_request *done_tail;
+  int running;            /* requests in the I/O pool */
+  int pending;            /* requests whose callback is not called */
+  int next_id;
+  int registered;         /* frame loop dispatcher */
+} cpr__fs_state;
+
+/* I/O pool shared by the heaps. Started by the first heap that loads the
+ * module and stopped when the last one is destroyed. */
+static volatile long _lock = 0;
+static int _users = 0;
+static int _thread_count = 0;
+static int _quit = 0;
+static cpr_thread _threads[CPR__FS_THREADS];
+static cpr_mutex _mutex;
+static cpr_cond _cond;
+static cpr__fs_request *_head = NULL;
+static cpr__fs_request *_tail = NULL;
+
+CPR_API_INTERN void cpr__fs_execute(cpr__fs_request *req) {
+  FILE *f;
+  long end;
+
+  req->error[0] = '\0';
+  if (req->type == CPR__FS_REMOVE) {
+    if (remove(req->path) != 0) {
+      snprintf(req->error, sizeof(req->error), "can't remove '%s'", req->path);
+    }
+    return;
+  }
+  if (req->type == CPR__FS_READ) {
+    if ((f = fopen(req->path, "rb")) == NULL) {
+      snprintf(req->error, sizeof(req->error), "can't open '%s'", req->path);
+      return;
+    }
+    if (fseek(f, req->offset, SEEK_SET) != 0) {
+      snprintf(req->error, sizeof(req->error), "can't read '%s'", req->path);
+      fclose(f);
+      return;
+    }
+    if (req->data == NULL) {
+      req->size = req->length;
+      if (req->size == 0 && fseek(f, 0, SEEK_END) == 0 && (end = ftell(f)) > req->offset) {
+        req->size = (duk_size_t)(end - req->offset);
+      }
+      fseek(f, req->offset, SEEK_SET);
+      if ((req->data = malloc(req->size ? req->size : 1)) == NULL) {
+        snprintf(req->error, sizeof(req->error), "can't allocate %lu bytes to read '%s'",
+                 (unsigned long)req->size, req->path);
+        fclose(f);
+        return;
+      }
+      req->own = 1;
+    } else if (req->length && req->length < req->size) {
+      req->size = req->length;
+    }
+    req->result = fread(req->data, 1, req->size, f);
+    if (ferror(f)) {
+      snprintf(req->error, sizeof(req->error), "can't read '%s'", req->path);
+    }
+  } else {
+    if (req->offset < 0) {
+      f = fopen(req->path, "wb");
+    } else if ((f = fopen(req->path, "r+b")) == NULL) {
+      f = fopen(req->path, "w+b");
+    }
+    if (f == NULL) {
+      snprintf(req->error, sizeof(req->error), "can't open '%s'", req->path);
+      return;
+    }
+    if (req->offset > 0 && fseek(f, req->offset, SEEK_SET) != 0) {
+      snprintf(req->error, sizeof(req->error), "can't write '%s'", req->path);
+      fclose(f);
+      return;
+    }
+    req->result = fwrite(req->data, 1, req->size, f);
+    if (req->result != req->size) {
+      snprintf(req->error, sizeof(req->error), "can't write '%s'", req->path);
+    }
+  }
+  if (fclose(f) != 0 && req->error[0] == '\0') {
+    snprintf(req->error, sizeof(req->error), "can't close '%s'", req->path);
+  }
+}
+
+/* Execute the request and move it to the done list of its heap */
+CPR_API_INTERN void cpr__fs_complete(cpr__fs_request *req) {
+  cpr__fs_state *state = req->state;
+
+  cpr__fs_execute(req);
+  cpr_mutex_lock(&state->mutex);
+  if (state->done_tail) {
+    state->done_tail->next = req;
+  } else {
+    state->done_head = req;
+  }
+  state->done_tail = req;
+  --state->running;
+  cpr_cond_broadcast(&state->cond);
+  cpr_mutex_unlock(&state->mutex);
+}
+
+CPR_API_INTERN void cpr__fs_thread(void *arg) {
+  cpr__fs_request *req;
+  (void)arg;
+
+  for (;;) {
+    cpr_mutex_lock(&_mutex);
+    while (_head == NULL && !_quit) {
+      cpr_cond_wait(&_cond, &_mutex);
+    }
+    if ((req = _head) == NULL) {
+      cpr_mutex_unlock(&_mutex);
+      return;
+    }
+    if ((_head = req->next) == NULL) {
+      _tail = NULL;
+    }
+    req->next = NULL;
+    cpr_mutex_unlock(&_mutex);
+    cpr__fs_complete(req);
+  }
+}
+
+CPR_API_INTERN void cpr__fs_pool_lock() {
+  while (!cpr_atomic_cas(&_lock, 0, 1));
+}
+
+CPR_API_INTERN void cpr__fs_pool_unlock() {
+  cpr_atomic_cas(&_lock, 1, 0);
+}
+
+CPR_API_INTERN void cpr__fs_pool_retain() {
+  cpr__fs_pool_lock();
+  if (_users++ == 0) {
+    cpr_mutex_init(&_mutex);
+    cpr_cond_init(&_cond);
+    _quit = 0;
+    for (_thread_count = 0; _thread_count < CPR__FS_THREADS; ++_thread_count) {
+      if (cpr_thread_create(&_threads[_thread_count], cpr__fs_thread, NULL) != 0) {
+        break;
+      }
+    }
+  }
+  cpr__fs_pool_unlock();
+}
+
+/* The requests of the heap must be done */
+CPR_API_INTERN void cpr__fs_pool_release() {
+  int i;
+
+  cpr__fs_pool_lock();
+  if (--_users == 0) {
+    cpr_mutex_lock(&_mutex);
+    _quit = 1;
+    cpr_cond_broadcast(&_cond);
+    cpr_mutex_unlock(&_mutex);
+    for (i = 0; i < _thread_count; ++i) {
+      cpr_thread_join(_threads[i]);
+    }
+    _thread_count = 0;
+    cpr_cond_destroy(&_cond);
+    cpr_mutex_destroy(&_mutex);
+  }
+  cpr__fs_pool_unlock();
+}
+
+CPR_API_INTERN void cpr__fs_submit(cpr__fs_request *req) {
+  cpr_mutex_lock(&req->state->mutex);
+  ++req->state->running;
+  ++req->state->pending;
+  cpr_mutex_unlock(&req->state->mutex);
+
+  /* No I/O thread: complete the request now (still dispatched later) */
+  if (_thread_count == 0) {
+    cpr__fs_complete(req);
+    return;
+  }
+  cpr_mutex_lock(&_mutex);
+  if (_tail) {
+    _tail->next = req;
+  } else {
+    _head = req;
+  }
+  _tail = req;
+  cpr_cond_signal(&_cond);
+  cpr_mutex_unlock(&_mutex);
+}
+
+CPR_API_INTERN void cpr__fs_free_request(cpr__fs_request *req) {
+  if (req->own) {
+    free(req->data);
+  }
+  free(req->path);
+  free(req);
+}
+
+/* Push the state object of the heap (global stash) */
+CPR_API_INTERN cpr__fs_state *cpr__fs_push_state(duk_context *ctx) {
+  cpr__fs_state *state;
+
+  duk_push_global_stash(ctx);
+  duk_get_prop_string(ctx, -1, CPR__FS_STASH);
+  duk_remove(ctx, -2);
+  duk_get_prop_string(ctx, -1, CPR__FS_PTR);
+  state = duk_get_pointer(ctx, -1);
+  duk_pop(ctx);
+  if (state == NULL) {
+    duk_error(ctx, DUK_ERR_ERROR, "fs module not initialized");
+  }
+  return state;
+}
+
+/* Call the callbacks of the done requests. Return the number of callbacks
+ * called. Throws the callbacks errors (the other requests stay done). */
+CPR_API_INTERN int cpr__fs_run(duk_context *ctx) {
+  cpr__fs_state *state = cpr__fs_push_state(ctx);
+  cpr__fs_request *req;
+  int count = 0, nargs;
+
+  duk_get_prop_string(ctx, -1, CPR__FS_CALLBACKS);
+  for (;;) {
+    cpr_mutex_lock(&state->mutex);
+    if ((req = state->done_head) != NULL) {
+      if ((state->done_head = req->next) == NULL) {
+        state->done_tail = NULL;
+      }
+      --state->pending;
+    }
+    cpr_mutex_unlock(&state->mutex);
+    if (req == NULL) {
+      break;
+    }
+
+    /* [ ... callbacks entry ] */
+    duk_get_prop_index(ctx, -1, req->id);
+    duk_del_prop_index(ctx, -2, req->id);
+    duk_get_prop_index(ctx, -1, 0);
+    if (req->error[0]) {
+      duk_push_error_object(ctx, DUK_ERR_ERROR, "%s", req->error);
+    } else {
+      duk_push_null(ctx);
+    }
+    nargs = 2;
+    if (req->type == CPR__FS_READ) {
+      if (req->error[0]) {
+        duk_push_null(ctx);
+      } else if (req->own) {
+        cpr_clone_push_buffer(ctx, req->data, req->result);
+        req->own = 0;
+      } else {
+        duk_get_prop_index(ctx, -3, 1);
+      }
+      ++nargs;
+    }
+    if (req->type == CPR__FS_REMOVE) {
+      --nargs;
+    } else {
+      duk_push_number(ctx, (duk_double_t)req->result);
+    }
+    cpr__fs_free_request(req);
+
+    ++count;
+    duk_call(ctx, nargs);
+    duk_pop_2(ctx);
+  }
+  duk_pop_2(ctx);
+  return count;
+}
+
+CPR_API_INTERN void cpr__fs_dispatch(duk_context *ctx, void *udata) {
+  cpr__fs_state *state = udata;
+  int done;
+
+  /* Only the heap that registered the dispatcher */
+  if (state->ctx != ctx) {
+    return;
+  }
+  cpr_mutex_lock(&state->mutex);
+  done = state->done_head != NULL;
+  cpr_mutex_unlock(&state->mutex);
+  if (done) {
+    cpr__fs_run(ctx);
+  }
+}
+
+CPR_API_INTERN duk_ret_t cpr__fs_finalizer(duk_context *ctx) {
+  cpr__fs_state *state;
+  cpr__fs_request *req;
+
+  duk_get_prop_string(ctx, 0, CPR__FS_PTR);
+  if ((state = duk_get_pointer(ctx, -1)) == NULL) {
+    return 0;
+  }
+  duk_push_pointer(ctx, NULL);
+  duk_put_prop_string(ctx, 0, CPR__FS_PTR);
+
+  /* The I/O threads may still use the buffers of the heap */
+  cpr_mutex_lock(&state->mutex);
+  while (state->running > 0) {
+    cpr_cond_wait(&state->cond, &state->mutex);
+  }
+  cpr_mutex_unlock(&state->mutex);
+  while ((req = state->done_head) != NULL) {
+    state->done_head = req->next;
+    cpr__fs_free_request(req);
+  }
+  if (state->registered) {
+    cpr_dispatch_remove(cpr__fs_dispatch, state);
+  }
+  cpr_cond_destroy(&state->cond);
+  cpr_mutex_destroy(&state->mutex);
+  free(state);
+  cpr__fs_pool_release();
+  return 0;
+}
+
+/* Create the request and keep the callback and `keep_idx` until it's called */
+CPR_API_INTERN cpr__fs_request *cpr__fs_request_create(duk_context *ctx, int type, duk_idx_t options_idx, duk_idx_t keep_idx, duk_idx_t cb_idx) {
+  const char *path = duk_require_string(ctx, 0);
+  cpr__fs_state *state;
+  cpr__fs_request *req;
+  double offset = type == CPR__FS_READ ? 0 : -1, length = 0;
+  size_t len;
+
+  duk_require_function(ctx, cb_idx);
+  if (duk_is_object(ctx, options_idx)) {
+    duk_get_prop_string(ctx, options_idx, "offset");
+    if (!duk_is_undefined(ctx, -1)) {
+      offset = duk_require_number(ctx, -1);
+      if (offset < 0) {
+        duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid offset");
+      }
+    }
+    duk_get_prop_string(ctx, options_idx, "length");
+    if (!duk_is_undefined(ctx, -1)) {
+      length = duk_require_number(ctx, -1);
+      if (length < 0) {
+        duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid length");
+      }
+    }
+    duk_pop_2(ctx);
+  } else if (!duk_is_undefined(ctx, options_idx)) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "options must be an object");
+  }
+
+  state = cpr__fs_push_state(ctx);
+  len = strlen(path) + 1;
+  if ((req = calloc(1, sizeof(cpr__fs_request))) == NULL || (req->path = malloc(len)) == NULL) {
+    free(req);
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the request");
+  }
+  memcpy(req->path, path, len);
+  req->type = type;
+  req->offset = (long)offset;
+  req->length = (duk_size_t)length;
+  req->state = state;
+  req->id = state->next_id++;
+
+  /* callbacks[id] = [callback, keep] */
+  duk_get_prop_string(ctx, -1, CPR__FS_CALLBACKS);
+  duk_push_array(ctx);
+  duk_dup(ctx, cb_idx);
+  duk_put_prop_index(ctx, -2, 0);
+  duk_dup(ctx, keep_idx);
+  duk_put_prop_index(ctx, -2, 1);
+  duk_put_prop_index(ctx, -2, req->id);
+  duk_pop_2(ctx);
+  return req;
+}
+
+/* fs.read(path, [options], callback) */
+CPR_API_INTERN duk_ret_t cpr__fs_js_read(duk_context *ctx) {
+  cpr__fs_request *req;
+  unsigned char *data = NULL;
+  duk_size_t size = 0;
+
+  if (duk_is_function(ctx, 1)) {
+    duk_insert(ctx, 1); /* [ path callback undefined ] -> [ path undefined callback ] */
+  }
+  duk_push_undefined(ctx);
+  if (duk_is_object(ctx, 1)) {
+    duk_get_prop_string(ctx, 1, "buffer");
+    duk_replace(ctx, 3);
+    if (!duk_is_undefined(ctx, 3) && (data = duk_get_buffer_data(ctx, 3, &size)) == NULL) {
+      duk_error(ctx, DUK_ERR_TYPE_ERROR, "buffer expected");
+    }
+  }
+  req = cpr__fs_request_create(ctx, CPR__FS_READ, 1, 3, 2);
+  req->data = data;
+  req->size = size;
+  cpr__fs_submit(req);
+  return 0;
+}
+
+/* fs.write(path, data, [options], callback) */
+CPR_API_INTERN duk_ret_t cpr__fs_js_write(duk_context *ctx) {
+  cpr__fs_request *req;
+  const void *data;
+  duk_size_t size;
+
+  if (duk_is_function(ctx, 2)) {
+    duk_insert(ctx, 2);
+  }
+  if (duk_is_string(ctx, 1)) {
+    data = duk_get_lstring(ctx, 1, &size);
+  } else if (duk_is_buffer(ctx, 1) || duk_get_buffer_data(ctx, 1, NULL)) {
+    data = duk_get_buffer_data(ctx, 1, &size);
+  } else {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "buffer or string expected");
+  }
+  req = cpr__fs_request_create(ctx, CPR__FS_WRITE, 2, 1, 3);
+  req->data = (unsigned char *)data;
+  req->size = size;
+  cpr__fs_submit(req);
+  return 0;
+}
+
+/* fs.remove(path, callback) */
+CPR_API_INTERN duk_ret_t cpr__fs_js_remove(duk_context *ctx) {
+  duk_push_undefined(ctx);
+  cpr__fs_submit(cpr__fs_request_create(ctx, CPR__FS_REMOVE, 2, 2, 1));
+  return 0;
+}
+
+/* Call the callbacks of the done requests now */
+CPR_API_INTERN duk_ret_t cpr__fs_js_dispatch(duk_context *ctx) {
+  duk_push_int(ctx, cpr__fs_run(ctx));
+  return 1;
+}
+
+/* Number of requests whose callback is not called yet */
+CPR_API_INTERN duk_ret_t cpr__fs_js_pending(duk_context *ctx) {
+  cpr__fs_state *state = cpr__fs_push_state(ctx);
+  int pending;
+
+  cpr_mutex_lock(&state->mutex);
+  pending = state->pending;
+  cpr_mutex_unlock(&state->mutex);
+  duk_push_int(ctx, pending);
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_fs(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "read",     cpr__fs_js_read,     3 },
+    { "write",    cpr__fs_js_write,    4 },
+    { "remove",   cpr__fs_js_remove,   2 },
+    { "dispatch", cpr__fs_js_dispatch, 0 },
+    { "pending",  cpr__fs_js_pending,  0 },
+    { NULL, NULL, 0 }
+  };
+  cpr__fs_state *state;
+
+  duk_push_global_stash(ctx);
+  if (!duk_has_prop_string(ctx, -1, CPR__FS_STASH)) {
+    if ((state = calloc(1, sizeof(cpr__fs_state))) == NULL) {
+      duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the fs state");
+    }
+    state->ctx = ctx;
+    cpr_mutex_init(&state->mutex);
+    cpr_cond_init(&state->cond);
+    cpr__fs_pool_retain();
+    /* Dispatched by the frame loop in the main thread only */
+    state->registered = cpr_dispatch_add(cpr__fs_dispatch, state) == 0;
+
+    duk_push_object(ctx);
+    duk_push_pointer(ctx, state);
+    duk_put_prop_string(ctx, -2, CPR__FS_PTR);
+    duk_push_object(ctx);
+    duk_put_prop_string(ctx, -2, CPR__FS_CALLBACKS);
+    duk_push_c_function(ctx, cpr__fs_finalizer, 1);
+    duk_set_finalizer(ctx, -2);
+    duk_put_prop_string(ctx, -2, CPR__FS_STASH);
+  }
+  duk_pop(ctx);
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+
+  return 1;  /* return module value */
+}
@@ -5,8 +5,14 @@
  */
 
 #include "cpr_gl.h"
+#include "cpr_png.h"
+#include "cpr_duktape_helpers.h"
 #include "GL/gl3w.h"
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h> /* memcpy, strerror, strlen */
+
 CPR_API_INTERN duk_ret_t cpr_gl_clear(duk_context *ctx) {
   glClear(duk_require_int(ctx, 0));
   return 0;
@@ -38,6 +44,84 @@ CPR_API_INTERN duk_ret_t cpr_gl_viewport(duk_context *ctx) {
   return 0;
 }
 
+/* gl.readPixels(x, y, width, height [, buffer]) -> buffer
+ * Read RGBA8 pixels of the current read framebuffer. Rows are returned top to
+ * bottom (image order, not GL order). If `buffer` is not given a new buffer is
+ * returned. */
+CPR_API_INTERN duk_ret_t cpr_gl_read_pixels(duk_context *ctx) {
+  int x, y, w, h, row;
+  duk_size_t size, stride;
+  unsigned char *pixels, *top, *bottom, tmp[256];
+  duk_size_t i, n;
+
+  x = duk_require_int(ctx, 0);
+  y = duk_require_int(ctx, 1);
+  w = duk_require_int(ctx, 2);
+  h = duk_require_int(ctx, 3);
+  if (w <= 0 || h <= 0) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid pixels size %dx%d", w, h);
+  }
+  stride = (duk_size_t)w * 4;
+  if (duk_is_null_or_undefined(ctx, 4)) {
+    pixels = (unsigned char *)duk_push_fixed_buffer(ctx, stride * h);
+  } else {
+    pixels = (unsigned char *)duk_require_buffer_data(ctx, 4, &size);
+    if (size < stride * h) {
+      duk_error(ctx, DUK_ERR_RANGE_ERROR, "pixels buffer too small (%lu bytes)", (unsigned long)size);
+    }
+    duk_dup(ctx, 4);
+  }
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+  /* Flip the rows in place */
+  for (row = 0; row < h / 2; ++row) {
+    top = pixels + row * stride;
+    bottom = pixels + (h - 1 - row) * stride;
+    for (i = 0; i < stride; i += n) {
+      n = stride - i < sizeof(tmp) ? stride - i : sizeof(tmp);
+      memcpy(tmp, top + i, n);
+      memcpy(top + i, bottom + i, n);
+      memcpy(bottom + i, tmp, n);
+    }
+  }
+  return 1;
+}
+
+/* gl.writeImage(filename, width, height, pixels)
+ * Write RGBA8 pixels (rows top to bottom) to a PNG file if `filename` ends
+ * with `.png` or as raw RGBA otherwise. */
+CPR_API_INTERN duk_ret_t cpr_gl_write_image(duk_context *ctx) {
+  const char *filename;
+  const unsigned char *pixels;
+  duk_size_t size, len;
+  FILE *file;
+  int w, h, rc;
+
+  filename = duk_require_string(ctx, 0);
+  w = duk_require_int(ctx, 1);
+  h = duk_require_int(ctx, 2);
+  pixels = (const unsigned char *)duk_require_buffer_data(ctx, 3, &size);
+  if (w < 0 || h < 0 || size < (duk_size_t)w * h * 4) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid image size %dx%d (%lu bytes)", w, h, (unsigned long)size);
+  }
+
+  len = strlen(filename);
+  if (len > 4 && strcmp(filename + len - 4, ".png") == 0) {
+    rc = cpr__png_write(filename, w, h, pixels);
+  } else if ((file = fopen(filename, "wb")) == NULL) {
+    rc = -1;
+  } else {
+    rc = fwrite(pixels, 4, (size_t)w * h, file) == (size_t)w * h ? 0 : -1;
+    rc = fclose(file) == 0 ? rc : -1;
+  }
+  if (rc != 0) {
+    duk_error(ctx, DUK_ERR_ERROR, "Can't write image '%s': %s", filename, strerror(errno));
+  }
+  return 0;
+}
+
 CPR_API_EXTERN duk_ret_t dukopen_gl(duk_context *ctx) {
   const duk_function_list_entry module_funcs[] = {
     { "clear", cpr_gl_clear, 1 },
@@ -45,6 +129,8 @@ CPR_API_EXTERN duk_ret_t dukopen_gl(duk_context *ctx) {
     { "clearDepth", cpr_gl_clear_depth, 1 },
     { "clearColor", cpr_gl_clear_color, 4},
     { "viewport", cpr_gl_viewport, 4},
+    { "readPixels", cpr_gl_read_pixels, 5 },
+    { "writeImage", cpr_gl_write_image, 4 },
     { NULL, NULL, 0 }
   };
 
@@ -56,7 +142,7 @@ CPR_API_EXTERN duk_ret_t dukopen_gl(duk_context *ctx) {
   };
 
   /* duk_push_object(ctx); */  /* object is passed by the caller */
-  duk_put_function_list(ctx, -1, module_funcs);
+  cpr_put_function_list_light(ctx, -1, module_funcs);
   duk_put_number_list(ctx, -1, module_consts);
 
   return 1; /* return the object passed as paramter */
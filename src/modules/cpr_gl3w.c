@@ -7,6 +7,7 @@
 #include "cpr_gl3w.h"
 #include "GL/gl3w.h"
 #include "cpr_gl.h"
+#include "cpr_duktape_helpers.h"
 
 CPR_API_INTERN duk_ret_t cpr_gl3w_init(duk_context *ctx) {
   duk_push_boolean(ctx, gl3wInit() == 0);
@@ -40,8 +41,8 @@ CPR_API_EXTERN duk_ret_t dukopen_gl3w(duk_context *ctx) {
   /* XXX load OpenGL into its own object? */
   duk_push_c_function(ctx, dukopen_gl, 1);
 
-  duk_push_object(ctx);  /* module result */
-  duk_put_function_list(ctx, -1, module_funcs);
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
 
   /* Open the gl module */
   duk_call(ctx, 1);
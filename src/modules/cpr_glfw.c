@@ -8,9 +8,14 @@
 #if defined(CPR_COMPILING_CEPORA)
 #include "cpr_config.h"
 #include "cpr_debug_internal.h"
+#include "cpr_cepora.h" /* cpr_is_headless */
+#include "cpr_profiler.h"
+#include "cpr_dispatch.h"
 /* XXX debug when not compiling for cepora */
 #endif
 #include "cpr_glfw.h"
+#include "cpr_duktape_helpers.h"
+#include "cpr_native.h"
 #include "GLFW/glfw3.h" /* GLFW library header */
 
 /* Binding options
@@ -65,10 +70,15 @@
  */
 #define CPR__REGISTER_CALLBACK(__p1__, __p2__, __p3__)       \
   do {                                                      \
+    cpr_native *n;                                          \
     GLFWwindow *window;                                     \
     cpr_user_data *u;                                       \
-    window = duk_require_pointer(ctx, 0);                   \
-    u = glfwGetWindowUserPointer(window);                   \
+    n = cpr_native_require(ctx, 0, CPR_GLFW_WINDOW);        \
+    window = n->ptr;                                        \
+    u = n->state;                                           \
+    /* The window handle keeps the callback alive */        \
+    duk_dup(ctx, 1);                                        \
+    duk_put_prop_string(ctx, 0, "\xff" #__p2__);            \
     if ((u->__p2__ = duk_get_heapptr(ctx, 1)) == NULL) {    \
       __p1__(window, NULL);                                 \
       duk_push_null(ctx);                                   \
@@ -89,9 +99,13 @@ CPR_API_INTERN void cpr__log_raw(const char *fmt, ...) {
 #endif
 
 /* Internal user data associated to a GLFWwindow. It's used to store callback
- * pointers.
+ * pointers. It's the native state of the window handle and is freed with the
+ * window.
  */
 typedef struct cpr_user_data {
+  cpr_native *native;         /* Window handle */
+  struct cpr_user_data *prev; /* Live windows list */
+  struct cpr_user_data *next;
 #if defined(CPR__GLFW_MOUSE_CALLBACK_BIND) || \
     defined(CPR__GLFW_WINDOW_CALLBACKS_BIND) || \
     defined(CPR__GLFW_KEYBOARD_BIND)
@@ -125,6 +139,60 @@ typedef struct cpr_user_data {
 #endif
 } cpr_user_data;
 
+/* Windows not destroyed yet. glfwTerminate destroys them all. */
+static cpr_user_data *_windows = NULL;
+
+/* Native state of a cursor handle */
+typedef struct cpr_cursor_data {
+  cpr_native *native;           /* Cursor handle */
+  struct cpr_cursor_data *prev; /* Live cursors list */
+  struct cpr_cursor_data *next;
+} cpr_cursor_data;
+
+/* Cursors not destroyed yet. glfwTerminate destroys them too. */
+static cpr_cursor_data *_cursors = NULL;
+
+CPR_API_INTERN void cpr__finalize_window(void *ptr, void *state) {
+  cpr_user_data *u = state;
+  if (u->prev) {
+    u->prev->next = u->next;
+  } else {
+    _windows = u->next;
+  }
+  if (u->next) {
+    u->next->prev = u->prev;
+  }
+  glfwDestroyWindow(ptr);
+  free(u);
+}
+
+static const cpr_native_type cpr__window_type = { CPR_GLFW_WINDOW, cpr__finalize_window };
+static const cpr_native_type cpr__monitor_type = { CPR_GLFW_MONITOR, NULL };
+
+CPR_API_INTERN GLFWwindow *cpr__require_window(duk_context *ctx, duk_idx_t idx) {
+  return cpr_native_require(ctx, idx, CPR_GLFW_WINDOW)->ptr;
+}
+
+/* Optional window argument (NULL if null or undefined) */
+CPR_API_INTERN GLFWwindow *cpr__get_window(duk_context *ctx, duk_idx_t idx) {
+  cpr_native *n = cpr_native_get(ctx, idx, CPR_GLFW_WINDOW);
+  return n ? n->ptr : NULL;
+}
+
+#if defined(CPR__GLFW_MONITOR_BIND) || defined(CPR__GLFW_MONITOR_MODE_BIND)
+CPR_API_INTERN GLFWmonitor *cpr__require_monitor(duk_context *ctx, duk_idx_t idx) {
+  return cpr_native_require(ctx, idx, CPR_GLFW_MONITOR)->ptr;
+}
+#endif
+
+/* Push the handle of a window created by glfw.createWindow */
+CPR_API_INTERN void cpr__push_window(duk_context *ctx, GLFWwindow *window) {
+  if (window == NULL) {
+    duk_push_null(ctx);
+  } else {
+    cpr_native_push_handle(ctx, ((cpr_user_data *)glfwGetWindowUserPointer(window))->native);
+  }
+}
 
 /* global reference to the duktape context. Required for GLFW callbacks */
 /* XXX is there any workaround to avoid keeping a global reference to the context? */
@@ -134,14 +202,12 @@ static duk_context *_ctx = NULL;
 /* Context handling */
 
 CPR_API_INTERN duk_ret_t glfw_make_context_current(duk_context *ctx) {
-  GLFWwindow *window = NULL;
-  window = duk_require_pointer(ctx, 0);
-  glfwMakeContextCurrent(window);
+  glfwMakeContextCurrent(cpr__get_window(ctx, 0));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_current_context(duk_context *ctx) {
-  duk_push_pointer(ctx, glfwGetCurrentContext());
+  cpr__push_window(ctx, glfwGetCurrentContext());
   return 1;
 }
 
@@ -174,6 +240,19 @@ CPR_API_INTERN duk_ret_t glfw_init(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_terminate(duk_context *ctx) {
+  cpr_user_data *u;
+  cpr_cursor_data *c;
+  /* The windows and cursors are destroyed: their handles become stale */
+  while ((u = _windows) != NULL) {
+    _windows = u->next;
+    cpr_native_invalidate(u->native);
+    free(u);
+  }
+  while ((c = _cursors) != NULL) {
+    _cursors = c->next;
+    cpr_native_invalidate(c->native);
+    free(c);
+  }
   glfwTerminate();
   return 0;
 }
@@ -243,47 +322,52 @@ CPR_API_INTERN duk_ret_t glfw_window_hint(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_create_window(duk_context *ctx) {
-#if defined(CPR__GLFW_MOUSE_CALLBACK_BIND) || \
-    defined(CPR__GLFW_WINDOW_CALLBACKS_BIND) || \
-    defined(CPR__GLFW_KEYBOARD_BIND) || \
-    defined(CPR__GLFW_WINDOW_EXTRA_BIND)
   cpr_user_data *u = NULL;
-#endif
   GLFWwindow *window = NULL;
   int width = 0;
   int height = 0;
   const char *title = NULL;
   GLFWmonitor *monitor = NULL;
   GLFWwindow *share = NULL;
+  cpr_native *n = NULL;
 
-#if defined(CPR__GLFW_MOUSE_CALLBACK_BIND) || \
-    defined(CPR__GLFW_WINDOW_CALLBACKS_BIND) || \
-    defined(CPR__GLFW_KEYBOARD_BIND) || \
-    defined(CPR__GLFW_WINDOW_EXTRA_BIND)
-  u = (cpr_user_data*)malloc(sizeof(cpr_user_data));
+  width = duk_require_int(ctx, 0);
+  height = duk_require_int(ctx, 1);
+  title = duk_require_string(ctx, 2);
+  if ((n = cpr_native_get(ctx, 3, CPR_GLFW_MONITOR)) != NULL) {
+    monitor = n->ptr;
+  }
+  share = cpr__get_window(ctx, 4);
+  CPR__DLOG("width %d height %d title '%s' monitor %p share %p", width, height, title, monitor, share);
+
+#if defined(CPR_COMPILING_CEPORA)
+  /* Offscreen rendering: the window and its default framebuffer still exist
+   * but are never shown */
+  if (cpr_is_headless()) {
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    monitor = NULL;
+  }
 #endif
+
+  if ((u = (cpr_user_data*)calloc(1, sizeof(cpr_user_data))) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate window user data");
+  }
 #if defined(CPR__GLFW_MOUSE_CALLBACK_BIND) || \
     defined(CPR__GLFW_WINDOW_CALLBACKS_BIND) || \
     defined(CPR__GLFW_KEYBOARD_BIND)
   u->ctx = ctx;
 #endif
 
-  width = duk_require_int(ctx, 0);
-  height = duk_require_int(ctx, 1);
-  title = duk_require_string(ctx, 2);
-  monitor =  duk_get_pointer(ctx, 3);
-  share = duk_get_pointer(ctx, 4);
-  CPR__DLOG("width %d height %d title '%s' monitor %p share %p", width, height, title, monitor, share);
-
   if ((window = glfwCreateWindow(width, height, title, monitor, share)) != NULL) {
-#if defined(CPR__GLFW_MOUSE_CALLBACK_BIND) || \
-    defined(CPR__GLFW_WINDOW_CALLBACKS_BIND) || \
-    defined(CPR__GLFW_KEYBOARD_BIND) || \
-    defined(CPR__GLFW_WINDOW_EXTRA_BIND)
     glfwSetWindowUserPointer(window, u);
-#endif
-    duk_push_pointer(ctx, window);
+    if ((u->next = _windows) != NULL) {
+      _windows->prev = u;
+    }
+    _windows = u;
+    /* The window is destroyed with its handle if not destroyed before */
+    u->native = cpr_native_push(ctx, &cpr__window_type, window, u);
   } else {
+    free(u);
     duk_push_undefined(ctx);
   }
 
@@ -291,32 +375,31 @@ CPR_API_INTERN duk_ret_t glfw_create_window(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_destroy_window(duk_context *ctx) {
-  free((cpr_user_data *)glfwGetWindowUserPointer(duk_require_pointer(ctx, 0)));
-  glfwDestroyWindow(duk_require_pointer(ctx, 0));
+  cpr_native_destroy(cpr_native_require(ctx, 0, CPR_GLFW_WINDOW));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_window_should_close(duk_context *ctx) {
   int rc = 0;
-  rc = glfwWindowShouldClose(duk_require_pointer(ctx ,0));
+  rc = glfwWindowShouldClose(cpr__require_window(ctx, 0));
   duk_push_boolean(ctx, rc);
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_set_window_should_close(duk_context *ctx) {
-  glfwSetWindowShouldClose(duk_require_pointer(ctx, 0), duk_require_boolean(ctx, 1));
+  glfwSetWindowShouldClose(cpr__require_window(ctx, 0), duk_require_boolean(ctx, 1));
   return 0;
 }
 
 #if defined(CPR__GLFW_WINDOW_EXTRA_BIND)
 CPR_API_INTERN duk_ret_t glfw_set_window_title(duk_context *ctx) {
-  glfwSetWindowTitle(duk_require_pointer(ctx, 0), duk_require_string(ctx, 1));
+  glfwSetWindowTitle(cpr__require_window(ctx, 0), duk_require_string(ctx, 1));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_window_pos(duk_context *ctx) {
   int xpos = 0, ypos = 0;
-  glfwGetWindowPos(duk_require_pointer(ctx, 0), &xpos, &ypos);
+  glfwGetWindowPos(cpr__require_window(ctx, 0), &xpos, &ypos);
   duk_push_array(ctx);
   duk_push_int(ctx, xpos);
   duk_put_prop_index(ctx, -2, 0);
@@ -326,7 +409,7 @@ CPR_API_INTERN duk_ret_t glfw_get_window_pos(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_set_window_pos(duk_context *ctx) {
-  glfwSetWindowPos(duk_require_pointer(ctx, 0),
+  glfwSetWindowPos(cpr__require_window(ctx, 0),
                    duk_require_int(ctx, 1),
                    duk_require_int(ctx, 2));
   return 0;
@@ -334,7 +417,7 @@ CPR_API_INTERN duk_ret_t glfw_set_window_pos(duk_context *ctx) {
 
 CPR_API_INTERN duk_ret_t glfw_get_window_size(duk_context *ctx) {
   int width = 0, height = 0;
-  glfwGetWindowSize(duk_require_pointer(ctx, 0), &width, &height);
+  glfwGetWindowSize(cpr__require_window(ctx, 0), &width, &height);
   duk_push_array(ctx);
   duk_push_int(ctx, width);
   duk_put_prop_index(ctx, -2, 0);
@@ -344,7 +427,7 @@ CPR_API_INTERN duk_ret_t glfw_get_window_size(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_set_window_size(duk_context *ctx) {
-  glfwSetWindowSize(duk_require_pointer(ctx, 0),
+  glfwSetWindowSize(cpr__require_window(ctx, 0),
                     duk_require_int(ctx, 1),
                     duk_require_int(ctx, 2));
   return 0;
@@ -352,7 +435,7 @@ CPR_API_INTERN duk_ret_t glfw_set_window_size(duk_context *ctx) {
 
 CPR_API_INTERN duk_ret_t glfw_get_framebuffer_size(duk_context *ctx) {
   int width = 0, height = 0;
-  glfwGetFramebufferSize(duk_require_pointer(ctx, 0), &width, &height);
+  glfwGetFramebufferSize(cpr__require_window(ctx, 0), &width, &height);
   duk_push_array(ctx);
   duk_push_int(ctx, width);
   duk_put_prop_index(ctx, -2, 0);
@@ -364,7 +447,7 @@ CPR_API_INTERN duk_ret_t glfw_get_framebuffer_size(duk_context *ctx) {
 CPR_API_INTERN duk_ret_t glfw_get_window_frame_size(duk_context *ctx) {
   /* void glfwGetWindowFrameSize(GLFWwindow* window, int* left, int* top, int* right, int* bottom); */
   int left, top, right, bottom;
-  glfwGetWindowFrameSize(duk_require_pointer(ctx, 0), &left, &top, &right, &bottom);
+  glfwGetWindowFrameSize(cpr__require_window(ctx, 0), &left, &top, &right, &bottom);
   duk_push_array(ctx);
   duk_push_int(ctx, left);
   duk_put_prop_index(ctx, -2, 0);
@@ -378,47 +461,50 @@ CPR_API_INTERN duk_ret_t glfw_get_window_frame_size(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_iconify_window(duk_context *ctx) {
-  glfwIconifyWindow(duk_require_pointer(ctx, 0));
+  glfwIconifyWindow(cpr__require_window(ctx, 0));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_restore_window(duk_context *ctx) {
-  glfwRestoreWindow(duk_require_pointer(ctx, 0));
+  glfwRestoreWindow(cpr__require_window(ctx, 0));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_show_window(duk_context *ctx) {
-  glfwShowWindow(duk_require_pointer(ctx ,0));
+  glfwShowWindow(cpr__require_window(ctx, 0));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_hide_window(duk_context *ctx) {
-  glfwHideWindow(duk_require_pointer(ctx, 0));
+  glfwHideWindow(cpr__require_window(ctx, 0));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_window_monitor(duk_context *ctx) {
-  duk_push_pointer(ctx, glfwGetWindowMonitor(duk_require_pointer(ctx, 0)));
+  cpr_native_push_shared(ctx, &cpr__monitor_type, glfwGetWindowMonitor(cpr__require_window(ctx, 0)));
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_window_attrib(duk_context *ctx) {
   int value = 0;
-  value = glfwGetWindowAttrib(duk_require_pointer(ctx, 0), duk_require_int(ctx ,1));
+  value = glfwGetWindowAttrib(cpr__require_window(ctx, 0), duk_require_int(ctx ,1));
   duk_push_int(ctx, value);
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_set_window_user_pointer(duk_context *ctx) {
   cpr_user_data *u;
-  u = glfwGetWindowUserPointer(duk_require_pointer(ctx ,0));
+  u = cpr_native_require(ctx, 0, CPR_GLFW_WINDOW)->state;
   u->user_ptr = duk_get_heapptr(ctx ,1);
+  /* Keep the value reachable from the window handle */
+  duk_dup(ctx, 1);
+  duk_put_prop_string(ctx, 0, "\xff" "userPointer");
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_window_user_pointer(duk_context *ctx) {
   cpr_user_data *u;
-  u = glfwGetWindowUserPointer(duk_require_pointer(ctx, 0));
+  u = cpr_native_require(ctx, 0, CPR_GLFW_WINDOW)->state;
   duk_push_heapptr(ctx, u->user_ptr);
   return 1;
 }
@@ -430,7 +516,7 @@ CPR_API_INTERN void cpr__window_pos_callback(GLFWwindow *window, int x, int y) {
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->window_pos_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_int(u->ctx, x);
   duk_push_int(u->ctx, y);
   duk_call(u->ctx, 3);
@@ -445,7 +531,7 @@ CPR_API_INTERN void cpr__window_size_callback(GLFWwindow *window, int width, int
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->window_size_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_int(u->ctx, width);
   duk_push_int(u->ctx, height);
   duk_call(u->ctx, 3);
@@ -460,7 +546,7 @@ CPR_API_INTERN void cpr__window_close_callback(GLFWwindow *window) {
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->window_close_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_call(u->ctx, 1);
 }
 
@@ -474,7 +560,7 @@ CPR_API_INTERN void cpr__window_refresh_callback(GLFWwindow *window) {
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->window_refresh_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_call(u->ctx, 1);
 }
 
@@ -487,7 +573,7 @@ CPR_API_INTERN void cpr__window_focus_callback(GLFWwindow *window, int focused)
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->window_focus_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_boolean(u->ctx, focused);
   duk_call(u->ctx, 2);
 }
@@ -501,7 +587,7 @@ CPR_API_INTERN void cpr__window_iconify_callback(GLFWwindow *window, int iconifi
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->window_iconify_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_boolean(u->ctx, iconified);
   duk_call(u->ctx, 2);
 }
@@ -515,7 +601,7 @@ CPR_API_INTERN void cpr__framebuffer_size_callback(GLFWwindow *window, int width
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->framebuffer_size_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_int(u->ctx, width);
   duk_push_int(u->ctx, height);
   duk_call(u->ctx, 3);
@@ -528,12 +614,22 @@ CPR_API_INTERN duk_ret_t glfw_set_framebuffer_size_callback(duk_context *ctx) {
 #endif /* CPR__GLFW_WINDOW_CALLBACKS_BIND */
 
 CPR_API_INTERN duk_ret_t glfw_poll_events(duk_context *ctx) {
+#if defined(CPR_COMPILING_CEPORA)
+  cpr_profiler_begin("glfw.pollEvents");
   glfwPollEvents();
+  cpr_profiler_end(NULL);
+  cpr_dispatch(ctx);
+#else
+  glfwPollEvents();
+#endif
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_wait_events(duk_context *ctx) {
   glfwWaitEvents();
+#if defined(CPR_COMPILING_CEPORA)
+  cpr_dispatch(ctx);
+#endif
   return 0;
 }
 
@@ -543,7 +639,20 @@ CPR_API_INTERN duk_ret_t glfw_post_empty_event(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_swap_buffers(duk_context *ctx) {
-  glfwSwapBuffers(duk_require_pointer(ctx, 0));
+  GLFWwindow *window = cpr__require_window(ctx, 0);
+#if defined(CPR_COMPILING_CEPORA)
+  cpr_profiler_begin("glfw.swapBuffers");
+  glfwSwapBuffers(window);
+  cpr_profiler_end(NULL);
+#else
+  glfwSwapBuffers(window);
+#endif
+#if defined(CPR_COMPILING_CEPORA)
+  /* Let scripts looping until the window should close end in headless mode */
+  if (cpr_headless_swap()) {
+    glfwSetWindowShouldClose(window, GL_TRUE);
+  }
+#endif
   return 0;
 }
 
@@ -557,20 +666,20 @@ CPR_API_INTERN duk_ret_t glfw_get_monitors(duk_context *ctx) {
   monitors = glfwGetMonitors(&count);
   duk_push_array(ctx);
   for (i=0; i<count; ++i) {
-    duk_push_pointer(ctx, monitors[i]);
+    cpr_native_push_shared(ctx, &cpr__monitor_type, monitors[i]);
     duk_put_prop_index(ctx, -2, i);
   }
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_primary_monitor(duk_context *ctx) {
-  duk_push_pointer(ctx, glfwGetPrimaryMonitor());
+  cpr_native_push_shared(ctx, &cpr__monitor_type, glfwGetPrimaryMonitor());
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_monitor_pos(duk_context *ctx) {
   int xpos = 0, ypos = 0;
-  glfwGetMonitorPos(duk_require_pointer(ctx, 0), &xpos, &ypos);
+  glfwGetMonitorPos(cpr__require_monitor(ctx, 0), &xpos, &ypos);
   duk_push_array(ctx);
   duk_push_int(ctx, xpos);
   duk_put_prop_index(ctx, -2, 0);
@@ -581,7 +690,7 @@ CPR_API_INTERN duk_ret_t glfw_get_monitor_pos(duk_context *ctx) {
 
 CPR_API_INTERN duk_ret_t glfw_get_monitor_physical_size(duk_context *ctx) {
   int width = 0, height = 0;
-  glfwGetMonitorPhysicalSize(duk_require_pointer(ctx, 0), &width, &height);
+  glfwGetMonitorPhysicalSize(cpr__require_monitor(ctx, 0), &width, &height);
   duk_push_array(ctx);
   duk_push_int(ctx, width);
   duk_put_prop_index(ctx, -2, 0);
@@ -591,7 +700,7 @@ CPR_API_INTERN duk_ret_t glfw_get_monitor_physical_size(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_monitor_name(duk_context *ctx) {
-  duk_push_string(ctx, glfwGetMonitorName(duk_require_pointer(ctx, 0)));
+  duk_push_string(ctx, glfwGetMonitorName(cpr__require_monitor(ctx, 0)));
   return 1;
 }
 
@@ -623,7 +732,7 @@ CPR_API_INTERN duk_ret_t glfw_get_video_modes(duk_context *ctx) {
   int count = 0, i;
   const GLFWvidmode *modes = NULL;
 
-  if ((modes = glfwGetVideoModes(duk_require_pointer(ctx, 0), &count)) != NULL) {
+  if ((modes = glfwGetVideoModes(cpr__require_monitor(ctx, 0), &count)) != NULL) {
     duk_push_array(ctx);
     for (i=0; i<count; ++i) {
       cpr__push_array_vidmode(ctx, &modes[i]);
@@ -637,7 +746,7 @@ CPR_API_INTERN duk_ret_t glfw_get_video_modes(duk_context *ctx) {
 
 CPR_API_INTERN duk_ret_t glfw_get_video_mode(duk_context *ctx) {
   const GLFWvidmode *mode = NULL;
-  if ((mode = glfwGetVideoMode(duk_require_pointer(ctx, 0))) != NULL) {
+  if ((mode = glfwGetVideoMode(cpr__require_monitor(ctx, 0))) != NULL) {
     cpr__push_array_vidmode(ctx, mode);
   } else {
     duk_push_null(ctx);
@@ -646,7 +755,7 @@ CPR_API_INTERN duk_ret_t glfw_get_video_mode(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_set_gamma(duk_context *ctx) {
-  glfwSetGamma(duk_require_pointer(ctx, 0), duk_require_number(ctx, 1));
+  glfwSetGamma(cpr__require_monitor(ctx, 0), duk_require_number(ctx, 1));
   return 0;
 }
 
@@ -671,7 +780,7 @@ CPR_API_INTERN void cpr__push_array_gamma_ramp(duk_context *ctx, const GLFWgamma
 
 CPR_API_INTERN duk_ret_t glfw_get_gamma_ramp(duk_context *ctx) {
   const GLFWgammaramp *ramp = NULL;
-  ramp = glfwGetGammaRamp(duk_require_pointer(ctx,0 ));
+  ramp = glfwGetGammaRamp(cpr__require_monitor(ctx, 0));
   cpr__push_array_gamma_ramp(ctx, ramp);
   return 1;
 }
@@ -724,7 +833,7 @@ CPR_API_INTERN duk_ret_t glfw_set_gamma_ramp(duk_context *ctx) {
      * replaced by the return values by duk_safe_call */
     duk_pop_2(ctx);
   }
-  glfwSetGammaRamp(duk_require_pointer(ctx, 0), &ramp);
+  glfwSetGammaRamp(cpr__require_monitor(ctx, 0), &ramp);
   duk_free(ctx, ramp.red);
   duk_free(ctx, ramp.green);
   duk_free(ctx, ramp.blue);
@@ -744,12 +853,12 @@ rethrow:
 
 #if defined(CPR__GLFW_INPUT_MODE_BIND)
 CPR_API_INTERN duk_ret_t glfw_get_input_mode(duk_context *ctx) {
-  duk_push_int(ctx, glfwGetInputMode(duk_require_pointer(ctx, 0), duk_require_int(ctx, 1)));
+  duk_push_int(ctx, glfwGetInputMode(cpr__require_window(ctx, 0), duk_require_int(ctx, 1)));
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_set_input_mode(duk_context *ctx) {
-  glfwSetInputMode(duk_require_pointer(ctx, 0),
+  glfwSetInputMode(cpr__require_window(ctx, 0),
                    duk_require_int(ctx, 1),
                    duk_require_int(ctx, 2));
   return 0;
@@ -758,20 +867,20 @@ CPR_API_INTERN duk_ret_t glfw_set_input_mode(duk_context *ctx) {
 
 #if defined(CPR__GLFW_KEYBOARD_BIND)
 CPR_API_INTERN duk_ret_t glfw_get_key(duk_context *ctx) {
-  duk_push_int(ctx, glfwGetKey(duk_require_pointer(ctx, 0), duk_require_int(ctx, 1)));
+  duk_push_int(ctx, glfwGetKey(cpr__require_window(ctx, 0), duk_require_int(ctx, 1)));
   return 1;
 }
 #endif /* CPR__GLFW_KEYBOARD_BIND */
 
 #if defined(CPR__GLFW_MOUSE_BIND)
 CPR_API_INTERN duk_ret_t glfw_get_mouse_button(duk_context *ctx) {
-  duk_push_int(ctx, glfwGetMouseButton(duk_require_pointer(ctx, 0), duk_require_int(ctx, 1)));
+  duk_push_int(ctx, glfwGetMouseButton(cpr__require_window(ctx, 0), duk_require_int(ctx, 1)));
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_cursor_pos(duk_context *ctx) {
   double xpos, ypos;
-  glfwGetCursorPos(duk_require_pointer(ctx, 0), &xpos, &ypos);
+  glfwGetCursorPos(cpr__require_window(ctx, 0), &xpos, &ypos);
   duk_push_array(ctx);
   duk_push_number(ctx, xpos);
   duk_put_prop_index(ctx, -2, 0);
@@ -781,7 +890,7 @@ CPR_API_INTERN duk_ret_t glfw_get_cursor_pos(duk_context *ctx) {
 }
 
 CPR_API_INTERN duk_ret_t glfw_set_cursor_pos(duk_context *ctx) {
-  glfwSetCursorPos(duk_require_pointer(ctx, 0),
+  glfwSetCursorPos(cpr__require_window(ctx, 0),
                    duk_require_number(ctx ,1),
                    duk_require_number(ctx ,2));
   return 0;
@@ -789,6 +898,40 @@ CPR_API_INTERN duk_ret_t glfw_set_cursor_pos(duk_context *ctx) {
 #endif /* CPR__GLFW_MOUSE_BIND */
 
 #if defined(CPR__GLFW_CREATE_CURSOR_BIND)
+CPR_API_INTERN void cpr__finalize_cursor(void *ptr, void *state) {
+  cpr_cursor_data *c = state;
+  if (c->prev) {
+    c->prev->next = c->next;
+  } else {
+    _cursors = c->next;
+  }
+  if (c->next) {
+    c->next->prev = c->prev;
+  }
+  glfwDestroyCursor(ptr);
+  free(c);
+}
+
+static const cpr_native_type cpr__cursor_type = { CPR_GLFW_CURSOR, cpr__finalize_cursor };
+
+/* The cursor is destroyed with its handle if not destroyed before */
+CPR_API_INTERN void cpr__push_cursor(duk_context *ctx, GLFWcursor *cursor) {
+  cpr_cursor_data *c;
+  if (cursor == NULL) {
+    duk_push_null(ctx);
+    return;
+  }
+  if ((c = calloc(1, sizeof(cpr_cursor_data))) == NULL) {
+    glfwDestroyCursor(cursor);
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate cursor data");
+  }
+  if ((c->next = _cursors) != NULL) {
+    _cursors->prev = c;
+  }
+  _cursors = c;
+  c->native = cpr_native_push(ctx, &cpr__cursor_type, cursor, c);
+}
+
 /* @param buffer
  * @param width
  * @param height
@@ -802,24 +945,28 @@ CPR_API_INTERN duk_ret_t glfw_create_cursor(duk_context *ctx) {
   image.pixels = (unsigned char *)duk_require_buffer_data(ctx, 0, &len);
   image.width  = duk_require_int(ctx, 1);
   image.height = duk_require_int(ctx, 2);
-  duk_push_pointer(ctx, glfwCreateCursor(&image,
-                                         duk_require_int(ctx, 3),
-                                         duk_require_int(ctx, 4)));
+  cpr__push_cursor(ctx, glfwCreateCursor(&image,
+                                          duk_require_int(ctx, 3),
+                                          duk_require_int(ctx, 4)));
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_create_standard_cursor(duk_context *ctx) {
-  duk_push_pointer(ctx, glfwCreateStandardCursor(duk_require_int(ctx, 0)));
+  cpr__push_cursor(ctx, glfwCreateStandardCursor(duk_require_int(ctx, 0)));
   return 1;
 }
 
 CPR_API_INTERN duk_ret_t glfw_destroy_cursor(duk_context *ctx) {
-  glfwDestroyCursor(duk_require_pointer(ctx, 0));
+  cpr_native_destroy(cpr_native_require(ctx, 0, CPR_GLFW_CURSOR));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_set_cursor(duk_context *ctx) {
-  glfwSetCursor(duk_require_pointer(ctx, 0), duk_require_pointer(ctx, 1));
+  cpr_native *n = cpr_native_get(ctx, 1, CPR_GLFW_CURSOR);
+  glfwSetCursor(cpr__require_window(ctx, 0), n ? n->ptr : NULL);
+  /* The window keeps its cursor alive */
+  duk_dup(ctx, 1);
+  duk_put_prop_string(ctx, 0, "\xff" "cursor");
   return 0;
 }
 #endif /* CPR__GLFW_CREATE_CURSOR_BIND */
@@ -830,7 +977,7 @@ CPR_API_INTERN void cpr__key_callback(GLFWwindow* window, int key, int scancode,
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->key_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_int(u->ctx, key);
   duk_push_int(u->ctx, scancode);
   duk_push_int(u->ctx, action);
@@ -847,7 +994,7 @@ CPR_API_INTERN void cpr__char_callback(GLFWwindow *window, unsigned int characte
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->char_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_int(u->ctx, character);
   duk_call(u->ctx, 2);
 }
@@ -861,7 +1008,7 @@ CPR_API_INTERN void cpr__set_char_mods_callback(GLFWwindow *window, unsigned int
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->char_mods_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_uint(u->ctx, codepoint);
   duk_push_int(u->ctx, mods);
   duk_call(u->ctx, 3);
@@ -878,7 +1025,7 @@ CPR_API_INTERN void cpr__mouse_button_callback(GLFWwindow *window, int button, i
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->mouse_button_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_int(u->ctx, button);
   duk_push_int(u->ctx, action);
   duk_push_int(u->ctx, mods);
@@ -894,7 +1041,7 @@ CPR_API_INTERN void cpr__cursor_pos_callback(GLFWwindow *window, double xpos, do
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->cursor_pos_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_number(u->ctx, xpos);
   duk_push_number(u->ctx, ypos);
   duk_call(u->ctx, 3);
@@ -909,7 +1056,7 @@ CPR_API_INTERN void cpr__cursor_enter_callback(GLFWwindow *window, int entered)
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->cursor_enter_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_boolean(u->ctx, entered);
   duk_call(u->ctx, 2);
 }
@@ -923,7 +1070,7 @@ CPR_API_INTERN void cpr__scroll_callback(GLFWwindow *window, double xoffset, dou
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->scroll_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_number(u->ctx, xoffset);
   duk_push_number(u->ctx, yoffset);
   duk_call(u->ctx, 3);
@@ -939,7 +1086,7 @@ CPR_API_INTERN void cpr__drop_callback(GLFWwindow *window, int count, const char
   cpr_user_data *u;
   u = glfwGetWindowUserPointer(window);
   duk_push_heapptr(u->ctx, u->drop_callback_ptr);
-  duk_push_pointer(u->ctx, window);
+  cpr_native_push_handle(u->ctx, u->native);
   duk_push_array(u->ctx);
   for (i=0; i<count; ++i) {
     duk_push_string(u->ctx, paths[i]);
@@ -996,13 +1143,13 @@ CPR_API_INTERN duk_ret_t glfw_get_joystick_name(duk_context *ctx) {
 #if defined(CPR__GLFW_CLIPBOARD_BIND)
 CPR_API_INTERN duk_ret_t glfw_set_clipboard_string(duk_context *ctx) {
   /* The string is copied by GLFW before the function returns. */
-  glfwSetClipboardString(duk_get_pointer(ctx, 0), duk_get_string(ctx, 1));
+  glfwSetClipboardString(cpr__get_window(ctx, 0), duk_get_string(ctx, 1));
   return 0;
 }
 
 CPR_API_INTERN duk_ret_t glfw_get_clipboard_string(duk_context *ctx) {
   /* The returned string is allocated and freed by GLFW. */
-  duk_push_string(ctx, glfwGetClipboardString(duk_get_pointer(ctx, 0)));
+  duk_push_string(ctx, glfwGetClipboardString(cpr__get_window(ctx, 0)));
   return 1;
 }
 #endif /* CPR__GLFW_CLIPBOARD_BIND */
@@ -1020,7 +1167,8 @@ CPR_API_INTERN duk_ret_t glfw_set_time(duk_context *ctx) {
 #endif /* CPR__GLFW_TIME_BIND */
 
 CPR_API_EXTERN duk_ret_t dukopen_glfw(duk_context *ctx) {
-  const duk_function_list_entry module_funcs[] = {
+  /* Static: the functions are created on first use */
+  static const duk_function_list_entry module_funcs[] = {
     /* Context handling */
     { "makeContextCurrent",          glfw_make_context_current,          1   },
     { "getCurrentContext",           glfw_get_current_context,           0   },
@@ -1405,8 +1553,8 @@ CPR_API_EXTERN duk_ret_t dukopen_glfw(duk_context *ctx) {
     { NULL, 0.0 }
   };
 
-  duk_push_object(ctx);  /* module result */
-  duk_put_function_list(ctx, -1, module_funcs);
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_lazy(ctx, -1, module_funcs);
   duk_put_number_list(ctx, -1, module_consts);
 
   _ctx = ctx;
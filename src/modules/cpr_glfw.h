@@ -14,6 +14,11 @@
 extern "C" {
 #endif
 
+/* Handle types of the GLFW objects (see cpr_native.h) */
+#define CPR_GLFW_WINDOW   "GLFWwindow"
+#define CPR_GLFW_MONITOR  "GLFWmonitor"
+#define CPR_GLFW_CURSOR   "GLFWcursor"
+
 CPR_API_EXTERN duk_ret_t dukopen_glfw(duk_context *ctx);
 
 #ifdef __cplusplus
@@ -235,7 +235,7 @@ CPR_API_EXTERN duk_ret_t dukopen_imgui(duk_context *ctx) {
     { NULL, 0.0 }
   };
 
-  duk_push_object(ctx);
+  cpr_push_module_exports(ctx);
   cpr_put_function_list_magic(ctx, -1, module_funcs);
   duk_put_number_list(ctx, -1, module_consts);
 
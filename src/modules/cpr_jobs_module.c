@@ -0,0 +1,81 @@
+/*
+ * cpr_jobs_module.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Job system scripting interface (see cpr_jobs.h).
+ * Native modules return job handles (`cpr_jobs_push_handle`) that scripts can
+ * poll from the frame loop or wait for:
+ *
+ *   job = physics.step world, dt
+ *   ...
+ *   jobs.wait job unless jobs.isDone job
+ */
+
+#include "cpr_jobs_module.h"
+#include "cpr_jobs.h"
+#include "cpr_duktape_helpers.h"
+
+CPR_API_INTERN duk_ret_t cpr_jobs_js_is_done(duk_context *ctx) {
+  duk_push_boolean(ctx, cpr_job_is_done(cpr_jobs_require_handle(ctx, 0)));
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr_jobs_js_wait(duk_context *ctx) {
+  cpr_job_wait(cpr_jobs_require_handle(ctx, 0));
+  return 0;
+}
+
+/* Return a job done when all the jobs of the array are done */
+CPR_API_INTERN duk_ret_t cpr_jobs_js_all(duk_context *ctx) {
+  duk_size_t i, n;
+  cpr_job *job;
+
+  if (!duk_is_array(ctx, 0)) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "array of job handles expected");
+  }
+  n = duk_get_length(ctx, 0);
+  for (i = 0; i < n; ++i) {
+    duk_get_prop_index(ctx, 0, (duk_uarridx_t)i);
+    cpr_jobs_require_handle(ctx, -1);
+    duk_pop(ctx);
+  }
+  if ((job = cpr_job_create(NULL, NULL)) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the job");
+  }
+  cpr_jobs_push_handle(ctx, job);
+  cpr_job_release(job);
+  for (i = 0; i < n; ++i) {
+    duk_get_prop_index(ctx, 0, (duk_uarridx_t)i);
+    if (cpr_job_depends(job, cpr_jobs_require_handle(ctx, -1)) != 0) {
+      duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the job");
+    }
+    duk_pop(ctx);
+  }
+  /* Keep the jobs (and the values they reference) alive */
+  duk_dup(ctx, 0);
+  duk_put_prop_string(ctx, -2, "jobs");
+  cpr_job_submit(job);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr_jobs_js_thread_count(duk_context *ctx) {
+  duk_push_int(ctx, cpr_jobs_thread_count());
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_jobs(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "isDone",      cpr_jobs_js_is_done,      1 },
+    { "wait",        cpr_jobs_js_wait,         1 },
+    { "all",         cpr_jobs_js_all,          1 },
+    { "threadCount", cpr_jobs_js_thread_count, 0 },
+    { NULL, NULL, 0 }
+  };
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+
+  return 1;  /* return module value */
+}
@@ -0,0 +1,23 @@
+/*
+ * cpr_jobs_module.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_JOBS_MODULE_H
+#define CPR_JOBS_MODULE_H
+
+#include "duktape.h"
+#include "cpr_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+CPR_API_EXTERN duk_ret_t dukopen_jobs(duk_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_JOBS_MODULE_H */
@@ -0,0 +1,231 @@
+/*
+ * cpr_mainloop.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Fixed timestep main loop.
+ * `mainloop.run` drives the game loop from C: the `update` callback is called at a
+ * fixed rate using a time accumulator and `render` is called once per frame
+ * with the interpolation alpha between the last two updates. When a frame
+ * takes too long at most `maxSteps` updates are run and the remaining time is
+ * dropped so the loop can't spiral. With `sleep` the loop waits for the next
+ * update deadline instead of rendering the same state again.
+ *
+ * If a GLFW window is given, events are polled before the updates, the buffers
+ * are swapped after `render` and the loop stops when the window should close.
+ * The deferred callbacks (see cpr_dispatch.h) are dispatched after the events.
+ * The loop also stops after `maxFrames` frames or when `mainloop.stop` is called.
+ * In headless mode the window is closed after the `--frames` limit.
+ *
+ * Every iteration ends a profiler frame. The updates, render, buffer swap,
+ * event polling and sleep are profiled in their own zones.
+ *
+ * `fixedDelta` replaces the measured frame time by a constant, which makes
+ * runs reproducible (tests, video capture or batch rendering).
+ */
+
+#include "cpr_mainloop.h"
+#include "cpr_macros.h"
+#include "cpr_sys_tools.h"
+#include "cpr_cepora.h" /* cpr_headless_swap */
+#include "cpr_profiler.h"
+#include "cpr_dispatch.h"
+#include "cpr_duktape_helpers.h"
+#include "cpr_native.h"
+#include "cpr_glfw.h" /* CPR_GLFW_WINDOW */
+#include "GLFW/glfw3.h"
+
+#include <math.h> /* fmod */
+
+#define CPR__MAINLOOP_DEFAULT_RATE      60.0
+#define CPR__MAINLOOP_DEFAULT_MAX_STEPS 5
+
+typedef struct cpr__mainloop_stats {
+  double frames;
+  double updates;
+  double dropped;   /* seconds dropped by the max steps limit */
+} cpr__mainloop_stats;
+
+/* Set by `mainloop.stop` in the global stash of the heap. Reset when a loop
+ * starts. */
+#define CPR__MAINLOOP_STOP "cprMainloopStop"
+
+CPR_API_INTERN void cpr__mainloop_set_stop(duk_context *ctx, int stop) {
+  duk_push_global_stash(ctx);
+  duk_push_boolean(ctx, stop);
+  duk_put_prop_string(ctx, -2, CPR__MAINLOOP_STOP);
+  duk_pop(ctx);
+}
+
+CPR_API_INTERN int cpr__mainloop_is_stopped(duk_context *ctx) {
+  int stop;
+  duk_push_global_stash(ctx);
+  duk_get_prop_string(ctx, -1, CPR__MAINLOOP_STOP);
+  stop = duk_to_boolean(ctx, -1);
+  duk_pop_2(ctx);
+  return stop;
+}
+
+CPR_API_INTERN double cpr__mainloop_get_number(duk_context *ctx, duk_idx_t idx, const char *key, double value) {
+  if (duk_get_prop_string(ctx, idx, key) && !duk_is_undefined(ctx, -1)) {
+    value = duk_require_number(ctx, -1);
+  }
+  duk_pop(ctx);
+  return value;
+}
+
+/* Push the callable `key` property or undefined */
+CPR_API_INTERN int cpr__mainloop_get_callback(duk_context *ctx, duk_idx_t idx, const char *key) {
+  duk_get_prop_string(ctx, idx, key);
+  if (duk_is_undefined(ctx, -1)) {
+    return 0;
+  }
+  if (!duk_is_callable(ctx, -1)) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "mainloop %s must be a function", key);
+  }
+  return 1;
+}
+
+/* Binding API */
+
+/* mainloop.run(params) -> { frames, updates, dropped, time }
+ * params: update(dt), render(alpha), rate (updates per second, default 60),
+ * maxSteps (default 5), sleep (default false), window, swap (default true),
+ * maxFrames, fixedDelta */
+CPR_API_INTERN duk_ret_t cpr_mainloop_run(duk_context *ctx) {
+  duk_idx_t update_idx, render_idx;
+  int has_update, has_render, sleep, swap, steps, max_steps;
+  double rate, dt, max_frames, fixed_delta, start, now, last, acc = 0.0;
+  cpr_native *window = NULL;
+  cpr__mainloop_stats stats = { 0.0, 0.0, 0.0 };
+
+  duk_require_object_coercible(ctx, 0);
+  rate = cpr__mainloop_get_number(ctx, 0, "rate", CPR__MAINLOOP_DEFAULT_RATE);
+  max_steps = (int)cpr__mainloop_get_number(ctx, 0, "maxSteps", CPR__MAINLOOP_DEFAULT_MAX_STEPS);
+  max_frames = cpr__mainloop_get_number(ctx, 0, "maxFrames", -1.0);
+  fixed_delta = cpr__mainloop_get_number(ctx, 0, "fixedDelta", -1.0);
+  if (!(rate > 0.0)) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid mainloop rate %g", rate);
+  }
+  if (max_steps <= 0) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid mainloop max steps %d", max_steps);
+  }
+  duk_get_prop_string(ctx, 0, "sleep");
+  sleep = duk_to_boolean(ctx, -1);
+  duk_get_prop_string(ctx, 0, "swap");
+  swap = duk_is_undefined(ctx, -1) ? 1 : duk_to_boolean(ctx, -1);
+  duk_pop_2(ctx);
+  /* The window handle stays on the value stack for the whole loop */
+  duk_get_prop_string(ctx, 0, "window");
+  window = cpr_native_get(ctx, -1, CPR_GLFW_WINDOW);
+
+  /* Callbacks stay on the value stack for the whole loop */
+  has_update = cpr__mainloop_get_callback(ctx, 0, "update");
+  update_idx = duk_get_top_index(ctx);
+  has_render = cpr__mainloop_get_callback(ctx, 0, "render");
+  render_idx = duk_get_top_index(ctx);
+
+  dt = 1.0 / rate;
+  cpr__mainloop_set_stop(ctx, 0);
+  start = last = cpr_get_time();
+  while (!cpr__mainloop_is_stopped(ctx) && (max_frames < 0.0 || stats.frames < max_frames)) {
+    if (window != NULL) {
+      cpr_profiler_begin("glfw.pollEvents");
+      glfwPollEvents();
+      cpr_profiler_end(NULL);
+      /* Stop if the window was destroyed by a callback */
+      if (window->ptr == NULL || glfwWindowShouldClose(window->ptr)) {
+        break;
+      }
+    }
+    cpr_dispatch(ctx);
+
+    now = cpr_get_time();
+    acc += fixed_delta >= 0.0 ? fixed_delta : now - last;
+    last = now;
+
+    for (steps = 0; acc >= dt && !cpr__mainloop_is_stopped(ctx); ++steps) {
+      if (steps == max_steps) {
+        /* Drop the time the loop can't catch up with, but keep the phase */
+        stats.dropped += acc - fmod(acc, dt);
+        acc = fmod(acc, dt);
+        break;
+      }
+      if (has_update) {
+        cpr_profiler_begin("mainloop.update");
+        duk_dup(ctx, update_idx);
+        duk_push_number(ctx, dt);
+        duk_call(ctx, 1);
+        duk_pop(ctx);
+        cpr_profiler_end(NULL);
+      }
+      acc -= dt;
+      stats.updates += 1.0;
+    }
+
+    if (has_render) {
+      cpr_profiler_begin("mainloop.render");
+      duk_dup(ctx, render_idx);
+      duk_push_number(ctx, acc / dt);
+      duk_call(ctx, 1);
+      duk_pop(ctx);
+      cpr_profiler_end(NULL);
+    }
+    if (window != NULL && window->ptr != NULL && swap) {
+      cpr_profiler_begin("glfw.swapBuffers");
+      glfwSwapBuffers(window->ptr);
+      cpr_profiler_end(NULL);
+      if (cpr_headless_swap()) {
+        glfwSetWindowShouldClose(window->ptr, 1);
+      }
+    }
+    stats.frames += 1.0;
+
+    /* Wait for the next update deadline */
+    if (sleep && fixed_delta < 0.0) {
+      cpr_profiler_begin("mainloop.sleep");
+      cpr_sleep(dt - acc - (cpr_get_time() - last));
+      cpr_profiler_end(NULL);
+    }
+    cpr_profiler_frame();
+  }
+
+  duk_push_object(ctx);
+  duk_push_number(ctx, stats.frames);
+  duk_put_prop_string(ctx, -2, "frames");
+  duk_push_number(ctx, stats.updates);
+  duk_put_prop_string(ctx, -2, "updates");
+  duk_push_number(ctx, stats.dropped);
+  duk_put_prop_string(ctx, -2, "dropped");
+  duk_push_number(ctx, cpr_get_time() - start);
+  duk_put_prop_string(ctx, -2, "time");
+  return 1;
+}
+
+/* mainloop.stop()
+ * Stop the running loop after the current update or frame. */
+CPR_API_INTERN duk_ret_t cpr_mainloop_stop(duk_context *ctx) {
+  cpr__mainloop_set_stop(ctx, 1);
+  return 0;
+}
+
+/* mainloop.getTime() -> monotonic time in seconds */
+CPR_API_INTERN duk_ret_t cpr_mainloop_get_time(duk_context *ctx) {
+  duk_push_number(ctx, cpr_get_time());
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_mainloop(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "run",      cpr_mainloop_run,       1 },
+    { "stop",     cpr_mainloop_stop,      0 },
+    { "getTime",  cpr_mainloop_get_time,  0 },
+    { NULL, NULL, 0 }
+  };
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+
+  return 1;  /* return module value */
+}
@@ -0,0 +1,507 @@
+/*
+ * cpr_particles.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Particle systems.
+ * Particles are stored structure-of-arrays and updated by the SIMD kernels of
+ * cpr_particles_simd.c. Each system has a single emitter whose parameters are
+ * set from scripts with `setEmitter`. The size and color of a particle are
+ * interpolated from the emitter start to end values over its lifetime.
+ *
+ * Vertex data is written by the output kernel straight into the mapped vertex
+ * buffer of the system (or into a script buffer with `write`). Vertex data of
+ * `count` particles is stored in three planes:
+ *   - positions: `count` * 2 floats (x, y) at offset 0
+ *   - sizes:     `count` floats at offset 8 * count
+ *   - colors:    `count` RGBA8 at offset 12 * count
+ *
+ * Like the tilemap module the OpenGL functions are resolved by gl3w so
+ * `gl3w.init` must be called before any `draw` call.
+ */
+
+#include "cpr_particles.h"
+#include "cpr_particles_simd.h"
+#include "cpr_macros.h"
+#include "cpr_duktape_helpers.h"
+#include "GL/gl3w.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h> /* calloc, malloc, free */
+
+#define CPR__PARTICLES_MAX_CAPACITY (1 << 22)
+/* Bytes of vertex data per particle: position (2 floats), size and color */
+#define CPR__PARTICLES_VERTEX_SIZE  16
+#define CPR__PARTICLES_ATTRIBUTES   6
+#define CPR__PARTICLES_MIN_LIFE     0.001f
+#define CPR__PARTICLES_PI           3.14159265358979323846f
+
+typedef struct cpr__particles_emitter {
+  float x, y;
+  float rate;           /* particles per second */
+  float life, life_var;
+  float speed, speed_var;
+  float angle, spread;  /* radians */
+  float gravity_x, gravity_y;
+} cpr__particles_emitter;
+
+typedef struct cpr__particles {
+  int capacity;
+  int count;
+  void *memory;         /* unaligned block holding the SoA arrays */
+  cpr__particles_soa soa;
+  cpr__particles_emitter emitter;
+  cpr__particles_style style;
+  float spawn_acc;      /* fractional particles to spawn */
+  uint32_t seed;
+  GLuint vao;
+  GLuint vbo;
+} cpr__particles;
+
+/* Module state of the heap (see cpr_get_heap_state) */
+#define CPR__PARTICLES_STATE "cprParticles"
+
+typedef struct cpr__particles_state {
+  const cpr__particles_kernel *kernel;  /* used by all the systems */
+  GLuint program;                       /* shared by all the systems */
+  GLint view_location;
+} cpr__particles_state;
+
+static const char *_vertex_shader =
+  "#version 150\n"
+  "in vec2 a_pos;\n"
+  "in float a_size;\n"
+  "in vec4 a_color;\n"
+  "uniform vec4 u_view;\n" /* camera x, y, 2/width, -2/height */
+  "out vec4 v_color;\n"
+  "void main() {\n"
+  "  v_color = a_color;\n"
+  "  gl_PointSize = a_size;\n"
+  "  gl_Position = vec4((a_pos.x - u_view.x) * u_view.z - 1.0,\n"
+  "                     (a_pos.y - u_view.y) * u_view.w + 1.0, 0.0, 1.0);\n"
+  "}\n";
+
+static const char *_fragment_shader =
+  "#version 150\n"
+  "in vec4 v_color;\n"
+  "out vec4 o_color;\n"
+  "void main() {\n"
+  "  vec2 d = gl_PointCoord - vec2(0.5);\n"
+  "  if (dot(d, d) > 0.25) discard;\n"
+  "  o_color = v_color;\n"
+  "}\n";
+
+CPR_API_INTERN GLuint cpr__particles_compile_shader(duk_context *ctx, GLenum type, const char *source) {
+  GLuint shader;
+  GLint status = GL_FALSE;
+  char log[512];
+
+  shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (status != GL_TRUE) {
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    glDeleteShader(shader);
+    duk_error(ctx, DUK_ERR_ERROR, "Can't compile particles shader: %s", log);
+  }
+  return shader;
+}
+
+CPR_API_INTERN cpr__particles_state *cpr__particles_get_state(duk_context *ctx) {
+  cpr__particles_state *state = cpr_get_heap_state(ctx, CPR__PARTICLES_STATE, sizeof(cpr__particles_state));
+  if (state->kernel == NULL) {
+    state->kernel = cpr__particles_select_kernel(NULL);
+  }
+  return state;
+}
+
+/* Lazily create the shader program. Must be called with a current GL context. */
+CPR_API_INTERN void cpr__particles_init_program(duk_context *ctx, cpr__particles_state *state) {
+  GLuint vs, fs;
+  GLint status = GL_FALSE;
+
+  if (state->program != 0) {
+    return;
+  }
+  vs = cpr__particles_compile_shader(ctx, GL_VERTEX_SHADER, _vertex_shader);
+  fs = cpr__particles_compile_shader(ctx, GL_FRAGMENT_SHADER, _fragment_shader);
+  state->program = glCreateProgram();
+  glAttachShader(state->program, vs);
+  glAttachShader(state->program, fs);
+  glBindAttribLocation(state->program, 0, "a_pos");
+  glBindAttribLocation(state->program, 1, "a_size");
+  glBindAttribLocation(state->program, 2, "a_color");
+  glLinkProgram(state->program);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  glGetProgramiv(state->program, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    glDeleteProgram(state->program);
+    state->program = 0;
+    duk_error(ctx, DUK_ERR_ERROR, "Can't link particles shader program");
+  }
+  state->view_location = glGetUniformLocation(state->program, "u_view");
+}
+
+CPR_API_INTERN cpr__particles *cpr__particles_require(duk_context *ctx, duk_idx_t idx) {
+  cpr__particles *ps = duk_require_pointer(ctx, idx);
+  if (ps == NULL) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "invalid particle system (NULL)");
+  }
+  return ps;
+}
+
+/* xorshift32. Return a random float in [0, 1) */
+CPR_API_INTERN float cpr__particles_random(cpr__particles *ps) {
+  uint32_t x = ps->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  ps->seed = x;
+  return (float)(x >> 8) / 16777216.0f;
+}
+
+/* Spawn up to `n` particles at the emitter position. Return the number of
+ * particles actually spawned. */
+CPR_API_INTERN int cpr__particles_spawn(cpr__particles *ps, int n) {
+  int i;
+  float angle, speed, life;
+  cpr__particles_emitter *e = &ps->emitter;
+  cpr__particles_soa *p = &ps->soa;
+
+  if (n > ps->capacity - ps->count) {
+    n = ps->capacity - ps->count;
+  }
+  for (i = ps->count; i < ps->count + n; ++i) {
+    angle = e->angle + e->spread * (cpr__particles_random(ps) - 0.5f);
+    speed = e->speed + e->speed_var * (cpr__particles_random(ps) * 2.0f - 1.0f);
+    life = e->life + e->life_var * (cpr__particles_random(ps) * 2.0f - 1.0f);
+    p->x[i] = e->x;
+    p->y[i] = e->y;
+    p->vx[i] = cosf(angle) * speed;
+    p->vy[i] = sinf(angle) * speed;
+    p->age[i] = 0.0f;
+    p->inv_life[i] = 1.0f / (life < CPR__PARTICLES_MIN_LIFE ? CPR__PARTICLES_MIN_LIFE : life);
+  }
+  ps->count += n;
+  return n;
+}
+
+/* Remove the dead particles by moving the last particles in their slots */
+CPR_API_INTERN void cpr__particles_kill(cpr__particles *ps) {
+  int i = 0, last;
+  cpr__particles_soa *p = &ps->soa;
+
+  while (i < ps->count) {
+    if (p->age[i] * p->inv_life[i] < 1.0f) {
+      ++i;
+      continue;
+    }
+    last = --ps->count;
+    p->x[i] = p->x[last];
+    p->y[i] = p->y[last];
+    p->vx[i] = p->vx[last];
+    p->vy[i] = p->vy[last];
+    p->age[i] = p->age[last];
+    p->inv_life[i] = p->inv_life[last];
+  }
+}
+
+CPR_API_INTERN float cpr__particles_get_float(duk_context *ctx, duk_idx_t idx, const char *key, float value) {
+  if (duk_get_prop_string(ctx, idx, key)) {
+    value = (float)duk_require_number(ctx, -1);
+  }
+  duk_pop(ctx);
+  return value;
+}
+
+/* Read an [r, g, b, a] array property */
+CPR_API_INTERN void cpr__particles_get_color(duk_context *ctx, duk_idx_t idx, const char *key, float *color) {
+  int i;
+  if (duk_get_prop_string(ctx, idx, key)) {
+    if (!duk_is_array(ctx, -1)) {
+      duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s must be an [r, g, b, a] array", key);
+    }
+    for (i = 0; i < 4; ++i) {
+      duk_get_prop_index(ctx, -1, i);
+      color[i] = (float)duk_get_number(ctx, -1);
+      duk_pop(ctx);
+    }
+  }
+  duk_pop(ctx);
+}
+
+/* Binding API */
+
+/* particles.create(capacity) */
+CPR_API_INTERN duk_ret_t cpr_particles_create(duk_context *ctx) {
+  cpr__particles *ps;
+  int capacity;
+  float *base;
+  int i;
+
+  capacity = duk_require_int(ctx, 0);
+  if (capacity <= 0 || capacity > CPR__PARTICLES_MAX_CAPACITY) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid particles capacity %d", capacity);
+  }
+  /* Round the arrays size up to the SIMD width so all the arrays stay aligned */
+  capacity = (capacity + CPR__PARTICLES_LANES - 1) & ~(CPR__PARTICLES_LANES - 1);
+
+  if ((ps = (cpr__particles *)calloc(1, sizeof(cpr__particles))) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "particles: out of memory");
+  }
+  if ((ps->memory = malloc((size_t)capacity * CPR__PARTICLES_ATTRIBUTES * sizeof(float) + 32)) == NULL) {
+    free(ps);
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "particles: out of memory");
+  }
+  base = (float *)(((uintptr_t)ps->memory + 31) & ~(uintptr_t)31);
+  ps->soa.x = base;
+  ps->soa.y = base + capacity;
+  ps->soa.vx = base + capacity * 2;
+  ps->soa.vy = base + capacity * 3;
+  ps->soa.age = base + capacity * 4;
+  ps->soa.inv_life = base + capacity * 5;
+  ps->capacity = capacity;
+  ps->seed = 0x9e3779b9u;
+
+  /* Default emitter: white particles going up for one second */
+  ps->emitter.life = 1.0f;
+  ps->emitter.speed = 100.0f;
+  ps->emitter.angle = -CPR__PARTICLES_PI / 2.0f;
+  ps->style.size = 4.0f;
+  for (i = 0; i < 4; ++i) {
+    ps->style.color[i] = 1.0f;
+  }
+  ps->style.dcolor[3] = -1.0f;
+
+  duk_push_pointer(ctx, ps);
+  return 1;
+}
+
+/* Release the system and its GL objects. The GL context must be current if
+ * the system has been drawn. */
+CPR_API_INTERN duk_ret_t cpr_particles_destroy(duk_context *ctx) {
+  cpr__particles *ps = cpr__particles_require(ctx, 0);
+  if (ps->vao != 0) {
+    glDeleteVertexArrays(1, &ps->vao);
+    glDeleteBuffers(1, &ps->vbo);
+  }
+  free(ps->memory);
+  free(ps);
+  return 0;
+}
+
+/* particles.setEmitter(ps, params)
+ * Only the parameters defined in `params` are changed:
+ * x, y, rate, life, lifeVariance, speed, speedVariance, angle, spread,
+ * gravityX, gravityY, startSize, endSize, startColor, endColor */
+CPR_API_INTERN duk_ret_t cpr_particles_set_emitter(duk_context *ctx) {
+  int i;
+  float size_end, color_end[4];
+  cpr__particles *ps = cpr__particles_require(ctx, 0);
+  cpr__particles_emitter *e = &ps->emitter;
+  cpr__particles_style *s = &ps->style;
+
+  duk_require_object_coercible(ctx, 1);
+  e->x = cpr__particles_get_float(ctx, 1, "x", e->x);
+  e->y = cpr__particles_get_float(ctx, 1, "y", e->y);
+  e->rate = cpr__particles_get_float(ctx, 1, "rate", e->rate);
+  e->life = cpr__particles_get_float(ctx, 1, "life", e->life);
+  e->life_var = cpr__particles_get_float(ctx, 1, "lifeVariance", e->life_var);
+  e->speed = cpr__particles_get_float(ctx, 1, "speed", e->speed);
+  e->speed_var = cpr__particles_get_float(ctx, 1, "speedVariance", e->speed_var);
+  e->angle = cpr__particles_get_float(ctx, 1, "angle", e->angle);
+  e->spread = cpr__particles_get_float(ctx, 1, "spread", e->spread);
+  e->gravity_x = cpr__particles_get_float(ctx, 1, "gravityX", e->gravity_x);
+  e->gravity_y = cpr__particles_get_float(ctx, 1, "gravityY", e->gravity_y);
+
+  /* Style is stored as start value and delta */
+  size_end = cpr__particles_get_float(ctx, 1, "endSize", s->size + s->dsize);
+  s->size = cpr__particles_get_float(ctx, 1, "startSize", s->size);
+  s->dsize = size_end - s->size;
+  for (i = 0; i < 4; ++i) {
+    color_end[i] = s->color[i] + s->dcolor[i];
+  }
+  cpr__particles_get_color(ctx, 1, "startColor", s->color);
+  cpr__particles_get_color(ctx, 1, "endColor", color_end);
+  for (i = 0; i < 4; ++i) {
+    s->dcolor[i] = color_end[i] - s->color[i];
+  }
+  return 0;
+}
+
+/* particles.setSeed(ps, seed) */
+CPR_API_INTERN duk_ret_t cpr_particles_set_seed(duk_context *ctx) {
+  cpr__particles *ps = cpr__particles_require(ctx, 0);
+  ps->seed = duk_require_uint(ctx, 1);
+  /* xorshift state must not be zero */
+  if (ps->seed == 0) {
+    ps->seed = 0x9e3779b9u;
+  }
+  return 0;
+}
+
+/* particles.emit(ps, count)
+ * Spawn a burst of particles. Return the number of particles spawned. */
+CPR_API_INTERN duk_ret_t cpr_particles_emit(duk_context *ctx) {
+  cpr__particles *ps = cpr__particles_require(ctx, 0);
+  int n = duk_require_int(ctx, 1);
+  duk_push_int(ctx, n > 0 ? cpr__particles_spawn(ps, n) : 0);
+  return 1;
+}
+
+/* particles.update(ps, dt)
+ * Integrate the particles, remove the dead ones and spawn new particles at the
+ * emitter rate. Return the number of alive particles. */
+CPR_API_INTERN duk_ret_t cpr_particles_update(duk_context *ctx) {
+  int n;
+  cpr__particles *ps = cpr__particles_require(ctx, 0);
+  float dt = (float)duk_require_number(ctx, 1);
+
+  if (dt > 0.0f) {
+    cpr__particles_get_state(ctx)->kernel->integrate(&ps->soa, ps->count, dt, ps->emitter.gravity_x, ps->emitter.gravity_y);
+    cpr__particles_kill(ps);
+    ps->spawn_acc += ps->emitter.rate * dt;
+    n = (int)ps->spawn_acc;
+    ps->spawn_acc -= (float)n;
+    cpr__particles_spawn(ps, n);
+  }
+  duk_push_int(ctx, ps->count);
+  return 1;
+}
+
+/* particles.count(ps) */
+CPR_API_INTERN duk_ret_t cpr_particles_count(duk_context *ctx) {
+  duk_push_int(ctx, cpr__particles_require(ctx, 0)->count);
+  return 1;
+}
+
+/* particles.write(ps, buffer)
+ * Write the vertex data (see layout above) into a buffer or typed array of at
+ * least 16 * count bytes. Return the number of particles written. */
+CPR_API_INTERN duk_ret_t cpr_particles_write(duk_context *ctx) {
+  duk_size_t size;
+  uint8_t *data;
+  cpr__particles *ps = cpr__particles_require(ctx, 0);
+  int n = ps->count;
+
+  data = (uint8_t *)duk_require_buffer_data(ctx, 1, &size);
+  if (size < (duk_size_t)n * CPR__PARTICLES_VERTEX_SIZE) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "particles buffer too small (%lu bytes)", (unsigned long)size);
+  }
+  cpr__particles_get_state(ctx)->kernel->output(&ps->soa, n, &ps->style, (float *)data, (float *)(data + n * 8), data + n * 12);
+  duk_push_int(ctx, n);
+  return 1;
+}
+
+/* particles.draw(ps, x, y, width, height)
+ * Draw the particles as point sprites seen by the camera rectangle (in world
+ * units). Sizes are in pixels. Return the number of particles drawn. */
+CPR_API_INTERN duk_ret_t cpr_particles_draw(duk_context *ctx) {
+  uint8_t *data;
+  float cam_x, cam_y, cam_w, cam_h;
+  cpr__particles *ps = cpr__particles_require(ctx, 0);
+  cpr__particles_state *state = cpr__particles_get_state(ctx);
+  int n = ps->count;
+
+  cam_x = (float)duk_require_number(ctx, 1);
+  cam_y = (float)duk_require_number(ctx, 2);
+  cam_w = (float)duk_require_number(ctx, 3);
+  cam_h = (float)duk_require_number(ctx, 4);
+  if (n == 0 || cam_w <= 0.0f || cam_h <= 0.0f) {
+    duk_push_int(ctx, 0);
+    return 1;
+  }
+
+  cpr__particles_init_program(ctx, state);
+  if (ps->vao == 0) {
+    glGenVertexArrays(1, &ps->vao);
+    glGenBuffers(1, &ps->vbo);
+    glBindVertexArray(ps->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, ps->vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)ps->capacity * CPR__PARTICLES_VERTEX_SIZE, NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+  } else {
+    glBindVertexArray(ps->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, ps->vbo);
+  }
+
+  /* Orphan the previous frame data and write the vertices in place */
+  data = (uint8_t *)glMapBufferRange(GL_ARRAY_BUFFER, 0, (GLsizeiptr)n * CPR__PARTICLES_VERTEX_SIZE,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (data == NULL) {
+    glBindVertexArray(0);
+    duk_error(ctx, DUK_ERR_ERROR, "Can't map particles vertex buffer");
+  }
+  state->kernel->output(&ps->soa, n, &ps->style, (float *)data, (float *)(data + n * 8), data + n * 12);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+
+  /* Planes offsets depend on the particles count */
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *)0);
+  glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (void *)((size_t)n * 8));
+  glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void *)((size_t)n * 12));
+
+  glUseProgram(state->program);
+  glUniform4f(state->view_location, cam_x, cam_y, 2.0f / cam_w, -2.0f / cam_h);
+  glEnable(GL_PROGRAM_POINT_SIZE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glDrawArrays(GL_POINTS, 0, n);
+
+  glBindVertexArray(0);
+  glUseProgram(0);
+  duk_push_int(ctx, n);
+  return 1;
+}
+
+/* particles.setKernel(name)
+ * Force the kernel used by all the systems ("avx2", "sse2" or "scalar").
+ * Return false if the kernel is not supported. */
+CPR_API_INTERN duk_ret_t cpr_particles_set_kernel(duk_context *ctx) {
+  const cpr__particles_kernel *kernel = cpr__particles_select_kernel(duk_require_string(ctx, 0));
+  if (kernel != NULL) {
+    cpr__particles_get_state(ctx)->kernel = kernel;
+  }
+  duk_push_boolean(ctx, kernel != NULL);
+  return 1;
+}
+
+/* particles.getKernel() */
+CPR_API_INTERN duk_ret_t cpr_particles_get_kernel(duk_context *ctx) {
+  duk_push_string(ctx, cpr__particles_get_state(ctx)->kernel->name);
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_particles(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "create",       cpr_particles_create,       1 },
+    { "destroy",      cpr_particles_destroy,      1 },
+    { "setEmitter",   cpr_particles_set_emitter,  2 },
+    { "setSeed",      cpr_particles_set_seed,     2 },
+    { "emit",         cpr_particles_emit,         2 },
+    { "update",       cpr_particles_update,       2 },
+    { "count",        cpr_particles_count,        1 },
+    { "write",        cpr_particles_write,        2 },
+    { "draw",         cpr_particles_draw,         5 },
+    { "setKernel",    cpr_particles_set_kernel,   1 },
+    { "getKernel",    cpr_particles_get_kernel,   0 },
+    { NULL, NULL, 0 }
+  };
+
+  const duk_number_list_entry module_consts[] = {
+    { "VERTEX_SIZE",  (double)CPR__PARTICLES_VERTEX_SIZE },
+    { "MAX_CAPACITY", (double)CPR__PARTICLES_MAX_CAPACITY },
+    { NULL, 0.0 }
+  };
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+  duk_put_number_list(ctx, -1, module_consts);
+
+  return 1;  /* return module value */
+}
@@ -0,0 +1,237 @@
+/*
+ * cpr_particles_simd.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Particle kernels.
+ * Each kernel processes the particles by packs of 4 (SSE2) or 8 (AVX2) lanes
+ * and finishes the remaining particles with the scalar code. The AVX2 kernel is
+ * compiled with a function target attribute and only selected if the CPU
+ * supports it, so the module still runs on SSE2-only machines. Other
+ * architectures and compilers fall back to the scalar kernel.
+ */
+
+#include "cpr_particles_simd.h"
+#include "cpr_config.h"
+
+#include <string.h> /* strcmp */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPR__PARTICLES_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(CPR__PARTICLES_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CPR__PARTICLES_AVX2
+#include <immintrin.h>
+#define CPR__PARTICLES_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Scalar ********************************************************************/
+
+static void cpr__particles_integrate_range(cpr__particles_soa *p, int begin, int count, float dt, float gx, float gy) {
+  int i;
+  for (i = begin; i < count; ++i) {
+    p->vx[i] += gx * dt;
+    p->vy[i] += gy * dt;
+    p->x[i] += p->vx[i] * dt;
+    p->y[i] += p->vy[i] * dt;
+    p->age[i] += dt;
+  }
+}
+
+static uint8_t cpr__particles_unorm8(float c) {
+  c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+  return (uint8_t)(c * 255.0f + 0.5f);
+}
+
+static void cpr__particles_output_range(const cpr__particles_soa *p, int begin, int count, const cpr__particles_style *s,
+                                        float *xy, float *size, uint8_t *rgba) {
+  int i, c;
+  float t;
+  for (i = begin; i < count; ++i) {
+    t = p->age[i] * p->inv_life[i];
+    t = t > 1.0f ? 1.0f : t;
+    xy[i * 2] = p->x[i];
+    xy[i * 2 + 1] = p->y[i];
+    size[i] = s->size + s->dsize * t;
+    for (c = 0; c < 4; ++c) {
+      rgba[i * 4 + c] = cpr__particles_unorm8(s->color[c] + s->dcolor[c] * t);
+    }
+  }
+}
+
+static void cpr__particles_integrate_scalar(cpr__particles_soa *p, int count, float dt, float gx, float gy) {
+  cpr__particles_integrate_range(p, 0, count, dt, gx, gy);
+}
+
+static void cpr__particles_output_scalar(const cpr__particles_soa *p, int count, const cpr__particles_style *s,
+                                         float *xy, float *size, uint8_t *rgba) {
+  cpr__particles_output_range(p, 0, count, s, xy, size, rgba);
+}
+
+/* SSE2 **********************************************************************/
+
+#if defined(CPR__PARTICLES_SSE2)
+
+static void cpr__particles_integrate_sse2(cpr__particles_soa *p, int count, float dt, float gx, float gy) {
+  int i, n = count & ~3;
+  __m128 vdt = _mm_set1_ps(dt);
+  __m128 dvx = _mm_set1_ps(gx * dt);
+  __m128 dvy = _mm_set1_ps(gy * dt);
+  __m128 vx, vy;
+
+  for (i = 0; i < n; i += 4) {
+    vx = _mm_add_ps(_mm_load_ps(p->vx + i), dvx);
+    vy = _mm_add_ps(_mm_load_ps(p->vy + i), dvy);
+    _mm_store_ps(p->vx + i, vx);
+    _mm_store_ps(p->vy + i, vy);
+    _mm_store_ps(p->x + i, _mm_add_ps(_mm_load_ps(p->x + i), _mm_mul_ps(vx, vdt)));
+    _mm_store_ps(p->y + i, _mm_add_ps(_mm_load_ps(p->y + i), _mm_mul_ps(vy, vdt)));
+    _mm_store_ps(p->age + i, _mm_add_ps(_mm_load_ps(p->age + i), vdt));
+  }
+  cpr__particles_integrate_range(p, n, count, dt, gx, gy);
+}
+
+/* Convert a color channel to [0, 255] integers */
+static __m128i cpr__particles_unorm8_sse2(__m128 c) {
+  c = _mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+  return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+}
+
+static void cpr__particles_output_sse2(const cpr__particles_soa *p, int count, const cpr__particles_style *s,
+                                       float *xy, float *size, uint8_t *rgba) {
+  int i, n = count & ~3;
+  __m128 t, x, y, r, g, b, a;
+  __m128i packed;
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 s0 = _mm_set1_ps(s->size), ds = _mm_set1_ps(s->dsize);
+  __m128 r0 = _mm_set1_ps(s->color[0]), dr = _mm_set1_ps(s->dcolor[0]);
+  __m128 g0 = _mm_set1_ps(s->color[1]), dg = _mm_set1_ps(s->dcolor[1]);
+  __m128 b0 = _mm_set1_ps(s->color[2]), db = _mm_set1_ps(s->dcolor[2]);
+  __m128 a0 = _mm_set1_ps(s->color[3]), da = _mm_set1_ps(s->dcolor[3]);
+
+  for (i = 0; i < n; i += 4) {
+    t = _mm_min_ps(_mm_mul_ps(_mm_load_ps(p->age + i), _mm_load_ps(p->inv_life + i)), one);
+    x = _mm_load_ps(p->x + i);
+    y = _mm_load_ps(p->y + i);
+    _mm_storeu_ps(xy + i * 2, _mm_unpacklo_ps(x, y));
+    _mm_storeu_ps(xy + i * 2 + 4, _mm_unpackhi_ps(x, y));
+    _mm_storeu_ps(size + i, _mm_add_ps(s0, _mm_mul_ps(ds, t)));
+    r = _mm_add_ps(r0, _mm_mul_ps(dr, t));
+    g = _mm_add_ps(g0, _mm_mul_ps(dg, t));
+    b = _mm_add_ps(b0, _mm_mul_ps(db, t));
+    a = _mm_add_ps(a0, _mm_mul_ps(da, t));
+    /* Little endian RGBA8 */
+    packed = _mm_or_si128(
+      _mm_or_si128(cpr__particles_unorm8_sse2(r), _mm_slli_epi32(cpr__particles_unorm8_sse2(g), 8)),
+      _mm_or_si128(_mm_slli_epi32(cpr__particles_unorm8_sse2(b), 16), _mm_slli_epi32(cpr__particles_unorm8_sse2(a), 24)));
+    _mm_storeu_si128((__m128i *)(rgba + i * 4), packed);
+  }
+  cpr__particles_output_range(p, n, count, s, xy, size, rgba);
+}
+
+#endif /* CPR__PARTICLES_SSE2 */
+
+/* AVX2 **********************************************************************/
+
+#if defined(CPR__PARTICLES_AVX2)
+
+CPR__PARTICLES_TARGET_AVX2
+static void cpr__particles_integrate_avx2(cpr__particles_soa *p, int count, float dt, float gx, float gy) {
+  int i, n = count & ~7;
+  __m256 vdt = _mm256_set1_ps(dt);
+  __m256 dvx = _mm256_set1_ps(gx * dt);
+  __m256 dvy = _mm256_set1_ps(gy * dt);
+  __m256 vx, vy;
+
+  for (i = 0; i < n; i += 8) {
+    vx = _mm256_add_ps(_mm256_load_ps(p->vx + i), dvx);
+    vy = _mm256_add_ps(_mm256_load_ps(p->vy + i), dvy);
+    _mm256_store_ps(p->vx + i, vx);
+    _mm256_store_ps(p->vy + i, vy);
+    _mm256_store_ps(p->x + i, _mm256_add_ps(_mm256_load_ps(p->x + i), _mm256_mul_ps(vx, vdt)));
+    _mm256_store_ps(p->y + i, _mm256_add_ps(_mm256_load_ps(p->y + i), _mm256_mul_ps(vy, vdt)));
+    _mm256_store_ps(p->age + i, _mm256_add_ps(_mm256_load_ps(p->age + i), vdt));
+  }
+  cpr__particles_integrate_range(p, n, count, dt, gx, gy);
+}
+
+CPR__PARTICLES_TARGET_AVX2
+static __m256i cpr__particles_unorm8_avx2(__m256 c) {
+  c = _mm256_min_ps(_mm256_max_ps(c, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+  return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+}
+
+CPR__PARTICLES_TARGET_AVX2
+static void cpr__particles_output_avx2(const cpr__particles_soa *p, int count, const cpr__particles_style *s,
+                                       float *xy, float *size, uint8_t *rgba) {
+  int i, n = count & ~7;
+  __m256 t, x, y, lo, hi, r, g, b, a;
+  __m256i packed;
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 s0 = _mm256_set1_ps(s->size), ds = _mm256_set1_ps(s->dsize);
+  __m256 r0 = _mm256_set1_ps(s->color[0]), dr = _mm256_set1_ps(s->dcolor[0]);
+  __m256 g0 = _mm256_set1_ps(s->color[1]), dg = _mm256_set1_ps(s->dcolor[1]);
+  __m256 b0 = _mm256_set1_ps(s->color[2]), db = _mm256_set1_ps(s->dcolor[2]);
+  __m256 a0 = _mm256_set1_ps(s->color[3]), da = _mm256_set1_ps(s->dcolor[3]);
+
+  for (i = 0; i < n; i += 8) {
+    t = _mm256_min_ps(_mm256_mul_ps(_mm256_load_ps(p->age + i), _mm256_load_ps(p->inv_life + i)), one);
+    x = _mm256_load_ps(p->x + i);
+    y = _mm256_load_ps(p->y + i);
+    /* Unpack works per 128 bits lane: swap the middle halves back in order */
+    lo = _mm256_unpacklo_ps(x, y);
+    hi = _mm256_unpackhi_ps(x, y);
+    _mm256_storeu_ps(xy + i * 2, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(xy + i * 2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    _mm256_storeu_ps(size + i, _mm256_add_ps(s0, _mm256_mul_ps(ds, t)));
+    r = _mm256_add_ps(r0, _mm256_mul_ps(dr, t));
+    g = _mm256_add_ps(g0, _mm256_mul_ps(dg, t));
+    b = _mm256_add_ps(b0, _mm256_mul_ps(db, t));
+    a = _mm256_add_ps(a0, _mm256_mul_ps(da, t));
+    packed = _mm256_or_si256(
+      _mm256_or_si256(cpr__particles_unorm8_avx2(r), _mm256_slli_epi32(cpr__particles_unorm8_avx2(g), 8)),
+      _mm256_or_si256(_mm256_slli_epi32(cpr__particles_unorm8_avx2(b), 16), _mm256_slli_epi32(cpr__particles_unorm8_avx2(a), 24)));
+    _mm256_storeu_si256((__m256i *)(rgba + i * 4), packed);
+  }
+  cpr__particles_output_range(p, n, count, s, xy, size, rgba);
+}
+
+#endif /* CPR__PARTICLES_AVX2 */
+
+static const cpr__particles_kernel _kernels[] = {
+#if defined(CPR__PARTICLES_AVX2)
+  { "avx2",   cpr__particles_integrate_avx2,   cpr__particles_output_avx2 },
+#endif
+#if defined(CPR__PARTICLES_SSE2)
+  { "sse2",   cpr__particles_integrate_sse2,   cpr__particles_output_sse2 },
+#endif
+  { "scalar", cpr__particles_integrate_scalar, cpr__particles_output_scalar },
+  { NULL, NULL, NULL }
+};
+
+static int cpr__particles_kernel_supported(const cpr__particles_kernel *kernel) {
+#if defined(CPR__PARTICLES_AVX2)
+  if (strcmp(kernel->name, "avx2") == 0) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }
+#endif
+  (void)kernel;
+  return 1;
+}
+
+const cpr__particles_kernel *cpr__particles_select_kernel(const char *name) {
+  const cpr__particles_kernel *kernel;
+
+  /* Kernels are sorted from the fastest to the slowest */
+  for (kernel = _kernels; kernel->name != NULL; ++kernel) {
+    if ((name == NULL || strcmp(name, kernel->name) == 0) && cpr__particles_kernel_supported(kernel)) {
+      return kernel;
+    }
+  }
+  return NULL;
+}
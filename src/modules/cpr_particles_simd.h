@@ -0,0 +1,58 @@
+/*
+ * cpr_particles_simd.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_PARTICLES_SIMD_H
+#define CPR_PARTICLES_SIMD_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Particle attributes stored structure-of-arrays. Every array is aligned on 32
+ * bytes and its capacity is a multiple of CPR__PARTICLES_LANES. */
+#define CPR__PARTICLES_LANES 8
+
+typedef struct cpr__particles_soa {
+  float *x, *y;
+  float *vx, *vy;
+  float *age;
+  float *inv_life;    /* 1 / lifetime */
+} cpr__particles_soa;
+
+/* Size and color interpolated over the normalized particle age */
+typedef struct cpr__particles_style {
+  float size;         /* start size */
+  float dsize;        /* end size - start size */
+  float color[4];     /* start color (RGBA 0..1) */
+  float dcolor[4];    /* end color - start color */
+} cpr__particles_style;
+
+/* Integrate velocity (gravity), position and age of the particles [0, count) */
+typedef void (*cpr__particles_integrate_fn)(cpr__particles_soa *p, int count, float dt, float gx, float gy);
+
+/* Write the vertex data of the particles [0, count) in three planes:
+ * interleaved positions (x, y), sizes and RGBA8 colors. */
+typedef void (*cpr__particles_output_fn)(const cpr__particles_soa *p, int count, const cpr__particles_style *style,
+                                         float *xy, float *size, uint8_t *rgba);
+
+typedef struct cpr__particles_kernel {
+  const char *name;
+  cpr__particles_integrate_fn integrate;
+  cpr__particles_output_fn output;
+} cpr__particles_kernel;
+
+/* Return the kernel `name` ("avx2", "sse2" or "scalar") or the best kernel
+ * supported by the CPU if `name` is NULL. Return NULL if the kernel `name` is
+ * not available. */
+const cpr__particles_kernel *cpr__particles_select_kernel(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_PARTICLES_SIMD_H */
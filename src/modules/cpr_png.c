@@ -0,0 +1,152 @@
+/*
+ * cpr_png.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Minimal PNG writer.
+ * Image data is stored in uncompressed deflate blocks so no zlib is needed.
+ * Files are bigger than compressed PNG but writing is fast, which is what we
+ * want for screenshots and render regression tests.
+ */
+
+#include "cpr_config.h"
+#include "cpr_png.h"
+
+#include <stdio.h>
+
+#define CPR__PNG_MAX_BLOCK 65535
+
+typedef struct cpr__png_writer {
+  FILE *file;
+  uint32_t crc;
+  uint32_t adler_a, adler_b;
+} cpr__png_writer;
+
+static uint32_t _crc_table[256];
+
+CPR_API_INTERN void cpr__png_init_crc_table() {
+  uint32_t c;
+  int n, k;
+  if (_crc_table[1] != 0) {
+    return;
+  }
+  for (n = 0; n < 256; ++n) {
+    c = (uint32_t)n;
+    for (k = 0; k < 8; ++k) {
+      c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    _crc_table[n] = c;
+  }
+}
+
+/* Write bytes to the current chunk */
+CPR_API_INTERN void cpr__png_put(cpr__png_writer *w, const uint8_t *data, size_t size) {
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    w->crc = _crc_table[(w->crc ^ data[i]) & 0xff] ^ (w->crc >> 8);
+  }
+  fwrite(data, 1, size, w->file);
+}
+
+/* Write image data bytes (updates the zlib checksum) */
+CPR_API_INTERN void cpr__png_put_data(cpr__png_writer *w, const uint8_t *data, size_t size) {
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    w->adler_a = (w->adler_a + data[i]) % 65521;
+    w->adler_b = (w->adler_b + w->adler_a) % 65521;
+  }
+  cpr__png_put(w, data, size);
+}
+
+CPR_API_INTERN void cpr__png_put_u32(cpr__png_writer *w, uint32_t v) {
+  uint8_t b[4];
+  b[0] = (uint8_t)(v >> 24);
+  b[1] = (uint8_t)(v >> 16);
+  b[2] = (uint8_t)(v >> 8);
+  b[3] = (uint8_t)v;
+  cpr__png_put(w, b, 4);
+}
+
+CPR_API_INTERN void cpr__png_begin_chunk(cpr__png_writer *w, uint32_t length, const char *type) {
+  cpr__png_put_u32(w, length);
+  w->crc = 0xffffffffu;
+  cpr__png_put(w, (const uint8_t *)type, 4);
+}
+
+CPR_API_INTERN void cpr__png_end_chunk(cpr__png_writer *w) {
+  cpr__png_put_u32(w, w->crc ^ 0xffffffffu);
+}
+
+/* Not static: called by cpr_gl.c in the same module */
+int cpr__png_write(const char *filename, int width, int height, const uint8_t *pixels) {
+  static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  static const uint8_t zlib_header[2] = { 0x78, 0x01 };
+  static const uint8_t ihdr_tail[5] = { 8, 6, 0, 0, 0 }; /* 8 bits RGBA, no interlace */
+  cpr__png_writer w;
+  uint8_t block[5], filter = 0;
+  size_t row_size = (size_t)width * 4 + 1, raw_size = row_size * height;
+  size_t blocks = raw_size == 0 ? 1 : (raw_size + CPR__PNG_MAX_BLOCK - 1) / CPR__PNG_MAX_BLOCK;
+  size_t remaining = raw_size, block_left = 0, n, row_pos = 0;
+  int y = 0, err;
+
+  if ((w.file = fopen(filename, "wb")) == NULL) {
+    return -1;
+  }
+  cpr__png_init_crc_table();
+  w.adler_a = 1;
+  w.adler_b = 0;
+
+  fwrite(signature, 1, sizeof(signature), w.file);
+  cpr__png_begin_chunk(&w, 13, "IHDR");
+  cpr__png_put_u32(&w, (uint32_t)width);
+  cpr__png_put_u32(&w, (uint32_t)height);
+  cpr__png_put(&w, ihdr_tail, sizeof(ihdr_tail));
+  cpr__png_end_chunk(&w);
+
+  /* zlib stream: header, stored blocks (5 bytes header each) and adler32 */
+  cpr__png_begin_chunk(&w, (uint32_t)(2 + raw_size + blocks * 5 + 4), "IDAT");
+  cpr__png_put(&w, zlib_header, sizeof(zlib_header));
+  for (;;) {
+    if (block_left == 0) {
+      block_left = remaining < CPR__PNG_MAX_BLOCK ? remaining : CPR__PNG_MAX_BLOCK;
+      remaining -= block_left;
+      block[0] = remaining == 0; /* BFINAL, BTYPE 00 */
+      block[1] = (uint8_t)block_left;
+      block[2] = (uint8_t)(block_left >> 8);
+      block[3] = (uint8_t)~block[1];
+      block[4] = (uint8_t)~block[2];
+      cpr__png_put(&w, block, 5);
+      if (block_left == 0) {
+        break;
+      }
+    }
+    /* Each row starts with its filter type (none) */
+    if (row_pos == 0) {
+      cpr__png_put_data(&w, &filter, 1);
+      ++row_pos;
+      --block_left;
+    } else {
+      n = row_size - row_pos;
+      n = n < block_left ? n : block_left;
+      cpr__png_put_data(&w, pixels + (size_t)y * (row_size - 1) + (row_pos - 1), n);
+      row_pos += n;
+      block_left -= n;
+      if (row_pos == row_size) {
+        row_pos = 0;
+        ++y;
+      }
+    }
+    if (block_left == 0 && remaining == 0) {
+      break;
+    }
+  }
+  cpr__png_put_u32(&w, (w.adler_b << 16) | w.adler_a);
+  cpr__png_end_chunk(&w);
+
+  cpr__png_begin_chunk(&w, 0, "IEND");
+  cpr__png_end_chunk(&w);
+
+  err = ferror(w.file);
+  return fclose(w.file) != 0 || err ? -1 : 0;
+}
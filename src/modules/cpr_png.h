@@ -0,0 +1,24 @@
+/*
+ * cpr_png.h
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef CPR_PNG_H
+#define CPR_PNG_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Write `width` x `height` RGBA8 pixels (rows top to bottom) to a PNG file.
+ * Return 0 on success or -1 and set errno on error. */
+int cpr__png_write(const char *filename, int width, int height, const uint8_t *pixels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPR_PNG_H */
@@ -0,0 +1,431 @@
+/*
+ * cpr_profiler_module.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Frame profiler scripting interface (see cpr_profiler.h).
+ * All the times returned to scripts are in milliseconds.
+ *
+ * GPU zones are timed with OpenGL timestamp queries (GL 3.3 or
+ * ARB_timer_query) so they can be nested. Queries are read back
+ * CPR__PROFILER_GPU_FRAMES frames later to avoid stalling the pipeline and
+ * their results are recorded as "gpu.<name>" zones. `gl3w.init` must be called
+ * and a context made current before `enableGpu`.
+ *
+ * The sampling functions control the script sampler (see cpr_sampler.h).
+ * The bindings counters are only available when cepora is started with the
+ * `--bindings` option (see cpr_bindings.h).
+ */
+
+#include "cpr_profiler_module.h"
+#include "cpr_profiler.h"
+#include "cpr_sampler.h"
+#include "cpr_bindings.h"
+#include "cpr_macros.h"
+#include "cpr_duktape_helpers.h"
+#include "cpr_thread.h"
+#include "GL/gl3w.h"
+
+#include <string.h> /* strncpy */
+
+#define CPR__PROFILER_GPU_FRAMES  4   /* frames in flight */
+#define CPR__PROFILER_GPU_ZONES   32  /* GPU zones per frame */
+
+typedef struct cpr__profiler_gpu_zone {
+  char name[CPR_PROFILER_NAME_SIZE];
+  int ended;
+} cpr__profiler_gpu_zone;
+
+typedef struct cpr__profiler_gpu_frame {
+  /* begin and end timestamp query of each zone */
+  GLuint queries[CPR__PROFILER_GPU_ZONES * 2];
+  cpr__profiler_gpu_zone zones[CPR__PROFILER_GPU_ZONES];
+  int count;
+} cpr__profiler_gpu_frame;
+
+/* GPU zones of the heap (see cpr_get_heap_state). The queries belong to
+ * the GL context of the heap. */
+#define CPR__PROFILER_GPU_STATE "cprProfilerGpu"
+
+typedef struct cpr__profiler_gpu {
+  int enabled;
+  cpr__profiler_gpu_frame frames[CPR__PROFILER_GPU_FRAMES];
+  int current;
+  int stack[CPR_PROFILER_MAX_DEPTH];
+  int depth;
+  /* GPU zones dropped because the frame or the stack is full */
+  int overflow;
+} cpr__profiler_gpu;
+
+CPR_API_INTERN cpr__profiler_gpu *cpr__profiler_get_gpu(duk_context *ctx) {
+  return cpr_get_heap_state(ctx, CPR__PROFILER_GPU_STATE, sizeof(cpr__profiler_gpu));
+}
+
+/* Record the zones of the oldest frame and reuse it as the current frame */
+CPR_API_INTERN void cpr__profiler_gpu_frame_hook(void *udata) {
+  cpr__profiler_gpu *gpu = udata;
+  cpr__profiler_gpu_frame *frame;
+  GLuint64 begin, end;
+  int i;
+
+  gpu->current = (gpu->current + 1) % CPR__PROFILER_GPU_FRAMES;
+  gpu->depth = 0;
+  gpu->overflow = 0;
+  frame = &gpu->frames[gpu->current];
+  for (i = 0; i < frame->count; ++i) {
+    if (!frame->zones[i].ended) {
+      continue;
+    }
+    glGetQueryObjectui64v(frame->queries[i * 2], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(frame->queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+    cpr_profiler_add(frame->zones[i].name, (double)(end - begin) * 1e-9);
+  }
+  frame->count = 0;
+}
+
+CPR_API_INTERN void cpr__profiler_push_stats(duk_context *ctx, const cpr_profiler_stats *stats) {
+  duk_push_object(ctx);
+  duk_push_string(ctx, stats->name);
+  duk_put_prop_string(ctx, -2, "name");
+  duk_push_int(ctx, stats->depth);
+  duk_put_prop_string(ctx, -2, "depth");
+  duk_push_int(ctx, stats->frames);
+  duk_put_prop_string(ctx, -2, "frames");
+  duk_push_number(ctx, stats->calls);
+  duk_put_prop_string(ctx, -2, "calls");
+  duk_push_number(ctx, stats->last * 1e3);
+  duk_put_prop_string(ctx, -2, "last");
+  duk_push_number(ctx, stats->min * 1e3);
+  duk_put_prop_string(ctx, -2, "min");
+  duk_push_number(ctx, stats->max * 1e3);
+  duk_put_prop_string(ctx, -2, "max");
+  duk_push_number(ctx, stats->avg * 1e3);
+  duk_put_prop_string(ctx, -2, "avg");
+  duk_push_number(ctx, stats->p50 * 1e3);
+  duk_put_prop_string(ctx, -2, "p50");
+  duk_push_number(ctx, stats->p95 * 1e3);
+  duk_put_prop_string(ctx, -2, "p95");
+  duk_push_number(ctx, stats->p99 * 1e3);
+  duk_put_prop_string(ctx, -2, "p99");
+}
+
+/* profiler.enable(enable) */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_enable(duk_context *ctx) {
+  cpr_profiler_enable(duk_require_boolean(ctx, 0));
+  return 0;
+}
+
+/* profiler.isEnabled() */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_is_enabled(duk_context *ctx) {
+  duk_push_boolean(ctx, cpr_profiler_is_enabled());
+  return 1;
+}
+
+/* profiler.begin(name) */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_begin(duk_context *ctx) {
+  cpr_profiler_begin(duk_require_string(ctx, 0));
+  return 0;
+}
+
+/* profiler.end([name])
+ * Leave the innermost zone. Throw an error if no zone is open or `name` is not
+ * the innermost zone. */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_end(duk_context *ctx) {
+  const char *name = duk_is_undefined(ctx, 0) ? NULL : duk_require_string(ctx, 0);
+  if (cpr_profiler_end(name) != 0) {
+    duk_error(ctx, DUK_ERR_ERROR, name ? "profiler zone '%s' is not open" : "no profiler zone open", name);
+  }
+  return 0;
+}
+
+/* profiler.frame() */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_frame(duk_context *ctx) {
+  cpr_profiler_frame();
+  return 0;
+}
+
+/* profiler.reset() */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_reset(duk_context *ctx) {
+  cpr_profiler_reset();
+  return 0;
+}
+
+/* profiler.stats([path])
+ * Return the statistics of the zone `path` (see cpr_profiler_find_zone) or
+ * undefined if the zone doesn't exist. Without a path return an array with
+ * the statistics of all the zones. */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_stats(duk_context *ctx) {
+  cpr_profiler_stats stats;
+  int i, n;
+
+  if (!duk_is_undefined(ctx, 0)) {
+    if (cpr_profiler_get_stats(cpr_profiler_find_zone(duk_require_string(ctx, 0)), &stats) != 0) {
+      return 0;
+    }
+    cpr__profiler_push_stats(ctx, &stats);
+    return 1;
+  }
+  duk_push_array(ctx);
+  n = cpr_profiler_zone_count();
+  for (i = 0; i < n; ++i) {
+    cpr_profiler_get_stats(i, &stats);
+    cpr__profiler_push_stats(ctx, &stats);
+    duk_put_prop_index(ctx, -2, i);
+  }
+  return 1;
+}
+
+/* profiler.history(path)
+ * Return the zone times of the last frames (oldest first). */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_history(duk_context *ctx) {
+  double history[CPR_PROFILER_HISTORY];
+  int i, n;
+
+  n = cpr_profiler_get_history(cpr_profiler_find_zone(duk_require_string(ctx, 0)), history, CPR_PROFILER_HISTORY);
+  duk_push_array(ctx);
+  for (i = 0; i < n; ++i) {
+    duk_push_number(ctx, history[i] * 1e3);
+    duk_put_prop_index(ctx, -2, i);
+  }
+  return 1;
+}
+
+/* profiler.report()
+ * Return a text table of the zone statistics. */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_report(duk_context *ctx) {
+  cpr_profiler_stats stats;
+  int i, n;
+
+  n = cpr_profiler_zone_count();
+  duk_push_sprintf(ctx, "%-32s %6s %8s %8s %8s %8s %8s\n", "zone", "calls", "last", "avg", "p50", "p95", "max");
+  for (i = 0; i < n; ++i) {
+    cpr_profiler_get_stats(i, &stats);
+    duk_push_sprintf(ctx, "%*s%-*s %6.0f %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+                     stats.depth * 2, "", 32 - stats.depth * 2, stats.name, stats.calls,
+                     stats.last * 1e3, stats.avg * 1e3, stats.p50 * 1e3, stats.p95 * 1e3, stats.max * 1e3);
+  }
+  duk_concat(ctx, n + 1);
+  return 1;
+}
+
+/* profiler.enableGpu(enable)
+ * Create (or delete) the GPU queries. Return false if timer queries are not
+ * supported by the current context. */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_enable_gpu(duk_context *ctx) {
+  int enable = duk_require_boolean(ctx, 0), i;
+  cpr__profiler_gpu *gpu;
+
+  /* The profiler ignores the other threads */
+  if (enable && (!cpr_thread_is_main() || !gl3wIsSupported(3, 3))) {
+    duk_push_false(ctx);
+    return 1;
+  }
+  gpu = cpr__profiler_get_gpu(ctx);
+  if (enable != gpu->enabled) {
+    for (i = 0; i < CPR__PROFILER_GPU_FRAMES; ++i) {
+      if (enable) {
+        glGenQueries(CPR__PROFILER_GPU_ZONES * 2, gpu->frames[i].queries);
+      } else {
+        glDeleteQueries(CPR__PROFILER_GPU_ZONES * 2, gpu->frames[i].queries);
+      }
+      gpu->frames[i].count = 0;
+    }
+    gpu->depth = 0;
+    gpu->overflow = 0;
+    gpu->enabled = enable;
+    cpr_profiler_set_frame_hook(enable ? cpr__profiler_gpu_frame_hook : NULL, enable ? gpu : NULL);
+  }
+  duk_push_true(ctx);
+  return 1;
+}
+
+/* profiler.gpuBegin(name) */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_gpu_begin(duk_context *ctx) {
+  cpr__profiler_gpu *gpu = cpr__profiler_get_gpu(ctx);
+  cpr__profiler_gpu_frame *frame = &gpu->frames[gpu->current];
+  const char *name = duk_require_string(ctx, 0);
+  cpr__profiler_gpu_zone *zone;
+
+  if (!gpu->enabled || !cpr_profiler_is_enabled()) {
+    return 0;
+  }
+  if (gpu->overflow || frame->count == CPR__PROFILER_GPU_ZONES || gpu->depth == CPR_PROFILER_MAX_DEPTH) {
+    ++gpu->overflow;
+    return 0;
+  }
+  zone = &frame->zones[frame->count];
+  strncpy(zone->name, "gpu.", CPR_PROFILER_NAME_SIZE);
+  strncpy(zone->name + 4, name, CPR_PROFILER_NAME_SIZE - 5);
+  zone->name[CPR_PROFILER_NAME_SIZE - 1] = '\0';
+  zone->ended = 0;
+  glQueryCounter(frame->queries[frame->count * 2], GL_TIMESTAMP);
+  gpu->stack[gpu->depth++] = frame->count++;
+  return 0;
+}
+
+/* profiler.gpuEnd() */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_gpu_end(duk_context *ctx) {
+  cpr__profiler_gpu *gpu = cpr__profiler_get_gpu(ctx);
+  cpr__profiler_gpu_frame *frame = &gpu->frames[gpu->current];
+  int i;
+
+  if (!gpu->enabled || !cpr_profiler_is_enabled()) {
+    return 0;
+  }
+  if (gpu->overflow) {
+    --gpu->overflow;
+    return 0;
+  }
+  if (gpu->depth == 0) {
+    duk_error(ctx, DUK_ERR_ERROR, "no profiler GPU zone open");
+  }
+  i = gpu->stack[--gpu->depth];
+  glQueryCounter(frame->queries[i * 2 + 1], GL_TIMESTAMP);
+  frame->zones[i].ended = 1;
+  return 0;
+}
+
+/* profiler.startSampling([rate])
+ * Start sampling the scripts `rate` times per second. Return false if the
+ * sampler is not available in this build. */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_start_sampling(duk_context *ctx) {
+  double rate = duk_is_undefined(ctx, 0) ? CPR_SAMPLER_DEFAULT_RATE : duk_require_number(ctx, 0);
+  duk_push_boolean(ctx, cpr_sampler_start(rate) == 0);
+  return 1;
+}
+
+/* profiler.stopSampling() */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_stop_sampling(duk_context *ctx) {
+  cpr_sampler_stop();
+  return 0;
+}
+
+/* profiler.clearSamples() */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_clear_samples(duk_context *ctx) {
+  cpr_sampler_clear();
+  return 0;
+}
+
+/* profiler.samples() -> { count, flat: [{ frame, self, total }] }
+ * The flat profile is sorted by self samples. */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_samples(duk_context *ctx) {
+  const cpr_sampler_entry *entries;
+  int i, n;
+
+  duk_push_object(ctx);
+  duk_push_number(ctx, cpr_sampler_sample_count());
+  duk_put_prop_string(ctx, -2, "count");
+  duk_push_array(ctx);
+  n = cpr_sampler_flat(&entries);
+  for (i = 0; i < n; ++i) {
+    duk_push_object(ctx);
+    duk_push_string(ctx, entries[i].frame);
+    duk_put_prop_string(ctx, -2, "frame");
+    duk_push_number(ctx, entries[i].self);
+    duk_put_prop_string(ctx, -2, "self");
+    duk_push_number(ctx, entries[i].total);
+    duk_put_prop_string(ctx, -2, "total");
+    duk_put_prop_index(ctx, -2, i);
+  }
+  duk_put_prop_string(ctx, -2, "flat");
+  return 1;
+}
+
+/* profiler.writeSamples(filename)
+ * Write the collapsed stacks (flamegraph.pl format) */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_write_samples(duk_context *ctx) {
+  const char *filename = duk_require_string(ctx, 0);
+  if (cpr_sampler_write_collapsed(filename) != 0) {
+    duk_error(ctx, DUK_ERR_ERROR, "can't write samples file '%s'", filename);
+  }
+  return 0;
+}
+
+/* profiler.bindingsEnabled() */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_bindings_enabled(duk_context *ctx) {
+  duk_push_boolean(ctx, cpr_bindings_is_enabled());
+  return 1;
+}
+
+/* profiler.bindings() -> [{ name, calls, time, frames, callsPerFrame,
+ * timePerFrame, lastCalls, lastTime, p50, p99 }]
+ * Times are in milliseconds except the latency percentiles in microseconds. */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_bindings(duk_context *ctx) {
+  const cpr_binding_stats *b;
+  double frames;
+  int i, n = cpr_bindings_count();
+
+  duk_push_array(ctx);
+  for (i = 0; i < n; ++i) {
+    b = cpr_bindings_get(i);
+    frames = b->frames > 0.0 ? b->frames : 1.0;
+    duk_push_object(ctx);
+    duk_push_string(ctx, b->name);
+    duk_put_prop_string(ctx, -2, "name");
+    duk_push_number(ctx, b->calls);
+    duk_put_prop_string(ctx, -2, "calls");
+    duk_push_number(ctx, b->time * 1e3);
+    duk_put_prop_string(ctx, -2, "time");
+    duk_push_number(ctx, b->frames);
+    duk_put_prop_string(ctx, -2, "frames");
+    duk_push_number(ctx, b->calls / frames);
+    duk_put_prop_string(ctx, -2, "callsPerFrame");
+    duk_push_number(ctx, b->time * 1e3 / frames);
+    duk_put_prop_string(ctx, -2, "timePerFrame");
+    duk_push_number(ctx, b->last_calls);
+    duk_put_prop_string(ctx, -2, "lastCalls");
+    duk_push_number(ctx, b->last_time * 1e3);
+    duk_put_prop_string(ctx, -2, "lastTime");
+    duk_push_number(ctx, cpr_bindings_percentile(b, 50.0) * 1e6);
+    duk_put_prop_string(ctx, -2, "p50");
+    duk_push_number(ctx, cpr_bindings_percentile(b, 99.0) * 1e6);
+    duk_put_prop_string(ctx, -2, "p99");
+    duk_put_prop_index(ctx, -2, i);
+  }
+  return 1;
+}
+
+/* profiler.resetBindings() */
+CPR_API_INTERN duk_ret_t cpr_profiler_js_reset_bindings(duk_context *ctx) {
+  cpr_bindings_reset();
+  return 0;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_profiler(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "enable",          cpr_profiler_js_enable,           1 },
+    { "isEnabled",       cpr_profiler_js_is_enabled,       0 },
+    { "begin",           cpr_profiler_js_begin,            1 },
+    { "end",             cpr_profiler_js_end,              1 },
+    { "frame",           cpr_profiler_js_frame,            0 },
+    { "reset",           cpr_profiler_js_reset,            0 },
+    { "stats",           cpr_profiler_js_stats,            1 },
+    { "history",         cpr_profiler_js_history,          1 },
+    { "report",          cpr_profiler_js_report,           0 },
+    { "enableGpu",       cpr_profiler_js_enable_gpu,       1 },
+    { "gpuBegin",        cpr_profiler_js_gpu_begin,        1 },
+    { "gpuEnd",          cpr_profiler_js_gpu_end,          0 },
+    { "startSampling",   cpr_profiler_js_start_sampling,   1 },
+    { "stopSampling",    cpr_profiler_js_stop_sampling,    0 },
+    { "clearSamples",    cpr_profiler_js_clear_samples,    0 },
+    { "samples",         cpr_profiler_js_samples,          0 },
+    { "writeSamples",    cpr_profiler_js_write_samples,    1 },
+    { "bindingsEnabled", cpr_profiler_js_bindings_enabled, 0 },
+    { "bindings",        cpr_profiler_js_bindings,         0 },
+    { "resetBindings",   cpr_profiler_js_reset_bindings,   0 },
+    { NULL, NULL, 0 }
+  };
+
+  const duk_number_list_entry module_consts[] = {
+    { "HISTORY",    (double)CPR_PROFILER_HISTORY },
+    { "MAX_ZONES",  (double)CPR_PROFILER_MAX_ZONES },
+    { NULL, 0.0 }
+  };
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+  duk_put_number_list(ctx, -1, module_consts);
+
+  return 1;  /* return module value */
+}
@@ -0,0 +1,661 @@
+/*
+ * cpr_stream.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Asset streaming.
+ * A stream manager loads the requested assets (scripts, images, tilemap
+ * chunks, blobs...) in the background by priority and keeps the loaded assets
+ * resident within a memory budget. The assets are files found in the search
+ * paths (`module.paths`) and read by the job system (see cpr_jobs.h).
+ *
+ *   m = stream.create budget: 32 * 1024 * 1024, onLoad: (err, name, value) -> ...
+ *   stream.request m, 'chunks/3_4.bin', x: 96, y: 128
+ *   stream.request m, 'scripts/boss.coffee', priority: 10
+ *   stream.setCamera m, player.x, player.y
+ *   ...
+ *   stream.update m  # every frame
+ *   data = stream.get m, 'chunks/3_4.bin'
+ *
+ * Assets with the highest `priority` (default 0) are loaded first, then the
+ * ones closest to the camera (assets without position are at the camera).
+ * `update` collects the loaded assets, evicts the least recently used resident
+ * assets while the budget is exceeded and starts at most `concurrency` loads.
+ * Assets used (`get` or `request`) since the previous update are not evicted.
+ *
+ * Text assets (.coffee, .js, .json and .txt or `type: 'text'`) are loaded as
+ * strings and the others as ArrayBuffers.
+ */
+
+#include "cpr_stream.h"
+#include "cpr_clone.h"
+#include "cpr_jobs.h"
+#include "cpr_package.h" /* cpr_package_search */
+#include "cpr_duktape_helpers.h"
+
+#include <stdio.h>  /* fopen, fread */
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* strlen, strrchr, memcpy */
+
+/* Hidden properties of the manager handles */
+#define CPR__STREAM_PTR      "\xff" "cprStream"
+#define CPR__STREAM_INDEX    "\xff" "cprIndex"   /* name to slot */
+#define CPR__STREAM_VALUES   "\xff" "cprValues"  /* slot to value */
+#define CPR__STREAM_ON_LOAD  "\xff" "cprOnLoad"
+#define CPR__STREAM_ON_EVICT "\xff" "cprOnEvict"
+
+#define CPR__STREAM_DEFAULT_BUDGET      (64.0 * 1024 * 1024)
+#define CPR__STREAM_DEFAULT_CONCURRENCY 2
+#define CPR__STREAM_MAX_CONCURRENCY     16
+
+enum {
+  CPR__STREAM_FREE = 0, /* unused slot */
+  CPR__STREAM_QUEUED,
+  CPR__STREAM_LOADING,
+  CPR__STREAM_RESIDENT,
+  CPR__STREAM_EVICTED,
+  CPR__STREAM_FAILED
+};
+
+static const char *_state_names[] = {
+  NULL, "queued", "loading", "resident", "evicted", "failed"
+};
+
+typedef struct cpr__stream_asset {
+  char *name;
+  int state;
+  int text;
+  double priority;
+  double x, y;
+  int positioned;
+  duk_size_t size;        /* resident size */
+  unsigned long used;     /* update count of the last use */
+  unsigned long order;    /* request order (queue ties) */
+  int queue_pos;          /* -1 if not queued */
+} cpr__stream_asset;
+
+/* Read by a job. `slot` is -1 if the asset was released while loading. */
+typedef struct cpr__stream_load {
+  cpr_job *job;
+  int slot;
+  char *path;
+  unsigned char *data;
+  duk_size_t size;
+  int failed;
+} cpr__stream_load;
+
+typedef struct cpr__stream {
+  cpr__stream_asset *assets;
+  int capacity;
+  int count;              /* assets in use */
+  int *queue;             /* binary heap of slots, best first */
+  int queue_len;
+  cpr__stream_load *loads[CPR__STREAM_MAX_CONCURRENCY];
+  int load_count;
+  int concurrency;
+  double budget;
+  double resident;
+  double camera_x, camera_y;
+  unsigned long frame;
+  unsigned long order;
+} cpr__stream;
+
+/* Load job (no Duktape calls) */
+CPR_API_INTERN void cpr__stream_read(void *data) {
+  cpr__stream_load *load = data;
+  FILE *f;
+  long size;
+
+  load->failed = 1;
+  if ((f = fopen(load->path, "rb")) == NULL) {
+    return;
+  }
+  if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0 &&
+      (load->data = malloc(size ? (size_t)size : 1)) != NULL) {
+    load->size = fread(load->data, 1, (size_t)size, f);
+    load->failed = ferror(f) != 0;
+  }
+  fclose(f);
+}
+
+CPR_API_INTERN void cpr__stream_free_load(cpr__stream_load *load) {
+  cpr_job_release(load->job);
+  free(load->data);
+  free(load->path);
+  free(load);
+}
+
+/* Priority queue */
+
+CPR_API_INTERN double cpr__stream_distance(cpr__stream *m, cpr__stream_asset *a) {
+  double dx, dy;
+  if (!a->positioned) {
+    return 0.0;
+  }
+  dx = a->x - m->camera_x;
+  dy = a->y - m->camera_y;
+  return dx * dx + dy * dy;
+}
+
+/* Return true if slot `a` must be loaded before slot `b` */
+CPR_API_INTERN int cpr__stream_before(cpr__stream *m, int a, int b) {
+  cpr__stream_asset *aa = &m->assets[a], *bb = &m->assets[b];
+  double da, db;
+
+  if (aa->priority != bb->priority) {
+    return aa->priority > bb->priority;
+  }
+  da = cpr__stream_distance(m, aa);
+  db = cpr__stream_distance(m, bb);
+  if (da != db) {
+    return da < db;
+  }
+  return aa->order < bb->order;
+}
+
+CPR_API_INTERN void cpr__stream_queue_set(cpr__stream *m, int pos, int slot) {
+  m->queue[pos] = slot;
+  m->assets[slot].queue_pos = pos;
+}
+
+CPR_API_INTERN void cpr__stream_sift_up(cpr__stream *m, int pos) {
+  int slot = m->queue[pos], parent;
+  while (pos > 0 && cpr__stream_before(m, slot, m->queue[parent = (pos - 1) / 2])) {
+    cpr__stream_queue_set(m, pos, m->queue[parent]);
+    pos = parent;
+  }
+  cpr__stream_queue_set(m, pos, slot);
+}
+
+CPR_API_INTERN void cpr__stream_sift_down(cpr__stream *m, int pos) {
+  int slot = m->queue[pos], child;
+  while ((child = 2 * pos + 1) < m->queue_len) {
+    if (child + 1 < m->queue_len && cpr__stream_before(m, m->queue[child + 1], m->queue[child])) {
+      ++child;
+    }
+    if (!cpr__stream_before(m, m->queue[child], slot)) {
+      break;
+    }
+    cpr__stream_queue_set(m, pos, m->queue[child]);
+    pos = child;
+  }
+  cpr__stream_queue_set(m, pos, slot);
+}
+
+/* The queue can hold all the slots (allocated with the slots) */
+CPR_API_INTERN void cpr__stream_queue_push(cpr__stream *m, int slot) {
+  cpr__stream_queue_set(m, m->queue_len++, slot);
+  cpr__stream_sift_up(m, m->queue_len - 1);
+}
+
+CPR_API_INTERN void cpr__stream_queue_remove(cpr__stream *m, int pos) {
+  int moved;
+  m->assets[m->queue[pos]].queue_pos = -1;
+  if (pos != --m->queue_len) {
+    moved = m->queue[m->queue_len];
+    cpr__stream_queue_set(m, pos, moved);
+    cpr__stream_sift_down(m, pos);
+    cpr__stream_sift_up(m, m->assets[moved].queue_pos);
+  }
+}
+
+/* Restore the queue order (e.g. after the camera moved) */
+CPR_API_INTERN void cpr__stream_queue_sort(cpr__stream *m) {
+  int i;
+  for (i = m->queue_len / 2 - 1; i >= 0; --i) {
+    cpr__stream_sift_down(m, i);
+  }
+}
+
+/* Handles */
+
+CPR_API_INTERN void cpr__stream_free(cpr__stream *m) {
+  int i;
+
+  /* The jobs write to the loads */
+  for (i = 0; i < m->load_count; ++i) {
+    cpr_job_wait(m->loads[i]->job);
+    cpr__stream_free_load(m->loads[i]);
+  }
+  for (i = 0; i < m->capacity; ++i) {
+    free(m->assets[i].name);
+  }
+  free(m->assets);
+  free(m->queue);
+  free(m);
+}
+
+CPR_API_INTERN duk_ret_t cpr__stream_finalizer(duk_context *ctx) {
+  cpr__stream *m;
+
+  duk_get_prop_string(ctx, 0, CPR__STREAM_PTR);
+  if ((m = duk_get_pointer(ctx, -1)) != NULL) {
+    cpr__stream_free(m);
+  }
+  return 0;
+}
+
+CPR_API_INTERN cpr__stream *cpr__stream_require(duk_context *ctx, duk_idx_t idx) {
+  cpr__stream *m = NULL;
+
+  if (duk_is_object(ctx, idx)) {
+    duk_get_prop_string(ctx, idx, CPR__STREAM_PTR);
+    m = duk_get_pointer(ctx, -1);
+    duk_pop(ctx);
+  }
+  if (m == NULL) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "stream manager expected");
+  }
+  return m;
+}
+
+/* Return the slot of the asset named by the string at `name_idx` or -1 */
+CPR_API_INTERN int cpr__stream_find(duk_context *ctx, duk_idx_t name_idx) {
+  int slot;
+
+  duk_get_prop_string(ctx, 0, CPR__STREAM_INDEX);
+  duk_dup(ctx, name_idx);
+  duk_get_prop(ctx, -2);
+  slot = duk_is_number(ctx, -1) ? duk_get_int(ctx, -1) : -1;
+  duk_pop_2(ctx);
+  return slot;
+}
+
+/* Drop the value of a resident asset */
+CPR_API_INTERN void cpr__stream_drop(duk_context *ctx, cpr__stream *m, int slot) {
+  duk_get_prop_string(ctx, 0, CPR__STREAM_VALUES);
+  duk_del_prop_index(ctx, -1, (duk_uarridx_t)slot);
+  duk_pop(ctx);
+  m->resident -= (double)m->assets[slot].size;
+  m->assets[slot].size = 0;
+}
+
+/* Call the `onLoad` or `onEvict` callback if any. The name and the value are
+ * on the stack top and popped. */
+CPR_API_INTERN void cpr__stream_notify(duk_context *ctx, const char *callback, int nargs) {
+  duk_get_prop_string(ctx, 0, callback);
+  if (!duk_is_function(ctx, -1)) {
+    duk_pop_n(ctx, nargs + 1);
+    return;
+  }
+  duk_insert(ctx, -nargs - 1);
+  duk_call(ctx, nargs);
+  duk_pop(ctx);
+}
+
+CPR_API_INTERN int cpr__stream_is_text(const char *name) {
+  const char *ext = strrchr(name, '.');
+  return ext && (strcmp(ext, ".coffee") == 0 || strcmp(ext, ".js") == 0 ||
+                 strcmp(ext, ".json") == 0 || strcmp(ext, ".txt") == 0);
+}
+
+/* Collect the loaded assets. Return the number of assets loaded. */
+CPR_API_INTERN int cpr__stream_collect(duk_context *ctx, cpr__stream *m) {
+  cpr__stream_load *load;
+  cpr__stream_asset *a;
+  int i = 0, loaded = 0;
+
+  while (i < m->load_count) {
+    load = m->loads[i];
+    if (!cpr_job_is_done(load->job)) {
+      ++i;
+      continue;
+    }
+    m->loads[i] = m->loads[--m->load_count];
+    if (load->slot < 0) {
+      cpr__stream_free_load(load);
+      continue;
+    }
+
+    a = &m->assets[load->slot];
+    if (load->failed) {
+      a->state = CPR__STREAM_FAILED;
+      duk_push_error_object(ctx, DUK_ERR_ERROR, "can't read '%s'", load->path);
+      duk_push_string(ctx, a->name);
+      cpr__stream_free_load(load);
+      cpr__stream_notify(ctx, CPR__STREAM_ON_LOAD, 2);
+      continue;
+    }
+
+    duk_get_prop_string(ctx, 0, CPR__STREAM_VALUES);
+    if (a->text) {
+      duk_push_lstring(ctx, (const char *)load->data, load->size);
+    } else {
+      cpr_clone_push_buffer(ctx, load->data, load->size);
+      load->data = NULL; /* owned by the ArrayBuffer */
+    }
+    duk_put_prop_index(ctx, -2, (duk_uarridx_t)load->slot);
+    a->state = CPR__STREAM_RESIDENT;
+    a->size = load->size;
+    a->used = m->frame;
+    m->resident += (double)a->size;
+    ++loaded;
+
+    duk_push_null(ctx);
+    duk_push_string(ctx, a->name);
+    duk_get_prop_index(ctx, -3, (duk_uarridx_t)load->slot);
+    duk_remove(ctx, -4); /* values */
+    cpr__stream_free_load(load);
+    cpr__stream_notify(ctx, CPR__STREAM_ON_LOAD, 3);
+  }
+  return loaded;
+}
+
+/* Evict the least recently used assets until the budget is met */
+CPR_API_INTERN void cpr__stream_evict(duk_context *ctx, cpr__stream *m) {
+  int i, lru;
+
+  while (m->resident > m->budget) {
+    lru = -1;
+    for (i = 0; i < m->capacity; ++i) {
+      if (m->assets[i].state == CPR__STREAM_RESIDENT && m->assets[i].used < m->frame &&
+          (lru < 0 || m->assets[i].used < m->assets[lru].used)) {
+        lru = i;
+      }
+    }
+    if (lru < 0) {
+      return;
+    }
+    cpr__stream_drop(ctx, m, lru);
+    m->assets[lru].state = CPR__STREAM_EVICTED;
+    duk_push_string(ctx, m->assets[lru].name);
+    cpr__stream_notify(ctx, CPR__STREAM_ON_EVICT, 1);
+  }
+}
+
+/* Start the loads of the first queued assets */
+CPR_API_INTERN void cpr__stream_start(duk_context *ctx, cpr__stream *m) {
+  cpr__stream_load *load;
+  cpr__stream_asset *a;
+  const char *path;
+  size_t len;
+  int slot;
+
+  while (m->load_count < m->concurrency && m->queue_len > 0) {
+    slot = m->queue[0];
+    cpr__stream_queue_remove(m, 0);
+    a = &m->assets[slot];
+
+    /* A missing asset is reported to onLoad (not logged as a missing module) */
+    if (!cpr_package_search(ctx, a->name)) {
+      duk_pop(ctx);
+      a->state = CPR__STREAM_FAILED;
+      duk_push_error_object(ctx, DUK_ERR_ERROR, "asset '%s' not found", a->name);
+      duk_push_string(ctx, a->name);
+      cpr__stream_notify(ctx, CPR__STREAM_ON_LOAD, 2);
+      continue;
+    }
+
+    path = duk_get_string(ctx, -1);
+    len = strlen(path) + 1;
+    if ((load = calloc(1, sizeof(cpr__stream_load))) == NULL ||
+        (load->path = malloc(len)) == NULL ||
+        (load->job = cpr_job_create(cpr__stream_read, load)) == NULL) {
+      if (load) {
+        free(load->path);
+        free(load);
+      }
+      cpr__stream_queue_push(m, slot);
+      duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the asset load");
+    }
+    memcpy(load->path, path, len);
+    duk_pop(ctx);
+    load->slot = slot;
+    a->state = CPR__STREAM_LOADING;
+    m->loads[m->load_count++] = load;
+    cpr_job_submit(load->job);
+  }
+}
+
+/* Binding API */
+
+/* stream.create([options]) */
+CPR_API_INTERN duk_ret_t cpr__stream_js_create(duk_context *ctx) {
+  cpr__stream *m;
+  double budget = CPR__STREAM_DEFAULT_BUDGET;
+  int concurrency = CPR__STREAM_DEFAULT_CONCURRENCY;
+
+  if (duk_is_object(ctx, 0)) {
+    duk_get_prop_string(ctx, 0, "budget");
+    if (!duk_is_undefined(ctx, -1)) {
+      budget = duk_require_number(ctx, -1);
+    }
+    duk_get_prop_string(ctx, 0, "concurrency");
+    if (!duk_is_undefined(ctx, -1)) {
+      concurrency = duk_require_int(ctx, -1);
+    }
+    duk_pop_2(ctx);
+  }
+  if (budget < 0) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid budget");
+  }
+  if (concurrency <= 0 || concurrency > CPR__STREAM_MAX_CONCURRENCY) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid concurrency %d", concurrency);
+  }
+  if ((m = calloc(1, sizeof(cpr__stream))) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the stream manager");
+  }
+  m->budget = budget;
+  m->concurrency = concurrency;
+
+  duk_push_object(ctx);
+  duk_push_pointer(ctx, m);
+  duk_put_prop_string(ctx, -2, CPR__STREAM_PTR);
+  duk_push_object(ctx);
+  duk_put_prop_string(ctx, -2, CPR__STREAM_INDEX);
+  duk_push_object(ctx);
+  duk_put_prop_string(ctx, -2, CPR__STREAM_VALUES);
+  if (duk_is_object(ctx, 0)) {
+    duk_get_prop_string(ctx, 0, "onLoad");
+    duk_put_prop_string(ctx, -2, CPR__STREAM_ON_LOAD);
+    duk_get_prop_string(ctx, 0, "onEvict");
+    duk_put_prop_string(ctx, -2, CPR__STREAM_ON_EVICT);
+  }
+  duk_push_c_function(ctx, cpr__stream_finalizer, 1);
+  duk_set_finalizer(ctx, -2);
+  return 1;
+}
+
+/* stream.request(m, name, [hints]). Queue the asset or update its hints
+ * (priority, x, y, type). Return the asset state. */
+CPR_API_INTERN duk_ret_t cpr__stream_js_request(duk_context *ctx) {
+  cpr__stream *m = cpr__stream_require(ctx, 0);
+  const char *name = duk_require_string(ctx, 1);
+  cpr__stream_asset *a, *assets;
+  int slot, *queue, capacity;
+  size_t len;
+
+  if ((slot = cpr__stream_find(ctx, 1)) < 0) {
+    if (m->count == m->capacity) {
+      capacity = m->capacity ? m->capacity * 2 : 64;
+      if ((assets = realloc(m->assets, capacity * sizeof(cpr__stream_asset))) == NULL) {
+        duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the asset");
+      }
+      m->assets = assets;
+      memset(&m->assets[m->capacity], 0, (capacity - m->capacity) * sizeof(cpr__stream_asset));
+      if ((queue = realloc(m->queue, capacity * sizeof(int))) == NULL) {
+        duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the asset");
+      }
+      m->queue = queue;
+      m->capacity = capacity;
+    }
+    for (slot = 0; m->assets[slot].state != CPR__STREAM_FREE; ++slot);
+    a = &m->assets[slot];
+    len = strlen(name) + 1;
+    if ((a->name = malloc(len)) == NULL) {
+      duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the asset");
+    }
+    memcpy(a->name, name, len);
+    a->text = cpr__stream_is_text(name);
+    a->priority = a->x = a->y = 0.0;
+    a->positioned = 0;
+    a->size = 0;
+    a->queue_pos = -1;
+    a->state = CPR__STREAM_EVICTED;
+    ++m->count;
+
+    duk_get_prop_string(ctx, 0, CPR__STREAM_INDEX);
+    duk_push_int(ctx, slot);
+    duk_put_prop_string(ctx, -2, name);
+    duk_pop(ctx);
+  }
+  a = &m->assets[slot];
+  a->used = m->frame;
+
+  if (duk_is_object(ctx, 2)) {
+    duk_get_prop_string(ctx, 2, "priority");
+    if (!duk_is_undefined(ctx, -1)) {
+      a->priority = duk_require_number(ctx, -1);
+    }
+    duk_get_prop_string(ctx, 2, "x");
+    duk_get_prop_string(ctx, 2, "y");
+    if (!duk_is_undefined(ctx, -2) || !duk_is_undefined(ctx, -1)) {
+      a->x = duk_to_number(ctx, -2);
+      a->y = duk_to_number(ctx, -1);
+      a->positioned = 1;
+    }
+    duk_get_prop_string(ctx, 2, "type");
+    if (!duk_is_undefined(ctx, -1)) {
+      a->text = strcmp(duk_require_string(ctx, -1), "text") == 0;
+    }
+    duk_pop_n(ctx, 4);
+  }
+
+  if (a->state == CPR__STREAM_QUEUED) {
+    cpr__stream_sift_up(m, a->queue_pos);
+    cpr__stream_sift_down(m, a->queue_pos);
+  } else if (a->state == CPR__STREAM_EVICTED || a->state == CPR__STREAM_FAILED) {
+    a->state = CPR__STREAM_QUEUED;
+    a->order = m->order++;
+    cpr__stream_queue_push(m, slot);
+  }
+  duk_push_string(ctx, _state_names[a->state]);
+  return 1;
+}
+
+/* stream.release(m, name). Forget the asset (dequeue, cancel or drop it).
+ * Return false if the asset is unknown. */
+CPR_API_INTERN duk_ret_t cpr__stream_js_release(duk_context *ctx) {
+  cpr__stream *m = cpr__stream_require(ctx, 0);
+  cpr__stream_asset *a;
+  int slot, i;
+
+  duk_require_string(ctx, 1);
+  if ((slot = cpr__stream_find(ctx, 1)) < 0) {
+    duk_push_false(ctx);
+    return 1;
+  }
+  a = &m->assets[slot];
+  if (a->state == CPR__STREAM_QUEUED) {
+    cpr__stream_queue_remove(m, a->queue_pos);
+  } else if (a->state == CPR__STREAM_LOADING) {
+    for (i = 0; i < m->load_count; ++i) {
+      if (m->loads[i]->slot == slot) {
+        m->loads[i]->slot = -1;
+      }
+    }
+  } else if (a->state == CPR__STREAM_RESIDENT) {
+    cpr__stream_drop(ctx, m, slot);
+  }
+  free(a->name);
+  a->name = NULL;
+  a->state = CPR__STREAM_FREE;
+  --m->count;
+
+  duk_get_prop_string(ctx, 0, CPR__STREAM_INDEX);
+  duk_dup(ctx, 1);
+  duk_del_prop(ctx, -2);
+  duk_push_true(ctx);
+  return 1;
+}
+
+/* stream.setCamera(m, x, y) */
+CPR_API_INTERN duk_ret_t cpr__stream_js_set_camera(duk_context *ctx) {
+  cpr__stream *m = cpr__stream_require(ctx, 0);
+  m->camera_x = duk_require_number(ctx, 1);
+  m->camera_y = duk_require_number(ctx, 2);
+  cpr__stream_queue_sort(m);
+  return 0;
+}
+
+/* stream.update(m). Return the number of assets loaded since the last update. */
+CPR_API_INTERN duk_ret_t cpr__stream_js_update(duk_context *ctx) {
+  cpr__stream *m = cpr__stream_require(ctx, 0);
+  int loaded;
+
+  /* The callbacks are called once the asset state is updated so a callback
+   * error leaves the manager consistent (the update is resumed next time) */
+  loaded = cpr__stream_collect(ctx, m);
+  cpr__stream_evict(ctx, m);
+  cpr__stream_start(ctx, m);
+  ++m->frame;
+  duk_push_int(ctx, loaded);
+  return 1;
+}
+
+/* stream.get(m, name). Return the value of a resident asset or undefined. */
+CPR_API_INTERN duk_ret_t cpr__stream_js_get(duk_context *ctx) {
+  cpr__stream *m = cpr__stream_require(ctx, 0);
+  int slot;
+
+  duk_require_string(ctx, 1);
+  if ((slot = cpr__stream_find(ctx, 1)) < 0 || m->assets[slot].state != CPR__STREAM_RESIDENT) {
+    return 0;
+  }
+  m->assets[slot].used = m->frame;
+  duk_get_prop_string(ctx, 0, CPR__STREAM_VALUES);
+  duk_get_prop_index(ctx, -1, (duk_uarridx_t)slot);
+  return 1;
+}
+
+/* stream.state(m, name). Return the asset state ('queued', 'loading',
+ * 'resident', 'evicted' or 'failed') or undefined if unknown. */
+CPR_API_INTERN duk_ret_t cpr__stream_js_state(duk_context *ctx) {
+  cpr__stream *m = cpr__stream_require(ctx, 0);
+  int slot;
+
+  duk_require_string(ctx, 1);
+  if ((slot = cpr__stream_find(ctx, 1)) < 0) {
+    return 0;
+  }
+  duk_push_string(ctx, _state_names[m->assets[slot].state]);
+  return 1;
+}
+
+/* stream.stats(m) */
+CPR_API_INTERN duk_ret_t cpr__stream_js_stats(duk_context *ctx) {
+  cpr__stream *m = cpr__stream_require(ctx, 0);
+
+  duk_push_object(ctx);
+  duk_push_int(ctx, m->count);
+  duk_put_prop_string(ctx, -2, "count");
+  duk_push_int(ctx, m->queue_len);
+  duk_put_prop_string(ctx, -2, "queued");
+  duk_push_int(ctx, m->load_count);
+  duk_put_prop_string(ctx, -2, "loading");
+  duk_push_number(ctx, m->resident);
+  duk_put_prop_string(ctx, -2, "resident");
+  duk_push_number(ctx, m->budget);
+  duk_put_prop_string(ctx, -2, "budget");
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_stream(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "create",    cpr__stream_js_create,     1 },
+    { "request",   cpr__stream_js_request,    3 },
+    { "release",   cpr__stream_js_release,    2 },
+    { "setCamera", cpr__stream_js_set_camera, 3 },
+    { "update",    cpr__stream_js_update,     1 },
+    { "get",       cpr__stream_js_get,        2 },
+    { "state",     cpr__stream_js_state,      2 },
+    { "stats",     cpr__stream_js_stats,      1 },
+    { NULL, NULL, 0 }
+  };
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+
+  return 1;  /* return module value */
+}
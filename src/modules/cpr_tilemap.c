@@ -0,0 +1,537 @@
+/*
+ * cpr_tilemap.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Chunked tilemap renderer.
+ * Layers are stored as Uint16 tile id grids split in square chunks. Each chunk
+ * owns a static vertex buffer which is only rebuilt when one of its tiles has
+ * changed (dirty flag) and when the chunk is actually visible. Culling is done
+ * at chunk granularity so drawing a map costs one draw call per visible chunk.
+ *
+ * Tile id 0 is the empty tile. Tile id N maps to the tile N - 1 of the tileset
+ * texture (row-major order).
+ *
+ * Like the imgui module the OpenGL functions are resolved by gl3w so
+ * `gl3w.init` must be called before any `draw` call.
+ */
+
+#include "cpr_tilemap.h"
+#include "cpr_macros.h"
+#include "cpr_duktape_helpers.h"
+#include "GL/gl3w.h"
+
+#include <stdint.h>
+#include <stdlib.h> /* calloc, free */
+#include <math.h>   /* HUGE_VALF */
+
+#define CPR__TILEMAP_DEFAULT_CHUNK_SIZE 32
+#define CPR__TILEMAP_MAX_CHUNK_SIZE     128
+#define CPR__TILEMAP_MAX_LAYERS         16
+/* Vertex layout: position (x, y) and texture coordinates (u, v) */
+#define CPR__TILEMAP_VERTEX_FLOATS      4
+#define CPR__TILEMAP_TILE_VERTICES      6
+
+typedef struct cpr__tilemap_chunk {
+  uint16_t *tiles;      /* `layers` grids of chunk_size * chunk_size tile ids. NULL if empty */
+  GLuint vao;
+  GLuint vbo;
+  GLsizei vertex_count;
+  int dirty;
+} cpr__tilemap_chunk;
+
+typedef struct cpr__tilemap {
+  int cols, rows, layers;
+  int chunk_size;
+  int chunk_cols, chunk_rows;
+  float tile_width, tile_height;
+  GLuint texture;
+  int tileset_cols, tileset_rows;
+  cpr__tilemap_chunk *chunks;
+  /* Vertex scratch buffer shared by all chunk rebuilds */
+  float *vertices;
+} cpr__tilemap;
+
+/* Shader program shared by all the maps of the heap (see cpr_get_heap_state) */
+#define CPR__TILEMAP_STATE "cprTilemap"
+
+typedef struct cpr__tilemap_state {
+  GLuint program;
+  GLint view_location;
+  GLint tileset_location;
+} cpr__tilemap_state;
+
+static const char *_vertex_shader =
+  "#version 150\n"
+  "in vec2 a_pos;\n"
+  "in vec2 a_uv;\n"
+  "uniform vec4 u_view;\n" /* camera x, y, 2/width, -2/height */
+  "out vec2 v_uv;\n"
+  "void main() {\n"
+  "  v_uv = a_uv;\n"
+  "  gl_Position = vec4((a_pos.x - u_view.x) * u_view.z - 1.0,\n"
+  "                     (a_pos.y - u_view.y) * u_view.w + 1.0, 0.0, 1.0);\n"
+  "}\n";
+
+static const char *_fragment_shader =
+  "#version 150\n"
+  "in vec2 v_uv;\n"
+  "uniform sampler2D u_tileset;\n"
+  "out vec4 o_color;\n"
+  "void main() {\n"
+  "  o_color = texture(u_tileset, v_uv);\n"
+  "}\n";
+
+CPR_API_INTERN GLuint cpr__tilemap_compile_shader(duk_context *ctx, GLenum type, const char *source) {
+  GLuint shader;
+  GLint status = GL_FALSE;
+  char log[512];
+
+  shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (status != GL_TRUE) {
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    glDeleteShader(shader);
+    duk_error(ctx, DUK_ERR_ERROR, "Can't compile tilemap shader: %s", log);
+  }
+  return shader;
+}
+
+/* Lazily create the shader program. Must be called with a current GL context. */
+CPR_API_INTERN cpr__tilemap_state *cpr__tilemap_init_program(duk_context *ctx) {
+  cpr__tilemap_state *state = cpr_get_heap_state(ctx, CPR__TILEMAP_STATE, sizeof(cpr__tilemap_state));
+  GLuint vs, fs;
+  GLint status = GL_FALSE;
+
+  if (state->program != 0) {
+    return state;
+  }
+  vs = cpr__tilemap_compile_shader(ctx, GL_VERTEX_SHADER, _vertex_shader);
+  fs = cpr__tilemap_compile_shader(ctx, GL_FRAGMENT_SHADER, _fragment_shader);
+  state->program = glCreateProgram();
+  glAttachShader(state->program, vs);
+  glAttachShader(state->program, fs);
+  glBindAttribLocation(state->program, 0, "a_pos");
+  glBindAttribLocation(state->program, 1, "a_uv");
+  glLinkProgram(state->program);
+  /* Shaders are released with the program */
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  glGetProgramiv(state->program, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    glDeleteProgram(state->program);
+    state->program = 0;
+    duk_error(ctx, DUK_ERR_ERROR, "Can't link tilemap shader program");
+  }
+  state->view_location = glGetUniformLocation(state->program, "u_view");
+  state->tileset_location = glGetUniformLocation(state->program, "u_tileset");
+  return state;
+}
+
+CPR_API_INTERN cpr__tilemap *cpr__tilemap_require(duk_context *ctx, duk_idx_t idx) {
+  cpr__tilemap *map = duk_require_pointer(ctx, idx);
+  if (map == NULL) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "invalid tilemap (NULL)");
+  }
+  return map;
+}
+
+CPR_API_INTERN int cpr__tilemap_require_layer(duk_context *ctx, cpr__tilemap *map, duk_idx_t idx) {
+  int layer = duk_require_int(ctx, idx);
+  if (layer < 0 || layer >= map->layers) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid tilemap layer %d", layer);
+  }
+  return layer;
+}
+
+/* Return the chunk containing the tile (x, y). If `create` is true the chunk
+ * tiles storage is allocated on demand, otherwise NULL is returned for empty
+ * chunks. */
+CPR_API_INTERN cpr__tilemap_chunk *cpr__tilemap_chunk_at(duk_context *ctx, cpr__tilemap *map, int x, int y, int create) {
+  cpr__tilemap_chunk *chunk;
+  size_t size;
+
+  chunk = &map->chunks[(y / map->chunk_size) * map->chunk_cols + (x / map->chunk_size)];
+  if (chunk->tiles == NULL && create) {
+    size = (size_t)map->layers * map->chunk_size * map->chunk_size;
+    if ((chunk->tiles = (uint16_t *)calloc(size, sizeof(uint16_t))) == NULL) {
+      duk_error(ctx, DUK_ERR_ALLOC_ERROR, "tilemap: out of memory");
+    }
+  }
+  return chunk->tiles ? chunk : NULL;
+}
+
+CPR_API_INTERN uint16_t *cpr__tilemap_tile_ptr(cpr__tilemap *map, cpr__tilemap_chunk *chunk, int layer, int x, int y) {
+  int cs = map->chunk_size;
+  return &chunk->tiles[(layer * cs + (y % cs)) * cs + (x % cs)];
+}
+
+/* Build the chunk vertex buffer from its tiles. Layers are emitted in order so
+ * a whole chunk is drawn with a single draw call. */
+CPR_API_INTERN void cpr__tilemap_rebuild_chunk(cpr__tilemap *map, cpr__tilemap_chunk *chunk, int cx, int cy) {
+  int layer, tx, ty, idx;
+  int cs = map->chunk_size;
+  float *v = map->vertices;
+  float x0, y0, x1, y1, u0, v0, u1, v1;
+  float du = 1.0f / (float)map->tileset_cols;
+  float dv = 1.0f / (float)map->tileset_rows;
+  uint16_t *tiles = chunk->tiles;
+  uint16_t id;
+
+  for (layer = 0; layer < map->layers; ++layer) {
+    for (ty = 0; ty < cs; ++ty) {
+      for (tx = 0; tx < cs; ++tx) {
+        if ((id = *tiles++) == 0) {
+          continue;
+        }
+        idx = id - 1;
+        x0 = (float)(cx * cs + tx) * map->tile_width;
+        y0 = (float)(cy * cs + ty) * map->tile_height;
+        x1 = x0 + map->tile_width;
+        y1 = y0 + map->tile_height;
+        u0 = (float)(idx % map->tileset_cols) * du;
+        v0 = (float)(idx / map->tileset_cols) * dv;
+        u1 = u0 + du;
+        v1 = v0 + dv;
+        /* Two triangles per tile */
+        v[0]  = x0; v[1]  = y0; v[2]  = u0; v[3]  = v0;
+        v[4]  = x1; v[5]  = y0; v[6]  = u1; v[7]  = v0;
+        v[8]  = x1; v[9]  = y1; v[10] = u1; v[11] = v1;
+        v[12] = x0; v[13] = y0; v[14] = u0; v[15] = v0;
+        v[16] = x1; v[17] = y1; v[18] = u1; v[19] = v1;
+        v[20] = x0; v[21] = y1; v[22] = u0; v[23] = v1;
+        v += CPR__TILEMAP_TILE_VERTICES * CPR__TILEMAP_VERTEX_FLOATS;
+      }
+    }
+  }
+
+  chunk->vertex_count = (GLsizei)((v - map->vertices) / CPR__TILEMAP_VERTEX_FLOATS);
+  if (chunk->vao == 0) {
+    glGenVertexArrays(1, &chunk->vao);
+    glGenBuffers(1, &chunk->vbo);
+    glBindVertexArray(chunk->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, chunk->vbo);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, CPR__TILEMAP_VERTEX_FLOATS * sizeof(float), (void *)0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, CPR__TILEMAP_VERTEX_FLOATS * sizeof(float), (void *)(2 * sizeof(float)));
+  } else {
+    glBindVertexArray(chunk->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, chunk->vbo);
+  }
+  glBufferData(GL_ARRAY_BUFFER,
+               chunk->vertex_count * CPR__TILEMAP_VERTEX_FLOATS * sizeof(float),
+               map->vertices, GL_STATIC_DRAW);
+  chunk->dirty = 0;
+}
+
+CPR_API_INTERN void cpr__tilemap_free(cpr__tilemap *map) {
+  int i;
+  cpr__tilemap_chunk *chunk;
+
+  for (i = 0; i < map->chunk_cols * map->chunk_rows; ++i) {
+    chunk = &map->chunks[i];
+    if (chunk->vao != 0) {
+      glDeleteVertexArrays(1, &chunk->vao);
+      glDeleteBuffers(1, &chunk->vbo);
+    }
+    free(chunk->tiles);
+  }
+  free(map->chunks);
+  free(map->vertices);
+  free(map);
+}
+
+/* Binding API */
+
+/* tilemap.create(cols, rows, layers, tileWidth, tileHeight [, chunkSize]) */
+CPR_API_INTERN duk_ret_t cpr_tilemap_create(duk_context *ctx) {
+  cpr__tilemap *map = NULL;
+  int cols, rows, layers, chunk_size;
+  float tile_width, tile_height;
+
+  cols = duk_require_int(ctx, 0);
+  rows = duk_require_int(ctx, 1);
+  layers = duk_require_int(ctx, 2);
+  tile_width = (float)duk_require_number(ctx, 3);
+  tile_height = (float)duk_require_number(ctx, 4);
+  chunk_size = duk_is_null_or_undefined(ctx, 5) ? CPR__TILEMAP_DEFAULT_CHUNK_SIZE : duk_require_int(ctx, 5);
+
+  if (cols <= 0 || rows <= 0) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid tilemap size %dx%d", cols, rows);
+  }
+  if (layers <= 0 || layers > CPR__TILEMAP_MAX_LAYERS) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid tilemap layers count %d", layers);
+  }
+  if (chunk_size <= 0 || chunk_size > CPR__TILEMAP_MAX_CHUNK_SIZE) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid tilemap chunk size %d", chunk_size);
+  }
+  /* Comparisons are false for NaN */
+  if (!(tile_width > 0.0f && tile_width < HUGE_VALF && tile_height > 0.0f && tile_height < HUGE_VALF)) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid tile size %fx%f", tile_width, tile_height);
+  }
+
+  if ((map = (cpr__tilemap *)calloc(1, sizeof(cpr__tilemap))) == NULL) {
+    goto error;
+  }
+  map->cols = cols;
+  map->rows = rows;
+  map->layers = layers;
+  map->chunk_size = chunk_size;
+  map->chunk_cols = (cols + chunk_size - 1) / chunk_size;
+  map->chunk_rows = (rows + chunk_size - 1) / chunk_size;
+  map->tile_width = tile_width;
+  map->tile_height = tile_height;
+  map->tileset_cols = 1;
+  map->tileset_rows = 1;
+  if ((map->chunks = (cpr__tilemap_chunk *)calloc((size_t)map->chunk_cols * map->chunk_rows, sizeof(cpr__tilemap_chunk))) == NULL) {
+    goto error;
+  }
+  /* Worst case: every tile of every layer of a chunk is set */
+  if ((map->vertices = (float *)malloc((size_t)layers * chunk_size * chunk_size *
+      CPR__TILEMAP_TILE_VERTICES * CPR__TILEMAP_VERTEX_FLOATS * sizeof(float))) == NULL) {
+    goto error;
+  }
+
+  duk_push_pointer(ctx, map);
+  return 1;
+
+error:
+  if (map) {
+    free(map->chunks);
+    free(map);
+  }
+  duk_error(ctx, DUK_ERR_ALLOC_ERROR, "tilemap: out of memory");
+  return 0; /* Not reachable */
+}
+
+/* Release the map and its GL objects. The GL context must be current. */
+CPR_API_INTERN duk_ret_t cpr_tilemap_destroy(duk_context *ctx) {
+  cpr__tilemap_free(cpr__tilemap_require(ctx, 0));
+  return 0;
+}
+
+/* tilemap.setTileset(map, texture, columns, rows)
+ * `texture` is a GL texture name holding `columns` x `rows` tiles. */
+CPR_API_INTERN duk_ret_t cpr_tilemap_set_tileset(duk_context *ctx) {
+  int i, cols, rows;
+  cpr__tilemap *map = cpr__tilemap_require(ctx, 0);
+  GLuint texture = (GLuint)duk_require_uint(ctx, 1);
+
+  cols = duk_require_int(ctx, 2);
+  rows = duk_require_int(ctx, 3);
+  /* Keep the previous tileset on error (the size is a divisor) */
+  if (cols <= 0 || rows <= 0) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid tileset size %dx%d", cols, rows);
+  }
+  map->texture = texture;
+  map->tileset_cols = cols;
+  map->tileset_rows = rows;
+  /* Texture coordinates have changed */
+  for (i = 0; i < map->chunk_cols * map->chunk_rows; ++i) {
+    map->chunks[i].dirty = 1;
+  }
+  return 0;
+}
+
+/* tilemap.setTile(map, layer, x, y, id) */
+CPR_API_INTERN duk_ret_t cpr_tilemap_set_tile(duk_context *ctx) {
+  cpr__tilemap *map;
+  cpr__tilemap_chunk *chunk;
+  uint16_t *tile;
+  int layer, x, y;
+  uint16_t id;
+
+  map = cpr__tilemap_require(ctx, 0);
+  layer = cpr__tilemap_require_layer(ctx, map, 1);
+  x = duk_require_int(ctx, 2);
+  y = duk_require_int(ctx, 3);
+  id = duk_require_uint(ctx, 4) & 0xffff;
+  if (x < 0 || y < 0 || x >= map->cols || y >= map->rows) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "tile (%d,%d) out of map bounds", x, y);
+  }
+  /* Don't allocate a chunk to clear a tile */
+  if ((chunk = cpr__tilemap_chunk_at(ctx, map, x, y, id != 0)) == NULL) {
+    return 0;
+  }
+  tile = cpr__tilemap_tile_ptr(map, chunk, layer, x, y);
+  if (*tile != id) {
+    *tile = id;
+    chunk->dirty = 1;
+  }
+  return 0;
+}
+
+/* tilemap.getTile(map, layer, x, y) */
+CPR_API_INTERN duk_ret_t cpr_tilemap_get_tile(duk_context *ctx) {
+  cpr__tilemap *map;
+  cpr__tilemap_chunk *chunk;
+  int layer, x, y;
+
+  map = cpr__tilemap_require(ctx, 0);
+  layer = cpr__tilemap_require_layer(ctx, map, 1);
+  x = duk_require_int(ctx, 2);
+  y = duk_require_int(ctx, 3);
+  if (x < 0 || y < 0 || x >= map->cols || y >= map->rows) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "tile (%d,%d) out of map bounds", x, y);
+  }
+  if ((chunk = cpr__tilemap_chunk_at(ctx, map, x, y, 0)) == NULL) {
+    duk_push_uint(ctx, 0);
+  } else {
+    duk_push_uint(ctx, *cpr__tilemap_tile_ptr(map, chunk, layer, x, y));
+  }
+  return 1;
+}
+
+/* tilemap.setTiles(map, layer, x, y, width, height, tiles)
+ * Copy a region of tiles from a Uint16Array (or any buffer) of width * height
+ * tile ids. Only the chunks actually modified are marked dirty. */
+CPR_API_INTERN duk_ret_t cpr_tilemap_set_tiles(duk_context *ctx) {
+  cpr__tilemap *map;
+  cpr__tilemap_chunk *chunk;
+  uint16_t *tile;
+  const uint16_t *src;
+  duk_size_t size;
+  int layer, x, y, w, h, i, j;
+
+  map = cpr__tilemap_require(ctx, 0);
+  layer = cpr__tilemap_require_layer(ctx, map, 1);
+  x = duk_require_int(ctx, 2);
+  y = duk_require_int(ctx, 3);
+  w = duk_require_int(ctx, 4);
+  h = duk_require_int(ctx, 5);
+  src = (const uint16_t *)duk_require_buffer_data(ctx, 6, &size);
+
+  if (x < 0 || y < 0 || w < 0 || h < 0 || x + w > map->cols || y + h > map->rows) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "region (%d,%d,%d,%d) out of map bounds", x, y, w, h);
+  }
+  if (size < (duk_size_t)w * h * sizeof(uint16_t)) {
+    duk_error(ctx, DUK_ERR_RANGE_ERROR, "tiles buffer too small (%lu bytes)", (unsigned long)size);
+  }
+
+  for (j = 0; j < h; ++j) {
+    for (i = 0; i < w; ++i, ++src) {
+      if ((chunk = cpr__tilemap_chunk_at(ctx, map, x + i, y + j, *src != 0)) == NULL) {
+        continue;
+      }
+      tile = cpr__tilemap_tile_ptr(map, chunk, layer, x + i, y + j);
+      if (*tile != *src) {
+        *tile = *src;
+        chunk->dirty = 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* tilemap.draw(map, x, y, width, height)
+ * Draw the map region visible by the camera rectangle (in world units).
+ * Returns the number of draw calls issued. */
+CPR_API_INTERN duk_ret_t cpr_tilemap_draw(duk_context *ctx) {
+  cpr__tilemap *map;
+  cpr__tilemap_chunk *chunk;
+  cpr__tilemap_state *state;
+  float cam_x, cam_y, cam_w, cam_h, chunk_w, chunk_h;
+  int cx, cy, cx0, cy0, cx1, cy1, draws = 0;
+
+  map = cpr__tilemap_require(ctx, 0);
+  cam_x = (float)duk_require_number(ctx, 1);
+  cam_y = (float)duk_require_number(ctx, 2);
+  cam_w = (float)duk_require_number(ctx, 3);
+  cam_h = (float)duk_require_number(ctx, 4);
+
+  if (cam_w <= 0.0f || cam_h <= 0.0f) {
+    duk_push_int(ctx, 0);
+    return 1;
+  }
+
+  /* Chunk range overlapping the camera rectangle */
+  chunk_w = map->tile_width * map->chunk_size;
+  chunk_h = map->tile_height * map->chunk_size;
+  cx0 = cam_x <= 0.0f ? 0 : (int)(cam_x / chunk_w);
+  cy0 = cam_y <= 0.0f ? 0 : (int)(cam_y / chunk_h);
+  cx1 = (int)((cam_x + cam_w) / chunk_w);
+  cy1 = (int)((cam_y + cam_h) / chunk_h);
+  if (cam_x + cam_w <= 0.0f || cam_y + cam_h <= 0.0f || cx0 >= map->chunk_cols || cy0 >= map->chunk_rows) {
+    duk_push_int(ctx, 0);
+    return 1;
+  }
+  if (cx1 >= map->chunk_cols) cx1 = map->chunk_cols - 1;
+  if (cy1 >= map->chunk_rows) cy1 = map->chunk_rows - 1;
+
+  state = cpr__tilemap_init_program(ctx);
+  glUseProgram(state->program);
+  glUniform4f(state->view_location, cam_x, cam_y, 2.0f / cam_w, -2.0f / cam_h);
+  glUniform1i(state->tileset_location, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, map->texture);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  for (cy = cy0; cy <= cy1; ++cy) {
+    for (cx = cx0; cx <= cx1; ++cx) {
+      chunk = &map->chunks[cy * map->chunk_cols + cx];
+      if (chunk->tiles == NULL) {
+        continue;
+      }
+      if (chunk->dirty) {
+        cpr__tilemap_rebuild_chunk(map, chunk, cx, cy);
+      }
+      if (chunk->vertex_count == 0) {
+        continue;
+      }
+      glBindVertexArray(chunk->vao);
+      glDrawArrays(GL_TRIANGLES, 0, chunk->vertex_count);
+      ++draws;
+    }
+  }
+
+  glBindVertexArray(0);
+  glUseProgram(0);
+  duk_push_int(ctx, draws);
+  return 1;
+}
+
+/* Return the number of chunks waiting for a vertex buffer rebuild. Mostly
+ * useful for debugging and tests. */
+CPR_API_INTERN duk_ret_t cpr_tilemap_dirty_chunks(duk_context *ctx) {
+  int i, count = 0;
+  cpr__tilemap *map = cpr__tilemap_require(ctx, 0);
+
+  for (i = 0; i < map->chunk_cols * map->chunk_rows; ++i) {
+    if (map->chunks[i].tiles != NULL && map->chunks[i].dirty) {
+      ++count;
+    }
+  }
+  duk_push_int(ctx, count);
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_tilemap(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "create",       cpr_tilemap_create,       6 },
+    { "destroy",      cpr_tilemap_destroy,      1 },
+    { "setTileset",   cpr_tilemap_set_tileset,  4 },
+    { "setTile",      cpr_tilemap_set_tile,     5 },
+    { "getTile",      cpr_tilemap_get_tile,     4 },
+    { "setTiles",     cpr_tilemap_set_tiles,    7 },
+    { "draw",         cpr_tilemap_draw,         5 },
+    { "dirtyChunks",  cpr_tilemap_dirty_chunks, 1 },
+    { NULL, NULL, 0 }
+  };
+
+  const duk_number_list_entry module_consts[] = {
+    { "CHUNK_SIZE", (double)CPR__TILEMAP_DEFAULT_CHUNK_SIZE },
+    { "MAX_LAYERS", (double)CPR__TILEMAP_MAX_LAYERS },
+    { NULL, 0.0 }
+  };
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+  duk_put_number_list(ctx, -1, module_consts);
+
+  return 1;  /* return module value */
+}
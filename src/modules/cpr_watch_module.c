@@ -0,0 +1,106 @@
+/*
+ * cpr_watch_module.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Hot reload scripting interface (see cpr_watch.h).
+ * The watch mode is started by the `--watch` command line option or by
+ * `watch.start`. The listeners are called after a changed module is reloaded
+ * (`error` is set if the module can't be recompiled or evaluated):
+ *
+ *   watch.on (err, id, exports) ->
+ *     level = exports if id is 'level' and not err
+ *
+ * The reloads happen in the frame loop (`glfw.pollEvents` or `mainloop`) or
+ * when `watch.poll` is called.
+ */
+
+#include "cpr_watch_module.h"
+#include "cpr_watch.h"
+#include "cpr_duktape_helpers.h"
+
+CPR_API_INTERN duk_ret_t cpr_watch_js_start(duk_context *ctx) {
+  int log_level;
+
+  /* Same log level as the heap */
+  duk_get_global_string(ctx, "Duktape");
+  duk_get_prop_string(ctx, -1, "Logger");
+  duk_get_prop_string(ctx, -1, "clog");
+  duk_get_prop_string(ctx, -1, "l");
+  log_level = duk_get_int(ctx, -1);
+  duk_pop_n(ctx, 4);
+  duk_push_boolean(ctx, cpr_watch_start(log_level) == 0);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr_watch_js_stop(duk_context *ctx) {
+  cpr_watch_stop();
+  return 0;
+}
+
+CPR_API_INTERN duk_ret_t cpr_watch_js_is_started(duk_context *ctx) {
+  duk_push_boolean(ctx, cpr_watch_is_started());
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr_watch_js_on(duk_context *ctx) {
+  duk_require_function(ctx, 0);
+  cpr_watch_push_listeners(ctx);
+  duk_dup(ctx, 0);
+  duk_put_prop_index(ctx, -2, (duk_uarridx_t)duk_get_length(ctx, -2));
+  return 0;
+}
+
+CPR_API_INTERN duk_ret_t cpr_watch_js_off(duk_context *ctx) {
+  duk_size_t i, n;
+
+  cpr_watch_push_listeners(ctx);
+  n = duk_get_length(ctx, -1);
+  for (i = 0; i < n; ++i) {
+    duk_get_prop_index(ctx, -1, (duk_uarridx_t)i);
+    if (duk_strict_equals(ctx, -1, 0)) {
+      /* listeners.splice(i, 1) */
+      duk_push_string(ctx, "splice");
+      duk_push_uint(ctx, (duk_uint_t)i);
+      duk_push_uint(ctx, 1);
+      duk_call_prop(ctx, -5, 2);
+      duk_push_true(ctx);
+      return 1;
+    }
+    duk_pop(ctx);
+  }
+  duk_push_false(ctx);
+  return 1;
+}
+
+/* Reload the recompiled modules now. Return the number of modules reloaded. */
+CPR_API_INTERN duk_ret_t cpr_watch_js_poll(duk_context *ctx) {
+  duk_push_int(ctx, cpr_watch_reload(ctx));
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr_watch_js_modules(duk_context *ctx) {
+  cpr_watch_push_ids(ctx);
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_watch(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "start",     cpr_watch_js_start,      0 },
+    { "stop",      cpr_watch_js_stop,       0 },
+    { "isStarted", cpr_watch_js_is_started, 0 },
+    { "on",        cpr_watch_js_on,         1 },
+    { "off",       cpr_watch_js_off,        1 },
+    { "poll",      cpr_watch_js_poll,       0 },
+    { "modules",   cpr_watch_js_modules,    0 },
+    { NULL, NULL, 0 }
+  };
+
+  /* The modules required from now on can be watched by `watch.start` */
+  cpr_watch_enable();
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+
+  return 1;  /* return module value */
+}
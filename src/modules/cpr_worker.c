@@ -0,0 +1,419 @@
+/*
+ * cpr_worker.c
+ * Copyright (c) 2015 Laurent Zubiaur
+ * MIT License (http://opensource.org/licenses/MIT)
+ */
+
+/* Worker threads.
+ * A worker runs a CoffeeScript script in its own thread and Duktape heap
+ * (created like the main heap, see `cpr_create_context`). Workers and their
+ * parent only share messages: values are cloned with the structured clone
+ * (see cpr_clone.h) and the transferable ArrayBuffers (`worker.alloc`) in the
+ * transfer list are moved without copy.
+ *
+ *   w = worker.create 'scripts/job.coffee', ['arg']
+ *   worker.post w, {data: buffer}, [buffer]
+ *   msg = worker.receive w, -1
+ *
+ * In the worker `worker.parent` is the handle of the parent (null in the main
+ * thread). `receive` timeouts are in seconds: 0 (default) polls and a negative
+ * timeout waits until a message is received or the other side ended.
+ *
+ * `terminate` requests the worker to stop (`receive` returns undefined and
+ * `shouldStop` returns true in the worker) then waits for its thread. Scripts
+ * that never check are interrupted only if the runtime is built with the
+ * script sampler (CPR_BUILD_SAMPLER). Workers are terminated when their handle
+ * is garbage collected.
+ */
+
+#include "cpr_worker.h"
+#include "cpr_cepora.h"
+#include "cpr_clone.h"
+#include "cpr_error.h"
+#include "cpr_sampler.h" /* cpr_heap_udata */
+#include "cpr_sys_tools.h" /* cpr_get_time */
+#include "cpr_thread.h"
+#include "cpr_macros.h"
+#include "cpr_duktape_helpers.h"
+
+#include <stdlib.h> /* malloc, calloc, free */
+#include <string.h> /* strlen, memcpy */
+
+/* Hidden properties of the worker handles */
+#define CPR__WORKER_PTR     "\xff" "cprWorker"
+#define CPR__WORKER_PARENT  "\xff" "cprParent"
+/* Worker pointer in the global stash of the worker heap */
+#define CPR__WORKER_STASH   "cprWorker"
+
+typedef struct cpr__message {
+  cpr_clone_data data;
+  struct cpr__message *next;
+} cpr__message;
+
+typedef struct cpr__queue {
+  cpr__message *head;
+  cpr__message *tail;
+  cpr_cond cond;          /* signaled when a message is pushed */
+} cpr__queue;
+
+typedef struct cpr__worker {
+  cpr_heap_udata udata;   /* must be first (heap user data) */
+  cpr_thread thread;
+  cpr_mutex mutex;        /* protects the queues and `running` */
+  cpr__queue inbox;       /* parent to worker */
+  cpr__queue outbox;      /* worker to parent */
+  int running;
+  volatile int stop;
+  volatile int in_script; /* the script can be interrupted */
+  int log_level;
+  char *script;
+  char **args;
+  int arg_count;
+} cpr__worker;
+
+CPR_API_INTERN char *cpr__worker_strdup(const char *str) {
+  size_t len = strlen(str) + 1;
+  char *dup = malloc(len);
+  if (dup) {
+    memcpy(dup, str, len);
+  }
+  return dup;
+}
+
+CPR_API_INTERN void cpr__queue_push(cpr__queue *q, cpr__message *m) {
+  m->next = NULL;
+  if (q->tail) {
+    q->tail->next = m;
+  } else {
+    q->head = m;
+  }
+  q->tail = m;
+}
+
+CPR_API_INTERN cpr__message *cpr__queue_pop(cpr__queue *q) {
+  cpr__message *m = q->head;
+  if (m) {
+    q->head = m->next;
+    if (q->head == NULL) {
+      q->tail = NULL;
+    }
+  }
+  return m;
+}
+
+CPR_API_INTERN void cpr__queue_clear(cpr__queue *q) {
+  cpr__message *m;
+  while ((m = cpr__queue_pop(q))) {
+    cpr_clone_free(&m->data);
+    free(m);
+  }
+}
+
+/* Heap interrupt (see duk_custom.h): stop the script when terminated. The
+ * timeout error is raised until the script call returns so the heap must not
+ * be interrupted outside of it (e.g. while loading the compiler). */
+CPR_API_INTERN int cpr__worker_interrupt(void *udata, void *thread) {
+  cpr__worker *w = udata;
+  (void)thread;
+  return w->in_script && w->stop;
+}
+
+CPR_API_INTERN void cpr__worker_main(void *arg) {
+  cpr__worker *w = arg;
+  duk_context *ctx;
+  int i, rc;
+
+  if ((ctx = cpr_create_context(&w->udata, w->log_level)) != NULL) {
+    duk_push_global_stash(ctx);
+    duk_push_pointer(ctx, w);
+    duk_put_prop_string(ctx, -2, CPR__WORKER_STASH);
+    duk_pop(ctx);
+
+    duk_get_global_string(ctx, "Duktape");
+    duk_push_array(ctx);
+    for (i = 0; i < w->arg_count; ++i) {
+      duk_push_string(ctx, w->args[i]);
+      duk_put_prop_index(ctx, -2, i);
+    }
+    duk_put_prop_string(ctx, -2, "arguments");
+    duk_pop(ctx);
+
+    if (cpr_load_coffee_script(ctx) == 0 && cpr_compile_script(ctx, w->script) == 0) {
+      w->in_script = 1;
+      rc = w->stop ? DUK_EXEC_SUCCESS : duk_pcall(ctx, 0);
+      w->in_script = 0;
+      if (rc != DUK_EXEC_SUCCESS && !w->stop) {
+        ERR(ctx, "Worker '%s' failed : %s", w->script, duk_safe_to_string(ctx, -1));
+        cpr_dump_stack_trace(ctx, -1);
+      }
+      duk_pop(ctx);
+    }
+    cpr_destroy_context(ctx);
+  }
+
+  cpr_mutex_lock(&w->mutex);
+  w->running = 0;
+  cpr_cond_broadcast(&w->outbox.cond);
+  cpr_mutex_unlock(&w->mutex);
+}
+
+CPR_API_INTERN void cpr__worker_free(cpr__worker *w) {
+  int i;
+
+  cpr_mutex_lock(&w->mutex);
+  w->stop = 1;
+  cpr_cond_broadcast(&w->inbox.cond);
+  cpr_mutex_unlock(&w->mutex);
+  cpr_thread_join(w->thread);
+
+  cpr__queue_clear(&w->inbox);
+  cpr__queue_clear(&w->outbox);
+  cpr_cond_destroy(&w->inbox.cond);
+  cpr_cond_destroy(&w->outbox.cond);
+  cpr_mutex_destroy(&w->mutex);
+  for (i = 0; i < w->arg_count; ++i) {
+    free(w->args[i]);
+  }
+  free(w->args);
+  free(w->script);
+  free(w);
+}
+
+/* Return the worker of the handle at `idx`. `parent` is set to true if the
+ * handle is `worker.parent`. */
+CPR_API_INTERN cpr__worker *cpr__worker_get(duk_context *ctx, duk_idx_t idx, int *parent) {
+  cpr__worker *w;
+
+  if (!duk_is_object(ctx, idx)) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "worker handle expected");
+  }
+  duk_get_prop_string(ctx, idx, CPR__WORKER_PTR);
+  w = duk_get_pointer(ctx, -1);
+  duk_get_prop_string(ctx, idx, CPR__WORKER_PARENT);
+  *parent = duk_to_boolean(ctx, -1);
+  duk_pop_2(ctx);
+  if (w == NULL) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "invalid or terminated worker");
+  }
+  return w;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_finalizer(duk_context *ctx) {
+  cpr__worker *w;
+
+  duk_get_prop_string(ctx, 0, CPR__WORKER_PTR);
+  if ((w = duk_get_pointer(ctx, -1)) != NULL) {
+    cpr__worker_free(w);
+  }
+  return 0;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_js_create(duk_context *ctx) {
+  const char *script = duk_require_string(ctx, 0);
+  cpr__worker *w;
+  int i;
+
+  if ((w = calloc(1, sizeof(cpr__worker))) == NULL) {
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the worker");
+  }
+  w->udata.interrupt = cpr__worker_interrupt;
+  w->script = cpr__worker_strdup(script);
+
+  if (!duk_is_undefined(ctx, 1)) {
+    if (!duk_is_array(ctx, 1)) {
+      free(w->script);
+      free(w);
+      duk_error(ctx, DUK_ERR_TYPE_ERROR, "arguments must be an array");
+    }
+    w->arg_count = (int)duk_get_length(ctx, 1);
+    w->args = calloc(w->arg_count + 1, sizeof(char *));
+    for (i = 0; w->args && i < w->arg_count; ++i) {
+      duk_get_prop_index(ctx, 1, i);
+      w->args[i] = cpr__worker_strdup(duk_to_string(ctx, -1));
+      duk_pop(ctx);
+    }
+  }
+
+  /* Same log level as the parent */
+  duk_get_global_string(ctx, "Duktape");
+  duk_get_prop_string(ctx, -1, "Logger");
+  duk_get_prop_string(ctx, -1, "clog");
+  duk_get_prop_string(ctx, -1, "l");
+  w->log_level = duk_get_int(ctx, -1);
+  duk_pop_n(ctx, 4);
+
+  cpr_mutex_init(&w->mutex);
+  cpr_cond_init(&w->inbox.cond);
+  cpr_cond_init(&w->outbox.cond);
+  w->running = 1;
+  if (w->script == NULL || (w->arg_count && w->args == NULL) ||
+      cpr_thread_create(&w->thread, cpr__worker_main, w) != 0) {
+    cpr_cond_destroy(&w->inbox.cond);
+    cpr_cond_destroy(&w->outbox.cond);
+    cpr_mutex_destroy(&w->mutex);
+    for (i = 0; w->args && i < w->arg_count; ++i) {
+      free(w->args[i]);
+    }
+    free(w->args);
+    free(w->script);
+    free(w);
+    duk_error(ctx, DUK_ERR_ERROR, "can't start worker '%s'", script);
+  }
+
+  duk_push_object(ctx);
+  duk_push_pointer(ctx, w);
+  duk_put_prop_string(ctx, -2, CPR__WORKER_PTR);
+  duk_push_c_function(ctx, cpr__worker_finalizer, 1);
+  duk_set_finalizer(ctx, -2);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_js_post(duk_context *ctx) {
+  int parent, posted = 0;
+  cpr__worker *w = cpr__worker_get(ctx, 0, &parent);
+  cpr_clone_data data;
+  cpr__message *m;
+
+  cpr_clone_serialize(ctx, 1, 2, &data);
+  if ((m = malloc(sizeof(cpr__message))) == NULL) {
+    cpr_clone_free(&data);
+    duk_error(ctx, DUK_ERR_ALLOC_ERROR, "can't allocate the message");
+  }
+  m->data = data;
+
+  cpr_mutex_lock(&w->mutex);
+  /* Messages to a worker that ended are dropped */
+  if (parent || w->running) {
+    cpr__queue_push(parent ? &w->outbox : &w->inbox, m);
+    cpr_cond_signal(parent ? &w->outbox.cond : &w->inbox.cond);
+    posted = 1;
+  }
+  cpr_mutex_unlock(&w->mutex);
+
+  if (!posted) {
+    cpr_clone_free(&m->data);
+    free(m);
+  }
+  duk_push_boolean(ctx, posted);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_deserialize(duk_context *ctx) {
+  cpr_clone_deserialize(ctx, duk_get_pointer(ctx, -1));
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_js_receive(duk_context *ctx) {
+  int parent, rc;
+  cpr__worker *w = cpr__worker_get(ctx, 0, &parent);
+  cpr__queue *q = parent ? &w->inbox : &w->outbox;
+  double timeout = duk_is_undefined(ctx, 1) ? 0.0 : duk_require_number(ctx, 1);
+  double end = cpr_get_time() + timeout;
+  cpr__message *m;
+
+  cpr_mutex_lock(&w->mutex);
+  while ((m = cpr__queue_pop(q)) == NULL) {
+    if ((parent && w->stop) || (!parent && !w->running) || timeout == 0.0) {
+      break;
+    }
+    if (timeout < 0.0) {
+      cpr_cond_wait(&q->cond, &w->mutex);
+    } else if (end <= cpr_get_time() || cpr_cond_timedwait(&q->cond, &w->mutex, end - cpr_get_time()) != 0) {
+      m = cpr__queue_pop(q);
+      break;
+    }
+  }
+  cpr_mutex_unlock(&w->mutex);
+
+  if (m == NULL) {
+    return 0;
+  }
+  duk_push_pointer(ctx, &m->data);
+  rc = duk_safe_call(ctx, cpr__worker_deserialize, 1, 1);
+  cpr_clone_free(&m->data);
+  free(m);
+  if (rc != DUK_EXEC_SUCCESS) {
+    duk_throw(ctx);
+  }
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_js_is_running(duk_context *ctx) {
+  int parent, running;
+  cpr__worker *w = cpr__worker_get(ctx, 0, &parent);
+
+  cpr_mutex_lock(&w->mutex);
+  running = w->running;
+  cpr_mutex_unlock(&w->mutex);
+  duk_push_boolean(ctx, running);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_js_terminate(duk_context *ctx) {
+  int parent;
+  cpr__worker *w = cpr__worker_get(ctx, 0, &parent);
+
+  if (parent) {
+    duk_error(ctx, DUK_ERR_TYPE_ERROR, "a worker can't terminate its parent");
+  }
+  cpr__worker_free(w);
+  duk_push_pointer(ctx, NULL);
+  duk_put_prop_string(ctx, 0, CPR__WORKER_PTR);
+  return 0;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_js_should_stop(duk_context *ctx) {
+  cpr__worker *w;
+
+  duk_push_global_stash(ctx);
+  duk_get_prop_string(ctx, -1, CPR__WORKER_STASH);
+  w = duk_get_pointer(ctx, -1);
+  duk_push_boolean(ctx, w && w->stop);
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_js_alloc(duk_context *ctx) {
+  cpr_clone_push_buffer(ctx, NULL, duk_require_uint(ctx, 0));
+  return 1;
+}
+
+CPR_API_INTERN duk_ret_t cpr__worker_js_cpu_count(duk_context *ctx) {
+  duk_push_int(ctx, cpr_thread_cpu_count());
+  return 1;
+}
+
+CPR_API_EXTERN duk_ret_t dukopen_worker(duk_context *ctx) {
+  const duk_function_list_entry module_funcs[] = {
+    { "create",     cpr__worker_js_create,      2 },
+    { "post",       cpr__worker_js_post,        3 },
+    { "receive",    cpr__worker_js_receive,     2 },
+    { "isRunning",  cpr__worker_js_is_running,  1 },
+    { "terminate",  cpr__worker_js_terminate,   1 },
+    { "shouldStop", cpr__worker_js_should_stop, 0 },
+    { "alloc",      cpr__worker_js_alloc,       1 },
+    { "cpuCount",   cpr__worker_js_cpu_count,   0 },
+    { NULL, NULL, 0 }
+  };
+  void *w;
+
+  cpr_push_module_exports(ctx);  /* module result */
+  cpr_put_function_list_light(ctx, -1, module_funcs);
+
+  /* Handle of the parent if running in a worker */
+  duk_push_global_stash(ctx);
+  duk_get_prop_string(ctx, -1, CPR__WORKER_STASH);
+  w = duk_get_pointer(ctx, -1);
+  duk_pop_2(ctx);
+  if (w) {
+    duk_push_object(ctx);
+    duk_push_pointer(ctx, w);
+    duk_put_prop_string(ctx, -2, CPR__WORKER_PTR);
+    duk_push_true(ctx);
+    duk_put_prop_string(ctx, -2, CPR__WORKER_PARENT);
+  } else {
+    duk_push_null(ctx);
+  }
+  duk_put_prop_string(ctx, -2, "parent");
+
+  return 1;  /* return module value */
+}
@@ -72,29 +72,37 @@ def open_process(cmd):
         'code': proc.returncode
     }
 
-def run_test(source, cmd):
-    testcase = parse_test_case(source)
-    output = open_process(cmd)
-
+def check_output(testcase, output):
+    """Compare the process output with the expected output. Return True if the
+    test passed."""
     trace(testcase)
     trace(output)
 
     if testcase['md5'] == output['md5']:
         print('*** PASS : {0[basename]}'.format(testcase))
+        return True
     else:
         print('*** FAIL : {0[basename]}'.format(testcase))
         for line in unified_diff(testcase['data'], output['data']):
             sys.stdout.write(line)
+        return False
+
+def run_test(source, cmd):
+    testcase = parse_test_case(source)
+    output = open_process(cmd)
+    return check_output(testcase, output)
     # s = SequenceMatcher(None, testcase['data'], output['data'])
     # if s.ratio() < 1.0:
     #     print('Match failed. Ratio:', s.quick_ratio())
 
-parser = argparse.ArgumentParser()
-parser.add_argument('-s', '--source', help='Source file to parse to get the expected test output')
-parser.add_argument('-d', '--debug', action='store_true', help='Enable this script debug logging')
-# Rest of the command line are passed to the test process
-parser.add_argument('cmd', nargs=argparse.REMAINDER)
+# The functions are also used by the parallel runner (run-tests.py)
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-s', '--source', help='Source file to parse to get the expected test output')
+    parser.add_argument('-d', '--debug', action='store_true', help='Enable this script debug logging')
+    # Rest of the command line are passed to the test process
+    parser.add_argument('cmd', nargs=argparse.REMAINDER)
 
-args = parser.parse_args()
-debug = args.debug
-run_test(args.source, args.cmd)
+    args = parser.parse_args()
+    debug = args.debug
+    run_test(args.source, args.cmd)
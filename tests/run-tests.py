@@ -0,0 +1,156 @@
+# run-tests.py
+# Parallel test runner. Runs the testcases on several cores and compares their
+# output with the expected results like run-testcase.py.
+#
+# By default each job keeps a cepora process running in worker mode
+# (`cepora --worker`) that runs every testcase in a new Duktape heap, so the
+# process startup and the CoffeeScript compiler compilation are paid once per
+# job. Use --no-reuse to start a new process per testcase.
+#
+# Testcase options and arguments are read from the testcase header:
+#   # @options --bindings
+#   # @args -arg1 -arg2 optionA
+#
+# Usage: run-tests.py [options] cepora_exec testcase...
+#
+# Copyright (c) 2016 Laurent Zubiaur
+# MIT License (http://opensource.org/licenses/MIT)
+from __future__ import print_function
+
+import sys, argparse, subprocess, threading, multiprocessing, tempfile, os, time, importlib
+from hashlib import md5
+from os import path, environ
+
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+sys.path.insert(0, path.dirname(path.abspath(__file__)))
+testcase_runner = importlib.import_module('run-testcase')
+
+def parse_directives(filename):
+    options, args = [], []
+    with open(filename, 'r') as source:
+        for line in source:
+            if line.startswith('# @options '):
+                options += line.split()[2:]
+            elif line.startswith('# @args '):
+                args += line.split()[2:]
+    return options, args
+
+def read_output(filename, code):
+    """Same result as run-testcase.open_process"""
+    m = md5()
+    output = []
+    if path.exists(filename):
+        with open(filename, 'rb') as f:
+            for line in f:
+                m.update(line)
+                output.append(line.decode('utf-8'))
+    return { 'data': output, 'md5': m.hexdigest(), 'code': code }
+
+class Worker(object):
+    """cepora process in worker mode"""
+
+    def __init__(self, cepora, timeout):
+        self.cepora = cepora
+        self.timeout = timeout
+        self.proc = None
+        self.output = path.join(tempfile.gettempdir(), 'cepora-test-{0}-{1}.txt'.format(os.getpid(), id(self)))
+
+    def start(self):
+        self.proc = subprocess.Popen([self.cepora, '--worker'],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            env=environ.copy())
+
+    def run(self, cmd):
+        if self.proc is None:
+            self.start()
+        line = '\t'.join([self.output] + cmd) + '\n'
+        # Kill the worker if the testcase doesn't end
+        timer = threading.Timer(self.timeout, self.proc.kill)
+        timer.start()
+        try:
+            self.proc.stdin.write(line.encode('utf-8'))
+            self.proc.stdin.flush()
+            done = self.proc.stdout.readline().decode('utf-8')
+        except (IOError, OSError):
+            done = ''
+        finally:
+            timer.cancel()
+        code = int(done.split()[1]) if done.startswith('@done ') else -1
+        output = read_output(self.output, code)
+        if code == -1:
+            # The worker crashed or was killed: start a new one for the next
+            # testcase
+            self.stop()
+        return output
+
+    def stop(self):
+        if self.proc is not None:
+            try:
+                self.proc.stdin.close()
+            except (IOError, OSError):
+                pass
+            self.proc.kill()
+            self.proc.wait()
+            self.proc = None
+        if path.exists(self.output):
+            os.remove(self.output)
+
+def main():
+    parser = argparse.ArgumentParser(description='Run the cepora testcases in parallel')
+    parser.add_argument('-d', '--debug', action='store_true', help='Enable the testcase runner debug logging')
+    parser.add_argument('-j', '--jobs', type=int, default=0, help='number of parallel jobs (default: number of cores)')
+    parser.add_argument('-o', '--options', default='', help='cepora options for all the testcases (e.g. "-l 5")')
+    parser.add_argument('-t', '--timeout', type=float, default=120.0, help='testcase timeout in seconds')
+    parser.add_argument('--no-reuse', action='store_true', help='start a new cepora process per testcase')
+    parser.add_argument('cepora', help='cepora executable')
+    parser.add_argument('testcases', nargs='+')
+    args = parser.parse_args()
+    testcase_runner.debug = args.debug
+
+    jobs = args.jobs if args.jobs > 0 else multiprocessing.cpu_count()
+    jobs = max(1, min(jobs, len(args.testcases)))
+    tasks = queue.Queue()
+    for i, source in enumerate(args.testcases):
+        tasks.put((i, source))
+    results = [None] * len(args.testcases)
+    lock = threading.Lock()
+
+    def job():
+        worker = None if args.no_reuse else Worker(args.cepora, args.timeout)
+        while True:
+            try:
+                i, source = tasks.get_nowait()
+            except queue.Empty:
+                break
+            testcase = testcase_runner.parse_test_case(source)
+            options, script_args = parse_directives(source)
+            cmd = args.options.split() + options + [source] + script_args
+            if worker:
+                output = worker.run(cmd)
+            else:
+                output = testcase_runner.open_process([args.cepora] + cmd)
+            # Print the results of a testcase together
+            with lock:
+                results[i] = testcase_runner.check_output(testcase, output)
+                sys.stdout.flush()
+        if worker:
+            worker.stop()
+
+    start = time.time()
+    threads = [threading.Thread(target=job) for i in range(jobs)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    failed = results.count(False)
+    print('{0} passed, {1} failed in {2:.2f}s ({3} jobs)'.format(len(results) - failed, failed, time.time() - start, jobs))
+    sys.exit(1 if failed else 0)
+
+if __name__ == '__main__':
+    main()